@@ -0,0 +1,159 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The French developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Loopback benchmark for the socket event loop: open many inbound P2P
+# connections to one node, complete the version handshake on each, then
+# measure ping round trips with all of them connected.
+#
+# Usage: connections_bench.py --connections=1000 --socketevents=epoll
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+import hashlib
+import random
+import resource
+import select
+import socket
+import struct
+import time
+
+REGTEST_MAGIC = "\x39\x30\x61\x63"
+PROTOCOL_VERSION = 70912
+
+
+def sha256d(data):
+    return hashlib.sha256(hashlib.sha256(data).digest()).digest()
+
+
+def frame(command, payload):
+    return (REGTEST_MAGIC + struct.pack("<12sI", command, len(payload)) +
+            sha256d(payload)[:4] + payload)
+
+
+def ser_addr(port):
+    return struct.pack("<Q", 1) + "\x00" * 10 + "\xff\xff" + socket.inet_aton("127.0.0.1") + struct.pack(">H", port)
+
+
+def version_payload(port):
+    return (struct.pack("<iQq", PROTOCOL_VERSION, 1, int(time.time())) +
+            ser_addr(port) + ser_addr(0) +
+            struct.pack("<Q", random.getrandbits(64)) +
+            "\x0b/bench:0.1/" + struct.pack("<i", 0))
+
+
+class Peer(object):
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = ""
+
+    def send(self, command, payload=""):
+        self.sock.sendall(frame(command, payload))
+
+    def read_messages(self):
+        """Read what is available and return the complete messages in it"""
+        data = self.sock.recv(65536)
+        if not data:
+            raise AssertionError("connection closed by node")
+        self.buf += data
+        msgs = []
+        while len(self.buf) >= 24:
+            command, length = struct.unpack("<12sI", self.buf[4:20])
+            if len(self.buf) < 24 + length:
+                break
+            msgs.append((command.rstrip("\x00"), self.buf[24:24 + length]))
+            self.buf = self.buf[24 + length:]
+        return msgs
+
+
+def wait_for(peers, want, timeout=60):
+    """Read from all peers until each has received a message for which want() is true"""
+    pending = dict((p.sock.fileno(), p) for p in peers)
+    poller = select.epoll()
+    for fd in pending:
+        poller.register(fd, select.EPOLLIN)
+    deadline = time.time() + timeout
+    while pending:
+        if time.time() > deadline:
+            raise AssertionError("%d peers timed out" % len(pending))
+        for fd, _ in poller.poll(1):
+            peer = pending.get(fd)
+            if peer is None:
+                continue
+            for command, payload in peer.read_messages():
+                if want(peer, command, payload):
+                    poller.unregister(fd)
+                    del pending[fd]
+                    break
+    poller.close()
+
+
+class ConnectionsBench(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--connections", dest="connections", default=1000, type="int",
+                          help="Number of inbound connections to open")
+        parser.add_option("--rounds", dest="rounds", default=5, type="int",
+                          help="Number of ping rounds")
+        parser.add_option("--socketevents", dest="socketevents", default="epoll",
+                          help="Socket events mode of the node (epoll or select)")
+
+    def setup_chain(self):
+        print("Initializing test directory " + self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, extra_args=[[
+            "-maxconnections=%d" % (self.options.connections + 100),
+            "-socketevents=" + self.options.socketevents,
+            "-listen", "-dnsseed=0"]])
+        self.is_network_split = False
+
+    def run_test(self):
+        n = self.options.connections
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (min(hard, max(soft, n + 256)), hard))
+
+        port = p2p_port(0)
+        start = time.time()
+        peers = [Peer(port) for i in range(n)]
+        for peer in peers:
+            peer.send("version", version_payload(port))
+        wait_for(peers, lambda peer, command, payload: command == "verack")
+        for peer in peers:
+            peer.send("verack")
+        print("%d handshakes: %.2fs" % (n, time.time() - start))
+        assert_equal(self.nodes[0].getconnectioncount(), n)
+
+        for r in range(self.options.rounds):
+            sent = {}
+            latencies = []
+
+            def got_pong(peer, command, payload):
+                if command != "pong" or payload != sent[peer]:
+                    return False
+                latencies.append(time.time() - sent_time)
+                return True
+
+            sent_time = time.time()
+            for peer in peers:
+                sent[peer] = struct.pack("<Q", random.getrandbits(64))
+                peer.send("ping", sent[peer])
+            wait_for(peers, got_pong)
+            latencies.sort()
+            print("round %d: all %d pongs in %.3fs, median %.1fms, p99 %.1fms" % (
+                r, n, time.time() - sent_time,
+                1000 * latencies[len(latencies) // 2],
+                1000 * latencies[len(latencies) * 99 // 100]))
+
+        for peer in peers:
+            peer.sock.close()
+
+
+if __name__ == '__main__':
+    ConnectionsBench().main()
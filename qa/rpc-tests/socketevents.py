@@ -0,0 +1,82 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The French developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the epoll socket event loop against a node still on select(): give the
+# epoll node more inbound connections than fit in an fd_set, then have it
+# connect out on a descriptor above FD_SETSIZE and relay blocks both ways.
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+from connections_bench import Peer, version_payload, wait_for
+
+import random
+import resource
+import struct
+
+FD_SETSIZE = 1024
+
+
+class SocketEventsTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory " + self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir, extra_args=[
+            ["-socketevents=epoll", "-maxconnections=%d" % (FD_SETSIZE + 200), "-listen", "-dnsseed=0"],
+            ["-socketevents=select", "-listen", "-dnsseed=0"]])
+        self.is_network_split = False
+
+    def run_test(self):
+        n = FD_SETSIZE + 50
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        if hard != resource.RLIM_INFINITY and hard < n + 256:
+            print("Skipping: needs a descriptor limit of at least %d" % (n + 256))
+            return
+        resource.setrlimit(resource.RLIMIT_NOFILE, (max(soft, n + 256), hard))
+
+        # Fill node 0's descriptor table past what select() could watch
+        port = p2p_port(0)
+        peers = [Peer(port) for i in range(n)]
+        for peer in peers:
+            peer.send("version", version_payload(port))
+        wait_for(peers, lambda peer, command, payload: command == "verack")
+        for peer in peers:
+            peer.send("verack")
+        assert_equal(self.nodes[0].getconnectioncount(), n)
+
+        # Its outbound socket now lands above FD_SETSIZE: connect and relay both ways
+        connect_nodes(self.nodes[0], 1)
+        assert_equal(self.nodes[1].getconnectioncount(), 1)
+        self.nodes[1].setgenerate(True, 5)
+        sync_blocks(self.nodes)
+        self.nodes[0].setgenerate(True, 5)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[0].getblockcount(), 10)
+
+        # The inbound peers are all still served
+        sent = {}
+        for peer in peers:
+            sent[peer] = struct.pack("<Q", random.getrandbits(64))
+            peer.send("ping", sent[peer])
+        wait_for(peers, lambda peer, command, payload: command == "pong" and payload == sent[peer])
+
+        # Dropped connections are noticed and unregistered
+        for peer in peers[:n // 2]:
+            peer.sock.close()
+        for i in range(100):
+            if self.nodes[0].getconnectioncount() == n - n // 2 + 1:
+                break
+            time.sleep(0.1)
+        assert_equal(self.nodes[0].getconnectioncount(), n - n // 2 + 1)
+        for peer in peers[n // 2:]:
+            peer.sock.close()
+
+
+if __name__ == '__main__':
+    SocketEventsTest().main()
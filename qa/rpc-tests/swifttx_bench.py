@@ -0,0 +1,57 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The French developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# SwiftTX load benchmark: have one node add Frenchnodes in-process and push lock
+# requests through its lock and vote code at a given rate, then print the lock
+# throughput and the latency percentiles it measured.
+#
+# Usage: swifttx_bench.py --frenchnodes=50 --requests=2000 --rate=200
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+
+def format_latency(name, stats):
+    def ms(t):
+        return ">50s" if t < 0 else "%.0fms" % (1000 * t)
+    return "%-8s %6d  avg %7.1fms  p50 %6s  p90 %6s  p99 %6s  max %7.1fms" % (
+        name, stats["count"], 1000 * stats["avgtime"],
+        ms(stats["p50"]), ms(stats["p90"]), ms(stats["p99"]), 1000 * stats["maxtime"])
+
+
+class SwiftTXBench(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--frenchnodes", dest="frenchnodes", default=50, type="int",
+                          help="Number of Frenchnodes to add")
+        parser.add_option("--requests", dest="requests", default=1000, type="int",
+                          help="Number of lock requests")
+        parser.add_option("--rate", dest="rate", default=100, type="int",
+                          help="Lock requests per second")
+
+    def setup_chain(self):
+        print("Initializing test directory " + self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir)
+        self.is_network_split = False
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, 1)
+        result = self.nodes[0].swifttxloadtest(self.options.frenchnodes, self.options.requests, self.options.rate)
+        print("%d of %d locks in %.2fs, %.1f locks/s" % (
+            result["completed"], result["requests"], result["time"], result["lockspersecond"]))
+        stats = result["stats"]
+        for name in ["vote", "complete", "notify"]:
+            print(format_latency(name, stats[name]))
+        assert_equal(result["completed"], self.options.requests)
+        assert_equal(stats["complete"]["count"], self.options.requests)
+
+
+if __name__ == '__main__':
+    SwiftTXBench().main()
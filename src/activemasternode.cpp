@@ -192,12 +192,20 @@ bool CActiveFrenchnode::SendFrenchnodePing(std::string& errorMessage)
         }
 
         pmn->lastPing = mnp;
-        mnodeman.mapSeenFrenchnodePing.insert(make_pair(mnp.GetHash(), mnp));
+        mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_LIST, vin.prevout);
 
         //mnodeman.mapSeenFrenchnodeBroadcast.lastPing is probably outdated, so we'll update it
         CFrenchnodeBroadcast mnb(*pmn);
         uint256 hash = mnb.GetHash();
-        if (mnodeman.mapSeenFrenchnodeBroadcast.count(hash)) mnodeman.mapSeenFrenchnodeBroadcast[hash].lastPing = mnp;
+        {
+            LOCK(mnodeman.cs_mapSeen);
+            mnodeman.mapSeenFrenchnodePing.insert(make_pair(mnp.GetHash(), mnp));
+            mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_PING, mnp.GetHash());
+            if (mnodeman.mapSeenFrenchnodeBroadcast.count(hash)) {
+                mnodeman.mapSeenFrenchnodeBroadcast[hash].lastPing = mnp;
+                mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_BROADCAST, hash);
+            }
+        }
 
         mnp.Relay();
 
@@ -265,7 +273,11 @@ bool CActiveFrenchnode::Register(CTxIn vin, CService service, CKey keyCollateral
         LogPrintf("CActiveFrenchnode::Register() -  %s\n", errorMessage);
         return false;
     }
-    mnodeman.mapSeenFrenchnodePing.insert(make_pair(mnp.GetHash(), mnp));
+    {
+        LOCK(mnodeman.cs_mapSeen);
+        mnodeman.mapSeenFrenchnodePing.insert(make_pair(mnp.GetHash(), mnp));
+        mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_PING, mnp.GetHash());
+    }
 
     LogPrintf("CActiveFrenchnode::Register() - Adding to Frenchnode list\n    service: %s\n    vin: %s\n", service.ToString(), vin.ToString());
     mnb = CFrenchnodeBroadcast(service, vin, pubKeyCollateralAddress, pubKeyFrenchnode, PROTOCOL_VERSION);
@@ -275,7 +287,11 @@ bool CActiveFrenchnode::Register(CTxIn vin, CService service, CKey keyCollateral
         LogPrintf("CActiveFrenchnode::Register() - %s\n", errorMessage);
         return false;
     }
-    mnodeman.mapSeenFrenchnodeBroadcast.insert(make_pair(mnb.GetHash(), mnb));
+    {
+        LOCK(mnodeman.cs_mapSeen);
+        mnodeman.mapSeenFrenchnodeBroadcast.insert(make_pair(mnb.GetHash(), mnb));
+        mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_BROADCAST, mnb.GetHash());
+    }
     masternodeSync.AddedFrenchnodeList(mnb.GetHash());
 
     CFrenchnode* pmn = mnodeman.Find(vin);
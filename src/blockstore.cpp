@@ -0,0 +1,192 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+
+#include "primitives/block.h"
+#include "util.h"
+
+#include <algorithm>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile(const boost::filesystem::path& path, size_t nMaxSize) : pbegin(NULL), nSize(0)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && nMaxSize > 0) {
+        size_t nMapSize = std::min((size_t)st.st_size, nMaxSize);
+        void* p = mmap(NULL, nMapSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pbegin = (const char*)p;
+            nSize = nMapSize;
+        } else {
+            LogPrintf("%s : mmap of %s failed\n", __func__, path.string());
+        }
+    }
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    if (pbegin)
+        munmap((void*)pbegin, nSize);
+#endif
+}
+
+CBlockFileMapper::CBlockFileMapper() : nUseCounter(0)
+{
+    // Block files are up to 128 MiB each; only 64-bit builds have the address space
+    // to keep many of them mapped.
+    nMaxFiles = sizeof(void*) >= 8 ? 256 : 4;
+}
+
+boost::shared_ptr<const CMappedFile> CBlockFileMapper::Get(int nFile, const boost::filesystem::path& path, size_t nSize)
+{
+    LOCK(cs);
+    std::map<int, CEntry>::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        it->second.nLastUse = ++nUseCounter;
+        return it->second.pfile;
+    }
+
+    boost::shared_ptr<const CMappedFile> pfile(new CMappedFile(path, nSize));
+    if (pfile->IsNull())
+        return boost::shared_ptr<const CMappedFile>();
+
+    if (mapFiles.size() >= nMaxFiles) {
+        std::map<int, CEntry>::iterator itOldest = mapFiles.begin();
+        for (std::map<int, CEntry>::iterator itFile = mapFiles.begin(); itFile != mapFiles.end(); ++itFile) {
+            if (itFile->second.nLastUse < itOldest->second.nLastUse)
+                itOldest = itFile;
+        }
+        mapFiles.erase(itOldest);
+    }
+    CEntry& entry = mapFiles[nFile];
+    entry.pfile = pfile;
+    entry.nLastUse = ++nUseCounter;
+    return pfile;
+}
+
+void CBlockFileMapper::Release(int nFile)
+{
+    LOCK(cs);
+    mapFiles.erase(nFile);
+}
+
+void CBlockFileMapper::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+}
+
+CBlockCache::CBlockCache(size_t nMaxBytesIn) : nMaxBytes(nMaxBytesIn), nBytes(0), nHits(0), nMisses(0) {}
+
+void CBlockCache::Trim()
+{
+    while (nBytes > nMaxBytes && !listBlocks.empty()) {
+        std::map<uint256, CEntry>::iterator it = mapBlocks.find(listBlocks.back().first);
+        nBytes -= it->second.nSize;
+        mapBlocks.erase(it);
+        listBlocks.pop_back();
+    }
+}
+
+CBlockCache::BlockPtr CBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, CEntry>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end()) {
+        nMisses++;
+        return BlockPtr();
+    }
+    nHits++;
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second.it);
+    return it->second.it->second;
+}
+
+void CBlockCache::Insert(const uint256& hash, const BlockPtr& pblock, size_t nSize)
+{
+    LOCK(cs);
+    if (nSize > nMaxBytes)
+        return;
+    std::map<uint256, CEntry>::iterator it = mapBlocks.find(hash);
+    if (it != mapBlocks.end()) {
+        listBlocks.splice(listBlocks.begin(), listBlocks, it->second.it);
+        return;
+    }
+    listBlocks.push_front(std::make_pair(hash, pblock));
+    CEntry& entry = mapBlocks[hash];
+    entry.it = listBlocks.begin();
+    entry.nSize = nSize;
+    nBytes += nSize;
+    Trim();
+}
+
+void CBlockCache::Erase(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, CEntry>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return;
+    nBytes -= it->second.nSize;
+    listBlocks.erase(it->second.it);
+    mapBlocks.erase(it);
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    listBlocks.clear();
+    mapBlocks.clear();
+    nBytes = 0;
+}
+
+void CBlockCache::SetMaxSize(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    Trim();
+}
+
+size_t CBlockCache::GetCount() const
+{
+    LOCK(cs);
+    return mapBlocks.size();
+}
+
+size_t CBlockCache::GetBytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
+
+size_t CBlockCache::GetMaxBytes() const
+{
+    LOCK(cs);
+    return nMaxBytes;
+}
+
+uint64_t CBlockCache::GetHits() const
+{
+    LOCK(cs);
+    return nHits;
+}
+
+uint64_t CBlockCache::GetMisses() const
+{
+    LOCK(cs);
+    return nMisses;
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FRENCH_BLOCKSTORE_H
+#define FRENCH_BLOCKSTORE_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <limits>
+#include <list>
+#include <map>
+#include <stdint.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+class CBlock;
+
+/** Default for -blockcache, the size in MiB of the cache of recently read blocks */
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 32;
+
+/**
+ * A file, or its first nMaxSize bytes, mapped read-only into memory. Unavailable (IsNull)
+ * on platforms without mmap. Truncating the file to at least the mapped size is safe;
+ * touching mapped pages beyond the end of the file would raise SIGBUS.
+ */
+class CMappedFile
+{
+private:
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+    const char* pbegin;
+    size_t nSize;
+
+public:
+    CMappedFile(const boost::filesystem::path& path, size_t nMaxSize = std::numeric_limits<size_t>::max());
+    ~CMappedFile();
+
+    bool IsNull() const { return pbegin == NULL; }
+    const char* begin() const { return pbegin; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Keeps finalized block files (the ones no longer appended to) mapped, so blocks
+ * can be deserialized straight from the page cache instead of through fopen/fread.
+ * The number of mappings is bounded; the least recently used one is dropped first.
+ * Callers hold on to the returned pointer while they read, so dropping a mapping
+ * never invalidates a read in progress. Only the size recorded for the file is
+ * mapped, so finalizing (truncating) a file never cuts into a live mapping.
+ */
+class CBlockFileMapper
+{
+private:
+    struct CEntry {
+        boost::shared_ptr<const CMappedFile> pfile;
+        int64_t nLastUse;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<int, CEntry> mapFiles;
+    size_t nMaxFiles;
+    int64_t nUseCounter;
+
+public:
+    CBlockFileMapper();
+
+    //! Mapping of the first nSize bytes of finalized block file nFile (at path), created on first use. NULL if it cannot be mapped.
+    boost::shared_ptr<const CMappedFile> Get(int nFile, const boost::filesystem::path& path, size_t nSize);
+
+    //! Forget the mapping of a file, e.g. because it is about to be deleted or written to again
+    void Release(int nFile);
+    void Clear();
+};
+
+/**
+ * Byte-bounded LRU cache of recently read blocks, shared between all readers.
+ *
+ * Blocks are immutable once they have a hash, so entries never need invalidating.
+ * The size is accounted in serialized bytes. Cached blocks are shared between
+ * threads, so they are inserted with their merkle tree already built and must not
+ * have BuildMerkleTree called on them again.
+ */
+class CBlockCache
+{
+public:
+    typedef boost::shared_ptr<const CBlock> BlockPtr;
+
+private:
+    typedef std::list<std::pair<uint256, BlockPtr> > BlockList;
+    struct CEntry {
+        BlockList::iterator it;
+        size_t nSize;
+    };
+
+    mutable CCriticalSection cs;
+    BlockList listBlocks; //! most recently used first
+    std::map<uint256, CEntry> mapBlocks;
+    size_t nMaxBytes;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Trim();
+
+public:
+    CBlockCache(size_t nMaxBytesIn = DEFAULT_BLOCK_CACHE_SIZE * 1024 * 1024);
+
+    //! Look up a block, counting a hit or a miss. Returns NULL when not cached.
+    BlockPtr Get(const uint256& hash);
+    //! Add a block, evicting the least recently used ones to stay within the size limit
+    void Insert(const uint256& hash, const BlockPtr& pblock, size_t nSize);
+    void Erase(const uint256& hash);
+    void Clear();
+
+    void SetMaxSize(size_t nMaxBytesIn);
+
+    size_t GetCount() const;
+    size_t GetBytes() const;
+    size_t GetMaxBytes() const;
+    uint64_t GetHits() const;
+    uint64_t GetMisses() const;
+};
+
+#endif // FRENCH_BLOCKSTORE_H
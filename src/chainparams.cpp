@@ -162,6 +162,11 @@ public:
 
         convertSeed6(vFixedSeeds, pnSeed6_main, ARRAYLEN(pnSeed6_main));
 
+        // Scripts of ancestors of this block are not verified during initial sync.
+        // Bump both alongside the checkpoints on each release (0 = verify everything).
+        hashDefaultAssumeValid = uint256("0x00");
+        nDefaultAssumeValidHeight = 0;
+
         fMiningRequiresPeers = true;
         fAllowMinDifficultyBlocks = false;
         fDefaultConsistencyChecks = false;
@@ -239,6 +244,9 @@ public:
 
         convertSeed6(vFixedSeeds, pnSeed6_test, ARRAYLEN(pnSeed6_test));
 
+        hashDefaultAssumeValid = uint256("0x00");
+        nDefaultAssumeValidHeight = 0;
+
         fMiningRequiresPeers = true;
         fAllowMinDifficultyBlocks = false;
         fDefaultConsistencyChecks = false;
@@ -294,6 +302,9 @@ public:
         vFixedSeeds.clear(); //! Regtest mode doesn't have any fixed seeds.
         vSeeds.clear();      //! Regtest mode doesn't have any DNS seeds.
 
+        hashDefaultAssumeValid = uint256("0x00");
+        nDefaultAssumeValidHeight = 0;
+
         fMiningRequiresPeers = false;
         fAllowMinDifficultyBlocks = true;
         fDefaultConsistencyChecks = true;
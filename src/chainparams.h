@@ -91,6 +91,10 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<CAddress>& FixedSeeds() const { return vFixedSeeds; }
     virtual const Checkpoints::CCheckpointData& Checkpoints() const = 0;
+    /** Block whose ancestors are assumed to have valid scripts (default for -assumevalid) */
+    const uint256& DefaultAssumeValid() const { return hashDefaultAssumeValid; }
+    /** Height of that block, which anchors it during getblocks sync before the block is known */
+    int DefaultAssumeValidHeight() const { return nDefaultAssumeValidHeight; }
     int PoolMaxTransactions() const { return nPoolMaxTransactions; }
     std::string SporkKey() const { return strSporkKey; }
     std::string FrenchnodePoolDummyAddress() const { return strFrenchnodePoolDummyAddress; }
@@ -126,6 +130,8 @@ protected:
     std::string strNetworkID;
     CBlock genesis;
     std::vector<CAddress> vFixedSeeds;
+    uint256 hashDefaultAssumeValid;
+    int nDefaultAssumeValidHeight;
     bool fMiningRequiresPeers;
     bool fAllowMinDifficultyBlocks;
     bool fDefaultConsistencyChecks;
@@ -5,7 +5,9 @@
 
 #include "coins.h"
 
+#include "clientversion.h"
 #include "random.h"
+#include "streams.h"
 
 #include <assert.h>
 
@@ -64,6 +66,10 @@ bool CCoinsView::HaveCoins(const uint256& txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
 bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return false; }
 bool CCoinsView::GetStats(CCoinsStats& stats) const { return false; }
+bool CCoinsView::ForEachCoins(boost::function<bool(const uint256&, const CCoins&)> func) const { return false; }
+CCoinsViewCursor* CCoinsView::Cursor() const { return NULL; }
+bool CCoinsView::GetRunningStats(CCoinsRunningStats& stats) const { return false; }
+void CCoinsView::SetRunningStats(const CCoinsRunningStats& stats) {}
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView* viewIn) : base(viewIn) {}
@@ -73,10 +79,71 @@ uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
 bool CCoinsViewBacked::GetStats(CCoinsStats& stats) const { return base->GetStats(stats); }
+bool CCoinsViewBacked::ForEachCoins(boost::function<bool(const uint256&, const CCoins&)> func) const { return base->ForEachCoins(func); }
+CCoinsViewCursor* CCoinsViewBacked::Cursor() const { return base->Cursor(); }
+bool CCoinsViewBacked::GetRunningStats(CCoinsRunningStats& stats) const { return base->GetRunningStats(stats); }
+void CCoinsViewBacked::SetRunningStats(const CCoinsRunningStats& stats) { base->SetRunningStats(stats); }
+
+namespace
+{
+bool HaveOutput(const CCoins& coins, unsigned int n)
+{
+    return n < coins.vout.size() && !coins.vout[n].IsNull();
+}
+
+/** The set hash element for a single unspent output */
+void HashOutput(CMuHash3072& muhash, const uint256& txid, const CCoins& coins, unsigned int n, bool fInsert)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << txid << VARINT(n) << VARINT(coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0)) << coins.fCoinStake;
+    ss << coins.vout[n];
+    if (fInsert)
+        muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    else
+        muhash.Remove((const unsigned char*)&ss[0], ss.size());
+}
+
+uint64_t SerializedCoinsSize(const CCoins& coins)
+{
+    return coins.IsPruned() ? 0 : 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+}
+} // anon namespace
+
+void CCoinsRunningStats::AddCoins(const uint256& txid, const CCoins& coins)
+{
+    UpdateCoins(txid, CCoins(), coins);
+}
+
+void CCoinsRunningStats::UpdateCoins(const uint256& txid, const CCoins& before, const CCoins& after)
+{
+    nTransactions += (after.IsPruned() ? 0 : 1) - (before.IsPruned() ? 0 : 1);
+    nSerializedSize += SerializedCoinsSize(after) - SerializedCoinsSize(before);
+
+    // Outputs that stayed the same (the common case when a few outputs of a
+    // transaction are spent) leave the set hash untouched.
+    bool fSameMeta = before.nHeight == after.nHeight && before.fCoinBase == after.fCoinBase && before.fCoinStake == after.fCoinStake;
+    unsigned int nSize = std::max(before.vout.size(), after.vout.size());
+    for (unsigned int n = 0; n < nSize; n++) {
+        bool fBefore = HaveOutput(before, n);
+        bool fAfter = HaveOutput(after, n);
+        if (fBefore && fAfter && fSameMeta && before.vout[n] == after.vout[n])
+            continue;
+        if (fBefore) {
+            nTransactionOutputs--;
+            nTotalAmount -= before.vout[n].nValue;
+            HashOutput(muhash, txid, before, n, false);
+        }
+        if (fAfter) {
+            nTransactionOutputs++;
+            nTotalAmount += after.vout[n].nValue;
+            HashOutput(muhash, txid, after, n, true);
+        }
+    }
+}
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0), fStatsFetched(false), fHaveStats(false), fStatsDirty(false) {}
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -199,8 +266,32 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
     return true;
 }
 
+bool CCoinsViewCache::GetRunningStats(CCoinsRunningStats& stats) const
+{
+    if (!fStatsFetched) {
+        fHaveStats = base->GetRunningStats(cacheStats);
+        fStatsFetched = true;
+    }
+    if (!fHaveStats || cacheStats.hashBlock != GetBestBlock())
+        return false;
+    stats = cacheStats;
+    return true;
+}
+
+void CCoinsViewCache::SetRunningStats(const CCoinsRunningStats& stats)
+{
+    cacheStats = stats;
+    fStatsFetched = true;
+    fHaveStats = true;
+    fStatsDirty = true;
+}
+
 bool CCoinsViewCache::Flush()
 {
+    if (fStatsDirty) {
+        base->SetRunningStats(cacheStats);
+        fStatsDirty = false;
+    }
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     return fOk;
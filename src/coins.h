@@ -7,6 +7,7 @@
 #define FRENCH_COINS_H
 
 #include "compressor.h"
+#include "muhash.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -16,6 +17,7 @@
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
 #include <boost/unordered_map.hpp>
 
 /** 
@@ -325,11 +327,71 @@ struct CCoinsStats {
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
     uint256 hashSerialized;
+    uint256 hashMuHash;
     CAmount nTotalAmount;
 
-    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
+    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), hashMuHash(0), nTotalAmount(0) {}
 };
 
+/**
+ * Statistics about the unspent transaction output set that are kept up to date
+ * as coins change, instead of being recomputed by scanning the whole database.
+ * The set hash is a MuHash over one element per unspent output, so it does not
+ * depend on the order in which outputs were added or spent. The totals are only
+ * meaningful for the state at hashBlock.
+ */
+class CCoinsRunningStats
+{
+public:
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    CMuHash3072 muhash;
+
+    CCoinsRunningStats() : hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    //! Account for a transaction's coins that were not part of the set before (used for full rebuilds)
+    void AddCoins(const uint256& txid, const CCoins& coins);
+
+    //! Account for the coins of txid changing from before to after; either may be pruned
+    void UpdateCoins(const uint256& txid, const CCoins& before, const CCoins& after);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+
+/** Cursor over the coins records of a CCoinsView, pinned to the state at GetBestBlock() */
+class CCoinsViewCursor
+{
+public:
+    CCoinsViewCursor(const uint256& hashBlockIn) : hashBlock(hashBlockIn) {}
+    virtual ~CCoinsViewCursor() {}
+
+    virtual bool GetKey(uint256& key) const = 0;
+    virtual bool GetValue(CCoins& coins) const = 0;
+
+    virtual bool Valid() const = 0;
+    virtual void Next() = 0;
+
+    //! Get best block at the time this cursor was created
+    const uint256& GetBestBlock() const { return hashBlock; }
+
+private:
+    uint256 hashBlock;
+};
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -352,6 +414,20 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats& stats) const;
 
+    //! Walk every coins record of the backing database (in key order) until func returns false.
+    //! Entries only held in caches are not visited, so flush them first.
+    virtual bool ForEachCoins(boost::function<bool(const uint256&, const CCoins&)> func) const;
+
+    //! Get a cursor over the coins records of the backing database, or NULL if there is none.
+    //! Like ForEachCoins it does not see entries only held in caches; the caller owns the cursor.
+    virtual CCoinsViewCursor* Cursor() const;
+
+    //! Retrieve the running statistics, only if they describe the state at GetBestBlock()
+    virtual bool GetRunningStats(CCoinsRunningStats& stats) const;
+
+    //! Replace the running statistics; they are committed together with the next BatchWrite
+    virtual void SetRunningStats(const CCoinsRunningStats& stats);
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -371,6 +447,10 @@ public:
     void SetBackend(CCoinsView& viewIn);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+    bool ForEachCoins(boost::function<bool(const uint256&, const CCoins&)> func) const;
+    CCoinsViewCursor* Cursor() const;
+    bool GetRunningStats(CCoinsRunningStats& stats) const;
+    void SetRunningStats(const CCoinsRunningStats& stats);
 };
 
 class CCoinsViewCache;
@@ -421,6 +501,12 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Running statistics, fetched from the base view on first use. */
+    mutable CCoinsRunningStats cacheStats;
+    mutable bool fStatsFetched;
+    mutable bool fHaveStats;
+    bool fStatsDirty;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -431,6 +517,8 @@ public:
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256& hashBlock);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool GetRunningStats(CCoinsRunningStats& stats) const;
+    void SetRunningStats(const CCoinsRunningStats& stats);
 
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
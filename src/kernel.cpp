@@ -379,8 +379,21 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
     // First try finding the previous transaction in database
     uint256 hashBlock;
     CTransaction txPrev;
-    if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-        return error("CheckProofOfStake() : INFO: read txPrev failed");
+    if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true)) {
+        // Blocks below a loaded UTXO set snapshot or pruned blocks are not on disk;
+        // the kernel only needs the staked output, which the coins view still has.
+        // That view is at our tip, which says nothing about blocks at or below the
+        // snapshot base, so those can't be checked this way
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        if (mi == mapBlockIndex.end() || mi->second->nHeight + 1 <= nTxOutSetSnapshotHeight)
+            return error("CheckProofOfStake() : block %s is at or below the UTXO set snapshot", block.GetHash().ToString().c_str());
+        CMutableTransaction txPrevOut;
+        txPrevOut.vout.resize(txin.prevout.n + 1);
+        if (!GetUnspentOutput(txin.prevout, txPrevOut.vout[txin.prevout.n], hashBlock) ||
+            (mapBlockIndex[hashBlock]->nStatus & BLOCK_HAVE_DATA))
+            return error("CheckProofOfStake() : INFO: read txPrev failed");
+        txPrev = CTransaction(txPrevOut);
+    }
 
     //verify signature and script
     if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
@@ -393,10 +406,8 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
     else
         return error("CheckProofOfStake() : read block failed");
 
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
+    // The kernel only needs the header of the block containing the stake, which the index has
+    CBlock blockprev(pindex->GetBlockHeader());
 
     unsigned int nInterval = 0;
     unsigned int nTime = block.nTime;
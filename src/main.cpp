@@ -11,6 +11,8 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
+#include "blockstore.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -73,8 +75,15 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fHavePruned = false;
+bool fPruneMode = false;
+bool fBudgetCollateralsRecorded = false;
+int nTxOutSetSnapshotHeight = -1;
+uint64_t nPruneTarget = 0;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+uint256 hashAssumeValid;
+int nAssumeValidHeight = 0;
 unsigned int nCoinCacheSize = 5000;
 bool fAlerts = DEFAULT_ALERTS;
 
@@ -89,6 +98,8 @@ CFeeRate minRelayTxFee = CFeeRate(10000);
 
 CTxMemPool mempool(::minRelayTxFee);
 
+CBlockCache blockCache;
+
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
@@ -99,8 +110,6 @@ map<uint256, int64_t> mapRejectedBlocks;
 
 void EraseOrphansFor(NodeId peer);
 
-static void CheckBlockIndex();
-
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
 
@@ -146,6 +155,9 @@ CCriticalSection cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
 
+/** Mappings of the block files below nLastBlockFile, which are never written again. */
+CBlockFileMapper blockFileMapper;
+
 /**
      * Every received block is assigned a unique and increasing identifier, so we
      * know which one to give priority in case of a fork.
@@ -176,11 +188,21 @@ int nQueuedValidatedHeaders = 0;
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
+/** Peers we asked to announce new blocks to us as compact blocks, oldest first. */
+list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
+/** Misbehavior scores from handlers that run without cs_main, until SendMessages adds them. */
+CCriticalSection cs_queuedMisbehavior;
+map<NodeId, int> mapQueuedMisbehavior;
+
 /** Dirty block index entries. */
 set<CBlockIndex*> setDirtyBlockIndex;
 
 /** Dirty block file entries. */
 set<int> setDirtyFileInfo;
+
+/** Whether FlushStateToDisk should look for block files to prune; set on startup and when block files grow. */
+bool fCheckForPruning = false;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -295,6 +317,12 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer wants new blocks announced to it as compact blocks.
+    bool fPreferHeaderAndIDs;
+    //! Whether this peer can send us compact blocks ("sendcmpct" received).
+    bool fProvidesHeaderAndIDs;
+    //! The compact block from this peer that is waiting for its "blocktxn".
+    boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;
 
     CNodeState()
     {
@@ -308,6 +336,8 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        fPreferHeaderAndIDs = false;
+        fProvidesHeaderAndIDs = false;
     }
 };
 
@@ -369,6 +399,11 @@ void FinalizeNode(NodeId nodeid)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
+    {
+        LOCK(cs_queuedMisbehavior);
+        mapQueuedMisbehavior.erase(nodeid);
+    }
 
     mapNodeState.erase(nodeid);
 }
@@ -383,6 +418,8 @@ void MarkBlockAsReceived(const uint256& hash)
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
         state->nStallingSince = 0;
+        if (state->partialBlock && state->partialBlock->header.GetHash() == hash)
+            state->partialBlock.reset();
         mapBlocksInFlight.erase(itInFlight);
     }
 }
@@ -403,6 +440,38 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
 }
 
+/**
+ * Ask a peer that just gave us a new tip to announce its next blocks as compact
+ * blocks, without the inv/getdata round trip. Like BIP152 only the 3 most recent
+ * such peers are in high-bandwidth mode; the oldest one is switched back.
+ * Requires cs_main.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom)
+{
+    CNodeState* nodestate = State(pfrom->GetId());
+    if (!nodestate->fProvidesHeaderAndIDs)
+        return;
+    BOOST_FOREACH (NodeId nodeid, lNodesAnnouncingHeaderAndIDs) {
+        if (nodeid == pfrom->GetId())
+            return;
+    }
+
+    uint64_t nCMPCTBLOCKVersion = 1;
+    if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
+        NodeId nodeidOldest = lNodesAnnouncingHeaderAndIDs.front();
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->GetId() == nodeidOldest) {
+                pnode->PushMessage("sendcmpct", false, nCMPCTBLOCKVersion);
+                break;
+            }
+        }
+    }
+    pfrom->PushMessage("sendcmpct", true, nCMPCTBLOCKVersion);
+    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+}
+
 /** Check whether the last unknown block a peer advertized is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid)
 {
@@ -895,10 +964,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
     if (nResult < 0) nResult = 0;
 
     if (nResult < 6) {
-        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-        if (i != mapTxLocks.end()) {
-            sigs = (*i).second.CountSignatures();
-        }
+        sigs = swifttx.GetSignatures(nTXHash);
         if (sigs >= SWIFTTX_SIGNATURES_REQUIRED) {
             return nSwiftTXDepth + nResult;
         }
@@ -909,12 +975,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
 
 int GetIXConfirmations(uint256 nTXHash)
 {
-    int sigs = 0;
-
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-    if (i != mapTxLocks.end()) {
-        sigs = (*i).second.CountSignatures();
-    }
+    int sigs = swifttx.GetSignatures(nTXHash);
     if (sigs >= SWIFTTX_SIGNATURES_REQUIRED) {
         return nSwiftTXDepth;
     }
@@ -1125,14 +1186,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
     // ----------- swiftTX transaction scanning -----------
 
-    BOOST_FOREACH (const CTxIn& in, tx.vin) {
-        if (mapLockedInputs.count(in.prevout)) {
-            if (mapLockedInputs[in.prevout] != tx.GetHash()) {
-                return state.DoS(0,
-                    error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason),
-                    REJECT_INVALID, "tx-lock-conflict");
-            }
-        }
+    uint256 hashLock;
+    if (swifttx.GetConflictingLock(tx, hashLock)) {
+        return state.DoS(0,
+            error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason),
+            REJECT_INVALID, "tx-lock-conflict");
     }
 
     // Check for conflicts with in-memory transactions
@@ -1309,14 +1367,11 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
 
     // ----------- swiftTX transaction scanning -----------
 
-    BOOST_FOREACH (const CTxIn& in, tx.vin) {
-        if (mapLockedInputs.count(in.prevout)) {
-            if (mapLockedInputs[in.prevout] != tx.GetHash()) {
-                return state.DoS(0,
-                    error("AcceptableInputs : conflicts with existing transaction lock: %s", reason),
-                    REJECT_INVALID, "tx-lock-conflict");
-            }
-        }
+    uint256 hashLock;
+    if (swifttx.GetConflictingLock(tx, hashLock)) {
+        return state.DoS(0,
+            error("AcceptableInputs : conflicts with existing transaction lock: %s", reason),
+            REJECT_INVALID, "tx-lock-conflict");
     }
 
     // Check for conflicts with in-memory transactions
@@ -1516,10 +1571,10 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         }
     }
 
-    if (pindexSlow) {
-        CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow)) {
-            BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+    if (pindexSlow && (pindexSlow->nStatus & BLOCK_HAVE_DATA)) {
+        boost::shared_ptr<const CBlock> pblock;
+        if (ReadBlockFromDisk(pblock, pindexSlow)) {
+            BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -1532,6 +1587,17 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     return false;
 }
 
+bool GetUnspentOutput(const COutPoint& outpoint, CTxOut& txout, uint256& hashBlock)
+{
+    LOCK(cs_main);
+    const CCoins* coins = pcoinsTip->AccessCoins(outpoint.hash);
+    if (!coins || !coins->IsAvailable(outpoint.n) || chainActive[coins->nHeight] == NULL)
+        return false;
+    txout = coins->vout[outpoint.n];
+    hashBlock = chainActive[coins->nHeight]->GetBlockHash();
+    return true;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1559,18 +1625,55 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
+/**
+ * Block files below nLastBlockFile are never appended to again, so they can be
+ * read through a shared mapping instead of opening the file for every block.
+ * Returns NULL for the file still being written or when mapping is unavailable.
+ * The mapping is made under cs_LastBlockFile and covers only the recorded file
+ * size, so a later FlushBlockFile(true) truncation can't remove mapped pages.
+ */
+static boost::shared_ptr<const CMappedFile> GetMappedBlockFile(const CDiskBlockPos& pos)
+{
+    LOCK(cs_LastBlockFile);
+    if (pos.nFile >= nLastBlockFile || pos.nFile >= (int)vinfoBlockFile.size())
+        return boost::shared_ptr<const CMappedFile>();
+    return blockFileMapper.Get(pos.nFile, GetBlockPosFilename(pos, "blk"), vinfoBlockFile[pos.nFile].nSize);
+}
+
+/** Locate the serialized block at pos inside a mapped block file */
+static bool GetMappedBlockData(const CMappedFile& file, const CDiskBlockPos& pos, const char*& pchBlock, unsigned int& nSize)
+{
+    // The size field written by WriteBlockToDisk precedes the block
+    if (pos.nPos < sizeof(nSize) || pos.nPos > file.size())
+        return error("%s : block position out of range", __func__);
+    CMemoryReader(file.begin() + pos.nPos - sizeof(nSize), sizeof(nSize), SER_DISK, CLIENT_VERSION) >> nSize;
+    if (nSize > file.size() - pos.nPos)
+        return error("%s : block size out of range", __func__);
+    pchBlock = file.begin() + pos.nPos;
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    boost::shared_ptr<const CMappedFile> pfile = GetMappedBlockFile(pos);
 
     // Read block
     try {
-        filein >> block;
+        if (pfile) {
+            const char* pchBlock;
+            unsigned int nSize;
+            if (!GetMappedBlockData(*pfile, pos, pchBlock, nSize))
+                return false;
+            CMemoryReader(pchBlock, nSize, SER_DISK, CLIENT_VERSION) >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk : OpenBlockFile failed");
+            filein >> block;
+        }
     } catch (std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -1595,6 +1698,63 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadBlockFromDisk(boost::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    pblock = blockCache.Get(hash);
+    if (pblock)
+        return true;
+
+    boost::shared_ptr<CBlock> pblockNew(new CBlock());
+    if (!ReadBlockFromDisk(*pblockNew, pindex))
+        return false;
+    // Build the merkle tree while the block is still private to this thread;
+    // once shared, readers only ever see it through a const pointer
+    pblockNew->BuildMerkleTree();
+    pblock = pblockNew;
+    blockCache.Insert(hash, pblock, ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+    return true;
+}
+
+bool ReadRawBlockFromDisk(CSerializeData& vchBlock, const CDiskBlockPos& pos, const uint256& hash, size_t nPrefix)
+{
+    vchBlock.clear();
+
+    boost::shared_ptr<const CMappedFile> pfile = GetMappedBlockFile(pos);
+
+    unsigned int nSize;
+    try {
+        if (pfile) {
+            const char* pchBlock;
+            if (!GetMappedBlockData(*pfile, pos, pchBlock, nSize))
+                return false;
+            vchBlock.resize(nPrefix + nSize);
+            memcpy(&vchBlock[nPrefix], pchBlock, nSize);
+        } else {
+            if (pos.nPos < sizeof(nSize))
+                return error("%s : block position out of range", __func__);
+            CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(nSize)), true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s : OpenBlockFile failed", __func__);
+            filein >> nSize;
+            if (nSize > MAX_BLOCK_SIZE)
+                return error("%s : block size out of range", __func__);
+            vchBlock.resize(nPrefix + nSize);
+            filein.read(&vchBlock[nPrefix], nSize);
+        }
+
+        // Blocks serialize the same way on disk and on the wire. Check the header
+        // so a damaged file is not passed on to peers.
+        CBlockHeader header;
+        CMemoryReader(&vchBlock[nPrefix], nSize, SER_NETWORK, PROTOCOL_VERSION) >> header;
+        if (header.GetHash() != hash)
+            return error("%s : GetHash() doesn't match index", __func__);
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -1789,6 +1949,30 @@ void Misbehaving(NodeId pnode, int howmuch)
         LogPrintf("Misbehaving: %s (%d -> %d)\n", state->name, state->nMisbehavior - howmuch, state->nMisbehavior);
 }
 
+void QueueMisbehaving(NodeId pnode, int howmuch)
+{
+    if (howmuch == 0)
+        return;
+
+    LOCK(cs_queuedMisbehavior);
+    mapQueuedMisbehavior[pnode] += howmuch;
+}
+
+// Requires cs_main.
+static void ApplyQueuedMisbehavior(NodeId pnode)
+{
+    int howmuch;
+    {
+        LOCK(cs_queuedMisbehavior);
+        std::map<NodeId, int>::iterator it = mapQueuedMisbehavior.find(pnode);
+        if (it == mapQueuedMisbehavior.end())
+            return;
+        howmuch = it->second;
+        mapQueuedMisbehavior.erase(it);
+    }
+    Misbehaving(pnode, howmuch);
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (!pindexBestInvalid || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
@@ -1840,6 +2024,40 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
 }
 
+namespace
+{
+/** Copy the coins a transaction touches, so their change can be folded into the running stats */
+void SnapshotCoins(const CTransaction& tx, const CCoinsViewCache& view, std::vector<std::pair<uint256, CCoins> >& vCoins)
+{
+    std::set<uint256> setSeen;
+    vCoins.clear();
+    vCoins.reserve(tx.vin.size() + 1);
+    uint256 hash = tx.GetHash();
+    setSeen.insert(hash);
+    vCoins.push_back(std::make_pair(hash, CCoins()));
+    if (!tx.IsCoinBase()) {
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (setSeen.insert(txin.prevout.hash).second)
+                vCoins.push_back(std::make_pair(txin.prevout.hash, CCoins()));
+        }
+    }
+    for (unsigned int i = 0; i < vCoins.size(); i++) {
+        const CCoins* coins = view.AccessCoins(vCoins[i].first);
+        if (coins)
+            vCoins[i].second = *coins;
+    }
+}
+
+void ApplyCoinsChanges(CCoinsRunningStats& stats, const CCoinsViewCache& view, const std::vector<std::pair<uint256, CCoins> >& vCoinsBefore)
+{
+    static const CCoins coinsEmpty;
+    for (unsigned int i = 0; i < vCoinsBefore.size(); i++) {
+        const CCoins* coins = view.AccessCoins(vCoinsBefore[i].first);
+        stats.UpdateCoins(vCoinsBefore[i].first, vCoinsBefore[i].second, coins ? *coins : coinsEmpty);
+    }
+}
+} // anon namespace
+
 bool CScriptCheck::operator()()
 {
     const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
@@ -1849,6 +2067,32 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool AssumeScriptsValid(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid == 0)
+        return false;
+
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end()) {
+        // getblocks sync connects blocks in chain order, so the assumed-valid block is only
+        // learned after all of its ancestors. Until then it is anchored by height like a
+        // checkpoint, and ContextualCheckBlockHeader rejects any other block at that height.
+        return pindex->nHeight < nAssumeValidHeight;
+    }
+
+    // Once it is known (reindex, restart, or a chain that went past it) only its own
+    // ancestors qualify, and only while it lies at or below its release-time height or
+    // the last checkpoint, or is buried by two weeks worth of blocks.
+    const CBlockIndex* pindexAssumed = it->second;
+    if (pindexAssumed->GetAncestor(pindex->nHeight) != pindex)
+        return false;
+    if (pindexAssumed->nHeight <= std::max(nAssumeValidHeight, Checkpoints::GetTotalBlocksEstimate()))
+        return true;
+    int nBestHeight = std::max(chainActive.Height(), pindexBestHeader ? pindexBestHeader->nHeight : 0);
+    return nBestHeight - pindexAssumed->nHeight >= ASSUMEVALID_MIN_BURIED_TIME / Params().TargetSpacing();
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck>* pvChecks)
 {
     if (!tx.IsCoinBase()) {
@@ -1970,10 +2214,16 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    CCoinsRunningStats runningStats;
+    bool fRunningStats = view.GetRunningStats(runningStats);
+    std::vector<std::pair<uint256, CCoins> > vCoinsBefore;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction& tx = block.vtx[i];
         uint256 hash = tx.GetHash();
+        if (fRunningStats)
+            SnapshotCoins(tx, view, vCoinsBefore);
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly. Note that transactions with only provably unspendable outputs won't
@@ -2025,10 +2275,17 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 coins->vout[out.n] = undo.txout;
             }
         }
+
+        if (fRunningStats)
+            ApplyCoinsChanges(runningStats, view, vCoinsBefore);
     }
 
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
+    if (fRunningStats) {
+        runningStats.hashBlock = pindex->pprev->GetBlockHash();
+        view.SetRunningStats(runningStats);
+    }
 
     if (pfClean) {
         *pfClean = fClean;
@@ -2044,6 +2301,10 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Don't let a mapping outlive the truncation below
+    if (fFinalize)
+        blockFileMapper.Release(nLastBlockFile);
+
     FILE* fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -2093,7 +2354,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == Params().HashGenesisBlock()) {
+        CCoinsRunningStats runningStats;
+        bool fRunningStats = !fJustCheck && view.GetRunningStats(runningStats);
         view.SetBestBlock(pindex->GetBlockHash());
+        if (fRunningStats) {
+            runningStats.hashBlock = pindex->GetBlockHash();
+            view.SetRunningStats(runningStats);
+        }
         return true;
     }
 
@@ -2105,7 +2372,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.DoS(100, error("ConnectBlock() : PoW period ended"),
             REJECT_INVALID, "PoW-ended");
 
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    // Amounts, UTXO updates and stake kernels are still fully checked when scripts are not.
+    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate() && !AssumeScriptsValid(pindex);
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -2151,10 +2419,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<CTransaction> vCollaterals;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     CAmount nValueOut = 0;
     CAmount nValueIn = 0;
     unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS;
+    CCoinsRunningStats runningStats;
+    bool fRunningStats = !fJustCheck && view.GetRunningStats(runningStats);
+    std::vector<std::pair<uint256, CCoins> > vCoinsBefore;
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
         const CTransaction& tx = block.vtx[i];
 
@@ -2194,10 +2466,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
+        if (fRunningStats)
+            SnapshotCoins(tx, view, vCoinsBefore);
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        if (fRunningStats)
+            ApplyCoinsChanges(runningStats, view, vCoinsBefore);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        if (IsBudgetCollateralCandidate(tx))
+            vCollaterals.push_back(tx);
     }
 
     // track money supply and mint amount info
@@ -2255,8 +2533,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    // budget collateral is checked for as long as its proposal lasts, which has no upper bound;
+    // keep it outside the block files so pruning can't lose it
+    if (!vCollaterals.empty() && !pblocktree->WriteBudgetCollaterals(vCollaterals, pindex->GetBlockHash()))
+        return state.Abort("Failed to write budget collateral transactions");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    if (fRunningStats) {
+        runningStats.hashBlock = pindex->GetBlockHash();
+        view.SetRunningStats(runningStats);
+    }
 
     int64_t nTime3 = GetTimeMicros();
     nTimeIndex += nTime3 - nTime2;
@@ -2274,6 +2561,109 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
+unsigned int GetPruneKeepBlocks()
+{
+    // Undo data must cover the deepest reorganisation we accept. Budget collateral
+    // transactions are not covered by any depth, as a proposal can run for any number
+    // of cycles; ConnectBlock records them in the block tree instead. Stake kernels
+    // only need the block index (stake modifiers) and the UTXO set (the staked
+    // output), and stay valid whatever is pruned; still keep the minimum stake age.
+    int64_t nKeep = MIN_BLOCKS_TO_KEEP;
+    nKeep = std::max(nKeep, (int64_t)Params().MaxReorganizationDepth());
+    nKeep = std::max(nKeep, nStakeMinAge / Params().TargetSpacing());
+    return (unsigned int)nKeep;
+}
+
+uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    BOOST_FOREACH (const CBlockFileInfo& file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+void PruneOneBlockFile(int nFile)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile != nFile || !(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)))
+            continue;
+        pindex->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+        pindex->nFile = 0;
+        pindex->nDataPos = 0;
+        pindex->nUndoPos = 0;
+        setDirtyBlockIndex.insert(pindex);
+
+        // A pruned block would have to be downloaded again before its chain is
+        // considered, at which point it is added back to mapBlocksUnlinked if needed.
+        std::pair<multimap<CBlockIndex*, CBlockIndex*>::iterator, multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+        while (range.first != range.second) {
+            multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first++;
+            if (itUnlinked->second == pindex)
+                mapBlocksUnlinked.erase(itUnlinked);
+        }
+    }
+
+    vinfoBlockFile[nFile].SetNull();
+    setDirtyFileInfo.insert(nFile);
+}
+
+void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
+{
+    for (set<int>::const_iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        blockFileMapper.Release(*it);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+/**
+ * Pick the oldest block files to delete until the disk usage target is met. Files
+ * holding any block within GetPruneKeepBlocks() of the tip are never selected, and
+ * the last (still growing) file is left alone.
+ */
+void static FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    unsigned int nKeepBlocks = GetPruneKeepBlocks();
+    if (chainActive.Tip() == NULL || nPruneTarget == 0 || chainActive.Height() <= (int)nKeepBlocks)
+        return;
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Height() - nKeepBlocks;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We only look for files to prune after allocating new space, so leave room
+    // under the target for another allocation before the next check.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    int nCount = 0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        for (int nFile = 0; nFile < nLastBlockFile; nFile++) {
+            const CBlockFileInfo& info = vinfoBlockFile[nFile];
+            if (info.nSize == 0)
+                continue;
+            if (nCurrentUsage + nBuffer < nPruneTarget)
+                break;
+            // Keep scanning: a later file may only hold older blocks
+            if (info.nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            uint64_t nBytesToPrune = info.nSize + info.nUndoSize;
+            PruneOneBlockFile(nFile);
+            setFilesToPrune.insert(nFile);
+            nCurrentUsage -= nBytesToPrune;
+            nCount++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+        nPruneTarget / 1024 / 1024, nCurrentUsage / 1024 / 1024,
+        ((int64_t)nPruneTarget - (int64_t)nCurrentUsage) / 1024 / 1024,
+        nLastBlockWeCanPrune, nCount);
+}
+
 enum FlushStateMode {
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
@@ -2289,8 +2679,21 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
+        if (fPruneMode && fCheckForPruning && !fReindex) {
+            FindFilesToPrune(setFilesToPrune);
+            fCheckForPruning = false;
+            if (!setFilesToPrune.empty()) {
+                fFlushForPrune = true;
+                if (!fHavePruned) {
+                    pblocktree->WriteFlag("prunedblockfiles", true);
+                    fHavePruned = true;
+                }
+            }
+        }
+        if ((mode == FLUSH_STATE_ALWAYS) || fFlushForPrune ||
             ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
@@ -2330,6 +2733,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             }
             nLastWrite = GetTimeMicros();
         }
+        // Only delete the files once the block index no longer refers to them
+        if (fFlushForPrune)
+            UnlinkPrunedFiles(setFilesToPrune);
     } catch (const std::runtime_error& e) {
         return state.Abort(std::string("System error while flushing: ") + e.what());
     }
@@ -2342,6 +2748,13 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush()
+{
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew)
 {
@@ -2413,6 +2826,12 @@ bool static DisconnectTip(CValidationState& state)
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    // Frenchnode scores for heights after the disconnected block were based on its hash
+    {
+        LOCK(cs_mapCacheBlockHashes);
+        mapCacheBlockHashes.erase(mapCacheBlockHashes.upper_bound(pindexDelete->nHeight), mapCacheBlockHashes.end());
+    }
+    mnodeman.DisconnectedBlock(block);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -2488,6 +2907,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    // Frenchnodes whose collateral is gone
+    mnodeman.ConnectedBlock(*pblock, *pcoinsTip);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH (const CTransaction& tx, txConflicted) {
@@ -2773,11 +3194,40 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
             // Relay inventory, but don't relay old inventory during initial block download.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
+            // Peers in compact block high-bandwidth mode get the new tip pushed as a
+            // compact block right away, saving them the inv/getdata round trip.
+            CFramedMessageRef msgCmpctBlock;
+            set<NodeId> setPreferHeaderAndIDs;
+            if (pblock && pblock->GetHash() == hashNewTip) {
+                LOCK(cs_main);
+                for (map<NodeId, CNodeState>::const_iterator it = mapNodeState.begin(); it != mapNodeState.end(); ++it) {
+                    if (it->second.fPreferHeaderAndIDs)
+                        setPreferHeaderAndIDs.insert(it->first);
+                }
+                if (!setPreferHeaderAndIDs.empty()) {
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    ss << CBlockHeaderAndShortTxIDs(*pblock);
+                    msgCmpctBlock = MakeFramedMessage("cmpctblock", ss);
+                }
+            }
             {
                 LOCK(cs_vNodes);
-                BOOST_FOREACH (CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                CInv inv(MSG_BLOCK, hashNewTip);
+                BOOST_FOREACH (CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (msgCmpctBlock && setPreferHeaderAndIDs.count(pnode->GetId())) {
+                        bool fKnown;
+                        {
+                            LOCK(pnode->cs_inventory);
+                            fKnown = pnode->filterInventoryKnown.contains(inv.GetKey());
+                            pnode->filterInventoryKnown.insert(inv.GetKey());
+                        }
+                        if (!fKnown)
+                            pnode->PushSharedMessage(msgCmpctBlock);
+                    } else
+                        pnode->PushInventory(inv);
+                }
             }
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
@@ -3001,7 +3451,11 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
         pos.nPos = vinfoBlockFile[nFile].nSize;
     }
 
-    nLastBlockFile = nFile;
+    if ((int)nFile != nLastBlockFile) {
+        // A mapping made while this file was finalized would be too short once it grows
+        blockFileMapper.Release(nFile);
+        nLastBlockFile = nFile;
+    }
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
     if (fKnown)
         vinfoBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoBlockFile[nFile].nSize);
@@ -3019,6 +3473,8 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
                     AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
                     fclose(file);
                 }
+                if (fPruneMode)
+                    fCheckForPruning = true;
             } else
                 return state.Error("out of disk space");
         }
@@ -3049,6 +3505,8 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
                 AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
                 fclose(file);
             }
+            if (fPruneMode)
+                fCheckForPruning = true;
         } else
             return state.Error("out of disk space");
     }
@@ -3135,15 +3593,12 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         BOOST_FOREACH (const CTransaction& tx, block.vtx) {
             if (!tx.IsCoinBase()) {
                 //only reject blocks when it's based on complete consensus
-                BOOST_FOREACH (const CTxIn& in, tx.vin) {
-                    if (mapLockedInputs.count(in.prevout)) {
-                        if (mapLockedInputs[in.prevout] != tx.GetHash()) {
-                            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-                            LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", mapLockedInputs[in.prevout].ToString(), tx.GetHash().ToString());
-                            return state.DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"),
-                                REJECT_INVALID, "conflicting-tx-ix");
-                        }
-                    }
+                uint256 hashLock;
+                if (swifttx.GetConflictingLock(tx, hashLock)) {
+                    mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+                    LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", hashLock.ToString(), tx.GetHash().ToString());
+                    return state.DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"),
+                        REJECT_INVALID, "conflicting-tx-ix");
                 }
             }
         }
@@ -3260,6 +3715,11 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
         return state.DoS(100, error("%s : rejected by checkpoint lock-in at %d", __func__, nHeight),
             REJECT_CHECKPOINT, "checkpoint mismatch");
 
+    // Same for the height-anchored assumed-valid block, whose ancestors were connected without script checks
+    if (nAssumeValidHeight > 0 && nHeight == nAssumeValidHeight && hash != hashAssumeValid)
+        return state.DoS(100, error("%s : rejected by assumevalid lock-in at %d", __func__, nHeight),
+            REJECT_CHECKPOINT, "assumevalid mismatch");
+
     // Don't accept any forks from the main chain prior to last checkpoint
     CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
     if (pcheckpoint && nHeight < pcheckpoint->nHeight)
@@ -3696,7 +4156,8 @@ bool static LoadBlockIndexDB(string& strError)
     BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        // Blocks loaded from a UTXO set snapshot have no data on disk, but do have nTx
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -3735,6 +4196,14 @@ bool static LoadBlockIndexDB(string& strError)
         }
     }
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+    pblocktree->ReadFlag("budgetcollaterals", fBudgetCollateralsRecorded);
+    if (pblocktree->ReadInt("txoutsetheight", nTxOutSetSnapshotHeight))
+        LogPrintf("LoadBlockIndexDB(): chainstate was loaded from a UTXO set snapshot at height %d\n", nTxOutSetSnapshotHeight);
+
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     set<int> setBlkDataFiles;
@@ -3883,6 +4352,11 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height() - nCheckDepth)
             break;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // Below a loaded UTXO set snapshot there is nothing left to verify
+            LogPrintf("VerifyDB() : block data not available below height %d\n", pindex->nHeight + 1);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3939,10 +4413,330 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
 
 void UnloadBlockIndex()
 {
+    LOCK(cs_main);
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexBestHeader = NULL;
+    mapBlocksUnlinked.clear();
+    setDirtyBlockIndex.clear();
+    setDirtyFileInfo.clear();
+    vinfoBlockFile.clear();
+    nLastBlockFile = 0;
+    blockFileMapper.Clear();
+}
+
+namespace
+{
+/** Serializes into a UTXO set snapshot while accumulating its commitment hash */
+class CSnapshotWriter
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+
+public:
+    CSnapshotWriter(CAutoFile& fileIn) : file(fileIn), hasher(SER_GETHASH, PROTOCOL_VERSION) {}
+
+    template <typename T>
+    CSnapshotWriter& operator<<(const T& obj)
+    {
+        file << obj;
+        hasher << obj;
+        return *this;
+    }
+
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/** Deserializes from a UTXO set snapshot while accumulating its commitment hash */
+class CSnapshotReader
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+
+public:
+    CSnapshotReader(CAutoFile& fileIn) : file(fileIn), hasher(SER_GETHASH, PROTOCOL_VERSION) {}
+
+    template <typename T>
+    CSnapshotReader& operator>>(T& obj)
+    {
+        file >> obj;
+        hasher << obj;
+        return *this;
+    }
+
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/** Flush accumulated coins to the database once this many serialized bytes are pending */
+static const size_t TXOUTSET_LOAD_BATCH_SIZE = 16 << 20;
+/** Number of block index entries per database batch while loading a snapshot */
+static const size_t TXOUTSET_LOAD_INDEX_BATCH = 10000;
+
+/**
+ * Read a snapshot and check it against its commitment and hashExpected. When coinsview
+ * is given, the block index entries and coins are written to the databases as they are read.
+ */
+bool ReadTxOutSetSnapshot(CAutoFile& filein, const uint256& hashExpected, CCoinsViewDB* coinsview, CTxOutSetSnapshotHeader& header, std::string& strError)
+{
+    try {
+        CSnapshotReader reader(filein);
+        reader >> header;
+        if (memcmp(header.pchMagic, TXOUTSET_SNAPSHOT_MAGIC, sizeof(header.pchMagic)) != 0 || header.nVersion != TXOUTSET_SNAPSHOT_VERSION) {
+            strError = "not a supported UTXO set snapshot";
+            return false;
+        }
+        if (memcmp(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
+            strError = "UTXO set snapshot is for a different network";
+            return false;
+        }
+        if (header.nHeight < 0) {
+            strError = "invalid snapshot height";
+            return false;
+        }
+
+        // Block index from genesis to the snapshot block; block data is not part of the snapshot
+        std::vector<CDiskBlockIndex> vIndex;
+        uint256 hashPrev = 0;
+        for (int nHeight = 0; nHeight <= header.nHeight; nHeight++) {
+            boost::this_thread::interruption_point();
+            CDiskBlockIndex diskindex;
+            reader >> diskindex;
+            uint256 hash = diskindex.GetBlockHash();
+            if (diskindex.nHeight != nHeight || diskindex.hashPrev != hashPrev || (nHeight == 0 && hash != Params().HashGenesisBlock())) {
+                strError = strprintf("block index of snapshot is not a chain (height %d)", nHeight);
+                return false;
+            }
+            if (diskindex.nTx == 0 || !diskindex.IsValid(BLOCK_VALID_TRANSACTIONS)) {
+                strError = strprintf("block %s in snapshot was not fully validated", hash.ToString());
+                return false;
+            }
+            hashPrev = hash;
+            if (coinsview) {
+                diskindex.nStatus &= ~BLOCK_HAVE_MASK;
+                diskindex.nFile = 0;
+                diskindex.nDataPos = 0;
+                diskindex.nUndoPos = 0;
+                vIndex.push_back(diskindex);
+                if (vIndex.size() >= TXOUTSET_LOAD_INDEX_BATCH || nHeight == header.nHeight) {
+                    if (!pblocktree->WriteBlockIndexBatch(vIndex)) {
+                        strError = "failed to write block index";
+                        return false;
+                    }
+                    vIndex.clear();
+                }
+            }
+        }
+        if (hashPrev != header.hashBlock) {
+            strError = "block index of snapshot does not end at the snapshot block";
+            return false;
+        }
+
+        // Coins, in the order they are stored in the database
+        std::vector<std::pair<uint256, CCoins> > vCoins;
+        size_t nBatchSize = 0;
+        uint64_t nCoins = 0;
+        uint256 txidPrev = 0;
+        while (true) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            reader >> txid;
+            if (txid == 0)
+                break;
+            if (nCoins > 0 && memcmp(txidPrev.begin(), txid.begin(), txid.size()) >= 0) {
+                strError = "coins in snapshot are not sorted";
+                return false;
+            }
+            txidPrev = txid;
+            CCoins coins;
+            reader >> coins;
+            if (coins.IsPruned()) {
+                strError = strprintf("snapshot contains spent coins for %s", txid.ToString());
+                return false;
+            }
+            nCoins++;
+            if (coinsview) {
+                nBatchSize += 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+                vCoins.push_back(std::make_pair(txid, coins));
+                if (nBatchSize >= TXOUTSET_LOAD_BATCH_SIZE) {
+                    if (!coinsview->WriteCoinsBatch(vCoins, 0)) {
+                        strError = "failed to write coins";
+                        return false;
+                    }
+                    vCoins.clear();
+                    nBatchSize = 0;
+                    LogPrintf("%s : loaded %u coins\n", __func__, nCoins);
+                }
+            }
+        }
+
+        uint256 hashSnapshot = reader.GetHash();
+        uint64_t nCoinsExpected;
+        uint256 hashCommitted;
+        filein >> nCoinsExpected >> hashCommitted;
+        if (nCoins != nCoinsExpected || hashSnapshot != hashCommitted) {
+            strError = "UTXO set snapshot is truncated or corrupted";
+            return false;
+        }
+        if (hashSnapshot != hashExpected) {
+            strError = strprintf("UTXO set snapshot hash %s does not match the expected %s", hashSnapshot.ToString(), hashExpected.ToString());
+            return false;
+        }
+
+        // Setting the best block last makes the chainstate usable only once complete
+        if (coinsview && !coinsview->WriteCoinsBatch(vCoins, header.hashBlock)) {
+            strError = "failed to write coins";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Deserialize or I/O error - %s", e.what());
+        return false;
+    }
+    return true;
+}
+} // anon namespace
+
+bool DumpTxOutSet(const boost::filesystem::path& path, CTxOutSetSnapshotHeader& header, uint64_t& nCoins, uint256& hashSnapshot)
+{
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : failed to open %s", __func__, pathTmp.string());
+
+    nCoins = 0;
+    try {
+        CSnapshotWriter writer(fileout);
+        boost::scoped_ptr<CCoinsViewCursor> pcursor;
+        {
+            // The chain state is only needed to flush it and write the block index; the coins
+            // are then streamed from the database snapshot the cursor was opened on
+            LOCK(cs_main);
+            FlushStateToDisk();
+
+            CBlockIndex* pindexTip = chainActive.Tip();
+            pcursor.reset(pcoinsTip->Cursor());
+            if (pindexTip == NULL || !pcursor || pcursor->GetBestBlock() != pindexTip->GetBlockHash())
+                return error("%s : chainstate is not at the active tip", __func__);
+
+            memcpy(header.pchMagic, TXOUTSET_SNAPSHOT_MAGIC, sizeof(header.pchMagic));
+            header.nVersion = TXOUTSET_SNAPSHOT_VERSION;
+            memcpy(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+            header.hashBlock = pindexTip->GetBlockHash();
+            header.nHeight = pindexTip->nHeight;
+
+            writer << header;
+            for (int nHeight = 0; nHeight <= header.nHeight; nHeight++)
+                writer << CDiskBlockIndex(chainActive[nHeight]);
+        }
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CCoins coins;
+            if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+                return error("%s : failed to read the coin database", __func__);
+            writer << txid << coins;
+            nCoins++;
+            pcursor->Next();
+        }
+        writer << uint256(0);
+        hashSnapshot = writer.GetHash();
+        fileout << nCoins << hashSnapshot;
+    } catch (const std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return error("%s : failed to rename %s", __func__, pathTmp.string());
+    LogPrintf("Wrote UTXO set snapshot at height %d (%u coins, hash %s) to %s\n", header.nHeight, nCoins, hashSnapshot.ToString(), path.string());
+    return true;
+}
+
+bool LoadTxOutSet(const boost::filesystem::path& path, CCoinsViewDB* coinsview, const uint256& hashExpected, std::string& strError)
+{
+    LOCK(cs_main);
+    if (coinsview->GetBestBlock() != 0 || !mapBlockIndex.empty()) {
+        strError = "a UTXO set snapshot can only be loaded into an empty data directory";
+        return false;
+    }
+    if (hashExpected == 0) {
+        strError = "the expected snapshot hash must be given with -loadtxoutsethash";
+        return false;
+    }
+
+    // Verify the whole file against its commitment before touching the databases
+    CTxOutSetSnapshotHeader header;
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            strError = strprintf("failed to open %s", path.string());
+            return false;
+        }
+        if (!ReadTxOutSetSnapshot(filein, hashExpected, NULL, header, strError))
+            return false;
+    }
+
+    LogPrintf("Loading UTXO set snapshot at height %d (%s)...\n", header.nHeight, header.hashBlock.ToString());
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("failed to open %s", path.string());
+        return false;
+    }
+    // The block index and the coins go to two databases, so neither write is atomic with the
+    // other: on failure, wipe both so the data directory is empty again rather than half loaded
+    bool fLoaded = ReadTxOutSetSnapshot(filein, hashExpected, coinsview, header, strError);
+    if (fLoaded) {
+        // InitBlockIndex is skipped now that a chain exists, so record its flags here; blocks below
+        // the snapshot were never stored, so none of their budget collateral can go missing
+        if (!pblocktree->WriteFlag("txindex", GetBoolArg("-txindex", true)) ||
+            !pblocktree->WriteFlag("budgetcollaterals", true) ||
+            !pblocktree->WriteInt("txoutsetheight", header.nHeight)) {
+            strError = "failed to write block index";
+            fLoaded = false;
+        }
+    }
+    if (!fLoaded) {
+        if (!pblocktree->WipeBlockIndex() || !coinsview->Wipe())
+            strError += "; the partly loaded snapshot could not be removed, delete the blocks and chainstate directories";
+        return false;
+    }
+    nTxOutSetSnapshotHeight = header.nHeight;
+    LogPrintf("Loaded UTXO set snapshot; blocks up to height %d are not stored locally\n", header.nHeight);
+    return true;
+}
+
+static bool AddToRunningStats(CCoinsRunningStats* pstats, const uint256& txid, const CCoins& coins)
+{
+    pstats->AddCoins(txid, coins);
+    return true;
+}
+
+bool InitTxOutSetStats()
+{
+    LOCK(cs_main);
+    CCoinsRunningStats stats;
+    if (pcoinsTip->GetRunningStats(stats))
+        return true;
+
+    // Missing or stale (written by an older version): rebuild them once from the database
+    LogPrintf("Computing UTXO set statistics, this may take a while...\n");
+    int64_t nStart = GetTimeMillis();
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    stats = CCoinsRunningStats();
+    if (!pcoinsTip->ForEachCoins(boost::bind(&AddToRunningStats, &stats, _1, _2)))
+        return error("%s : failed to read the coin database", __func__);
+    stats.hashBlock = pcoinsTip->GetBestBlock();
+    pcoinsTip->SetRunningStats(stats);
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    LogPrintf("UTXO set statistics: %u transactions, %u outputs  %dms\n", stats.nTransactions, stats.nTransactionOutputs, GetTimeMillis() - nStart);
+    return true;
 }
 
 bool LoadBlockIndex(string& strError)
@@ -3964,6 +4758,9 @@ bool InitBlockIndex()
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", true);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    // A new database records budget collateral from the genesis block on
+    fBudgetCollateralsRecorded = true;
+    pblocktree->WriteFlag("budgetcollaterals", true);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4094,7 +4891,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
     return nLoaded > 0;
 }
 
-void static CheckBlockIndex()
+void CheckBlockIndex()
 {
     if (!fCheckBlockIndex) {
         return;
@@ -4130,6 +4927,7 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL;         // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL;         // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed = NULL;  // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL;    // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL;   // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
@@ -4137,6 +4935,7 @@ void static CheckBlockIndex()
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -4147,12 +4946,20 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis());                       // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        if (!fHavePruned) {
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 (we stored the number of transactions in the block), pruned or not
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0); // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0));                                             // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0));                                      // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
         assert(pindex->nHeight == nHeight);                                                                          // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork);                            // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight)));                                // The pskip pointer must point back for all but the first 2 blocks.
@@ -4164,11 +4971,17 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
-                assert(setBlockIndexCandidates.count(pindex));
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            if (pindexFirstInvalid == NULL) {
+                // If this block sorts at least as good as the current tip and is valid and we have all data
+                // for its parents, it must be in setBlockIndexCandidates. The tip must be there even when
+                // some of its data has been pruned. A block with a pruned parent may have been dropped
+                // from the candidates by FindMostWorkChain, see the mapBlocksUnlinked checks below.
+                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                    assert(setBlockIndexCandidates.count(pindex));
+                }
             }
-        } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
+        } else { // If this block sorts worse than the current tip or some ancestor was never processed, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
         }
         // Check whether this block is in mapBlocksUnlinked.
@@ -4182,12 +4995,22 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+        if (pindexFirstMissing == NULL) assert(!foundInUnlinked);          // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+            // We HAVE_DATA for this block and processed all parents at some point, but some parent's data is gone.
+            assert(fHavePruned);
+            // FindMostWorkChain moves such a block to mapBlocksUnlinked when it finds the pruned parent, so a
+            // block that is better than the tip and not a candidate must be there.
+            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+                if (pindexFirstInvalid == NULL) {
+                    assert(foundInUnlinked);
+                }
             }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
@@ -4207,6 +5030,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -4307,14 +5131,15 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
     case MSG_TXLOCK_REQUEST:
-        return mapTxLockReq.count(inv.hash) ||
-               mapTxLockReqRejected.count(inv.hash);
+        return swifttx.HasTxLockRequest(inv.hash);
     case MSG_TXLOCK_VOTE:
-        return mapTxLockVote.count(inv.hash);
-    case MSG_SPORK:
+        return swifttx.HasTxLockVote(inv.hash);
+    case MSG_SPORK: {
+        LOCK(cs_mapSporks);
         return mapSporks.count(inv.hash);
+    }
     case MSG_FRENCHNODE_WINNER:
-        if (masternodePayments.mapFrenchnodePayeeVotes.count(inv.hash)) {
+        if (masternodePayments.HasVote(inv.hash)) {
             masternodeSync.AddedFrenchnodeWinner(inv.hash);
             return true;
         }
@@ -4343,15 +5168,19 @@ bool static AlreadyHave(const CInv& inv)
             return true;
         }
         return false;
-    case MSG_FRENCHNODE_ANNOUNCE:
+    case MSG_FRENCHNODE_ANNOUNCE: {
+        LOCK(mnodeman.cs_mapSeen);
         if (mnodeman.mapSeenFrenchnodeBroadcast.count(inv.hash)) {
             masternodeSync.AddedFrenchnodeList(inv.hash);
             return true;
         }
         return false;
-    case MSG_FRENCHNODE_PING:
+    }
+    case MSG_FRENCHNODE_PING: {
+        LOCK(mnodeman.cs_mapSeen);
         return mnodeman.mapSeenFrenchnodePing.count(inv.hash);
     }
+    }
     // Don't know what it is, just say we already got one
     return true;
 }
@@ -4363,8 +5192,6 @@ void static ProcessGetData(CNode* pfrom)
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -4375,73 +5202,121 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
-                bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end()) {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a max reorg depth than the best header
-                        // chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                               (chainActive.Height() - mi->second->nHeight < Params().MaxReorganizationDepth());
-                        if (!send) {
-                            LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                // Only the index lookup needs cs_main. Plain blocks are sent as the
+                // bytes stored on disk, read and framed after the lock is released.
+                CDiskBlockPos posRaw;
+                uint256 hashContinueTip = 0;
+                {
+                    LOCK(cs_main);
+                    bool send = false;
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end()) {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a max reorg depth than the best header
+                            // chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                                   (chainActive.Height() - mi->second->nHeight < Params().MaxReorganizationDepth());
+                            if (!send) {
+                                LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
+                            }
                         }
-                    }
-                }
-                // Don't send not-validated blocks
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
-                    {
-                        LOCK(pfrom->cs_filter);
-                        if (pfrom->pfilter) {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
-                            pfrom->PushMessage("merkleblock", merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didnt send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                        // Pruned nodes only serve the blocks they promise to keep, whatever
+                        // happens to still be on disk
+                        if (send && fPruneMode && chainActive.Height() - mi->second->nHeight >= (int)GetPruneKeepBlocks()) {
+                            LogPrint("net", "ProcessGetData(): ignoring request from peer=%i for pruned block %s\n", pfrom->GetId(), inv.hash.ToString());
+                            send = false;
+                        }
+                        // Once the upload target is reached, blocks older than a week are only
+                        // served to whitelisted peers. Recent blocks keep relaying.
+                        static const int nOneWeek = 7 * 24 * 60 * 60;
+                        if (send && CNode::OutboundTargetReached() && !pfrom->fWhitelisted &&
+                            (inv.type == MSG_FILTERED_BLOCK || (pindexBestHeader != NULL && pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek))) {
+                            LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                            pfrom->fDisconnect = true;
+                            send = false;
                         }
-                        // else
-                        // no response
                     }
+                    // Don't send not-validated blocks
+                    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                        // Peers are unlikely to have the transactions of deep blocks in
+                        // their mempool, so those are sent whole even when asked as compact
+                        if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && chainActive.Height() - mi->second->nHeight >= MAX_CMPCTBLOCK_DEPTH))
+                            posRaw = mi->second->GetBlockPos();
+                        else if (inv.type == MSG_CMPCT_BLOCK) {
+                            boost::shared_ptr<const CBlock> pblock;
+                            if (!ReadBlockFromDisk(pblock, (*mi).second))
+                                assert(!"cannot load block from disk");
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(*pblock));
+                        } else // MSG_FILTERED_BLOCK)
+                        {
+                            // Send block from disk, or from the cache of recently served blocks
+                            boost::shared_ptr<const CBlock> pblock;
+                            if (!ReadBlockFromDisk(pblock, (*mi).second))
+                                assert(!"cannot load block from disk");
+                            const CBlock& block = *pblock;
+                            LOCK(pfrom->cs_filter);
+                            if (pfrom->pfilter) {
+                                CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                                pfrom->PushMessage("merkleblock", merkleBlock);
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didnt send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
+                                    if (!pfrom->filterInventoryKnown.contains(CInv(MSG_TX, pair.second).GetKey()))
+                                        pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            }
+                            // else
+                            // no response
+                        }
 
-                    // Trigger them to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue) {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue = 0;
+                        if (inv.hash == pfrom->hashContinue) {
+                            hashContinueTip = chainActive.Tip()->GetBlockHash();
+                            pfrom->hashContinue = 0;
+                        }
                     }
                 }
+
+                if (!posRaw.IsNull()) {
+                    // Send block from disk without deserializing it
+                    CSerializeData vMsg;
+                    if (ReadRawBlockFromDisk(vMsg, posRaw, inv.hash, CMessageHeader::HEADER_SIZE))
+                        pfrom->PushFramedMessage("block", vMsg);
+                    else
+                        LogPrintf("ProcessGetData(): cannot load block %s from disk for peer=%i\n", inv.hash.ToString(), pfrom->GetId());
+                }
+
+                // Trigger them to send a getblocks request for the next batch of inventory
+                if (hashContinueTip != 0) {
+                    // Bypass PushInventory, this must send even if redundant,
+                    // and we want it right after the last block so they don't
+                    // wait for other stuff first.
+                    vector<CInv> vInv;
+                    vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
+                    pfrom->PushMessage("inv", vInv);
+                }
             } else if (inv.IsKnownType()) {
+                LOCK(cs_main);
                 // Send stream from relay memory
                 bool pushed = false;
+                CFramedMessageRef msgRelay;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        pushed = true;
-                    }
+                    map<CInv, CFramedMessageRef>::iterator mi = mapRelay.find(inv);
+                    if (mi != mapRelay.end())
+                        msgRelay = mi->second;
+                }
+                if (msgRelay) {
+                    // Already framed, shared with every other peer asking for it
+                    pfrom->PushSharedMessage(msgRelay);
+                    pushed = true;
                 }
 
                 if (!pushed && inv.type == MSG_TX) {
@@ -4455,24 +5330,27 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
-                    if (mapTxLockVote.count(inv.hash)) {
+                    CConsensusVote vote;
+                    if (swifttx.GetTxLockVote(inv.hash, vote)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockVote[inv.hash];
+                        ss << vote;
                         pfrom->PushMessage("txlvote", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
-                    if (mapTxLockReq.count(inv.hash)) {
+                    CTransaction tx;
+                    if (swifttx.GetTxLockRequest(inv.hash, tx)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockReq[inv.hash];
+                        ss << tx;
                         pfrom->PushMessage("ix", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
+                    LOCK(cs_mapSporks);
                     if (mapSporks.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -4482,10 +5360,11 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_FRENCHNODE_WINNER) {
-                    if (masternodePayments.mapFrenchnodePayeeVotes.count(inv.hash)) {
+                    CFrenchnodePaymentWinner winner;
+                    if (masternodePayments.GetVote(inv.hash, winner)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << masternodePayments.mapFrenchnodePayeeVotes[inv.hash];
+                        ss << winner;
                         pfrom->PushMessage("mnw", ss);
                         pushed = true;
                     }
@@ -4531,6 +5410,8 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_FRENCHNODE_ANNOUNCE) {
+                    // dseg answers fill this in without cs_main
+                    LOCK(mnodeman.cs_mapSeen);
                     if (mnodeman.mapSeenFrenchnodeBroadcast.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -4541,6 +5422,7 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_FRENCHNODE_PING) {
+                    LOCK(mnodeman.cs_mapSeen);
                     if (mnodeman.mapSeenFrenchnodePing.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -4558,7 +5440,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             g_signals.Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -4577,6 +5459,69 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Finish a compact block from a peer with the transactions we were missing and
+ * process it, or fall back to asking for the full block. Requires cs_main.
+ */
+void static ProcessCompactBlockTxns(CNode* pfrom, const PartiallyDownloadedBlock& partialBlock, const std::vector<CTransaction>& vtxMissing)
+{
+    uint256 hashBlock = partialBlock.header.GetHash();
+    CBlock block;
+    ReadStatus status = partialBlock.FillBlock(block, vtxMissing);
+    if (status == READ_STATUS_INVALID) {
+        MarkBlockAsReceived(hashBlock);
+        Misbehaving(pfrom->GetId(), 100);
+        LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+        return;
+    } else if (status == READ_STATUS_FAILED) {
+        // Most likely a short ID collision with one of our transactions
+        LogPrint("cmpctblock", "Could not reconstruct block %s from peer=%d, requesting the full block\n", hashBlock.ToString(), pfrom->id);
+        vector<CInv> vGetData(1, CInv(MSG_BLOCK, hashBlock));
+        pfrom->PushMessage("getdata", vGetData);
+        return;
+    }
+
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", string("cmpctblock"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hashBlock);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    } else if (chainActive.Tip()->GetBlockHash() == hashBlock && !IsInitialBlockDownload()) {
+        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+    }
+}
+
+/**
+ * Check what a compact block proves before any of its transactions are fetched: the
+ * header in its context, and the proof of work or stake with the block signature,
+ * which only need the coinbase and coinstake it always carries. Requires cs_main.
+ */
+bool static CheckCompactBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex* const pindexPrev)
+{
+    int nHeight = pindexPrev->nHeight + 1;
+    if (nHeight <= Params().LAST_POW_BLOCK() && block.IsProofOfStake())
+        return state.DoS(100, error("%s : PoS period not active", __func__),
+            REJECT_INVALID, "PoS-early");
+    if (nHeight > Params().LAST_POW_BLOCK() && block.IsProofOfWork())
+        return state.DoS(100, error("%s : PoW period ended", __func__),
+            REJECT_INVALID, "PoW-ended");
+
+    if (!CheckBlockHeader(block, state, block.IsProofOfWork()))
+        return false;
+    if (!block.CheckBlockSignature())
+        return state.DoS(100, error("%s : bad proof-of-stake block signature", __func__),
+            REJECT_INVALID, "bad-blk-sig");
+    if (!ContextualCheckBlockHeader(block, state, pindexPrev))
+        return false;
+    if (!CheckWork(block, pindexPrev))
+        return state.DoS(50, error("%s : incorrect proof of work or stake", __func__),
+            REJECT_INVALID, "bad-diffbits");
+    return true;
+}
+
 bool fRequestedSporksIDB = false;
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
@@ -4719,6 +5664,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // We can send and receive compact blocks, but don't want them announced
+            // to us yet: high-bandwidth mode is enabled per peer once it relays us a new tip
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pfrom->PushMessage("sendcmpct", false, nCMPCTBLOCKVersion);
+        }
+    }
+
+
+    else if (strCommand == "sendcmpct") {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
     }
 
 
@@ -4750,7 +5714,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the addrKnown filters of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt == 0)
                         hashSalt = GetRandHash();
@@ -4812,8 +5776,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
+                    // Add this to the list of blocks to request. Near the tip, peers that
+                    // support it send the block as a compact block, which we can mostly
+                    // rebuild from our mempool.
+                    CInv invFetch(inv);
+                    if (State(pfrom->GetId())->fProvidesHeaderAndIDs && !IsInitialBlockDownload())
+                        invFetch.type = MSG_CMPCT_BLOCK;
+                    vToFetch.push_back(invFetch);
                     LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
                 }
             }
@@ -4836,6 +5805,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vector<CInv> vInv;
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ) {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message getdata size() = %u", vInv.size());
         }
@@ -4866,11 +5836,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             pindex = chainActive.Next(pindex);
         int nLimit = 500;
         LogPrint("net", "getblocks %d to %s limit %d from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop == uint256(0) ? "end" : hashStop.ToString(), nLimit, pfrom->id);
+        // If pruning, don't inv blocks unless we have them on disk and are likely to
+        // still have them by the time the peer asks (an hour of blocks of margin).
+        const int nPrunedBlocksLikelyToHave = GetPruneKeepBlocks() - 3600 / Params().TargetSpacing();
         for (; pindex; pindex = chainActive.Next(pindex)) {
             if (pindex->GetBlockHash() == hashStop) {
                 LogPrint("net", "  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
                 break;
             }
+            if (fPruneMode && (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Height() - nPrunedBlocksLikelyToHave)) {
+                LogPrint("net", "  getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                break;
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0) {
                 // When this block is requested, we'll send an inv that'll make them
@@ -5118,6 +6095,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
                     }
                 }
+                else if (chainActive.Tip()->GetBlockHash() == hashBlock && !IsInitialBlockDownload())
+                    MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
             } else {
@@ -5127,6 +6106,136 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hashBlock);
+        LogPrint("net", "received compact block %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+        pfrom->AddInventoryKnown(inv);
+
+        if (mapBlockIndex.count(hashBlock))
+            return true;
+
+        BlockMap::iterator miPrev = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+        if (miPrev == mapBlockIndex.end()) {
+            // Doesn't connect to our chain; the full block path knows how to catch up
+            vector<CInv> vGetData(1, inv);
+            pfrom->PushMessage("getdata", vGetData);
+            return true;
+        }
+
+        std::vector<CTransaction> vOrphanTxn;
+        vOrphanTxn.reserve(mapOrphanTransactions.size());
+        for (map<uint256, COrphanTx>::const_iterator mi = mapOrphanTransactions.begin(); mi != mapOrphanTransactions.end(); ++mi)
+            vOrphanTxn.push_back(mi->second.tx);
+
+        boost::shared_ptr<PartiallyDownloadedBlock> partialBlock(new PartiallyDownloadedBlock(&mempool));
+        ReadStatus status = partialBlock->InitData(cmpctblock, vOrphanTxn);
+        if (status == READ_STATUS_INVALID) {
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+            return true;
+        } else if (status == READ_STATUS_FAILED) {
+            // Short ID collisions, just request the whole block
+            vector<CInv> vGetData(1, inv);
+            pfrom->PushMessage("getdata", vGetData);
+            return true;
+        }
+
+        // Nothing is put in flight or requested for a block whose header does not check out
+        CValidationState state;
+        if (!CheckCompactBlockHeader(partialBlock->GetHeaderBlock(), state, miPrev->second)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hashBlock);
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+            }
+            LogPrint("cmpctblock", "Peer %d sent us a compact block %s with an invalid header\n", pfrom->id, hashBlock.ToString());
+            return true;
+        }
+
+        BlockTransactionsRequest req;
+        for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+            if (!partialBlock->IsTxAvailable(i))
+                req.indexes.push_back(i);
+        }
+        if (req.indexes.empty()) {
+            ProcessCompactBlockTxns(pfrom, *partialBlock, std::vector<CTransaction>());
+        } else {
+            // Keep the block in flight from this peer until its transactions arrive,
+            // so the stall detection applies and other peers' invs don't fetch it again
+            req.blockhash = hashBlock;
+            CNodeState* nodestate = State(pfrom->GetId());
+            // A newer compact block replaces the one still waiting for its transactions,
+            // which is no longer expected from this peer
+            if (nodestate->partialBlock) {
+                uint256 hashStale = nodestate->partialBlock->header.GetHash();
+                map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itStale = mapBlocksInFlight.find(hashStale);
+                if (itStale != mapBlocksInFlight.end() && itStale->second.first == pfrom->GetId())
+                    MarkBlockAsReceived(hashStale);
+                nodestate->partialBlock.reset();
+            }
+            MarkBlockAsInFlight(pfrom->GetId(), hashBlock);
+            nodestate->partialBlock = partialBlock;
+            pfrom->PushMessage("getblocktxn", req);
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrintf("Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Only recent blocks are served piecewise; queue the full block instead
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            return true;
+        }
+
+        boost::shared_ptr<const CBlock> pblock;
+        if (!ReadBlockFromDisk(pblock, mi->second))
+            return error("%s : cannot load block %s from disk", __func__, req.blockhash.ToString());
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= pblock->vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = pblock->vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CNodeState* nodestate = State(pfrom->GetId());
+        boost::shared_ptr<PartiallyDownloadedBlock> partialBlock = nodestate->partialBlock;
+        if (!partialBlock || partialBlock->header.GetHash() != resp.blockhash) {
+            LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+            return true;
+        }
+        nodestate->partialBlock.reset();
+        ProcessCompactBlockTxns(pfrom, *partialBlock, resp.txn);
+    }
+
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -5344,7 +6453,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
         budget.ProcessMessage(pfrom, strCommand, vRecv);
         masternodePayments.ProcessMessageFrenchnodePayments(pfrom, strCommand, vRecv);
-        ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
+        ProcessMessageSwiftTX(pfrom, strCommand, vRecv, nTimeReceived);
         ProcessSpork(pfrom, strCommand, vRecv);
         masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
     }
@@ -5375,7 +6484,26 @@ int ActiveProtocol()
     return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
 }
 
-// requires LOCK(cs_vRecvMsg)
+/**
+ * Commands the message handler threads may run side by side. ping/pong touch nothing but
+ * the peer itself, and getdata takes cs_main per item so that serving blocks does not hold
+ * up other peers. The sync requests only read their manager's state under its own lock and
+ * try for cs_main. Everything else, including the masternode, budget, payment and spork
+ * messages whose checks read the chain, runs under cs_main.
+ */
+static bool IsConcurrentMessage(const std::string& strCommand)
+{
+    static const char* const concurrentCommands[] = {
+        "ping", "pong", "getdata",
+        "dseg", "mnget", "mnvs", "getsporks"};
+    BOOST_FOREACH (const char* pszCommand, concurrentCommands) {
+        if (strCommand == pszCommand)
+            return true;
+    }
+    return false;
+}
+
+// requires LOCK(cs_msgProcessing) and LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
     //if (fDebug)
@@ -5449,8 +6577,15 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nTimeStart = GetTimeMicros();
         try {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            if (pfrom->nVersion != 0 && IsConcurrentMessage(strCommand)) {
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            } else {
+                // The core handlers were written for a single message thread; run them one at a time
+                LOCK(cs_main);
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            }
             boost::this_thread::interruption_point();
         } catch (std::ios_base::failure& e) {
             pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
@@ -5471,6 +6606,8 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        pfrom->RecordProcessingTime(strCommand, GetTimeMicros() - nTimeStart);
+
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -5530,9 +6667,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
-                // Periodically clear setAddrKnown to allow refresh broadcasts
+                // Periodically clear addrKnown to allow refresh broadcasts
                 if (nLastRebroadcast)
-                    pnode->setAddrKnown.clear();
+                    pnode->addrKnown.reset();
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -5548,8 +6685,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second) {
+                std::vector<unsigned char> vKey = addr.GetKey();
+                if (!pto->addrKnown.contains(vKey)) {
+                    pto->addrKnown.insert(vKey);
                     vAddr.push_back(addr);
                     // receiver rejects addr messages larger than 1000
                     if (vAddr.size() >= 1000) {
@@ -5563,6 +6701,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 pto->PushMessage("addr", vAddr);
         }
 
+        ApplyQueuedMisbehavior(pto->GetId());
         CNodeState& state = *State(pto->GetId());
         if (state.fShouldBan) {
             if (pto->fWhitelisted)
@@ -5615,7 +6754,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vInv.reserve(pto->vInventoryToSend.size());
             vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
-                if (pto->setInventoryKnown.count(inv))
+                std::vector<unsigned char> vKey = inv.GetKey();
+                if (pto->filterInventoryKnown.contains(vKey))
                     continue;
 
                 // trickle out tx inv to protect privacy
@@ -5634,13 +6774,11 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second) {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000) {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                pto->filterInventoryKnown.insert(vKey);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000) {
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
             pto->vInventoryToSend = vInvWait;
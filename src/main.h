@@ -43,14 +43,18 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
+class CBlockCache;
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CTxOutSetSnapshotHeader;
 class CValidationInterface;
 class CValidationState;
 
@@ -100,8 +104,18 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum depth of a block requested as MSG_CMPCT_BLOCK that is answered with a compact block rather than the full block */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of a block whose transactions are served in response to getblocktxn */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Minimum time worth of blocks that must be built on top of a block before its scripts are assumed valid. */
+static const int64_t ASSUMEVALID_MIN_BURIED_TIME = 14 * 24 * 60 * 60;
+/** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Minimum -prune target: the retained block and undo files have to fit, with room for pre-allocated chunks */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -122,9 +136,15 @@ struct BlockHasher {
     size_t operator()(const uint256& hash) const { return hash.GetLow64(); }
 };
 
+struct OutPointHasher {
+    size_t operator()(const COutPoint& out) const { return out.hash.GetLow64() ^ out.n; }
+};
+
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+/** Recently read blocks, shared by everything that reads whole blocks from disk */
+extern CBlockCache blockCache;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
@@ -137,8 +157,22 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** True if the budget collateral of every connected block is recorded in the block tree, as is needed to prune. */
+extern bool fBudgetCollateralsRecorded;
+/** Height of the UTXO set snapshot the chainstate was loaded from, or -1. */
+extern int nTxOutSetSnapshotHeight;
+/** Number of bytes of block and undo files we try to stay below in -prune mode. */
+extern uint64_t nPruneTarget;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+/** Block hash whose ancestors we will assume to have valid scripts without checking them. */
+extern uint256 hashAssumeValid;
+/** Height of hashAssumeValid, so getblocks sync can skip scripts before the block itself is known (0 if unknown). */
+extern int nAssumeValidHeight;
 extern unsigned int nCoinCacheSize;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
@@ -203,6 +237,20 @@ bool InitBlockIndex();
 bool LoadBlockIndex(std::string& strError);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Write the chainstate at the current tip, and the block index leading to it, to a snapshot file */
+bool DumpTxOutSet(const boost::filesystem::path& path, CTxOutSetSnapshotHeader& header, uint64_t& nCoins, uint256& hashSnapshot);
+/** Bulk-load a snapshot written by DumpTxOutSet into an empty chainstate and block index */
+bool LoadTxOutSet(const boost::filesystem::path& path, CCoinsViewDB* coinsview, const uint256& hashExpected, std::string& strError);
+/** Number of blocks below the tip whose block and undo data -prune always keeps */
+unsigned int GetPruneKeepBlocks();
+/** Calculate the amount of disk space the block and undo files currently use */
+uint64_t CalculateCurrentUsage();
+/** Mark one block file as pruned: clear the data flags and file positions of its blocks */
+void PruneOneBlockFile(int nFile);
+/** Actually unlink the specified block and undo files */
+void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
+/** Make sure the running UTXO set statistics match the tip, rebuilding them with a full scan if needed */
+bool InitTxOutSetStats();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
@@ -227,6 +275,8 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, bool fAllowSlow = false);
+/** Look up an unspent output and the block that created it in the UTXO set; works without block data (pruned nodes) */
+bool GetUnspentOutput(const COutPoint& outpoint, CTxOut& txout, uint256& hashBlock);
 /** Find the best known block, and make it the tip of the block chain */
 
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -247,8 +297,14 @@ bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
+/** Increase a node's misbehavior score from a handler running without cs_main; it is added on the node's next SendMessages. */
+void QueueMisbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files and flush state to disk. */
+void PruneAndFlush();
+/** Assert the consistency of the in-memory block index; does nothing unless -checkblockindex */
+void CheckBlockIndex();
 
 
 /** (try to) add transaction to memory pool **/
@@ -336,6 +392,9 @@ unsigned int GetLegacySigOpCount(const CTransaction& tx);
 unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& mapInputs);
 
 
+/** Whether script checks can be skipped when connecting pindex, as an ancestor of the buried assumed-valid block */
+bool AssumeScriptsValid(const CBlockIndex* pindex);
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
@@ -423,6 +482,10 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block through blockCache. The block is shared with other readers and must not be modified. */
+bool ReadBlockFromDisk(boost::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex);
+/** Read the serialized bytes of the block at pos into vchBlock, after nPrefix bytes left free (e.g. for a message header) */
+bool ReadRawBlockFromDisk(CSerializeData& vchBlock, const CDiskBlockPos& pos, const uint256& hash, size_t nPrefix = 0);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -514,6 +577,46 @@ public:
     }
 };
 
+/** Magic bytes and format version of UTXO set snapshot files (dumptxoutset / -loadtxoutset) */
+static const unsigned char TXOUTSET_SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', 0xff};
+static const int TXOUTSET_SNAPSHOT_VERSION = 1;
+
+/**
+ * Header of a UTXO set snapshot file. It is followed by the block index entries
+ * from genesis up to hashBlock, the coins records in database order terminated
+ * by a null txid, the number of coins records and a hash over everything before it.
+ */
+class CTxOutSetSnapshotHeader
+{
+public:
+    unsigned char pchMagic[sizeof(TXOUTSET_SNAPSHOT_MAGIC)];
+    int nVersion;
+    MessageStartChars pchMessageStart;
+    uint256 hashBlock;
+    int nHeight;
+
+    CTxOutSetSnapshotHeader()
+    {
+        memset(pchMagic, 0, sizeof(pchMagic));
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+        nVersion = 0;
+        hashBlock = 0;
+        nHeight = 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(this->nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
 /** Capture information about block/transaction validation */
 class CValidationState
 {
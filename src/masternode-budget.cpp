@@ -14,6 +14,7 @@
 #include "masternodeconfig.h"
 #include "masternode.h"
 #include "masternodeman.h"
+#include "txdb.h"
 #include "util.h"
 #include "wallet.h"
 
@@ -38,11 +39,25 @@ int GetBudgetPaymentCycleBlocks()
     return 144; //ten times per day
 }
 
+bool IsBudgetCollateralCandidate(const CTransaction& tx)
+{
+    if (tx.nLockTime != 0) return false;
+
+    BOOST_FOREACH (const CTxOut& o, tx.vout) {
+        const CScript& script = o.scriptPubKey;
+        if (script.size() == 34 && script[0] == OP_RETURN && script[1] == 32 && o.nValue >= std::min(PROPOSAL_FEE_TX, BUDGET_FEE_TX))
+            return true;
+    }
+    return false;
+}
+
 bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, std::string& strError, int64_t& nTime, int& nConf)
 {
     CTransaction txCollateral;
     uint256 nBlockHash;
-    if (!GetTransaction(nTxCollateralHash, txCollateral, nBlockHash, true)) {
+    // collateral in a connected block is recorded in the block tree, whether or not its block file is still there
+    if (!pblocktree->ReadBudgetCollateral(nTxCollateralHash, txCollateral, nBlockHash) &&
+        !GetTransaction(nTxCollateralHash, txCollateral, nBlockHash, true)) {
         strError = strprintf("Can't find collateral tx %s", txCollateral.ToString());
         LogPrint("masternode","CBudgetProposalBroadcast::IsBudgetCollateralValid - %s\n", strError);
         return false;
@@ -99,31 +114,133 @@ bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, s
     }
 }
 
-void CBudgetManager::CheckOrphanVotes()
+void CBudgetManager::CheckOrphanVotes(const uint256& nHash)
 {
     LOCK(cs);
 
-
     std::string strError = "";
-    std::map<uint256, CBudgetVote>::iterator it1 = mapOrphanFrenchnodeBudgetVotes.begin();
-    while (it1 != mapOrphanFrenchnodeBudgetVotes.end()) {
-        if (budget.UpdateProposal(((*it1).second), NULL, strError)) {
-            LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Proposal/Budget is known, activating and removing orphan vote\n");
-            mapOrphanFrenchnodeBudgetVotes.erase(it1++);
-        } else {
-            ++it1;
+    std::map<uint256, std::map<uint256, CBudgetVote> >::iterator it1 = mapOrphanFrenchnodeBudgetVotes.find(nHash);
+    if (it1 != mapOrphanFrenchnodeBudgetVotes.end()) {
+        std::map<uint256, CBudgetVote>::iterator it = (*it1).second.begin();
+        while (it != (*it1).second.end()) {
+            if (!UpdateProposal((*it).second, NULL, strError))
+                LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Orphan vote rejected - %s\n", strError);
+            EraseOrphanVoteFrom((*it).first);
+            ++it;
         }
+        LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Proposal %s is known, activated %d orphan votes\n", nHash.ToString(), (*it1).second.size());
+        mapOrphanFrenchnodeBudgetVotes.erase(it1);
+        recordChanges.Mark(BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE, nHash);
     }
-    std::map<uint256, CFinalizedBudgetVote>::iterator it2 = mapOrphanFinalizedBudgetVotes.begin();
-    while (it2 != mapOrphanFinalizedBudgetVotes.end()) {
-        if (budget.UpdateFinalizedBudget(((*it2).second), NULL, strError)) {
-            LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Proposal/Budget is known, activating and removing orphan vote\n");
-            mapOrphanFinalizedBudgetVotes.erase(it2++);
-        } else {
-            ++it2;
+
+    std::map<uint256, std::map<uint256, CFinalizedBudgetVote> >::iterator it2 = mapOrphanFinalizedBudgetVotes.find(nHash);
+    if (it2 != mapOrphanFinalizedBudgetVotes.end()) {
+        std::map<uint256, CFinalizedBudgetVote>::iterator it = (*it2).second.begin();
+        while (it != (*it2).second.end()) {
+            if (!UpdateFinalizedBudget((*it).second, NULL, strError))
+                LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Orphan vote rejected - %s\n", strError);
+            EraseOrphanVoteFrom((*it).first);
+            ++it;
         }
+        LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Budget %s is known, activated %d orphan votes\n", nHash.ToString(), (*it2).second.size());
+        mapOrphanFinalizedBudgetVotes.erase(it2);
+        recordChanges.Mark(BUDGET_RECORD_ORPHAN_FINALIZED_VOTE, nHash);
     }
-    LogPrint("masternode","CBudgetManager::CheckOrphanVotes - Done\n");
+}
+
+void CBudgetManager::EraseOrphanVoteFrom(const uint256& nVoteHash)
+{
+    std::map<uint256, NodeId>::iterator it = mapOrphanVoteFrom.find(nVoteHash);
+    if (it == mapOrphanVoteFrom.end()) return;
+
+    std::map<NodeId, int>::iterator itPeer = mapOrphanVotesPerPeer.find((*it).second);
+    if (itPeer != mapOrphanVotesPerPeer.end() && --(*itPeer).second <= 0)
+        mapOrphanVotesPerPeer.erase(itPeer);
+    mapOrphanVoteFrom.erase(it);
+}
+
+template <typename Vote>
+bool CBudgetManager::AddOrphanVote(std::map<uint256, std::map<uint256, Vote> >& mapOrphans, int nTable, const uint256& nHash, Vote& vote, NodeId nodeFrom)
+{
+    if (vote.nTime < GetAdjustedTime() - BUDGET_ORPHAN_VOTE_SECONDS) return false;
+
+    std::map<NodeId, int>::iterator itPeer = mapOrphanVotesPerPeer.find(nodeFrom);
+    if (itPeer != mapOrphanVotesPerPeer.end() && (*itPeer).second >= MAX_ORPHAN_VOTES_PER_PEER) {
+        LogPrint("masternode","CBudgetManager::AddOrphanVote - too many orphan votes from peer=%d\n", nodeFrom);
+        return false;
+    }
+
+    typename std::map<uint256, std::map<uint256, Vote> >::iterator itHash = mapOrphans.find(nHash);
+    if (itHash != mapOrphans.end()) {
+        std::map<uint256, Vote>& mapVotes = (*itHash).second;
+        // a masternode has one vote per item: keep its newest
+        for (typename std::map<uint256, Vote>::iterator it = mapVotes.begin(); it != mapVotes.end(); ++it) {
+            if ((*it).second.vin != vote.vin) continue;
+            if ((*it).second.nTime >= vote.nTime) return false;
+            EraseOrphanVoteFrom((*it).first);
+            mapVotes.erase(it);
+            break;
+        }
+        if (mapVotes.size() >= MAX_ORPHAN_VOTES_PER_HASH) {
+            LogPrint("masternode","CBudgetManager::AddOrphanVote - too many orphan votes for %s\n", nHash.ToString());
+            return false;
+        }
+    }
+
+    uint256 nVoteHash = vote.GetHash();
+    mapOrphans[nHash][nVoteHash] = vote;
+    recordChanges.Mark(nTable, nHash);
+    mapOrphanVoteFrom[nVoteHash] = nodeFrom;
+    mapOrphanVotesPerPeer[nodeFrom]++;
+    return true;
+}
+
+bool CBudgetManager::AddOrphanVote(CBudgetVote& vote, NodeId nodeFrom)
+{
+    LOCK(cs);
+    return AddOrphanVote(mapOrphanFrenchnodeBudgetVotes, BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE, vote.nProposalHash, vote, nodeFrom);
+}
+
+bool CBudgetManager::AddOrphanVote(CFinalizedBudgetVote& vote, NodeId nodeFrom)
+{
+    LOCK(cs);
+    return AddOrphanVote(mapOrphanFinalizedBudgetVotes, BUDGET_RECORD_ORPHAN_FINALIZED_VOTE, vote.nBudgetHash, vote, nodeFrom);
+}
+
+template <typename Vote>
+void CBudgetManager::RemoveExpiredOrphanVotes(std::map<uint256, std::map<uint256, Vote> >& mapOrphans, int nTable, int64_t nExpireTime)
+{
+    typename std::map<uint256, std::map<uint256, Vote> >::iterator itHash = mapOrphans.begin();
+    while (itHash != mapOrphans.end()) {
+        std::map<uint256, Vote>& mapVotes = (*itHash).second;
+        typename std::map<uint256, Vote>::iterator it = mapVotes.begin();
+        bool fChanged = false;
+        while (it != mapVotes.end()) {
+            if ((*it).second.nTime < nExpireTime) {
+                EraseOrphanVoteFrom((*it).first);
+                mapVotes.erase(it++);
+                fChanged = true;
+            } else {
+                ++it;
+            }
+        }
+        if (fChanged)
+            recordChanges.Mark(nTable, (*itHash).first);
+        if (mapVotes.empty())
+            mapOrphans.erase(itHash++);
+        else
+            ++itHash;
+    }
+}
+
+void CBudgetManager::RemoveExpiredOrphanVotes()
+{
+    LOCK(cs);
+    int64_t nExpireTime = GetAdjustedTime() - BUDGET_ORPHAN_VOTE_SECONDS;
+    RemoveExpiredOrphanVotes(mapOrphanFrenchnodeBudgetVotes, BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE, nExpireTime);
+    RemoveExpiredOrphanVotes(mapOrphanFinalizedBudgetVotes, BUDGET_RECORD_ORPHAN_FINALIZED_VOTE, nExpireTime);
+    LogPrint("masternode","CBudgetManager::RemoveExpiredOrphanVotes - %d proposals and %d finalized budgets with orphan votes\n",
+        mapOrphanFrenchnodeBudgetVotes.size(), mapOrphanFinalizedBudgetVotes.size());
 }
 
 void CBudgetManager::SubmitFinalBudget()
@@ -239,8 +356,10 @@ void CBudgetManager::SubmitFinalBudget()
 
     LOCK(cs);
     mapSeenFinalizedBudgets.insert(make_pair(finalizedBudgetBroadcast.GetHash(), finalizedBudgetBroadcast));
+    recordChanges.Mark(BUDGET_RECORD_SEEN_FINALIZED, finalizedBudgetBroadcast.GetHash());
     finalizedBudgetBroadcast.Relay();
-    budget.AddFinalizedBudget(finalizedBudgetBroadcast);
+    if (budget.AddFinalizedBudget(finalizedBudgetBroadcast))
+        budget.CheckOrphanVotes(finalizedBudgetBroadcast.GetHash());
     nSubmittedHeight = nCurrentHeight;
     LogPrint("masternode","CBudgetManager::SubmitFinalBudget - Done! %s\n", finalizedBudgetBroadcast.GetHash().ToString());
 }
@@ -249,126 +368,18 @@ void CBudgetManager::SubmitFinalBudget()
 // CBudgetDB
 //
 
-CBudgetDB::CBudgetDB()
-{
-    pathDB = GetDataDir() / "budget.dat";
-    strMagicMessage = "FrenchnodeBudget";
-}
-
-bool CBudgetDB::Write(const CBudgetManager& objToSave)
-{
-    LOCK(objToSave.cs);
-
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
+CBudgetDB budgetdb;
 
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    fileout.fclose();
-
-    LogPrint("masternode","Written info to budget.dat  %dms\n", GetTimeMillis() - nStart);
-
-    return true;
-}
-
-CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
+CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad)
 {
-    LOCK(objToLoad.cs);
-
-    int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
-        return FileError;
-    }
+    ReadResult result = CRecordLog::Read(objToLoad);
+    if (result != Ok) return result;
 
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-
-        // de-serialize data into CBudgetManager object
-        ssObj >> objToLoad;
-    } catch (std::exception& e) {
-        objToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
-    }
-
-    LogPrint("masternode","Loaded info from budget.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrint("masternode","  %s\n", objToLoad.ToString());
-    if (!fDryRun) {
-        LogPrint("masternode","Budget manager - cleaning....\n");
-        objToLoad.CheckAndRemove();
-        LogPrint("masternode","Budget manager - result:\n");
-        LogPrint("masternode","  %s\n", objToLoad.ToString());
-    }
+    LogPrint("masternode","Budget manager - cleaning....\n");
+    objToLoad.CheckAndRemove();
+    LogPrint("masternode","Budget manager - result:\n");
+    LogPrint("masternode","  %s\n", objToLoad.ToString());
 
     return Ok;
 }
@@ -377,47 +388,30 @@ void DumpBudgets()
 {
     int64_t nStart = GetTimeMillis();
 
-    CBudgetDB budgetdb;
-    CBudgetManager tempBudget;
-
-    LogPrint("masternode","Verifying budget.dat format...\n");
-    CBudgetDB::ReadResult readResult = budgetdb.Read(tempBudget, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CBudgetDB::FileError)
-        LogPrint("masternode","Missing budgets file - budget.dat, will try to recreate\n");
-    else if (readResult != CBudgetDB::Ok) {
-        LogPrint("masternode","Error reading budget.dat: ");
-        if (readResult == CBudgetDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint("masternode","Writting info to budget.dat...\n");
     budgetdb.Write(budget);
 
     LogPrint("masternode","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
-bool CBudgetManager::AddFinalizedBudget(CFinalizedBudget& finalizedBudget)
+bool CBudgetManager::AddFinalizedBudget(CFinalizedBudget& finalizedBudget, bool fCheckCollateral)
 {
     std::string strError = "";
-    if (!finalizedBudget.IsValid(strError)) return false;
+    if (!finalizedBudget.IsValid(strError, fCheckCollateral)) return false;
 
     if (mapFinalizedBudgets.count(finalizedBudget.GetHash())) {
         return false;
     }
 
     mapFinalizedBudgets.insert(make_pair(finalizedBudget.GetHash(), finalizedBudget));
+    recordChanges.Mark(BUDGET_RECORD_FINALIZED, finalizedBudget.GetHash());
     return true;
 }
 
-bool CBudgetManager::AddProposal(CBudgetProposal& budgetProposal)
+bool CBudgetManager::AddProposal(CBudgetProposal& budgetProposal, bool fCheckCollateral)
 {
     LOCK(cs);
     std::string strError = "";
-    if (!budgetProposal.IsValid(strError)) {
+    if (!budgetProposal.IsValid(strError, fCheckCollateral)) {
         LogPrint("masternode","CBudgetManager::AddProposal - invalid budget proposal - %s\n", strError);
         return false;
     }
@@ -427,6 +421,7 @@ bool CBudgetManager::AddProposal(CBudgetProposal& budgetProposal)
     }
 
     mapProposals.insert(make_pair(budgetProposal.GetHash(), budgetProposal));
+    recordChanges.Mark(BUDGET_RECORD_PROPOSAL, budgetProposal.GetHash());
     LogPrint("masternode","CBudgetManager::AddProposal - proposal %s added\n", budgetProposal.GetName ().c_str ());
     return true;
 }
@@ -876,59 +871,122 @@ void CBudgetManager::NewBlock()
 
     if (masternodeSync.RequestedFrenchnodeAssets <= FRENCHNODE_SYNC_BUDGET) return;
 
+    // the work itself is done by MaintenanceStep on the scheduler thread, a bit at a time
     if (strBudgetMode == "suggest") { //suggest the budget we see
-        SubmitFinalBudget();
+        fSubmitPending = true;
     }
 
-    //this function should be called 1/14 blocks, allowing up to 100 votes per day on all proposals
+    //the rest should be done 1/14 blocks, allowing up to 100 votes per day on all proposals
     if (chainActive.Height() % 14 != 0) return;
 
-    // incremental sync with our peers
-    if (masternodeSync.IsSynced()) {
-        LogPrint("masternode","CBudgetManager::NewBlock - incremental sync started\n");
-        if (chainActive.Height() % 1440 == rand() % 1440) {
-            ClearSeen();
-            ResetSync();
-        }
+    if (!StartMaintenance(chainActive.Height()))
+        LogPrint("masternode","CBudgetManager::NewBlock - maintenance still running, not restarted\n");
+}
+
+bool CBudgetManager::StartMaintenance(int nHeight)
+{
+    LOCK(cs);
+    if (nMaintenanceStage != MAINTENANCE_IDLE)
+        return false;
+    nMaintenanceStage = MAINTENANCE_SYNC;
+    nMaintenanceHeight = nHeight;
+    return true;
+}
 
-        LOCK(cs_vNodes);
-        BOOST_FOREACH (CNode* pnode, vNodes)
-            if (pnode->nVersion >= ActiveProtocol())
-                Sync(pnode, 0, true);
+void CBudgetManager::MaintenanceStep()
+{
+    // chain state is read by most steps; never wait for it, the next tick will do
+    TRY_LOCK(cs_main, lockMain);
+    if (!lockMain) return;
+    LOCK(cs);
 
-        MarkSynced();
+    if (fSubmitPending) {
+        fSubmitPending = false;
+        SubmitFinalBudget();
     }
 
+    switch (nMaintenanceStage) {
+    case MAINTENANCE_IDLE:
+        return;
 
-    CheckAndRemove();
+    case MAINTENANCE_SYNC:
+        // incremental sync with our peers
+        if (masternodeSync.IsSynced()) {
+            LogPrint("masternode","CBudgetManager::MaintenanceStep - incremental sync started\n");
+            if (nMaintenanceHeight % 1440 == rand() % 1440) {
+                ClearSeen();
+                ResetSync();
+            }
 
-    //remove invalid votes once in a while (we have to check the signatures and validity of every vote, somewhat CPU intensive)
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodes)
+                if (pnode->nVersion >= ActiveProtocol())
+                    Sync(pnode, 0, true);
 
-    LogPrint("masternode","CBudgetManager::NewBlock - askedForSourceProposalOrBudget cleanup - size: %d\n", askedForSourceProposalOrBudget.size());
-    std::map<uint256, int64_t>::iterator it = askedForSourceProposalOrBudget.begin();
-    while (it != askedForSourceProposalOrBudget.end()) {
-        if ((*it).second > GetTime() - (60 * 60 * 24)) {
-            ++it;
+            MarkSynced();
+        }
+        nMaintenanceStage = MAINTENANCE_CHECK;
+        return;
+
+    case MAINTENANCE_CHECK: {
+        CheckAndRemove();
+
+        LogPrint("masternode","CBudgetManager::MaintenanceStep - askedForSourceProposalOrBudget cleanup - size: %d\n", askedForSourceProposalOrBudget.size());
+        std::map<uint256, int64_t>::iterator it = askedForSourceProposalOrBudget.begin();
+        while (it != askedForSourceProposalOrBudget.end()) {
+            if ((*it).second > GetTime() - (60 * 60 * 24)) {
+                ++it;
+            } else {
+                askedForSourceProposalOrBudget.erase(it++);
+            }
+        }
+        RemoveExpiredOrphanVotes();
+
+        nMaintenanceNext = 0;
+        nMaintenanceStage = MAINTENANCE_CLEAN_PROPOSALS;
+        return;
+    }
+
+    //remove invalid votes once in a while, BUDGET_CLEAN_BATCH_SIZE objects per step
+    case MAINTENANCE_CLEAN_PROPOSALS: {
+        std::map<uint256, CBudgetProposal>::iterator it = mapProposals.lower_bound(nMaintenanceNext);
+        for (int n = 0; it != mapProposals.end() && n < BUDGET_CLEAN_BATCH_SIZE; ++n, ++it)
+            (*it).second.CleanAndRemove(false);
+
+        if (it != mapProposals.end()) {
+            nMaintenanceNext = (*it).first;
         } else {
-            askedForSourceProposalOrBudget.erase(it++);
+            nMaintenanceNext = 0;
+            nMaintenanceStage = MAINTENANCE_CLEAN_BUDGETS;
         }
+        return;
     }
 
-    LogPrint("masternode","CBudgetManager::NewBlock - mapProposals cleanup - size: %d\n", mapProposals.size());
-    std::map<uint256, CBudgetProposal>::iterator it2 = mapProposals.begin();
-    while (it2 != mapProposals.end()) {
-        (*it2).second.CleanAndRemove(false);
-        ++it2;
+    case MAINTENANCE_CLEAN_BUDGETS: {
+        std::map<uint256, CFinalizedBudget>::iterator it = mapFinalizedBudgets.lower_bound(nMaintenanceNext);
+        for (int n = 0; it != mapFinalizedBudgets.end() && n < BUDGET_CLEAN_BATCH_SIZE; ++n, ++it)
+            (*it).second.CleanAndRemove(false);
+
+        if (it != mapFinalizedBudgets.end()) {
+            nMaintenanceNext = (*it).first;
+        } else {
+            nMaintenanceNext = 0;
+            nMaintenanceStage = MAINTENANCE_IMMATURE;
+        }
+        return;
     }
 
-    LogPrint("masternode","CBudgetManager::NewBlock - mapFinalizedBudgets cleanup - size: %d\n", mapFinalizedBudgets.size());
-    std::map<uint256, CFinalizedBudget>::iterator it3 = mapFinalizedBudgets.begin();
-    while (it3 != mapFinalizedBudgets.end()) {
-        (*it3).second.CleanAndRemove(false);
-        ++it3;
+    case MAINTENANCE_IMMATURE:
+        CheckImmatureBudgets();
+        nMaintenanceStage = MAINTENANCE_IDLE;
+        LogPrint("masternode","CBudgetManager::MaintenanceStep - PASSED for block %d\n", nMaintenanceHeight);
+        return;
     }
+}
 
-    LogPrint("masternode","CBudgetManager::NewBlock - vecImmatureBudgetProposals cleanup - size: %d\n", vecImmatureBudgetProposals.size());
+void CBudgetManager::CheckImmatureBudgets()
+{
+    LogPrint("masternode","CBudgetManager::CheckImmatureBudgets - vecImmatureBudgetProposals cleanup - size: %d\n", vecImmatureBudgetProposals.size());
     std::vector<CBudgetProposalBroadcast>::iterator it4 = vecImmatureBudgetProposals.begin();
     while (it4 != vecImmatureBudgetProposals.end()) {
         std::string strError = "";
@@ -938,22 +996,11 @@ void CBudgetManager::NewBlock()
             continue;
         }
 
-        if (!(*it4).IsValid(strError)) {
-            LogPrint("masternode","mprop (immature) - invalid budget proposal - %s\n", strError);
-            it4 = vecImmatureBudgetProposals.erase(it4);
-            continue;
-        }
-
-        CBudgetProposal budgetProposal((*it4));
-        if (AddProposal(budgetProposal)) {
-            (*it4).Relay();
-        }
-
-        LogPrint("masternode","mprop (immature) - new budget - %s\n", (*it4).GetHash().ToString());
+        AddMaturedProposal(*it4);
         it4 = vecImmatureBudgetProposals.erase(it4);
     }
 
-    LogPrint("masternode","CBudgetManager::NewBlock - vecImmatureFinalizedBudgets cleanup - size: %d\n", vecImmatureFinalizedBudgets.size());
+    LogPrint("masternode","CBudgetManager::CheckImmatureBudgets - vecImmatureFinalizedBudgets cleanup - size: %d\n", vecImmatureFinalizedBudgets.size());
     std::vector<CFinalizedBudgetBroadcast>::iterator it5 = vecImmatureFinalizedBudgets.begin();
     while (it5 != vecImmatureFinalizedBudgets.end()) {
         std::string strError = "";
@@ -963,22 +1010,51 @@ void CBudgetManager::NewBlock()
             continue;
         }
 
-        if (!(*it5).IsValid(strError)) {
-            LogPrint("masternode","fbs (immature) - invalid finalized budget - %s\n", strError);
-            it5 = vecImmatureFinalizedBudgets.erase(it5);
-            continue;
-        }
+        AddMaturedFinalizedBudget(*it5);
+        it5 = vecImmatureFinalizedBudgets.erase(it5);
+    }
+}
 
-        LogPrint("masternode","fbs (immature) - new finalized budget - %s\n", (*it5).GetHash().ToString());
+void CBudgetManager::AddMaturedProposal(CBudgetProposalBroadcast& budgetProposalBroadcast)
+{
+    LOCK(cs);
 
-        CFinalizedBudget finalizedBudget((*it5));
-        if (AddFinalizedBudget(finalizedBudget)) {
-            (*it5).Relay();
-        }
+    // the caller has just checked the collateral
+    std::string strError = "";
+    if (!budgetProposalBroadcast.IsValid(strError, false)) {
+        LogPrint("masternode","mprop (immature) - invalid budget proposal - %s\n", strError);
+        return;
+    }
 
-        it5 = vecImmatureFinalizedBudgets.erase(it5);
+    CBudgetProposal budgetProposal(budgetProposalBroadcast);
+    if (AddProposal(budgetProposal, false)) {
+        budgetProposalBroadcast.Relay();
+        //votes for it may have arrived while its collateral was maturing
+        CheckOrphanVotes(budgetProposal.GetHash());
+    }
+
+    LogPrint("masternode","mprop (immature) - new budget - %s\n", budgetProposalBroadcast.GetHash().ToString());
+}
+
+void CBudgetManager::AddMaturedFinalizedBudget(CFinalizedBudgetBroadcast& finalizedBudgetBroadcast)
+{
+    LOCK(cs);
+
+    // the caller has just checked the collateral
+    std::string strError = "";
+    if (!finalizedBudgetBroadcast.IsValid(strError, false)) {
+        LogPrint("masternode","fbs (immature) - invalid finalized budget - %s\n", strError);
+        return;
+    }
+
+    LogPrint("masternode","fbs (immature) - new finalized budget - %s\n", finalizedBudgetBroadcast.GetHash().ToString());
+
+    CFinalizedBudget finalizedBudget(finalizedBudgetBroadcast);
+    if (AddFinalizedBudget(finalizedBudget, false)) {
+        finalizedBudgetBroadcast.Relay();
+        //votes for it may have arrived while its collateral was maturing
+        CheckOrphanVotes(finalizedBudget.GetHash());
     }
-    LogPrint("masternode","CBudgetManager::NewBlock - PASSED\n");
 }
 
 void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
@@ -997,7 +1073,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             if (nProp == 0) {
                 if (pfrom->HasFulfilledRequest("mnvs")) {
                     LogPrint("masternode","mnvs - peer already asked me for the list\n");
-                    Misbehaving(pfrom->GetId(), 20);
+                    QueueMisbehaving(pfrom->GetId(), 20);
                     return;
                 }
                 pfrom->FulfilledRequest("mnvs");
@@ -1026,6 +1102,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         mapSeenFrenchnodeBudgetProposals.insert(make_pair(budgetProposalBroadcast.GetHash(), budgetProposalBroadcast));
+        recordChanges.Mark(BUDGET_RECORD_SEEN_PROPOSAL, budgetProposalBroadcast.GetHash());
 
         if (!budgetProposalBroadcast.IsValid(strError)) {
             LogPrint("masternode","mprop - invalid budget proposal - %s\n", strError);
@@ -1041,7 +1118,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         LogPrint("masternode","mprop - new budget - %s\n", budgetProposalBroadcast.GetHash().ToString());
 
         //We might have active votes for this proposal that are valid now
-        CheckOrphanVotes();
+        CheckOrphanVotes(budgetProposal.GetHash());
     }
 
     if (strCommand == "mvote") { //Frenchnode Vote
@@ -1063,6 +1140,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
 
         mapSeenFrenchnodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+        recordChanges.Mark(BUDGET_RECORD_SEEN_PROPOSAL_VOTE, vote.GetHash());
         if (!vote.SignatureValid(true)) {
             LogPrint("masternode","mvote - signature invalid\n");
             if (masternodeSync.IsSynced()) Misbehaving(pfrom->GetId(), 20);
@@ -1099,6 +1177,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         mapSeenFinalizedBudgets.insert(make_pair(finalizedBudgetBroadcast.GetHash(), finalizedBudgetBroadcast));
+        recordChanges.Mark(BUDGET_RECORD_SEEN_FINALIZED, finalizedBudgetBroadcast.GetHash());
 
         if (!finalizedBudgetBroadcast.IsValid(strError)) {
             LogPrint("masternode","fbs - invalid finalized budget - %s\n", strError);
@@ -1114,7 +1193,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         masternodeSync.AddedBudgetItem(finalizedBudgetBroadcast.GetHash());
 
         //we might have active votes for this budget that are now valid
-        CheckOrphanVotes();
+        CheckOrphanVotes(finalizedBudget.GetHash());
     }
 
     if (strCommand == "fbvote") { //Finalized Budget Vote
@@ -1135,6 +1214,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         mapSeenFinalizedBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+        recordChanges.Mark(BUDGET_RECORD_SEEN_FINALIZED_VOTE, vote.GetHash());
         if (!vote.SignatureValid(true)) {
             LogPrint("masternode","fbvote - signature invalid\n");
             if (masternodeSync.IsSynced()) Misbehaving(pfrom->GetId(), 20);
@@ -1317,9 +1397,7 @@ bool CBudgetManager::UpdateProposal(CBudgetVote& vote, CNode* pfrom, std::string
             if (!masternodeSync.IsSynced()) return false;
 
             LogPrint("masternode","CBudgetManager::UpdateProposal - Unknown proposal %d, asking for source proposal\n", vote.nProposalHash.ToString());
-            mapOrphanFrenchnodeBudgetVotes[vote.nProposalHash] = vote;
-
-            if (!askedForSourceProposalOrBudget.count(vote.nProposalHash)) {
+            if (AddOrphanVote(vote, pfrom->GetId()) && !askedForSourceProposalOrBudget.count(vote.nProposalHash)) {
                 pfrom->PushMessage("mnvs", vote.nProposalHash);
                 askedForSourceProposalOrBudget[vote.nProposalHash] = GetTime();
             }
@@ -1330,7 +1408,10 @@ bool CBudgetManager::UpdateProposal(CBudgetVote& vote, CNode* pfrom, std::string
     }
 
 
-    return mapProposals[vote.nProposalHash].AddOrUpdateVote(vote, strError);
+    if (!mapProposals[vote.nProposalHash].AddOrUpdateVote(vote, strError))
+        return false;
+    recordChanges.Mark(BUDGET_RECORD_PROPOSAL, vote.nProposalHash);
+    return true;
 }
 
 bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pfrom, std::string& strError)
@@ -1344,9 +1425,7 @@ bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pf
             if (!masternodeSync.IsSynced()) return false;
 
             LogPrint("masternode","CBudgetManager::UpdateFinalizedBudget - Unknown Finalized Proposal %s, asking for source budget\n", vote.nBudgetHash.ToString());
-            mapOrphanFinalizedBudgetVotes[vote.nBudgetHash] = vote;
-
-            if (!askedForSourceProposalOrBudget.count(vote.nBudgetHash)) {
+            if (AddOrphanVote(vote, pfrom->GetId()) && !askedForSourceProposalOrBudget.count(vote.nBudgetHash)) {
                 pfrom->PushMessage("mnvs", vote.nBudgetHash);
                 askedForSourceProposalOrBudget[vote.nBudgetHash] = GetTime();
             }
@@ -1356,7 +1435,10 @@ bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pf
         return false;
     }
     LogPrint("masternode","CBudgetManager::UpdateFinalizedBudget - Finalized Proposal %s added\n", vote.nBudgetHash.ToString());
-    return mapFinalizedBudgets[vote.nBudgetHash].AddOrUpdateVote(vote, strError);
+    if (!mapFinalizedBudgets[vote.nBudgetHash].AddOrUpdateVote(vote, strError))
+        return false;
+    recordChanges.Mark(BUDGET_RECORD_FINALIZED, vote.nBudgetHash);
+    return true;
 }
 
 CBudgetProposal::CBudgetProposal()
@@ -1366,6 +1448,9 @@ CBudgetProposal::CBudgetProposal()
     nBlockEnd = 0;
     nAmount = 0;
     nTime = 0;
+    nYeas = 0;
+    nNays = 0;
+    nAbstains = 0;
     fValid = true;
 }
 
@@ -1378,6 +1463,9 @@ CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strU
     address = addressIn;
     nAmount = nAmountIn;
     nFeeTXHash = nFeeTXHashIn;
+    nYeas = 0;
+    nNays = 0;
+    nAbstains = 0;
     fValid = true;
 }
 
@@ -1392,6 +1480,9 @@ CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
     nTime = other.nTime;
     nFeeTXHash = other.nFeeTXHash;
     mapVotes = other.mapVotes;
+    nYeas = other.nYeas;
+    nNays = other.nNays;
+    nAbstains = other.nAbstains;
     fValid = true;
 }
 
@@ -1499,7 +1590,14 @@ bool CBudgetProposal::AddOrUpdateVote(CBudgetVote& vote, std::string& strError)
         return false;
     }
 
-    mapVotes[hash] = vote;
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.find(hash);
+    if (it != mapVotes.end()) {
+        CountVote((*it).second, -1);
+        (*it).second = vote;
+    } else {
+        mapVotes.insert(make_pair(hash, vote));
+    }
+    CountVote(vote, 1);
     LogPrint("mnbudget", "CBudgetProposal::AddOrUpdateVote - %s %s\n", strAction.c_str(), vote.GetHash().ToString().c_str());
 
     return true;
@@ -1511,66 +1609,54 @@ void CBudgetProposal::CleanAndRemove(bool fSignatureCheck)
     std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
 
     while (it != mapVotes.end()) {
-        (*it).second.fValid = (*it).second.SignatureValid(fSignatureCheck);
+        bool fValidNew = (*it).second.SignatureValid(fSignatureCheck);
+        if (fValidNew != (*it).second.fValid) {
+            CountVote((*it).second, -1);
+            (*it).second.fValid = fValidNew;
+            CountVote((*it).second, 1);
+        }
         ++it;
     }
 }
 
-double CBudgetProposal::GetRatio()
+void CBudgetProposal::CountVote(const CBudgetVote& vote, int nDelta)
 {
-    int yeas = 0;
-    int nays = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
+    if (!vote.fValid) return;
 
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES) yeas++;
-        if ((*it).second.nVote == VOTE_NO) nays++;
-        ++it;
-    }
-
-    if (yeas + nays == 0) return 0.0f;
-
-    return ((double)(yeas) / (double)(yeas + nays));
+    if (vote.nVote == VOTE_YES) nYeas += nDelta;
+    if (vote.nVote == VOTE_NO) nNays += nDelta;
+    if (vote.nVote == VOTE_ABSTAIN) nAbstains += nDelta;
 }
 
-int CBudgetProposal::GetYeas()
+void CBudgetProposal::TallyVotes()
 {
-    int ret = 0;
+    nYeas = 0;
+    nNays = 0;
+    nAbstains = 0;
 
     std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
     while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES && (*it).second.fValid) ret++;
+        CountVote((*it).second, 1);
         ++it;
     }
-
-    return ret;
 }
 
-int CBudgetProposal::GetNays()
+double CBudgetProposal::GetRatio()
 {
-    int ret = 0;
+    int yeas = 0;
+    int nays = 0;
 
     std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_NO && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
-}
 
-int CBudgetProposal::GetAbstains()
-{
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
     while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_ABSTAIN && (*it).second.fValid) ret++;
+        if ((*it).second.nVote == VOTE_YES) yeas++;
+        if ((*it).second.nVote == VOTE_NO) nays++;
         ++it;
     }
 
-    return ret;
+    if (yeas + nays == 0) return 0.0f;
+
+    return ((double)(yeas) / (double)(yeas + nays));
 }
 
 int CBudgetProposal::GetBlockStartCycle()
@@ -1641,7 +1727,7 @@ CBudgetProposalBroadcast::CBudgetProposalBroadcast(std::string strProposalNameIn
 void CBudgetProposalBroadcast::Relay()
 {
     CInv inv(MSG_BUDGET_PROPOSAL, GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "mprop", *this);
 }
 
 CBudgetVote::CBudgetVote()
@@ -1667,7 +1753,7 @@ CBudgetVote::CBudgetVote(CTxIn vinIn, uint256 nProposalHashIn, int nVoteIn)
 void CBudgetVote::Relay()
 {
     CInv inv(MSG_BUDGET_VOTE, GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "mvote", *this);
 }
 
 bool CBudgetVote::Sign(CKey& keyFrenchnode, CPubKey& pubKeyFrenchnode)
@@ -1792,6 +1878,7 @@ void CFinalizedBudget::AutoCheck()
     }
 
     fAutoChecked = true; //we only need to check this once
+    budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_FINALIZED, GetHash());
 
 
     if (strBudgetMode == "auto") //only vote for exact matches
@@ -2046,6 +2133,7 @@ void CFinalizedBudget::SubmitVote()
         LogPrint("masternode","CFinalizedBudget::SubmitVote  - new finalized budget vote - %s\n", vote.GetHash().ToString());
 
         budget.mapSeenFinalizedBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+        budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_FINALIZED_VOTE, vote.GetHash());
         vote.Relay();
     } else {
         LogPrint("masternode","CFinalizedBudget::SubmitVote : Error submitting vote - %s\n", strError);
@@ -2085,7 +2173,7 @@ CFinalizedBudgetBroadcast::CFinalizedBudgetBroadcast(std::string strBudgetNameIn
 void CFinalizedBudgetBroadcast::Relay()
 {
     CInv inv(MSG_BUDGET_FINALIZED, GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "fbs", *this);
 }
 
 CFinalizedBudgetVote::CFinalizedBudgetVote()
@@ -2111,7 +2199,7 @@ CFinalizedBudgetVote::CFinalizedBudgetVote(CTxIn vinIn, uint256 nBudgetHashIn)
 void CFinalizedBudgetVote::Relay()
 {
     CInv inv(MSG_BUDGET_FINALIZED_VOTE, GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "fbvote", *this);
 }
 
 bool CFinalizedBudgetVote::Sign(CKey& keyFrenchnode, CPubKey& pubKeyFrenchnode)
@@ -2159,6 +2247,89 @@ bool CFinalizedBudgetVote::SignatureValid(bool fSignatureCheck)
     return true;
 }
 
+void CBudgetManager::GetRecords(CRecordMap& records) const
+{
+    LOCK(cs);
+    AddRecords(records, BUDGET_RECORD_SEEN_PROPOSAL, mapSeenFrenchnodeBudgetProposals);
+    AddRecords(records, BUDGET_RECORD_SEEN_PROPOSAL_VOTE, mapSeenFrenchnodeBudgetVotes);
+    AddRecords(records, BUDGET_RECORD_SEEN_FINALIZED, mapSeenFinalizedBudgets);
+    AddRecords(records, BUDGET_RECORD_SEEN_FINALIZED_VOTE, mapSeenFinalizedBudgetVotes);
+    AddRecords(records, BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE, mapOrphanFrenchnodeBudgetVotes);
+    AddRecords(records, BUDGET_RECORD_ORPHAN_FINALIZED_VOTE, mapOrphanFinalizedBudgetVotes);
+    AddRecords(records, BUDGET_RECORD_PROPOSAL, mapProposals);
+    AddRecords(records, BUDGET_RECORD_FINALIZED, mapFinalizedBudgets);
+}
+
+void CBudgetManager::GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const
+{
+    LOCK(cs);
+    BOOST_FOREACH (const CRecordKey& key, setChanged) {
+        CDataStream ssKey(key, SER_DISK, CLIENT_VERSION);
+        unsigned char nTable;
+        ssKey >> nTable;
+        switch (nTable) {
+        case BUDGET_RECORD_SEEN_PROPOSAL:
+            AddChangedRecord(records, setErased, key, ssKey, mapSeenFrenchnodeBudgetProposals);
+            break;
+        case BUDGET_RECORD_SEEN_PROPOSAL_VOTE:
+            AddChangedRecord(records, setErased, key, ssKey, mapSeenFrenchnodeBudgetVotes);
+            break;
+        case BUDGET_RECORD_SEEN_FINALIZED:
+            AddChangedRecord(records, setErased, key, ssKey, mapSeenFinalizedBudgets);
+            break;
+        case BUDGET_RECORD_SEEN_FINALIZED_VOTE:
+            AddChangedRecord(records, setErased, key, ssKey, mapSeenFinalizedBudgetVotes);
+            break;
+        case BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE:
+            AddChangedRecord(records, setErased, key, ssKey, mapOrphanFrenchnodeBudgetVotes);
+            break;
+        case BUDGET_RECORD_ORPHAN_FINALIZED_VOTE:
+            AddChangedRecord(records, setErased, key, ssKey, mapOrphanFinalizedBudgetVotes);
+            break;
+        case BUDGET_RECORD_PROPOSAL:
+            AddChangedRecord(records, setErased, key, ssKey, mapProposals);
+            break;
+        case BUDGET_RECORD_FINALIZED:
+            AddChangedRecord(records, setErased, key, ssKey, mapFinalizedBudgets);
+            break;
+        }
+    }
+}
+
+bool CBudgetManager::LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue)
+{
+    LOCK(cs);
+    switch (nTable) {
+    case BUDGET_RECORD_SEEN_PROPOSAL:
+        LoadMapRecord(ssKey, ssValue, mapSeenFrenchnodeBudgetProposals);
+        break;
+    case BUDGET_RECORD_SEEN_PROPOSAL_VOTE:
+        LoadMapRecord(ssKey, ssValue, mapSeenFrenchnodeBudgetVotes);
+        break;
+    case BUDGET_RECORD_SEEN_FINALIZED:
+        LoadMapRecord(ssKey, ssValue, mapSeenFinalizedBudgets);
+        break;
+    case BUDGET_RECORD_SEEN_FINALIZED_VOTE:
+        LoadMapRecord(ssKey, ssValue, mapSeenFinalizedBudgetVotes);
+        break;
+    case BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE:
+        LoadMapRecord(ssKey, ssValue, mapOrphanFrenchnodeBudgetVotes);
+        break;
+    case BUDGET_RECORD_ORPHAN_FINALIZED_VOTE:
+        LoadMapRecord(ssKey, ssValue, mapOrphanFinalizedBudgetVotes);
+        break;
+    case BUDGET_RECORD_PROPOSAL:
+        LoadMapRecord(ssKey, ssValue, mapProposals);
+        break;
+    case BUDGET_RECORD_FINALIZED:
+        LoadMapRecord(ssKey, ssValue, mapFinalizedBudgets);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 std::string CBudgetManager::ToString() const
 {
     std::ostringstream info;
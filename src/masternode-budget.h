@@ -12,6 +12,7 @@
 #include "main.h"
 #include "masternode.h"
 #include "net.h"
+#include "recordlog.h"
 #include "sync.h"
 #include "util.h"
 #include <boost/lexical_cast.hpp>
@@ -34,6 +35,16 @@ class CTxBudgetPayment;
 static const CAmount PROPOSAL_FEE_TX = (50 * COIN);
 static const CAmount BUDGET_FEE_TX = (50 * COIN);
 static const int64_t BUDGET_VOTE_UPDATE_MIN = 60 * 60;
+//! How often the scheduler runs the next step of the budget maintenance
+static const int64_t BUDGET_MAINTENANCE_SECONDS = 1;
+//! Proposals or finalized budgets whose votes are re-checked per maintenance step
+static const int BUDGET_CLEAN_BATCH_SIZE = 50;
+//! Orphan votes kept for one unknown proposal or finalized budget (at most one per masternode)
+static const unsigned int MAX_ORPHAN_VOTES_PER_HASH = 1000;
+//! Orphan votes kept from one relaying peer
+static const int MAX_ORPHAN_VOTES_PER_PEER = 5000;
+//! Orphan votes signed longer ago than this are dropped
+static const int64_t BUDGET_ORPHAN_VOTE_SECONDS = 24 * 60 * 60;
 
 extern std::vector<CBudgetProposalBroadcast> vecImmatureBudgetProposals;
 extern std::vector<CFinalizedBudgetBroadcast> vecImmatureFinalizedBudgets;
@@ -44,6 +55,9 @@ void DumpBudgets();
 // Define amount of blocks in budget payment cycle
 int GetBudgetPaymentCycleBlocks();
 
+//Check whether a transaction could be the collateral of a proposal/finalized budget, so it is kept when pruning
+bool IsBudgetCollateralCandidate(const CTransaction& tx);
+
 //Check the collateral transaction for the budget proposal/finalized budget
 bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, std::string& strError, int64_t& nTime, int& nConf);
 
@@ -142,41 +156,57 @@ public:
     }
 };
 
-/** Save Budget Manager (budget.dat)
+/** Save Budget Manager (budget.log)
  */
-class CBudgetDB
+class CBudgetDB : public CRecordLog
 {
-private:
-    boost::filesystem::path pathDB;
-    std::string strMagicMessage;
-
 public:
-    enum ReadResult {
-        Ok,
-        FileError,
-        HashReadError,
-        IncorrectHash,
-        IncorrectMagicMessage,
-        IncorrectMagicNumber,
-        IncorrectFormat
-    };
-
-    CBudgetDB();
-    bool Write(const CBudgetManager& objToSave);
-    ReadResult Read(CBudgetManager& objToLoad, bool fDryRun = false);
+    CBudgetDB() : CRecordLog("budget.log", "FrenchnodeBudget") {}
+    ReadResult Read(CBudgetManager& objToLoad);
 };
 
+extern CBudgetDB budgetdb;
+
 
 //
 // Budget Manager : Contains all proposals for the budget
 //
 class CBudgetManager
 {
+public:
+    // periodic work started by NewBlock, done by MaintenanceStep one stage (or batch) at a time
+    enum MaintenanceStage {
+        MAINTENANCE_IDLE,
+        MAINTENANCE_SYNC,
+        MAINTENANCE_CHECK,
+        MAINTENANCE_CLEAN_PROPOSALS,
+        MAINTENANCE_CLEAN_BUDGETS,
+        MAINTENANCE_IMMATURE
+    };
+
 private:
     //hold txes until they mature enough to use
     // XX42    map<uint256, CTransaction> mapCollateral;
     map<uint256, uint256> mapCollateralTxids;
 
+    MaintenanceStage nMaintenanceStage;
+    int nMaintenanceHeight;
+    // where the current clean-up stage resumes
+    uint256 nMaintenanceNext;
+    bool fSubmitPending;
+
+    // peer that relayed each orphan vote, by vote hash, and how many each peer has pending;
+    // orphan votes loaded from budget.dat have no peer
+    std::map<uint256, NodeId> mapOrphanVoteFrom;
+    std::map<NodeId, int> mapOrphanVotesPerPeer;
+
+    void CheckImmatureBudgets();
+    template <typename Vote>
+    bool AddOrphanVote(std::map<uint256, std::map<uint256, Vote> >& mapOrphans, int nTable, const uint256& nHash, Vote& vote, NodeId nodeFrom);
+    template <typename Vote>
+    void RemoveExpiredOrphanVotes(std::map<uint256, std::map<uint256, Vote> >& mapOrphans, int nTable, int64_t nExpireTime);
+    void EraseOrphanVoteFrom(const uint256& nVoteHash);
+
 public:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -187,15 +217,34 @@ public:
 
     std::map<uint256, CBudgetProposalBroadcast> mapSeenFrenchnodeBudgetProposals;
     std::map<uint256, CBudgetVote> mapSeenFrenchnodeBudgetVotes;
-    std::map<uint256, CBudgetVote> mapOrphanFrenchnodeBudgetVotes;
+    // votes for proposals we don't have yet, by proposal hash and vote hash
+    std::map<uint256, std::map<uint256, CBudgetVote> > mapOrphanFrenchnodeBudgetVotes;
     std::map<uint256, CFinalizedBudgetBroadcast> mapSeenFinalizedBudgets;
     std::map<uint256, CFinalizedBudgetVote> mapSeenFinalizedBudgetVotes;
-    std::map<uint256, CFinalizedBudgetVote> mapOrphanFinalizedBudgetVotes;
+    // votes for finalized budgets we don't have yet, by budget hash and vote hash
+    std::map<uint256, std::map<uint256, CFinalizedBudgetVote> > mapOrphanFinalizedBudgetVotes;
+
+    // tables of the manager in budget.log
+    enum {
+        BUDGET_RECORD_SEEN_PROPOSAL,
+        BUDGET_RECORD_SEEN_PROPOSAL_VOTE,
+        BUDGET_RECORD_SEEN_FINALIZED,
+        BUDGET_RECORD_SEEN_FINALIZED_VOTE,
+        BUDGET_RECORD_ORPHAN_PROPOSAL_VOTE,
+        BUDGET_RECORD_ORPHAN_FINALIZED_VOTE,
+        BUDGET_RECORD_PROPOSAL,
+        BUDGET_RECORD_FINALIZED
+    };
+    // entries changed since the last dump, marked wherever the maps above are changed
+    CRecordChanges recordChanges;
 
     CBudgetManager()
     {
         mapProposals.clear();
         mapFinalizedBudgets.clear();
+        nMaintenanceStage = MAINTENANCE_IDLE;
+        nMaintenanceHeight = 0;
+        fSubmitPending = false;
     }
 
     void ClearSeen()
@@ -204,6 +253,7 @@ public:
         mapSeenFrenchnodeBudgetVotes.clear();
         mapSeenFinalizedBudgets.clear();
         mapSeenFinalizedBudgetVotes.clear();
+        recordChanges.MarkAll();
     }
 
     int sizeFinalized() { return (int)mapFinalizedBudgets.size(); }
@@ -215,7 +265,17 @@ public:
 
     void Calculate();
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Start the work due at a new block; it is carried out by MaintenanceStep
     void NewBlock();
+    /// Queue the maintenance for block nHeight, unless the previous run is still going
+    bool StartMaintenance(int nHeight);
+    MaintenanceStage GetMaintenanceStage() const
+    {
+        LOCK(cs);
+        return nMaintenanceStage;
+    }
+    /// Run the next step of the budget maintenance, every BUDGET_MAINTENANCE_SECONDS on the scheduler
+    void MaintenanceStep();
     CBudgetProposal* FindProposal(const std::string& strProposalName);
     CBudgetProposal* FindProposal(uint256 nHash);
     CFinalizedBudget* FindFinalizedBudget(uint256 nHash);
@@ -226,8 +286,8 @@ public:
     std::vector<CBudgetProposal*> GetAllProposals();
     std::vector<CFinalizedBudget*> GetFinalizedBudgets();
     bool IsBudgetPaymentBlock(int nBlockHeight);
-    bool AddProposal(CBudgetProposal& budgetProposal);
-    bool AddFinalizedBudget(CFinalizedBudget& finalizedBudget);
+    bool AddProposal(CBudgetProposal& budgetProposal, bool fCheckCollateral = true);
+    bool AddFinalizedBudget(CFinalizedBudget& finalizedBudget, bool fCheckCollateral = true);
     void SubmitFinalBudget();
 
     bool UpdateProposal(CBudgetVote& vote, CNode* pfrom, std::string& strError);
@@ -237,7 +297,16 @@ public:
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, CAmount nFees, bool fProofOfStake);
 
-    void CheckOrphanVotes();
+    /// Count the orphan votes waiting for a proposal or finalized budget that just arrived
+    void CheckOrphanVotes(const uint256& nHash);
+    /// Add a proposal or finalized budget whose collateral has matured, with the votes that came in meanwhile
+    void AddMaturedProposal(CBudgetProposalBroadcast& budgetProposalBroadcast);
+    void AddMaturedFinalizedBudget(CFinalizedBudgetBroadcast& finalizedBudgetBroadcast);
+    /// Hold on to a vote for a proposal or finalized budget we don't have yet; false if it is over a limit
+    bool AddOrphanVote(CBudgetVote& vote, NodeId nodeFrom);
+    bool AddOrphanVote(CFinalizedBudgetVote& vote, NodeId nodeFrom);
+    /// Drop orphan votes older than BUDGET_ORPHAN_VOTE_SECONDS
+    void RemoveExpiredOrphanVotes();
     void Clear()
     {
         LOCK(cs);
@@ -251,10 +320,18 @@ public:
         mapSeenFinalizedBudgetVotes.clear();
         mapOrphanFrenchnodeBudgetVotes.clear();
         mapOrphanFinalizedBudgetVotes.clear();
+        mapOrphanVoteFrom.clear();
+        mapOrphanVotesPerPeer.clear();
+        recordChanges.MarkAll();
     }
     void CheckAndRemove();
     std::string ToString() const;
 
+    /// Contents as CRecordLog records, and back
+    void GetRecords(CRecordMap& records) const;
+    void GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const;
+    bool LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue);
+
 
     ADD_SERIALIZE_METHODS;
 
@@ -456,6 +533,14 @@ private:
     mutable CCriticalSection cs;
     CAmount nAlloted;
 
+protected:
+    // valid votes in mapVotes, kept up to date as votes are added or checked
+    int nYeas;
+    int nNays;
+    int nAbstains;
+
+    void CountVote(const CBudgetVote& vote, int nDelta);
+
 public:
     bool fValid;
     std::string strProposalName;
@@ -506,9 +591,11 @@ public:
     int GetBlockCurrentCycle();
     int GetBlockEndCycle();
     double GetRatio();
-    int GetYeas();
-    int GetNays();
-    int GetAbstains();
+    int GetYeas() { return nYeas; }
+    int GetNays() { return nNays; }
+    int GetAbstains() { return nAbstains; }
+    /// Recount the valid votes after mapVotes was replaced
+    void TallyVotes();
     CAmount GetAmount() { return nAmount; }
     void SetAllotted(CAmount nAllotedIn) { nAlloted = nAllotedIn; }
     CAmount GetAllotted() { return nAlloted; }
@@ -547,6 +634,8 @@ public:
 
         //for saving to the serialized db
         READWRITE(mapVotes);
+        if (ser_action.ForRead())
+            TallyVotes();
     }
 };
 
@@ -575,6 +664,9 @@ public:
         swap(first.nTime, second.nTime);
         swap(first.nFeeTXHash, second.nFeeTXHash);
         first.mapVotes.swap(second.mapVotes);
+        swap(first.nYeas, second.nYeas);
+        swap(first.nNays, second.nNays);
+        swap(first.nAbstains, second.nAbstains);
     }
 
     CBudgetProposalBroadcast& operator=(CBudgetProposalBroadcast from)
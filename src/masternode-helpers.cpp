@@ -7,6 +7,7 @@
 #include "masternode-helpers.h"
 #include "init.h"
 #include "main.h"
+#include "masternode-budget.h"
 #include "masternodeman.h"
 #include "activemasternode.h"
 #include "masternode-payments.h"
@@ -43,6 +44,13 @@ void ThreadFrenchnodePool()
                 masternodePayments.CleanPaymentList();
                 CleanTransactionLocksList();
             }
+
+            // only what changed since the last dump is written out
+            if (c % FRENCHNODES_DUMP_SECONDS == 0) {
+                DumpFrenchnodes();
+                DumpBudgets();
+                DumpFrenchnodePayments();
+            }
         }
     }
 }
@@ -60,6 +68,11 @@ bool CFrenchnodeSigner::IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey)
                 if (out.scriptPubKey == payee2) return true;
             }
         }
+    } else {
+        // The collateral's block may have been pruned, but the output itself is unspent
+        CTxOut out;
+        if (GetUnspentOutput(vin.prevout, out, hash))
+            return out.nValue == FRENCHNODE_COLLATERAL * COIN && out.scriptPubKey == payee2;
     }
 
     return false;
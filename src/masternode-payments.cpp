@@ -21,129 +21,22 @@
 /** Object for who's going to get paid on which blocks */
 CFrenchnodePayments masternodePayments;
 
-CCriticalSection cs_vecPayments;
-CCriticalSection cs_mapFrenchnodeBlocks;
-CCriticalSection cs_mapFrenchnodePayeeVotes;
-
 //
 // CFrenchnodePaymentDB
 //
 
-CFrenchnodePaymentDB::CFrenchnodePaymentDB()
-{
-    pathDB = GetDataDir() / "mnpayments.dat";
-    strMagicMessage = "FrenchnodePayments";
-}
-
-bool CFrenchnodePaymentDB::Write(const CFrenchnodePayments& objToSave)
-{
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
+CFrenchnodePaymentDB mnpaymentsdb;
 
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    fileout.fclose();
-
-    LogPrint("masternode","Written info to mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
-
-    return true;
-}
-
-CFrenchnodePaymentDB::ReadResult CFrenchnodePaymentDB::Read(CFrenchnodePayments& objToLoad, bool fDryRun)
+CFrenchnodePaymentDB::ReadResult CFrenchnodePaymentDB::Read(CFrenchnodePayments& objToLoad)
 {
-    int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode payement cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-
-        // de-serialize data into CFrenchnodePayments object
-        ssObj >> objToLoad;
-    } catch (std::exception& e) {
-        objToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
-    }
+    ReadResult result = CRecordLog::Read(objToLoad);
+    if (result != Ok) return result;
 
-    LogPrint("masternode","Loaded info from mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrint("masternode","  %s\n", objToLoad.ToString());
-    if (!fDryRun) {
-        LogPrint("masternode","Frenchnode payments manager - cleaning....\n");
-        objToLoad.CleanPaymentList();
-        LogPrint("masternode","Frenchnode payments manager - result:\n");
-        LogPrint("masternode","  %s\n", objToLoad.ToString());
-    }
+    LogPrint("masternode","Frenchnode payments manager - cleaning....\n");
+    objToLoad.CleanPaymentList();
+    LogPrint("masternode","Frenchnode payments manager - result:\n");
+    LogPrint("masternode","  %s\n", objToLoad.ToString());
 
     return Ok;
 }
@@ -152,27 +45,9 @@ void DumpFrenchnodePayments()
 {
     int64_t nStart = GetTimeMillis();
 
-    CFrenchnodePaymentDB paymentdb;
-    CFrenchnodePayments tempPayments;
-
-    LogPrint("masternode","Verifying mnpayments.dat format...\n");
-    CFrenchnodePaymentDB::ReadResult readResult = paymentdb.Read(tempPayments, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CFrenchnodePaymentDB::FileError)
-        LogPrint("masternode","Missing budgets file - mnpayments.dat, will try to recreate\n");
-    else if (readResult != CFrenchnodePaymentDB::Ok) {
-        LogPrint("masternode","Error reading mnpayments.dat: ");
-        if (readResult == CFrenchnodePaymentDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint("masternode","Writting info to mnpayments.dat...\n");
-    paymentdb.Write(masternodePayments);
+    mnpaymentsdb.Write(masternodePayments);
 
-    LogPrint("masternode","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","Frenchnode payments dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
 bool IsBlockValueValid(const CBlock& block, CAmount nExpectedValue, CAmount nMinted)
@@ -356,7 +231,7 @@ void CFrenchnodePayments::ProcessMessageFrenchnodePayments(CNode* pfrom, std::st
         if (Params().NetworkID() == CBaseChainParams::MAIN) {
             if (pfrom->HasFulfilledRequest("mnget")) {
                 LogPrint("masternode","mnget - peer already asked me for the list\n");
-                Misbehaving(pfrom->GetId(), 20);
+                QueueMisbehaving(pfrom->GetId(), 20);
                 return;
             }
         }
@@ -378,7 +253,7 @@ void CFrenchnodePayments::ProcessMessageFrenchnodePayments(CNode* pfrom, std::st
             nHeight = chainActive.Tip()->nHeight;
         }
 
-        if (masternodePayments.mapFrenchnodePayeeVotes.count(winner.GetHash())) {
+        if (masternodePayments.HasVote(winner.GetHash())) {
             LogPrint("mnpayments", "mnw - Already seen - %s bestHeight %d\n", winner.GetHash().ToString().c_str(), nHeight);
             masternodeSync.AddedFrenchnodeWinner(winner.GetHash());
             return;
@@ -444,21 +319,100 @@ bool CFrenchnodePaymentWinner::Sign(CKey& keyFrenchnode, CPubKey& pubKeyFrenchno
     return true;
 }
 
+CFrenchnodePayments::CFrenchnodePayments() : nSyncedFromPeer(0), nLastBlockHeight(0), nBlocks(0), nOldestHeight(0)
+{
+    vBlocks.resize(MNPAYMENTS_MIN_HISTORY + MNPAYMENTS_FUTURE_BLOCKS + 1);
+}
+
+void CFrenchnodePayments::Clear()
+{
+    LOCK(cs);
+    std::fill(vBlocks.begin(), vBlocks.end(), CFrenchnodeBlockPayees());
+    nBlocks = 0;
+    nOldestHeight = 0;
+    mapVoteHeight.clear();
+    mapFrenchnodesLastVote.clear();
+    recordChanges.MarkAll();
+}
+
+CFrenchnodeBlockPayees* CFrenchnodePayments::GetBlock(int nBlockHeight)
+{
+    AssertLockHeld(cs);
+    if (nBlockHeight <= 0) return NULL;
+    CFrenchnodeBlockPayees& block = vBlocks[nBlockHeight % vBlocks.size()];
+    return block.nBlockHeight == nBlockHeight ? &block : NULL;
+}
+
+const CFrenchnodeBlockPayees* CFrenchnodePayments::GetBlock(int nBlockHeight) const
+{
+    AssertLockHeld(cs);
+    if (nBlockHeight <= 0) return NULL;
+    const CFrenchnodeBlockPayees& block = vBlocks[nBlockHeight % vBlocks.size()];
+    return block.nBlockHeight == nBlockHeight ? &block : NULL;
+}
+
+void CFrenchnodePayments::ClearBlock(CFrenchnodeBlockPayees& block, std::vector<uint256>& vRemoved)
+{
+    AssertLockHeld(cs);
+    if (block.nBlockHeight == 0) return;
+
+    LogPrint("mnpayments", "CFrenchnodePayments::CleanPaymentList - Removing old Frenchnode payment - block %d\n", block.nBlockHeight);
+    BOOST_FOREACH (const CFrenchnodePaymentWinner& winner, block.vecVotes) {
+        uint256 hash = winner.GetHash();
+        vRemoved.push_back(hash);
+        mapVoteHeight.erase(hash);
+        recordChanges.Mark(MNPAYMENTS_RECORD_VOTE, hash);
+        boost::unordered_map<COutPoint, int, OutPointHasher>::iterator it = mapFrenchnodesLastVote.find(winner.vinFrenchnode.prevout);
+        if (it != mapFrenchnodesLastVote.end() && it->second <= block.nBlockHeight)
+            mapFrenchnodesLastVote.erase(it);
+    }
+    block = CFrenchnodeBlockPayees();
+    nBlocks--;
+}
+
+void CFrenchnodePayments::Resize(size_t nSize, std::vector<uint256>& vRemoved)
+{
+    AssertLockHeld(cs);
+
+    std::vector<CFrenchnodeBlockPayees> vOld(nSize);
+    vBlocks.swap(vOld);
+    BOOST_FOREACH (CFrenchnodeBlockPayees& block, vOld) {
+        if (block.nBlockHeight == 0) continue;
+        CFrenchnodeBlockPayees& slot = vBlocks[block.nBlockHeight % vBlocks.size()];
+        // when shrinking, the newer of two heights sharing a slot stays
+        if (slot.nBlockHeight > block.nBlockHeight) {
+            ClearBlock(block, vRemoved);
+            continue;
+        }
+        if (slot.nBlockHeight != 0) ClearBlock(slot, vRemoved);
+        std::swap(slot, block);
+    }
+}
+
 bool CFrenchnodePayments::GetBlockPayee(int nBlockHeight, CScript& payee)
 {
-    if (mapFrenchnodeBlocks.count(nBlockHeight)) {
-        return mapFrenchnodeBlocks[nBlockHeight].GetPayee(payee);
+    LOCK(cs);
+
+    const CFrenchnodeBlockPayees* pblock = GetBlock(nBlockHeight);
+    if (pblock) {
+        return pblock->GetPayee(payee);
     }
 
     return false;
 }
 
+bool CFrenchnodePayments::HasPayeeWithVotes(int nBlockHeight, const CScript& payee, int nVotesReq) const
+{
+    LOCK(cs);
+
+    const CFrenchnodeBlockPayees* pblock = GetBlock(nBlockHeight);
+    return pblock && pblock->HasPayeeWithVotes(payee, nVotesReq);
+}
+
 // Is this masternode scheduled to get paid soon?
 // -- Only look ahead up to 8 blocks to allow for propagation of the latest 2 winners
 bool CFrenchnodePayments::IsScheduled(CFrenchnode& mn, int nNotBlockHeight)
 {
-    LOCK(cs_mapFrenchnodeBlocks);
-
     int nHeight;
     {
         TRY_LOCK(cs_main, locked);
@@ -469,15 +423,19 @@ bool CFrenchnodePayments::IsScheduled(CFrenchnode& mn, int nNotBlockHeight)
     CScript mnpayee;
     mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
 
+    return IsScheduled(mnpayee, nHeight, nNotBlockHeight);
+}
+
+bool CFrenchnodePayments::IsScheduled(const CScript& mnpayee, int nHeight, int nNotBlockHeight) const
+{
+    LOCK(cs);
+
     CScript payee;
-    for (int64_t h = nHeight; h <= nHeight + 8; h++) {
+    for (int h = nHeight; h <= nHeight + 8; h++) {
         if (h == nNotBlockHeight) continue;
-        if (mapFrenchnodeBlocks.count(h)) {
-            if (mapFrenchnodeBlocks[h].GetPayee(payee)) {
-                if (mnpayee == payee) {
-                    return true;
-                }
-            }
+        const CFrenchnodeBlockPayees* pblock = GetBlock(h);
+        if (pblock && pblock->GetPayee(payee) && mnpayee == payee) {
+            return true;
         }
     }
 
@@ -491,30 +449,72 @@ bool CFrenchnodePayments::AddWinningFrenchnode(CFrenchnodePaymentWinner& winnerI
         return false;
     }
 
+    return AddVote(winnerIn);
+}
+
+bool CFrenchnodePayments::AddVote(const CFrenchnodePaymentWinner& winner)
+{
+    std::vector<uint256> vRemoved;
     {
-        LOCK2(cs_mapFrenchnodePayeeVotes, cs_mapFrenchnodeBlocks);
+        LOCK(cs);
 
-        if (mapFrenchnodePayeeVotes.count(winnerIn.GetHash())) {
+        if (winner.nBlockHeight < nOldestHeight || winner.nBlockHeight <= 0) {
             return false;
         }
 
-        mapFrenchnodePayeeVotes[winnerIn.GetHash()] = winnerIn;
+        uint256 hash = winner.GetHash();
+        if (mapVoteHeight.count(hash)) {
+            return false;
+        }
 
-        if (!mapFrenchnodeBlocks.count(winnerIn.nBlockHeight)) {
-            CFrenchnodeBlockPayees blockPayees(winnerIn.nBlockHeight);
-            mapFrenchnodeBlocks[winnerIn.nBlockHeight] = blockPayees;
+        CFrenchnodeBlockPayees& block = vBlocks[winner.nBlockHeight % vBlocks.size()];
+        if (block.nBlockHeight != winner.nBlockHeight) {
+            // the slot belongs to a newer height: this one is out of the window
+            if (block.nBlockHeight > winner.nBlockHeight) return false;
+            ClearBlock(block, vRemoved);
+            block = CFrenchnodeBlockPayees(winner.nBlockHeight);
+            nBlocks++;
         }
+
+        block.vecVotes.push_back(winner);
+        block.AddPayee(winner.payee, 1);
+        mapVoteHeight.insert(std::make_pair(hash, winner.nBlockHeight));
+        recordChanges.Mark(MNPAYMENTS_RECORD_VOTE, hash);
     }
 
-    mapFrenchnodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+    // masternodeSync asks us about votes with its own lock held, so tell it without ours
+    BOOST_FOREACH (const uint256& hash, vRemoved)
+        masternodeSync.RemovedFrenchnodeWinner(hash);
 
     return true;
 }
 
-bool CFrenchnodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
+bool CFrenchnodePayments::HasVote(const uint256& hash) const
 {
-    LOCK(cs_vecPayments);
+    LOCK(cs);
+    return mapVoteHeight.count(hash);
+}
 
+bool CFrenchnodePayments::GetVote(const uint256& hash, CFrenchnodePaymentWinner& winnerRet) const
+{
+    LOCK(cs);
+
+    boost::unordered_map<uint256, int, BlockHasher>::const_iterator it = mapVoteHeight.find(hash);
+    if (it == mapVoteHeight.end()) return false;
+    const CFrenchnodeBlockPayees* pblock = GetBlock(it->second);
+    if (!pblock) return false;
+
+    BOOST_FOREACH (const CFrenchnodePaymentWinner& winner, pblock->vecVotes) {
+        if (winner.GetHash() == hash) {
+            winnerRet = winner;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CFrenchnodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
+{
     int nMaxSignatures = 0;
     int nFrenchnode_Drift_Count = 0;
 
@@ -575,8 +575,6 @@ bool CFrenchnodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 
 std::string CFrenchnodeBlockPayees::GetRequiredPaymentsString()
 {
-    LOCK(cs_vecPayments);
-
     std::string ret = "Unknown";
 
     BOOST_FOREACH (CFrenchnodePayee& payee, vecPayments) {
@@ -596,10 +594,11 @@ std::string CFrenchnodeBlockPayees::GetRequiredPaymentsString()
 
 std::string CFrenchnodePayments::GetRequiredPaymentsString(int nBlockHeight)
 {
-    LOCK(cs_mapFrenchnodeBlocks);
+    LOCK(cs);
 
-    if (mapFrenchnodeBlocks.count(nBlockHeight)) {
-        return mapFrenchnodeBlocks[nBlockHeight].GetRequiredPaymentsString();
+    CFrenchnodeBlockPayees* pblock = GetBlock(nBlockHeight);
+    if (pblock) {
+        return pblock->GetRequiredPaymentsString();
     }
 
     return "Unknown";
@@ -607,10 +606,11 @@ std::string CFrenchnodePayments::GetRequiredPaymentsString(int nBlockHeight)
 
 bool CFrenchnodePayments::IsTransactionValid(const CTransaction& txNew, int nBlockHeight)
 {
-    LOCK(cs_mapFrenchnodeBlocks);
+    LOCK(cs);
 
-    if (mapFrenchnodeBlocks.count(nBlockHeight)) {
-        return mapFrenchnodeBlocks[nBlockHeight].IsTransactionValid(txNew);
+    CFrenchnodeBlockPayees* pblock = GetBlock(nBlockHeight);
+    if (pblock) {
+        return pblock->IsTransactionValid(txNew);
     }
 
     return true;
@@ -618,8 +618,6 @@ bool CFrenchnodePayments::IsTransactionValid(const CTransaction& txNew, int nBlo
 
 void CFrenchnodePayments::CleanPaymentList()
 {
-    LOCK2(cs_mapFrenchnodePayeeVotes, cs_mapFrenchnodeBlocks);
-
     int nHeight;
     {
         TRY_LOCK(cs_main, locked);
@@ -628,21 +626,43 @@ void CFrenchnodePayments::CleanPaymentList()
     }
 
     //keep up to five cycles for historical sake
-    int nLimit = std::max(int(mnodeman.size() * 1.25), 1000);
+    int nLimit = std::max(int(mnodeman.size() * 1.25), MNPAYMENTS_MIN_HISTORY);
 
-    std::map<uint256, CFrenchnodePaymentWinner>::iterator it = mapFrenchnodePayeeVotes.begin();
-    while (it != mapFrenchnodePayeeVotes.end()) {
-        CFrenchnodePaymentWinner winner = (*it).second;
+    CleanPaymentList(nHeight, nLimit);
+}
 
-        if (nHeight - winner.nBlockHeight > nLimit) {
-            LogPrint("mnpayments", "CFrenchnodePayments::CleanPaymentList - Removing old Frenchnode payment - block %d\n", winner.nBlockHeight);
-            masternodeSync.mapSeenSyncMNW.erase((*it).first);
-            mapFrenchnodePayeeVotes.erase(it++);
-            mapFrenchnodeBlocks.erase(winner.nBlockHeight);
-        } else {
-            ++it;
+void CFrenchnodePayments::CleanPaymentList(int nHeight, int nLimit)
+{
+    std::vector<uint256> vRemoved;
+    {
+        LOCK(cs);
+
+        size_t nSize = nLimit + MNPAYMENTS_FUTURE_BLOCKS + 1;
+        if (nSize > vBlocks.size()) {
+            LogPrint("mnpayments", "CFrenchnodePayments::CleanPaymentList - Keeping %d blocks\n", nSize);
+            Resize(nSize, vRemoved);
+        }
+
+        // each height is cleared once as it leaves the window, or the whole ring is checked if
+        // more than its size left at once
+        int nOldest = nHeight - nLimit;
+        if (nOldest > nOldestHeight) {
+            if (nOldest - nOldestHeight >= (int)vBlocks.size()) {
+                BOOST_FOREACH (CFrenchnodeBlockPayees& block, vBlocks) {
+                    if (block.nBlockHeight < nOldest) ClearBlock(block, vRemoved);
+                }
+            } else {
+                for (int h = nOldestHeight; h < nOldest; h++) {
+                    CFrenchnodeBlockPayees* pblock = GetBlock(h);
+                    if (pblock) ClearBlock(*pblock, vRemoved);
+                }
+            }
+            nOldestHeight = nOldest;
         }
     }
+
+    BOOST_FOREACH (const uint256& hash, vRemoved)
+        masternodeSync.RemovedFrenchnodeWinner(hash);
 }
 
 bool CFrenchnodePaymentWinner::IsValid(CNode* pnode, std::string& strError)
@@ -753,7 +773,7 @@ bool CFrenchnodePayments::ProcessBlock(int nBlockHeight)
 void CFrenchnodePaymentWinner::Relay()
 {
     CInv inv(MSG_FRENCHNODE_WINNER, GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "mnw", *this);
 }
 
 bool CFrenchnodePaymentWinner::SignatureValid()
@@ -778,53 +798,99 @@ bool CFrenchnodePaymentWinner::SignatureValid()
 
 void CFrenchnodePayments::Sync(CNode* node, int nCountNeeded)
 {
-    LOCK(cs_mapFrenchnodePayeeVotes);
-
+    // the request is already marked fulfilled, so wait for cs_main rather than drop it; only the
+    // tip is read under it
     int nHeight;
     {
-        TRY_LOCK(cs_main, locked);
-        if (!locked || chainActive.Tip() == NULL) return;
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL) return;
         nHeight = chainActive.Tip()->nHeight;
     }
 
     int nCount = (mnodeman.CountEnabled() * 1.25);
     if (nCountNeeded > nCount) nCountNeeded = nCount;
 
-    int nInvCount = 0;
-    std::map<uint256, CFrenchnodePaymentWinner>::iterator it = mapFrenchnodePayeeVotes.begin();
-    while (it != mapFrenchnodePayeeVotes.end()) {
-        CFrenchnodePaymentWinner winner = (*it).second;
-        if (winner.nBlockHeight >= nHeight - nCountNeeded && winner.nBlockHeight <= nHeight + 20) {
-            node->PushInventory(CInv(MSG_FRENCHNODE_WINNER, winner.GetHash()));
-            nInvCount++;
+    std::vector<CInv> vInv;
+    {
+        LOCK(cs);
+        for (int h = nHeight - nCountNeeded; h <= nHeight + MNPAYMENTS_FUTURE_BLOCKS; h++) {
+            const CFrenchnodeBlockPayees* pblock = GetBlock(h);
+            if (!pblock) continue;
+            BOOST_FOREACH (const CFrenchnodePaymentWinner& winner, pblock->vecVotes)
+                vInv.push_back(CInv(MSG_FRENCHNODE_WINNER, winner.GetHash()));
         }
-        ++it;
     }
-    node->PushMessage("ssc", FRENCHNODE_SYNC_MNW, nInvCount);
+
+    BOOST_FOREACH (const CInv& inv, vInv)
+        node->PushInventory(inv);
+    node->PushMessage("ssc", FRENCHNODE_SYNC_MNW, (int)vInv.size());
 }
 
 std::string CFrenchnodePayments::ToString() const
 {
+    LOCK(cs);
+
     std::ostringstream info;
 
-    info << "Votes: " << (int)mapFrenchnodePayeeVotes.size() << ", Blocks: " << (int)mapFrenchnodeBlocks.size();
+    info << "Votes: " << (int)mapVoteHeight.size() << ", Blocks: " << nBlocks;
 
     return info.str();
 }
 
 
+void CFrenchnodePayments::GetRecords(CRecordMap& records) const
+{
+    LOCK(cs);
+    BOOST_FOREACH (const CFrenchnodeBlockPayees& block, vBlocks) {
+        BOOST_FOREACH (const CFrenchnodePaymentWinner& winner, block.vecVotes)
+            AddRecord(records, MNPAYMENTS_RECORD_VOTE, winner.GetHash(), winner);
+    }
+}
+
+void CFrenchnodePayments::GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const
+{
+    LOCK(cs);
+    BOOST_FOREACH (const CRecordKey& key, setChanged) {
+        CDataStream ssKey(key, SER_DISK, CLIENT_VERSION);
+        unsigned char nTable;
+        uint256 hash;
+        ssKey >> nTable >> hash;
+        CFrenchnodePaymentWinner winner;
+        if (nTable == MNPAYMENTS_RECORD_VOTE && GetVote(hash, winner))
+            records[key] = MakeRecordValue(winner);
+        else
+            setErased.insert(key);
+    }
+}
+
+bool CFrenchnodePayments::LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue)
+{
+    switch (nTable) {
+    case MNPAYMENTS_RECORD_VOTE: {
+        CFrenchnodePaymentWinner winner;
+        ssValue >> winner;
+        AddVote(winner);
+        break;
+    }
+    case MNPAYMENTS_RECORD_BLOCK:
+        // tallies written by older versions; they are counted again from the votes
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 int CFrenchnodePayments::GetOldestBlock()
 {
-    LOCK(cs_mapFrenchnodeBlocks);
+    LOCK(cs);
 
     int nOldestBlock = std::numeric_limits<int>::max();
 
-    std::map<int, CFrenchnodeBlockPayees>::iterator it = mapFrenchnodeBlocks.begin();
-    while (it != mapFrenchnodeBlocks.end()) {
-        if ((*it).first < nOldestBlock) {
-            nOldestBlock = (*it).first;
+    BOOST_FOREACH (const CFrenchnodeBlockPayees& block, vBlocks) {
+        if (block.nBlockHeight != 0 && block.nBlockHeight < nOldestBlock) {
+            nOldestBlock = block.nBlockHeight;
         }
-        it++;
     }
 
     return nOldestBlock;
@@ -833,16 +899,14 @@ int CFrenchnodePayments::GetOldestBlock()
 
 int CFrenchnodePayments::GetNewestBlock()
 {
-    LOCK(cs_mapFrenchnodeBlocks);
+    LOCK(cs);
 
     int nNewestBlock = 0;
 
-    std::map<int, CFrenchnodeBlockPayees>::iterator it = mapFrenchnodeBlocks.begin();
-    while (it != mapFrenchnodeBlocks.end()) {
-        if ((*it).first > nNewestBlock) {
-            nNewestBlock = (*it).first;
+    BOOST_FOREACH (const CFrenchnodeBlockPayees& block, vBlocks) {
+        if (block.nBlockHeight > nNewestBlock) {
+            nNewestBlock = block.nBlockHeight;
         }
-        it++;
     }
 
     return nNewestBlock;
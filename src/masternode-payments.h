@@ -10,15 +10,13 @@
 #include "main.h"
 #include "masternode.h"
 #include "clientversion.h"
+#include "recordlog.h"
 
 #include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
 
 using namespace std;
 
-extern CCriticalSection cs_vecPayments;
-extern CCriticalSection cs_mapFrenchnodeBlocks;
-extern CCriticalSection cs_mapFrenchnodePayeeVotes;
-
 class CFrenchnodePayments;
 class CFrenchnodePaymentWinner;
 class CFrenchnodeBlockPayees;
@@ -27,6 +25,10 @@ extern CFrenchnodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 7
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+//! Winners are accepted up to this many blocks ahead of the tip
+#define MNPAYMENTS_FUTURE_BLOCKS 20
+//! Winners are kept for at least this many blocks
+#define MNPAYMENTS_MIN_HISTORY 1000
 
 void ProcessMessageFrenchnodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -36,30 +38,17 @@ void FillBlockPayee(CMutableTransaction& txNew, CAmount nFees, bool fProofOfStak
 
 void DumpFrenchnodePayments();
 
-/** Save Frenchnode Payment Data (mnpayments.dat)
+/** Save Frenchnode Payment Data (mnpayments.log)
  */
-class CFrenchnodePaymentDB
+class CFrenchnodePaymentDB : public CRecordLog
 {
-private:
-    boost::filesystem::path pathDB;
-    std::string strMagicMessage;
-
 public:
-    enum ReadResult {
-        Ok,
-        FileError,
-        HashReadError,
-        IncorrectHash,
-        IncorrectMagicMessage,
-        IncorrectMagicNumber,
-        IncorrectFormat
-    };
-
-    CFrenchnodePaymentDB();
-    bool Write(const CFrenchnodePayments& objToSave);
-    ReadResult Read(CFrenchnodePayments& objToLoad, bool fDryRun = false);
+    CFrenchnodePaymentDB() : CRecordLog("mnpayments.log", "FrenchnodePayments") {}
+    ReadResult Read(CFrenchnodePayments& objToLoad);
 };
 
+extern CFrenchnodePaymentDB mnpaymentsdb;
+
 class CFrenchnodePayee
 {
 public:
@@ -88,78 +77,6 @@ public:
     }
 };
 
-// Keep track of votes for payees from masternodes
-class CFrenchnodeBlockPayees
-{
-public:
-    int nBlockHeight;
-    std::vector<CFrenchnodePayee> vecPayments;
-
-    CFrenchnodeBlockPayees()
-    {
-        nBlockHeight = 0;
-        vecPayments.clear();
-    }
-    CFrenchnodeBlockPayees(int nBlockHeightIn)
-    {
-        nBlockHeight = nBlockHeightIn;
-        vecPayments.clear();
-    }
-
-    void AddPayee(CScript payeeIn, int nIncrement)
-    {
-        LOCK(cs_vecPayments);
-
-        BOOST_FOREACH (CFrenchnodePayee& payee, vecPayments) {
-            if (payee.scriptPubKey == payeeIn) {
-                payee.nVotes += nIncrement;
-                return;
-            }
-        }
-
-        CFrenchnodePayee c(payeeIn, nIncrement);
-        vecPayments.push_back(c);
-    }
-
-    bool GetPayee(CScript& payee)
-    {
-        LOCK(cs_vecPayments);
-
-        int nVotes = -1;
-        BOOST_FOREACH (CFrenchnodePayee& p, vecPayments) {
-            if (p.nVotes > nVotes) {
-                payee = p.scriptPubKey;
-                nVotes = p.nVotes;
-            }
-        }
-
-        return (nVotes > -1);
-    }
-
-    bool HasPayeeWithVotes(CScript payee, int nVotesReq)
-    {
-        LOCK(cs_vecPayments);
-
-        BOOST_FOREACH (CFrenchnodePayee& p, vecPayments) {
-            if (p.nVotes >= nVotesReq && p.scriptPubKey == payee) return true;
-        }
-
-        return false;
-    }
-
-    bool IsTransactionValid(const CTransaction& txNew);
-    std::string GetRequiredPaymentsString();
-
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
-    {
-        READWRITE(nBlockHeight);
-        READWRITE(vecPayments);
-    }
-};
-
 // for storing the winning payments
 class CFrenchnodePaymentWinner
 {
@@ -184,7 +101,7 @@ public:
         payee = CScript();
     }
 
-    uint256 GetHash()
+    uint256 GetHash() const
     {
         CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
         ss << payee;
@@ -227,58 +144,149 @@ public:
     }
 };
 
+// Keep track of votes for payees from masternodes; guarded by the CFrenchnodePayments holding it
+class CFrenchnodeBlockPayees
+{
+public:
+    int nBlockHeight;
+    std::vector<CFrenchnodePayee> vecPayments;
+    // the votes counted in vecPayments
+    std::vector<CFrenchnodePaymentWinner> vecVotes;
+
+    CFrenchnodeBlockPayees()
+    {
+        nBlockHeight = 0;
+        vecPayments.clear();
+    }
+    CFrenchnodeBlockPayees(int nBlockHeightIn)
+    {
+        nBlockHeight = nBlockHeightIn;
+        vecPayments.clear();
+    }
+
+    void AddPayee(CScript payeeIn, int nIncrement)
+    {
+        BOOST_FOREACH (CFrenchnodePayee& payee, vecPayments) {
+            if (payee.scriptPubKey == payeeIn) {
+                payee.nVotes += nIncrement;
+                return;
+            }
+        }
+
+        CFrenchnodePayee c(payeeIn, nIncrement);
+        vecPayments.push_back(c);
+    }
+
+    bool GetPayee(CScript& payee) const
+    {
+        int nVotes = -1;
+        BOOST_FOREACH (const CFrenchnodePayee& p, vecPayments) {
+            if (p.nVotes > nVotes) {
+                payee = p.scriptPubKey;
+                nVotes = p.nVotes;
+            }
+        }
+
+        return (nVotes > -1);
+    }
+
+    bool HasPayeeWithVotes(const CScript& payee, int nVotesReq) const
+    {
+        BOOST_FOREACH (const CFrenchnodePayee& p, vecPayments) {
+            if (p.nVotes >= nVotesReq && p.scriptPubKey == payee) return true;
+        }
+
+        return false;
+    }
+
+    bool IsTransactionValid(const CTransaction& txNew);
+    std::string GetRequiredPaymentsString();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nBlockHeight);
+        READWRITE(vecPayments);
+    }
+};
+
 //
 // Frenchnode Payments Class
 // Keeps track of who should get paid for which blocks
 //
+// The payees and votes of the heights in the window kept are in a ring of
+// CFrenchnodeBlockPayees, height h in slot h % size, so finding a height is one lookup and
+// pruning a height clears its slot. A slot holding another height holds nothing for h.
+// The ring grows with the window, which follows the size of the Frenchnode list.
+//
 
 class CFrenchnodePayments
 {
 private:
+    mutable CCriticalSection cs;
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    std::vector<CFrenchnodeBlockPayees> vBlocks;
+    int nBlocks;
+    // heights below this have been pruned
+    int nOldestHeight;
+    // height of every vote in the ring, by vote hash
+    boost::unordered_map<uint256, int, BlockHasher> mapVoteHeight;
+    // height each Frenchnode last voted for
+    boost::unordered_map<COutPoint, int, OutPointHasher> mapFrenchnodesLastVote;
+
+    CFrenchnodeBlockPayees* GetBlock(int nBlockHeight);
+    const CFrenchnodeBlockPayees* GetBlock(int nBlockHeight) const;
+    /// Empty a slot; the hashes of its votes are added to vRemoved, for masternodeSync once cs is released
+    void ClearBlock(CFrenchnodeBlockPayees& block, std::vector<uint256>& vRemoved);
+    void Resize(size_t nSize, std::vector<uint256>& vRemoved);
+
 public:
-    std::map<uint256, CFrenchnodePaymentWinner> mapFrenchnodePayeeVotes;
-    std::map<int, CFrenchnodeBlockPayees> mapFrenchnodeBlocks;
-    std::map<uint256, int> mapFrenchnodesLastVote; //prevout.hash + prevout.n, nBlockHeight
+    // tables of the payments in mnpayments.log
+    enum {
+        MNPAYMENTS_RECORD_VOTE,
+        MNPAYMENTS_RECORD_BLOCK
+    };
+    // votes added or dropped since the last dump
+    CRecordChanges recordChanges;
 
-    CFrenchnodePayments()
-    {
-        nSyncedFromPeer = 0;
-        nLastBlockHeight = 0;
-    }
+    CFrenchnodePayments();
 
-    void Clear()
-    {
-        LOCK2(cs_mapFrenchnodeBlocks, cs_mapFrenchnodePayeeVotes);
-        mapFrenchnodeBlocks.clear();
-        mapFrenchnodePayeeVotes.clear();
-    }
+    void Clear();
 
     bool AddWinningFrenchnode(CFrenchnodePaymentWinner& winner);
+    /// Add a vote to the tally of its height, without checking it; false if it is known or out of the window
+    bool AddVote(const CFrenchnodePaymentWinner& winner);
+    bool HasVote(const uint256& hash) const;
+    bool GetVote(const uint256& hash, CFrenchnodePaymentWinner& winnerRet) const;
     bool ProcessBlock(int nBlockHeight);
 
     void Sync(CNode* node, int nCountNeeded);
     void CleanPaymentList();
+    /// Drop the heights more than nLimit blocks below nHeight, growing the ring to hold the window
+    void CleanPaymentList(int nHeight, int nLimit);
     int LastPayment(CFrenchnode& mn);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
+    bool HasPayeeWithVotes(int nBlockHeight, const CScript& payee, int nVotesReq) const;
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CFrenchnode& mn, int nNotBlockHeight);
+    bool IsScheduled(const CScript& mnpayee, int nHeight, int nNotBlockHeight) const;
 
     bool CanVote(COutPoint outFrenchnode, int nBlockHeight)
     {
-        LOCK(cs_mapFrenchnodePayeeVotes);
+        LOCK(cs);
 
-        if (mapFrenchnodesLastVote.count(outFrenchnode.hash + outFrenchnode.n)) {
-            if (mapFrenchnodesLastVote[outFrenchnode.hash + outFrenchnode.n] == nBlockHeight) {
-                return false;
-            }
+        int& nLastVote = mapFrenchnodesLastVote[outFrenchnode];
+        if (nLastVote == nBlockHeight) {
+            return false;
         }
 
         //record this masternode voted
-        mapFrenchnodesLastVote[outFrenchnode.hash + outFrenchnode.n] = nBlockHeight;
+        nLastVote = nBlockHeight;
         return true;
     }
 
@@ -290,14 +298,10 @@ public:
     int GetOldestBlock();
     int GetNewestBlock();
 
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
-    {
-        READWRITE(mapFrenchnodePayeeVotes);
-        READWRITE(mapFrenchnodeBlocks);
-    }
+    /// Contents as CRecordLog records, and back
+    void GetRecords(CRecordMap& records) const;
+    void GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const;
+    bool LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue);
 };
 
 
@@ -21,7 +21,8 @@ CFrenchnodeSync masternodeSync;
 
 CFrenchnodeSync::CFrenchnodeSync()
 {
-    Reset();
+    // there are no peers yet, and cs_vNodes may not even be constructed
+    ResetState();
 }
 
 bool CFrenchnodeSync::IsSynced()
@@ -61,13 +62,23 @@ bool CFrenchnodeSync::IsBlockchainSynced()
 }
 
 void CFrenchnodeSync::Reset()
+{
+    ResetState();
+    // requests peers fulfilled for the previous attempt would keep them from being asked again
+    ClearFulfilledRequest();
+}
+
+void CFrenchnodeSync::ResetState()
 {
     lastFrenchnodeList = 0;
     lastFrenchnodeWinner = 0;
     lastBudgetItem = 0;
-    mapSeenSyncMNB.clear();
-    mapSeenSyncMNW.clear();
-    mapSeenSyncBudget.clear();
+    {
+        LOCK(cs);
+        mapSeenSyncMNB.clear();
+        mapSeenSyncMNW.clear();
+        mapSeenSyncBudget.clear();
+    }
     lastFailure = 0;
     nCountFailures = 0;
     sumFrenchnodeList = 0;
@@ -81,11 +92,26 @@ void CFrenchnodeSync::Reset()
     RequestedFrenchnodeAssets = FRENCHNODE_SYNC_INITIAL;
     RequestedFrenchnodeAttempt = 0;
     nAssetSyncStarted = GetTime();
+    nAssetSyncStartedMillis = GetTimeMillis();
+    {
+        LOCK(cs);
+        mapSyncRequests.clear();
+        mapSyncReported.clear();
+        setSyncReplied.clear();
+        lastSyncReply = 0;
+        mapAssetSyncMillis.clear();
+    }
 }
 
 void CFrenchnodeSync::AddedFrenchnodeList(uint256 hash)
 {
-    if (mnodeman.mapSeenFrenchnodeBroadcast.count(hash)) {
+    bool fKnown;
+    {
+        LOCK(mnodeman.cs_mapSeen);
+        fKnown = mnodeman.mapSeenFrenchnodeBroadcast.count(hash);
+    }
+    LOCK(cs);
+    if (fKnown) {
         if (mapSeenSyncMNB[hash] < FRENCHNODE_SYNC_THRESHOLD) {
             lastFrenchnodeList = GetTime();
             mapSeenSyncMNB[hash]++;
@@ -98,7 +124,10 @@ void CFrenchnodeSync::AddedFrenchnodeList(uint256 hash)
 
 void CFrenchnodeSync::AddedFrenchnodeWinner(uint256 hash)
 {
-    if (masternodePayments.mapFrenchnodePayeeVotes.count(hash)) {
+    // masternodePayments removes winners with its lock held, so ask it before taking ours
+    bool fKnown = masternodePayments.HasVote(hash);
+    LOCK(cs);
+    if (fKnown) {
         if (mapSeenSyncMNW[hash] < FRENCHNODE_SYNC_THRESHOLD) {
             lastFrenchnodeWinner = GetTime();
             mapSeenSyncMNW[hash]++;
@@ -111,8 +140,10 @@ void CFrenchnodeSync::AddedFrenchnodeWinner(uint256 hash)
 
 void CFrenchnodeSync::AddedBudgetItem(uint256 hash)
 {
-    if (budget.mapSeenFrenchnodeBudgetProposals.count(hash) || budget.mapSeenFrenchnodeBudgetVotes.count(hash) ||
-        budget.mapSeenFinalizedBudgets.count(hash) || budget.mapSeenFinalizedBudgetVotes.count(hash)) {
+    bool fKnown = budget.mapSeenFrenchnodeBudgetProposals.count(hash) || budget.mapSeenFrenchnodeBudgetVotes.count(hash) ||
+                  budget.mapSeenFinalizedBudgets.count(hash) || budget.mapSeenFinalizedBudgetVotes.count(hash);
+    LOCK(cs);
+    if (fKnown) {
         if (mapSeenSyncBudget[hash] < FRENCHNODE_SYNC_THRESHOLD) {
             lastBudgetItem = GetTime();
             mapSeenSyncBudget[hash]++;
@@ -123,6 +154,18 @@ void CFrenchnodeSync::AddedBudgetItem(uint256 hash)
     }
 }
 
+void CFrenchnodeSync::RemovedFrenchnodeList(uint256 hash)
+{
+    LOCK(cs);
+    mapSeenSyncMNB.erase(hash);
+}
+
+void CFrenchnodeSync::RemovedFrenchnodeWinner(uint256 hash)
+{
+    LOCK(cs);
+    mapSeenSyncMNW.erase(hash);
+}
+
 bool CFrenchnodeSync::IsBudgetPropEmpty()
 {
     return sumBudgetItemProp == 0 && countBudgetItemProp > 0;
@@ -135,6 +178,21 @@ bool CFrenchnodeSync::IsBudgetFinEmpty()
 
 void CFrenchnodeSync::GetNextAsset()
 {
+    int64_t nNowMillis = GetTimeMillis();
+    {
+        LOCK(cs);
+        if (RequestedFrenchnodeAssets >= FRENCHNODE_SYNC_SPORKS && RequestedFrenchnodeAssets <= FRENCHNODE_SYNC_BUDGET) {
+            mapAssetSyncMillis[RequestedFrenchnodeAssets] = nNowMillis - nAssetSyncStartedMillis;
+            LogPrint("masternode", "CFrenchnodeSync::GetNextAsset - %s took %dms, %d peers asked, %d replied, %d items\n",
+                GetAssetName(RequestedFrenchnodeAssets), nNowMillis - nAssetSyncStartedMillis,
+                mapSyncRequests.size(), setSyncReplied.size(), CountSeen());
+        }
+        mapSyncRequests.clear();
+        mapSyncReported.clear();
+        setSyncReplied.clear();
+        lastSyncReply = 0;
+    }
+
     switch (RequestedFrenchnodeAssets) {
     case (FRENCHNODE_SYNC_INITIAL):
     case (FRENCHNODE_SYNC_FAILED): // should never be used here actually, use Reset() instead
@@ -157,6 +215,115 @@ void CFrenchnodeSync::GetNextAsset()
     }
     RequestedFrenchnodeAttempt = 0;
     nAssetSyncStarted = GetTime();
+    nAssetSyncStartedMillis = nNowMillis;
+}
+
+std::string CFrenchnodeSync::GetAssetName(int nAsset)
+{
+    switch (nAsset) {
+    case FRENCHNODE_SYNC_SPORKS:
+        return "sporks";
+    case FRENCHNODE_SYNC_LIST:
+        return "list";
+    case FRENCHNODE_SYNC_MNW:
+        return "winners";
+    case FRENCHNODE_SYNC_BUDGET:
+        return "budget";
+    }
+    return "";
+}
+
+void CFrenchnodeSync::SyncRequested(NodeId nodeid, int64_t nNow)
+{
+    LOCK(cs);
+    mapSyncRequests[nodeid] = nNow;
+    RequestedFrenchnodeAttempt = mapSyncRequests.size();
+}
+
+void CFrenchnodeSync::SyncReplied(NodeId nodeid, int nItemID, int nCount, int64_t nNow)
+{
+    LOCK(cs);
+    if (RequestedFrenchnodeAssets >= FRENCHNODE_SYNC_FINISHED) return;
+
+    switch (nItemID) {
+    case (FRENCHNODE_SYNC_LIST):
+        if (nItemID != RequestedFrenchnodeAssets) return;
+        sumFrenchnodeList += nCount;
+        countFrenchnodeList++;
+        break;
+    case (FRENCHNODE_SYNC_MNW):
+        if (nItemID != RequestedFrenchnodeAssets) return;
+        sumFrenchnodeWinner += nCount;
+        countFrenchnodeWinner++;
+        break;
+    case (FRENCHNODE_SYNC_BUDGET_PROP):
+        if (RequestedFrenchnodeAssets != FRENCHNODE_SYNC_BUDGET) return;
+        sumBudgetItemProp += nCount;
+        countBudgetItemProp++;
+        break;
+    case (FRENCHNODE_SYNC_BUDGET_FIN):
+        if (RequestedFrenchnodeAssets != FRENCHNODE_SYNC_BUDGET) return;
+        sumBudgetItemFin += nCount;
+        countBudgetItemFin++;
+        break;
+    default:
+        return;
+    }
+
+    if (!mapSyncRequests.count(nodeid)) return;
+
+    // budgets come as two counts, proposals first; the peer is done after the finalized ones
+    mapSyncReported[nodeid] += nCount;
+    if (nItemID != FRENCHNODE_SYNC_BUDGET_PROP) setSyncReplied.insert(nodeid);
+    lastSyncReply = nNow;
+}
+
+int CFrenchnodeSync::CountSyncPending(int64_t nNow)
+{
+    LOCK(cs);
+    int nPending = 0;
+    for (std::map<NodeId, int64_t>::const_iterator it = mapSyncRequests.begin(); it != mapSyncRequests.end(); ++it) {
+        if (!setSyncReplied.count(it->first) && nNow - it->second < FRENCHNODE_SYNC_PEER_TIMEOUT)
+            nPending++;
+    }
+    return nPending;
+}
+
+int CFrenchnodeSync::CountSeen()
+{
+    LOCK(cs);
+    switch (RequestedFrenchnodeAssets) {
+    case FRENCHNODE_SYNC_LIST:
+        return mapSeenSyncMNB.size();
+    case FRENCHNODE_SYNC_MNW:
+        return mapSeenSyncMNW.size();
+    case FRENCHNODE_SYNC_BUDGET:
+        return mapSeenSyncBudget.size();
+    }
+    return 0;
+}
+
+bool CFrenchnodeSync::IsAssetComplete(int64_t nNow, bool fMorePeers)
+{
+    LOCK(cs);
+    if (setSyncReplied.empty()) return false;
+
+    // wait for a second opinion while there is someone left to give one
+    if ((int)setSyncReplied.size() < FRENCHNODE_SYNC_THRESHOLD && (fMorePeers || CountSyncPending(nNow) > 0))
+        return false;
+
+    // items seen from any peer count once, so the largest reported count is the target
+    int nReported = 0;
+    BOOST_FOREACH (NodeId nodeid, setSyncReplied)
+        nReported = std::max(nReported, mapSyncReported[nodeid]);
+    if (CountSeen() >= nReported) return true;
+
+    // some items may be invalid or already gone; stop once they stop coming
+    int64_t nLastItem = lastSyncReply;
+    if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_LIST) nLastItem = std::max(nLastItem, lastFrenchnodeList);
+    if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_MNW) nLastItem = std::max(nLastItem, lastFrenchnodeWinner);
+    if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_BUDGET) nLastItem = std::max(nLastItem, lastBudgetItem);
+    return nNow - nLastItem >= FRENCHNODE_SYNC_QUIET;
 }
 
 std::string CFrenchnodeSync::GetSyncStatus()
@@ -187,33 +354,11 @@ void CFrenchnodeSync::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
         int nCount;
         vRecv >> nItemID >> nCount;
 
-        if (RequestedFrenchnodeAssets >= FRENCHNODE_SYNC_FINISHED) return;
-
-        //this means we will receive no further communication
-        switch (nItemID) {
-        case (FRENCHNODE_SYNC_LIST):
-            if (nItemID != RequestedFrenchnodeAssets) return;
-            sumFrenchnodeList += nCount;
-            countFrenchnodeList++;
-            break;
-        case (FRENCHNODE_SYNC_MNW):
-            if (nItemID != RequestedFrenchnodeAssets) return;
-            sumFrenchnodeWinner += nCount;
-            countFrenchnodeWinner++;
-            break;
-        case (FRENCHNODE_SYNC_BUDGET_PROP):
-            if (RequestedFrenchnodeAssets != FRENCHNODE_SYNC_BUDGET) return;
-            sumBudgetItemProp += nCount;
-            countBudgetItemProp++;
-            break;
-        case (FRENCHNODE_SYNC_BUDGET_FIN):
-            if (RequestedFrenchnodeAssets != FRENCHNODE_SYNC_BUDGET) return;
-            sumBudgetItemFin += nCount;
-            countBudgetItemFin++;
-            break;
-        }
+        //this means we will receive no further communication from this peer for the asset
+        if (nItemID == FRENCHNODE_SYNC_LIST) mnodeman.ListReplied(pfrom->GetId());
+        SyncReplied(pfrom->GetId(), nItemID, nCount, GetTime());
 
-        LogPrint("masternode", "CFrenchnodeSync:ProcessMessage - ssc - got inventory count %d %d\n", nItemID, nCount);
+        LogPrint("masternode", "CFrenchnodeSync:ProcessMessage - ssc - got inventory count %d %d peer=%d\n", nItemID, nCount, pfrom->GetId());
     }
 }
 
@@ -232,10 +377,6 @@ void CFrenchnodeSync::ClearFulfilledRequest()
 
 void CFrenchnodeSync::Process()
 {
-    static int tick = 0;
-
-    if (tick++ % FRENCHNODE_SYNC_TIMEOUT != 0) return;
-
     if (IsSynced()) {
         /* 
             Resync if we lose all masternodes from sleep/wake or failure to sync originally
@@ -253,152 +394,104 @@ void CFrenchnodeSync::Process()
         return;
     }
 
-    LogPrint("masternode", "CFrenchnodeSync::Process() - tick %d RequestedFrenchnodeAssets %d\n", tick, RequestedFrenchnodeAssets);
-
     if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_INITIAL) GetNextAsset();
 
     // sporks synced but blockchain is not, wait until we're almost at a recent block to continue
     if (Params().NetworkID() != CBaseChainParams::REGTEST &&
         !IsBlockchainSynced() && RequestedFrenchnodeAssets > FRENCHNODE_SYNC_SPORKS) return;
 
-    TRY_LOCK(cs_vNodes, lockRecv);
-    if (!lockRecv) return;
+    int nAsset = RequestedFrenchnodeAssets;
+    int64_t nNow = GetTime();
 
-    BOOST_FOREACH (CNode* pnode, vNodes) {
-        if (Params().NetworkID() == CBaseChainParams::REGTEST) {
-            if (RequestedFrenchnodeAttempt <= 2) {
+    std::string strRequest;
+    int nMinVersion = 0;
+    switch (nAsset) {
+    case FRENCHNODE_SYNC_SPORKS:
+        strRequest = "getspork";
+        break;
+    case FRENCHNODE_SYNC_LIST:
+        strRequest = "mnsync";
+        nMinVersion = masternodePayments.GetMinFrenchnodePaymentsProto();
+        break;
+    case FRENCHNODE_SYNC_MNW:
+        strRequest = "mnwsync";
+        nMinVersion = masternodePayments.GetMinFrenchnodePaymentsProto();
+        break;
+    case FRENCHNODE_SYNC_BUDGET:
+        strRequest = "busync";
+        nMinVersion = ActiveProtocol();
+        break;
+    default:
+        return;
+    }
+
+    // keep FRENCHNODE_SYNC_PEERS requests outstanding; peers that don't answer in time are replaced
+    bool fMorePeers = false;
+    {
+        TRY_LOCK(cs_vNodes, lockRecv);
+        if (!lockRecv) return;
+
+        int nWanted = FRENCHNODE_SYNC_PEERS - CountSyncPending(nNow);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->fDisconnect || pnode->nVersion < nMinVersion) continue;
+            if (pnode->HasFulfilledRequest(strRequest)) continue;
+            if (nWanted <= 0) {
+                fMorePeers = true;
+                break;
+            }
+            pnode->FulfilledRequest(strRequest);
+
+            if (nAsset == FRENCHNODE_SYNC_SPORKS) {
                 pnode->PushMessage("getsporks"); //get current network sporks
-            } else if (RequestedFrenchnodeAttempt < 4) {
-                mnodeman.DsegUpdate(pnode);
-            } else if (RequestedFrenchnodeAttempt < 6) {
+            } else if (nAsset == FRENCHNODE_SYNC_LIST) {
+                if (!mnodeman.DsegUpdate(pnode)) continue;
+            } else if (nAsset == FRENCHNODE_SYNC_MNW) {
                 int nMnCount = mnodeman.CountEnabled();
                 pnode->PushMessage("mnget", nMnCount); //sync payees
+            } else {
                 uint256 n = 0;
                 pnode->PushMessage("mnvs", n); //sync masternode votes
-            } else {
-                RequestedFrenchnodeAssets = FRENCHNODE_SYNC_FINISHED;
             }
-            RequestedFrenchnodeAttempt++;
-            return;
+            LogPrint("masternode", "CFrenchnodeSync::Process() - asked peer=%d for %s\n", pnode->GetId(), GetAssetName(nAsset));
+            SyncRequested(pnode->GetId(), nNow);
+            nWanted--;
         }
+    }
 
-        //set to synced
-        if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_SPORKS) {
-            if (pnode->HasFulfilledRequest("getspork")) continue;
-            pnode->FulfilledRequest("getspork");
+    int nRequested, nReplied;
+    {
+        LOCK(cs);
+        nRequested = mapSyncRequests.size();
+        nReplied = setSyncReplied.size();
+    }
+    // without a peer to ask, wait for one, but not past the asset timeout
+    bool fTimedOut = nNow - nAssetSyncStarted > FRENCHNODE_SYNC_ASSET_TIMEOUT;
+    if (nRequested == 0 && !fTimedOut) return;
 
-            pnode->PushMessage("getsporks"); //get current network sporks
-            if (RequestedFrenchnodeAttempt >= 2) GetNextAsset();
-            RequestedFrenchnodeAttempt++;
+    // sporks are answered right away and not counted, give the replies a moment to arrive
+    if (nAsset == FRENCHNODE_SYNC_SPORKS) {
+        if (nNow - nAssetSyncStarted >= FRENCHNODE_SYNC_QUIET) GetNextAsset();
+        return;
+    }
 
+    if (!IsAssetComplete(nNow, fMorePeers)) {
+        if (!fTimedOut) return;
+
+        // nobody answered and nothing came in: without the list or winners we can't check payments
+        if (nReplied == 0 && CountSeen() == 0 && nAsset != FRENCHNODE_SYNC_BUDGET &&
+            IsSporkActive(SPORK_8_FRENCHNODE_PAYMENT_ENFORCEMENT)) {
+            LogPrintf("CFrenchnodeSync::Process - ERROR - Sync has failed, will retry later\n");
+            RequestedFrenchnodeAssets = FRENCHNODE_SYNC_FAILED;
+            RequestedFrenchnodeAttempt = 0;
+            lastFailure = GetTime();
+            nCountFailures++;
             return;
         }
+        LogPrint("masternode", "CFrenchnodeSync::Process() - %s timed out, %d of %d peers replied\n", GetAssetName(nAsset), nReplied, nRequested);
+    }
 
-        if (pnode->nVersion >= masternodePayments.GetMinFrenchnodePaymentsProto()) {
-            if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_LIST) {
-                LogPrint("masternode", "CFrenchnodeSync::Process() - lastFrenchnodeList %lld (GetTime() - FRENCHNODE_SYNC_TIMEOUT) %lld\n", lastFrenchnodeList, GetTime() - FRENCHNODE_SYNC_TIMEOUT);
-                if (lastFrenchnodeList > 0 && lastFrenchnodeList < GetTime() - FRENCHNODE_SYNC_TIMEOUT * 2 && RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD) { //hasn't received a new item in the last five seconds, so we'll move to the
-                    GetNextAsset();
-                    return;
-                }
-
-                if (pnode->HasFulfilledRequest("mnsync")) continue;
-                pnode->FulfilledRequest("mnsync");
-
-                // timeout
-                if (lastFrenchnodeList == 0 &&
-                    (RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD * 3 || GetTime() - nAssetSyncStarted > FRENCHNODE_SYNC_TIMEOUT * 5)) {
-                    if (IsSporkActive(SPORK_8_FRENCHNODE_PAYMENT_ENFORCEMENT)) {
-                        LogPrintf("CFrenchnodeSync::Process - ERROR - Sync has failed, will retry later\n");
-                        RequestedFrenchnodeAssets = FRENCHNODE_SYNC_FAILED;
-                        RequestedFrenchnodeAttempt = 0;
-                        lastFailure = GetTime();
-                        nCountFailures++;
-                    } else {
-                        GetNextAsset();
-                    }
-                    return;
-                }
-
-                if (RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD * 3) return;
-
-                mnodeman.DsegUpdate(pnode);
-                RequestedFrenchnodeAttempt++;
-                return;
-            }
-
-            if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_MNW) {
-                if (lastFrenchnodeWinner > 0 && lastFrenchnodeWinner < GetTime() - FRENCHNODE_SYNC_TIMEOUT * 2 && RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD) { //hasn't received a new item in the last five seconds, so we'll move to the
-                    GetNextAsset();
-                    return;
-                }
-
-                if (pnode->HasFulfilledRequest("mnwsync")) continue;
-                pnode->FulfilledRequest("mnwsync");
-
-                // timeout
-                if (lastFrenchnodeWinner == 0 &&
-                    (RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD * 3 || GetTime() - nAssetSyncStarted > FRENCHNODE_SYNC_TIMEOUT * 5)) {
-                    if (IsSporkActive(SPORK_8_FRENCHNODE_PAYMENT_ENFORCEMENT)) {
-                        LogPrintf("CFrenchnodeSync::Process - ERROR - Sync has failed, will retry later\n");
-                        RequestedFrenchnodeAssets = FRENCHNODE_SYNC_FAILED;
-                        RequestedFrenchnodeAttempt = 0;
-                        lastFailure = GetTime();
-                        nCountFailures++;
-                    } else {
-                        GetNextAsset();
-                    }
-                    return;
-                }
-
-                if (RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD * 3) return;
-
-                CBlockIndex* pindexPrev = chainActive.Tip();
-                if (pindexPrev == NULL) return;
-
-                int nMnCount = mnodeman.CountEnabled();
-                pnode->PushMessage("mnget", nMnCount); //sync payees
-                RequestedFrenchnodeAttempt++;
-
-                return;
-            }
-        }
-
-        if (pnode->nVersion >= ActiveProtocol()) {
-            if (RequestedFrenchnodeAssets == FRENCHNODE_SYNC_BUDGET) {
-                
-                // We'll start rejecting votes if we accidentally get set as synced too soon
-                if (lastBudgetItem > 0 && lastBudgetItem < GetTime() - FRENCHNODE_SYNC_TIMEOUT * 2 && RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD) { 
-                    
-                    // Hasn't received a new item in the last five seconds, so we'll move to the
-                    GetNextAsset();
-
-                    // Try to activate our masternode if possible
-                    activeFrenchnode.ManageStatus();
-
-                    return;
-                }
-
-                // timeout
-                if (lastBudgetItem == 0 &&
-                    (RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD * 3 || GetTime() - nAssetSyncStarted > FRENCHNODE_SYNC_TIMEOUT * 5)) {
-                    // maybe there is no budgets at all, so just finish syncing
-                    GetNextAsset();
-                    activeFrenchnode.ManageStatus();
-                    return;
-                }
-
-                if (pnode->HasFulfilledRequest("busync")) continue;
-                pnode->FulfilledRequest("busync");
-
-                if (RequestedFrenchnodeAttempt >= FRENCHNODE_SYNC_THRESHOLD * 3) return;
-
-                uint256 n = 0;
-                pnode->PushMessage("mnvs", n); //sync masternode votes
-                RequestedFrenchnodeAttempt++;
+    GetNextAsset();
 
-                return;
-            }
-        }
-    }
+    // Try to activate our masternode if possible
+    if (nAsset == FRENCHNODE_SYNC_BUDGET) activeFrenchnode.ManageStatus();
 }
@@ -6,6 +6,12 @@
 #ifndef FRENCHNODE_SYNC_H
 #define FRENCHNODE_SYNC_H
 
+#include "net.h"
+#include "sync.h"
+
+#include <map>
+#include <set>
+
 #define FRENCHNODE_SYNC_INITIAL 0
 #define FRENCHNODE_SYNC_SPORKS 1
 #define FRENCHNODE_SYNC_LIST 2
@@ -19,16 +25,32 @@
 #define FRENCHNODE_SYNC_TIMEOUT 5
 #define FRENCHNODE_SYNC_THRESHOLD 2
 
+// peers asked for an asset at the same time
+#define FRENCHNODE_SYNC_PEERS 3
+// seconds without new items after the replies before an asset counts as complete
+#define FRENCHNODE_SYNC_QUIET 3
+// seconds to wait for a peer's item count before asking another one instead
+#define FRENCHNODE_SYNC_PEER_TIMEOUT 15
+// seconds before an asset is given up on
+#define FRENCHNODE_SYNC_ASSET_TIMEOUT 60
+
 class CFrenchnodeSync;
 extern CFrenchnodeSync masternodeSync;
 
 //
 // CFrenchnodeSync : Sync masternode assets in stages
 //
+// Each asset is requested from several peers at once. An asset is complete once
+// enough of them reported their item count ("ssc") and either as many distinct
+// items as the largest count were seen, or no new ones came for a few seconds.
+//
 
 class CFrenchnodeSync
 {
 public:
+    // guards the mapSeenSync* maps, which are fed from several message handler threads
+    mutable CCriticalSection cs;
+
     std::map<uint256, int> mapSeenSyncMNB;
     std::map<uint256, int> mapSeenSyncMNW;
     std::map<uint256, int> mapSeenSyncBudget;
@@ -56,19 +78,41 @@ public:
 
     // Time when current masternode asset sync started
     int64_t nAssetSyncStarted;
+    int64_t nAssetSyncStartedMillis;
+
+    // Peers asked for the current asset and when, the item counts they
+    // reported, and the ones that are done reporting (guarded by cs)
+    std::map<NodeId, int64_t> mapSyncRequests;
+    std::map<NodeId, int> mapSyncReported;
+    std::set<NodeId> setSyncReplied;
+    int64_t lastSyncReply;
+
+    // How long each finished asset took, in milliseconds (guarded by cs)
+    std::map<int, int64_t> mapAssetSyncMillis;
 
     CFrenchnodeSync();
 
     void AddedFrenchnodeList(uint256 hash);
     void AddedFrenchnodeWinner(uint256 hash);
     void AddedBudgetItem(uint256 hash);
+    void RemovedFrenchnodeList(uint256 hash);
+    void RemovedFrenchnodeWinner(uint256 hash);
     void GetNextAsset();
     std::string GetSyncStatus();
+    static std::string GetAssetName(int nAsset);
+    void SyncRequested(NodeId nodeid, int64_t nNow);
+    void SyncReplied(NodeId nodeid, int nItemID, int nCount, int64_t nNow);
+    int CountSyncPending(int64_t nNow);
+    int CountSeen();
+    bool IsAssetComplete(int64_t nNow, bool fMorePeers);
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
     bool IsBudgetFinEmpty();
     bool IsBudgetPropEmpty();
 
+    /// Start over from the first asset, asking every peer again
     void Reset();
+    /// Reset() without touching the peers
+    void ResetState();
     void Process();
     bool IsSynced();
     bool IsBlockchainSynced();
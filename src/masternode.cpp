@@ -20,18 +20,35 @@
 map<uint256, int> mapSeenFrenchnodeScanningErrors;
 // cache block hashes as we calculate them
 std::map<int64_t, uint256> mapCacheBlockHashes;
+CCriticalSection cs_mapCacheBlockHashes;
 
 //Get the last hash that matches the modulus given. Processed in reverse order
 bool GetBlockHash(uint256& hash, int nBlockHeight)
 {
+    // Heights looked up before are answered without cs_main: DisconnectTip trims
+    // the cache above the block it disconnects, so what is left is on chainActive
+    if (nBlockHeight > 0) {
+        LOCK(cs_mapCacheBlockHashes);
+        std::map<int64_t, uint256>::const_iterator it = mapCacheBlockHashes.find(nBlockHeight);
+        if (it != mapCacheBlockHashes.end()) {
+            hash = it->second;
+            return true;
+        }
+    }
+
+    LOCK(cs_main);
     if (chainActive.Tip() == NULL) return false;
 
     if (nBlockHeight == 0)
         nBlockHeight = chainActive.Tip()->nHeight;
 
-    if (mapCacheBlockHashes.count(nBlockHeight)) {
-        hash = mapCacheBlockHashes[nBlockHeight];
-        return true;
+    {
+        LOCK(cs_mapCacheBlockHashes);
+        std::map<int64_t, uint256>::const_iterator it = mapCacheBlockHashes.find(nBlockHeight);
+        if (it != mapCacheBlockHashes.end()) {
+            hash = it->second;
+            return true;
+        }
     }
 
     const CBlockIndex* BlockLastSolved = chainActive.Tip();
@@ -47,6 +64,7 @@ bool GetBlockHash(uint256& hash, int nBlockHeight)
     for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
         if (n >= nBlocksAgo) {
             hash = BlockReading->GetBlockHash();
+            LOCK(cs_mapCacheBlockHashes);
             mapCacheBlockHashes[nBlockHeight] = hash;
             return true;
         }
@@ -150,10 +168,14 @@ bool CFrenchnode::UpdateFromNewBroadcast(CFrenchnodeBroadcast& mnb)
         protocolVersion = mnb.protocolVersion;
         addr = mnb.addr;
         lastTimeChecked = 0;
+        mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_LIST, vin.prevout);
+        mnodeman.ListChanged();
         int nDoS = 0;
         if (mnb.lastPing == CFrenchnodePing() || (mnb.lastPing != CFrenchnodePing() && mnb.lastPing.CheckAndUpdate(nDoS, false))) {
             lastPing = mnb.lastPing;
-            mnodeman.mapSeenFrenchnodePing.insert(make_pair(lastPing.GetHash(), lastPing));
+            LOCK(mnodeman.cs_mapSeen);
+            if (mnodeman.mapSeenFrenchnodePing.insert(make_pair(lastPing.GetHash(), lastPing)).second)
+                mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_PING, lastPing.GetHash());
         }
         return true;
     }
@@ -170,13 +192,18 @@ uint256 CFrenchnode::CalculateScore(int mod, int64_t nBlockHeight)
     if (chainActive.Tip() == NULL) return 0;
 
     uint256 hash = 0;
-    uint256 aux = vin.prevout.hash + vin.prevout.n;
-
     if (!GetBlockHash(hash, nBlockHeight)) {
         LogPrint("masternode","CalculateScore ERROR - nHeight %d - Returned 0\n", nBlockHeight);
         return 0;
     }
 
+    return CalculateScore(hash);
+}
+
+uint256 CFrenchnode::CalculateScore(const uint256& hash) const
+{
+    uint256 aux = vin.prevout.hash + vin.prevout.n;
+
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     ss << hash;
     uint256 hash2 = ss.GetHash();
@@ -202,36 +229,18 @@ void CFrenchnode::Check(bool forceCheck)
     //once spent, stop doing the checks
     if (activeState == FRENCHNODE_VIN_SPENT) return;
 
+    int nState;
+    if (!IsPingedWithin(FRENCHNODE_REMOVAL_SECONDS))
+        nState = FRENCHNODE_REMOVE;
+    else if (!IsPingedWithin(FRENCHNODE_EXPIRATION_SECONDS))
+        nState = FRENCHNODE_EXPIRED;
+    else
+        nState = FRENCHNODE_ENABLED; // OK; spent collateral is found by CFrenchnodeMan::ConnectedBlock
 
-    if (!IsPingedWithin(FRENCHNODE_REMOVAL_SECONDS)) {
-        activeState = FRENCHNODE_REMOVE;
-        return;
-    }
-
-    if (!IsPingedWithin(FRENCHNODE_EXPIRATION_SECONDS)) {
-        activeState = FRENCHNODE_EXPIRED;
-        return;
+    if (nState != activeState) {
+        activeState = nState;
+        mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_LIST, vin.prevout);
     }
-
-    if (!unitTest) {
-        CValidationState state;
-        CMutableTransaction tx = CMutableTransaction();
-        CTxOut vout = CTxOut((FRENCHNODE_COLLATERAL-0.01) * COIN, masternodeSigner.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-
-        {
-            TRY_LOCK(cs_main, lockMain);
-            if (!lockMain) return;
-
-            if (!AcceptableInputs(mempool, state, CTransaction(tx), false, NULL)) {
-                activeState = FRENCHNODE_VIN_SPENT;
-                return;
-            }
-        }
-    }
-
-    activeState = FRENCHNODE_ENABLED; // OK
 }
 
 int64_t CFrenchnode::SecondsSincePayment()
@@ -280,14 +289,12 @@ int64_t CFrenchnode::GetLastPaid()
         }
         n++;
 
-        if (masternodePayments.mapFrenchnodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if (masternodePayments.mapFrenchnodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2)) {
-                return BlockReading->nTime + nOffset;
-            }
+        /*
+            Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
+            to converge on the same payees quickly, then keep the same schedule.
+        */
+        if (masternodePayments.HasPayeeWithVotes(BlockReading->nHeight, mnpayee, 2)) {
+            return BlockReading->nTime + nOffset;
         }
 
         if (BlockReading->pprev == NULL) {
@@ -584,8 +591,12 @@ bool CFrenchnodeBroadcast::CheckInputsAndAdd(int& nDoS)
         TRY_LOCK(cs_main, lockMain);
         if (!lockMain) {
             // not mnb fault, let it to be checked again later
-            mnodeman.mapSeenFrenchnodeBroadcast.erase(GetHash());
-            masternodeSync.mapSeenSyncMNB.erase(GetHash());
+            {
+                LOCK(mnodeman.cs_mapSeen);
+                mnodeman.mapSeenFrenchnodeBroadcast.erase(GetHash());
+                mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_BROADCAST, GetHash());
+            }
+            masternodeSync.RemovedFrenchnodeList(GetHash());
             return false;
         }
 
@@ -601,8 +612,12 @@ bool CFrenchnodeBroadcast::CheckInputsAndAdd(int& nDoS)
     if (GetInputAge(vin) < FRENCHNODE_MIN_CONFIRMATIONS) {
         LogPrint("masternode","mnb - Input must have at least %d confirmations\n", FRENCHNODE_MIN_CONFIRMATIONS);
         // maybe we miss few blocks, let this mnb to be checked again later
-        mnodeman.mapSeenFrenchnodeBroadcast.erase(GetHash());
-        masternodeSync.mapSeenSyncMNB.erase(GetHash());
+        {
+            LOCK(mnodeman.cs_mapSeen);
+            mnodeman.mapSeenFrenchnodeBroadcast.erase(GetHash());
+            mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_BROADCAST, GetHash());
+        }
+        masternodeSync.RemovedFrenchnodeList(GetHash());
         return false;
     }
 
@@ -610,7 +625,9 @@ bool CFrenchnodeBroadcast::CheckInputsAndAdd(int& nDoS)
     // should be at least not earlier than block when 1000 FRENCH tx got FRENCHNODE_MIN_CONFIRMATIONS
     uint256 hashBlock = 0;
     CTransaction tx2;
-    GetTransaction(vin.prevout.hash, tx2, hashBlock, true);
+    CTxOut txout;
+    if (!GetTransaction(vin.prevout.hash, tx2, hashBlock, true))
+        GetUnspentOutput(vin.prevout, txout, hashBlock);
     BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi != mapBlockIndex.end() && (*mi).second) {
         CBlockIndex* pMNIndex = (*mi).second;                                                        // block for 1000 PIVX tx -> 1 confirmation
@@ -641,6 +658,8 @@ bool CFrenchnodeBroadcast::CheckInputsAndAdd(int& nDoS)
 
 void CFrenchnodeBroadcast::Relay()
 {
+    // Not kept framed in mapRelay: the hash leaves out lastPing, which is updated in
+    // mapSeenFrenchnodeBroadcast as pings come in, so getdata serializes the current one
     CInv inv(MSG_FRENCHNODE_ANNOUNCE, GetHash());
     RelayInv(inv);
 }
@@ -759,12 +778,17 @@ bool CFrenchnodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled)
             }
 
             pmn->lastPing = *this;
+            mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_LIST, vin.prevout);
 
             //mnodeman.mapSeenFrenchnodeBroadcast.lastPing is probably outdated, so we'll update it
             CFrenchnodeBroadcast mnb(*pmn);
             uint256 hash = mnb.GetHash();
-            if (mnodeman.mapSeenFrenchnodeBroadcast.count(hash)) {
-                mnodeman.mapSeenFrenchnodeBroadcast[hash].lastPing = *this;
+            {
+                LOCK(mnodeman.cs_mapSeen);
+                if (mnodeman.mapSeenFrenchnodeBroadcast.count(hash)) {
+                    mnodeman.mapSeenFrenchnodeBroadcast[hash].lastPing = *this;
+                    mnodeman.recordChanges.Mark(CFrenchnodeMan::MN_RECORD_SEEN_BROADCAST, hash);
+                }
             }
 
             pmn->Check(true);
@@ -787,5 +811,5 @@ bool CFrenchnodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled)
 void CFrenchnodePing::Relay()
 {
     CInv inv(MSG_FRENCHNODE_PING, GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "mnp", *this);
 }
@@ -30,6 +30,7 @@ class CFrenchnode;
 class CFrenchnodeBroadcast;
 class CFrenchnodePing;
 extern map<int64_t, uint256> mapCacheBlockHashes;
+extern CCriticalSection cs_mapCacheBlockHashes;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
@@ -193,6 +194,7 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    uint256 CalculateScore(const uint256& hashBlock) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -319,7 +321,7 @@ public:
         READWRITE(nLastDsq);
     }
 
-    uint256 GetHash()
+    uint256 GetHash() const
     {
         CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
         ss << sigTime;
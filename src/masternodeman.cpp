@@ -25,17 +25,17 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-        const pair<int64_t, CTxIn>& t2) const
+struct CompareOutPoint {
+    bool operator()(const pair<COutPoint, CFrenchnode*>& t1,
+        const pair<COutPoint, CFrenchnode*>& t2) const
     {
         return t1.first < t2.first;
     }
 };
 
-struct CompareScoreMN {
-    bool operator()(const pair<int64_t, CFrenchnode>& t1,
-        const pair<int64_t, CFrenchnode>& t2) const
+struct CompareScorePtr {
+    bool operator()(const pair<int64_t, CFrenchnode*>& t1,
+        const pair<int64_t, CFrenchnode*>& t2) const
     {
         return t1.first < t2.first;
     }
@@ -45,155 +45,122 @@ struct CompareScoreMN {
 // CFrenchnodeDB
 //
 
-CFrenchnodeDB::CFrenchnodeDB()
-{
-    pathMN = GetDataDir() / "mncache.dat";
-    strMagicMessage = "FrenchnodeCache";
-}
+CFrenchnodeDB mndb;
 
-bool CFrenchnodeDB::Write(const CFrenchnodeMan& mnodemanToSave)
+CFrenchnodeDB::ReadResult CFrenchnodeDB::Read(CFrenchnodeMan& mnodemanToLoad)
 {
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssFrenchnodes(SER_DISK, CLIENT_VERSION);
-    ssFrenchnodes << strMagicMessage;                   // masternode cache file specific magic message
-    ssFrenchnodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssFrenchnodes << mnodemanToSave;
-    uint256 hash = Hash(ssFrenchnodes.begin(), ssFrenchnodes.end());
-    ssFrenchnodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
+    ReadResult result = CRecordLog::Read(mnodemanToLoad);
+    if (result != Ok) return result;
 
-    // Write and commit header, data
-    try {
-        fileout << ssFrenchnodes;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    //    FileCommit(fileout);
-    fileout.fclose();
-
-    LogPrint("masternode","Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("masternode","  %s\n", mnodemanToSave.ToString());
+    LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
+    LogPrint("masternode","Frenchnode manager - cleaning....\n");
+    mnodemanToLoad.CheckAndRemove(true);
+    LogPrint("masternode","Frenchnode manager - result:\n");
+    LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
 
-    return true;
+    return Ok;
 }
 
-CFrenchnodeDB::ReadResult CFrenchnodeDB::Read(CFrenchnodeMan& mnodemanToLoad, bool fDryRun)
+void DumpFrenchnodes()
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathMN.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssFrenchnodes(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssFrenchnodes.begin(), ssFrenchnodes.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-
-        ssFrenchnodes >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
 
-        // de-serialize file header (network specific magic number) and ..
-        ssFrenchnodes >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-        // de-serialize data into CFrenchnodeMan object
-        ssFrenchnodes >> mnodemanToLoad;
-    } catch (std::exception& e) {
-        mnodemanToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
-    }
+    mndb.Write(mnodeman);
 
-    LogPrint("masternode","Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
-    if (!fDryRun) {
-        LogPrint("masternode","Frenchnode manager - cleaning....\n");
-        mnodemanToLoad.CheckAndRemove(true);
-        LogPrint("masternode","Frenchnode manager - result:\n");
-        LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
-    }
+    LogPrint("masternode","Frenchnode dump finished  %dms\n", GetTimeMillis() - nStart);
+}
 
-    return Ok;
+CFrenchnodeMan::CFrenchnodeMan() : nListVersion(0)
+{
 }
 
-void DumpFrenchnodes()
+void CFrenchnodeMan::GetRecords(CRecordMap& records) const
 {
-    int64_t nStart = GetTimeMillis();
+    LOCK2(cs, cs_mapSeen);
+    BOOST_FOREACH (const CFrenchnode& mn, vFrenchnodes)
+        AddRecord(records, MN_RECORD_LIST, mn.vin.prevout, mn);
+    AddRecords(records, MN_RECORD_ASKED_US, mAskedUsForFrenchnodeList);
+    AddRecords(records, MN_RECORD_WE_ASKED, mWeAskedForFrenchnodeList);
+    AddRecords(records, MN_RECORD_WE_ASKED_ENTRY, mWeAskedForFrenchnodeListEntry);
+    AddRecords(records, MN_RECORD_SEEN_BROADCAST, mapSeenFrenchnodeBroadcast);
+    AddRecords(records, MN_RECORD_SEEN_PING, mapSeenFrenchnodePing);
+}
 
-    CFrenchnodeDB mndb;
-    CFrenchnodeMan tempMnodeman;
-
-    LogPrint("masternode","Verifying mncache.dat format...\n");
-    CFrenchnodeDB::ReadResult readResult = mndb.Read(tempMnodeman, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CFrenchnodeDB::FileError)
-        LogPrint("masternode","Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CFrenchnodeDB::Ok) {
-        LogPrint("masternode","Error reading mncache.dat: ");
-        if (readResult == CFrenchnodeDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
+void CFrenchnodeMan::GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const
+{
+    LOCK2(cs, cs_mapSeen);
+    std::map<COutPoint, CRecordKey> mapChangedList;
+    BOOST_FOREACH (const CRecordKey& key, setChanged) {
+        CDataStream ssKey(key, SER_DISK, CLIENT_VERSION);
+        unsigned char nTable;
+        ssKey >> nTable;
+        switch (nTable) {
+        case MN_RECORD_LIST: {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            mapChangedList[outpoint] = key;
+            break;
+        }
+        case MN_RECORD_ASKED_US:
+            AddChangedRecord(records, setErased, key, ssKey, mAskedUsForFrenchnodeList);
+            break;
+        case MN_RECORD_WE_ASKED:
+            AddChangedRecord(records, setErased, key, ssKey, mWeAskedForFrenchnodeList);
+            break;
+        case MN_RECORD_WE_ASKED_ENTRY:
+            AddChangedRecord(records, setErased, key, ssKey, mWeAskedForFrenchnodeListEntry);
+            break;
+        case MN_RECORD_SEEN_BROADCAST:
+            AddChangedRecord(records, setErased, key, ssKey, mapSeenFrenchnodeBroadcast);
+            break;
+        case MN_RECORD_SEEN_PING:
+            AddChangedRecord(records, setErased, key, ssKey, mapSeenFrenchnodePing);
+            break;
         }
     }
-    LogPrint("masternode","Writting info to mncache.dat...\n");
-    mndb.Write(mnodeman);
 
-    LogPrint("masternode","Frenchnode dump finished  %dms\n", GetTimeMillis() - nStart);
+    // the list is a vector: find the changed entries in one pass
+    if (!mapChangedList.empty()) {
+        BOOST_FOREACH (const CFrenchnode& mn, vFrenchnodes) {
+            std::map<COutPoint, CRecordKey>::iterator it = mapChangedList.find(mn.vin.prevout);
+            if (it == mapChangedList.end()) continue;
+            records[it->second] = MakeRecordValue(mn);
+            mapChangedList.erase(it);
+        }
+        for (std::map<COutPoint, CRecordKey>::const_iterator it = mapChangedList.begin(); it != mapChangedList.end(); ++it)
+            setErased.insert(it->second);
+    }
 }
 
-CFrenchnodeMan::CFrenchnodeMan()
+bool CFrenchnodeMan::LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue)
 {
+    LOCK2(cs, cs_mapSeen);
+    switch (nTable) {
+    case MN_RECORD_LIST: {
+        CFrenchnode mn;
+        ssValue >> mn;
+        vFrenchnodes.push_back(mn);
+        break;
+    }
+    case MN_RECORD_ASKED_US:
+        LoadMapRecord(ssKey, ssValue, mAskedUsForFrenchnodeList);
+        break;
+    case MN_RECORD_WE_ASKED:
+        LoadMapRecord(ssKey, ssValue, mWeAskedForFrenchnodeList);
+        break;
+    case MN_RECORD_WE_ASKED_ENTRY:
+        LoadMapRecord(ssKey, ssValue, mWeAskedForFrenchnodeListEntry);
+        break;
+    case MN_RECORD_SEEN_BROADCAST:
+        LoadMapRecord(ssKey, ssValue, mapSeenFrenchnodeBroadcast);
+        break;
+    case MN_RECORD_SEEN_PING:
+        LoadMapRecord(ssKey, ssValue, mapSeenFrenchnodePing);
+        break;
+    default:
+        return false;
+    }
+    return true;
 }
 
 bool CFrenchnodeMan::Add(CFrenchnode& mn)
@@ -207,6 +174,8 @@ bool CFrenchnodeMan::Add(CFrenchnode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CFrenchnodeMan: Adding new Frenchnode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vFrenchnodes.push_back(mn);
+        recordChanges.Mark(MN_RECORD_LIST, mn.vin.prevout);
+        ListChanged();
         return true;
     }
 
@@ -227,6 +196,7 @@ void CFrenchnodeMan::AskForMN(CNode* pnode, CTxIn& vin)
     pnode->PushMessage("dseg", vin);
     int64_t askAgain = GetTime() + FRENCHNODE_MIN_MNP_SECONDS;
     mWeAskedForFrenchnodeListEntry[vin.prevout] = askAgain;
+    recordChanges.Mark(MN_RECORD_WE_ASKED_ENTRY, vin.prevout);
 }
 
 void CFrenchnodeMan::Check()
@@ -242,7 +212,7 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
 {
     Check();
 
-    LOCK(cs);
+    LOCK2(cs, cs_mapSeen);
 
     //remove inactive and outdated
     vector<CFrenchnode>::iterator it = vFrenchnodes.begin();
@@ -259,7 +229,8 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
             map<uint256, CFrenchnodeBroadcast>::iterator it3 = mapSeenFrenchnodeBroadcast.begin();
             while (it3 != mapSeenFrenchnodeBroadcast.end()) {
                 if ((*it3).second.vin == (*it).vin) {
-                    masternodeSync.mapSeenSyncMNB.erase((*it3).first);
+                    masternodeSync.RemovedFrenchnodeList((*it3).first);
+                    recordChanges.Mark(MN_RECORD_SEEN_BROADCAST, (*it3).first);
                     mapSeenFrenchnodeBroadcast.erase(it3++);
                 } else {
                     ++it3;
@@ -270,22 +241,28 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
             map<COutPoint, int64_t>::iterator it2 = mWeAskedForFrenchnodeListEntry.begin();
             while (it2 != mWeAskedForFrenchnodeListEntry.end()) {
                 if ((*it2).first == (*it).vin.prevout) {
+                    recordChanges.Mark(MN_RECORD_WE_ASKED_ENTRY, (*it2).first);
                     mWeAskedForFrenchnodeListEntry.erase(it2++);
                 } else {
                     ++it2;
                 }
             }
 
+            recordChanges.Mark(MN_RECORD_LIST, (*it).vin.prevout);
             it = vFrenchnodes.erase(it);
         } else {
             ++it;
         }
     }
 
+    // states were just checked again
+    ListChanged();
+
     // check who's asked for the Frenchnode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForFrenchnodeList.begin();
     while (it1 != mAskedUsForFrenchnodeList.end()) {
         if ((*it1).second < GetTime()) {
+            recordChanges.Mark(MN_RECORD_ASKED_US, (*it1).first);
             mAskedUsForFrenchnodeList.erase(it1++);
         } else {
             ++it1;
@@ -296,16 +273,28 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     it1 = mWeAskedForFrenchnodeList.begin();
     while (it1 != mWeAskedForFrenchnodeList.end()) {
         if ((*it1).second < GetTime()) {
+            recordChanges.Mark(MN_RECORD_WE_ASKED, (*it1).first);
             mWeAskedForFrenchnodeList.erase(it1++);
         } else {
             ++it1;
         }
     }
 
+    // forget list requests that went unanswered
+    std::map<NodeId, int64_t>::iterator itRequested = mapListRequested.begin();
+    while (itRequested != mapListRequested.end()) {
+        if (GetTime() - itRequested->second > FRENCHNODES_LIST_REPLY_SECONDS) {
+            mapListRequested.erase(itRequested++);
+        } else {
+            ++itRequested;
+        }
+    }
+
     // check which Frenchnodes we've asked for
     map<COutPoint, int64_t>::iterator it2 = mWeAskedForFrenchnodeListEntry.begin();
     while (it2 != mWeAskedForFrenchnodeListEntry.end()) {
         if ((*it2).second < GetTime()) {
+            recordChanges.Mark(MN_RECORD_WE_ASKED_ENTRY, (*it2).first);
             mWeAskedForFrenchnodeListEntry.erase(it2++);
         } else {
             ++it2;
@@ -316,8 +305,9 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     map<uint256, CFrenchnodeBroadcast>::iterator it3 = mapSeenFrenchnodeBroadcast.begin();
     while (it3 != mapSeenFrenchnodeBroadcast.end()) {
         if ((*it3).second.lastPing.sigTime < GetTime() - (FRENCHNODE_REMOVAL_SECONDS * 2)) {
+            masternodeSync.RemovedFrenchnodeList((*it3).first);
+            recordChanges.Mark(MN_RECORD_SEEN_BROADCAST, (*it3).first);
             mapSeenFrenchnodeBroadcast.erase(it3++);
-            masternodeSync.mapSeenSyncMNB.erase((*it3).second.GetHash());
         } else {
             ++it3;
         }
@@ -327,6 +317,7 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     map<uint256, CFrenchnodePing>::iterator it4 = mapSeenFrenchnodePing.begin();
     while (it4 != mapSeenFrenchnodePing.end()) {
         if ((*it4).second.sigTime < GetTime() - (FRENCHNODE_REMOVAL_SECONDS * 2)) {
+            recordChanges.Mark(MN_RECORD_SEEN_PING, (*it4).first);
             mapSeenFrenchnodePing.erase(it4++);
         } else {
             ++it4;
@@ -334,15 +325,92 @@ void CFrenchnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     }
 }
 
-void CFrenchnodeMan::Clear()
+void CFrenchnodeMan::ConnectedBlock(const CBlock& block, const CCoinsViewCache& view)
+{
+    LOCK(cs);
+    if (vFrenchnodes.empty()) return;
+
+    boost::unordered_map<COutPoint, CFrenchnode*, OutPointHasher> mapCollateral(vFrenchnodes.size());
+    BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
+        if (mn.activeState != CFrenchnode::FRENCHNODE_VIN_SPENT)
+            mapCollateral[mn.vin.prevout] = &mn;
+    }
+
+    int nSpent = 0;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase()) continue;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            boost::unordered_map<COutPoint, CFrenchnode*, OutPointHasher>::iterator it = mapCollateral.find(txin.prevout);
+            if (it == mapCollateral.end()) continue;
+            LogPrint("masternode", "CFrenchnodeMan::ConnectedBlock -- collateral %s spent by %s\n", txin.prevout.ToStringShort(), tx.GetHash().ToString());
+            it->second->activeState = CFrenchnode::FRENCHNODE_VIN_SPENT;
+            recordChanges.Mark(MN_RECORD_LIST, it->first);
+            mapCollateral.erase(it);
+            nSpent++;
+        }
+    }
+
+    // The others were added since the last block or could have been spent on a fork we
+    // left: look them all up at once, sorted so outputs of the same transaction are together
+    if (!IsInitialBlockDownload()) {
+        std::vector<pair<COutPoint, CFrenchnode*> > vCollateral(mapCollateral.begin(), mapCollateral.end());
+        sort(vCollateral.begin(), vCollateral.end(), CompareOutPoint());
+        const CCoins* coins = NULL;
+        uint256 hashCoins = 0;
+        BOOST_FOREACH (PAIRTYPE(COutPoint, CFrenchnode*) & c, vCollateral) {
+            if (c.first.hash != hashCoins || hashCoins == 0) {
+                hashCoins = c.first.hash;
+                coins = view.AccessCoins(hashCoins);
+            }
+            if (coins && coins->IsAvailable(c.first.n)) continue;
+            LogPrint("masternode", "CFrenchnodeMan::ConnectedBlock -- collateral %s not found\n", c.first.ToStringShort());
+            c.second->activeState = CFrenchnode::FRENCHNODE_VIN_SPENT;
+            recordChanges.Mark(MN_RECORD_LIST, c.first);
+            nSpent++;
+        }
+    }
+
+    if (nSpent > 0) ListChanged();
+}
+
+void CFrenchnodeMan::DisconnectedBlock(const CBlock& block)
 {
     LOCK(cs);
+
+    std::set<COutPoint> setUnspent;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase()) continue;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin)
+            setUnspent.insert(txin.prevout);
+    }
+
+    // Frenchnodes not removed yet get a chance again: their collateral is back in
+    // the UTXO set, and the next block looks it up together with the others
+    BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
+        if (mn.activeState == CFrenchnode::FRENCHNODE_VIN_SPENT && setUnspent.count(mn.vin.prevout)) {
+            LogPrint("masternode", "CFrenchnodeMan::DisconnectedBlock -- collateral %s unspent\n", mn.vin.prevout.ToStringShort());
+            mn.activeState = CFrenchnode::FRENCHNODE_ENABLED;
+            mn.Check(true);
+            recordChanges.Mark(MN_RECORD_LIST, mn.vin.prevout);
+        }
+    }
+
+    ListChanged();
+}
+
+void CFrenchnodeMan::Clear()
+{
+    LOCK2(cs, cs_mapSeen);
     vFrenchnodes.clear();
+    mapRanks.clear();
+    nListVersion++;
     mAskedUsForFrenchnodeList.clear();
     mWeAskedForFrenchnodeList.clear();
     mWeAskedForFrenchnodeListEntry.clear();
+    mapListRequested.clear();
     mapSeenFrenchnodeBroadcast.clear();
     mapSeenFrenchnodePing.clear();
+    recordChanges.MarkAll();
 }
 
 int CFrenchnodeMan::stable_size ()
@@ -411,7 +479,7 @@ void CFrenchnodeMan::CountNetworks(int protocolVersion, int& ipv4, int& ipv6, in
     }
 }
 
-void CFrenchnodeMan::DsegUpdate(CNode* pnode)
+bool CFrenchnodeMan::DsegUpdate(CNode* pnode)
 {
     LOCK(cs);
 
@@ -421,7 +489,7 @@ void CFrenchnodeMan::DsegUpdate(CNode* pnode)
             if (it != mWeAskedForFrenchnodeList.end()) {
                 if (GetTime() < (*it).second) {
                     LogPrint("masternode", "dseg - we already asked peer %i for the list; skipping...\n", pnode->GetId());
-                    return;
+                    return false;
                 }
             }
         }
@@ -430,6 +498,22 @@ void CFrenchnodeMan::DsegUpdate(CNode* pnode)
     pnode->PushMessage("dseg", CTxIn());
     int64_t askAgain = GetTime() + FRENCHNODES_DSEG_SECONDS;
     mWeAskedForFrenchnodeList[pnode->addr] = askAgain;
+    recordChanges.Mark(MN_RECORD_WE_ASKED, (CNetAddr)pnode->addr);
+    mapListRequested[pnode->GetId()] = GetTime();
+    return true;
+}
+
+void CFrenchnodeMan::ListReplied(NodeId nodeid)
+{
+    LOCK(cs);
+    mapListRequested.erase(nodeid);
+}
+
+bool CFrenchnodeMan::IsListRequested(NodeId nodeid, int64_t nNow)
+{
+    LOCK(cs);
+    std::map<NodeId, int64_t>::const_iterator it = mapListRequested.find(nodeid);
+    return it != mapListRequested.end() && nNow - it->second <= FRENCHNODES_LIST_REPLY_SECONDS;
 }
 
 CFrenchnode* CFrenchnodeMan::Find(const CScript& payee)
@@ -473,7 +557,8 @@ CFrenchnode* CFrenchnodeMan::Find(const CPubKey& pubKeyFrenchnode)
 //
 CFrenchnode* CFrenchnodeMan::GetNextFrenchnodeInQueueForPayment(int nBlockHeight, bool fFilterSigTime, int& nCount)
 {
-    LOCK(cs);
+    // scores are read from the chain, which has to be locked before the list
+    LOCK2(cs_main, cs);
 
     CFrenchnode* pBestFrenchnode = NULL;
     std::vector<pair<int64_t, CTxIn> > vecFrenchnodeLastPaid;
@@ -588,119 +673,172 @@ CFrenchnode* CFrenchnodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight,
     return winner;
 }
 
-int CFrenchnodeMan::GetFrenchnodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+CFrenchnodeRanks::CFrenchnodeRanks(int64_t nBlockHeightIn, const uint256& hashBlockIn, int minProtocolIn, std::vector<CFrenchnode>& vFrenchnodes) : nBlockHeight(nBlockHeightIn),
+                                                                                                                                        hashBlock(hashBlockIn),
+                                                                                                                                        minProtocol(minProtocolIn),
+                                                                                                                                        nTimeCreated(GetTime())
 {
-    std::vector<pair<int64_t, CTxIn> > vecFrenchnodeScores;
+    std::vector<pair<int64_t, CFrenchnode*> > vecFrenchnodeScores;
     int64_t nFrenchnode_Min_Age = GetSporkValue(SPORK_16_MN_WINNER_MINIMUM_AGE);
-    int64_t nFrenchnode_Age = 0;
-
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    bool fFilterAge = IsSporkActive(SPORK_8_FRENCHNODE_PAYMENT_ENFORCEMENT);
 
-    // scan for winner
     BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
-        if (mn.protocolVersion < minProtocol) {
-            LogPrint("masternode","Skipping Frenchnode with obsolete version %d\n", mn.protocolVersion);
-            continue;                                                       // Skip obsolete versions
-        }
-
-        if (IsSporkActive(SPORK_8_FRENCHNODE_PAYMENT_ENFORCEMENT)) {
-            nFrenchnode_Age = GetAdjustedTime() - mn.sigTime;
-            if ((nFrenchnode_Age) < nFrenchnode_Min_Age) {
-                if (fDebug) LogPrint("masternode","Skipping just activated Frenchnode. Age: %ld\n", nFrenchnode_Age);
-                continue;                                                   // Skip masternodes younger than (default) 1 hour
-            }
-        }
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
-        }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+        if (mn.protocolVersion < minProtocol) continue;
+        mn.Check();
 
-        vecFrenchnodeScores.push_back(make_pair(n2, mn.vin));
+        uint256 n = mn.CalculateScore(hashBlock);
+        vecFrenchnodeScores.push_back(make_pair(n.GetCompact(false), &mn));
     }
 
-    sort(vecFrenchnodeScores.rbegin(), vecFrenchnodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecFrenchnodeScores) {
-        rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
+    sort(vecFrenchnodeScores.rbegin(), vecFrenchnodeScores.rend(), CompareScorePtr());
+
+    for (int i = 0; i < RANK_FILTERS; i++)
+        mapRank[i].rehash(vecFrenchnodeScores.size());
+    BOOST_FOREACH (PAIRTYPE(int64_t, CFrenchnode*) & s, vecFrenchnodeScores) {
+        CFrenchnode& mn = *s.second;
+        bool fEnabled = mn.IsEnabled();
+        // Skip masternodes younger than (default) 1 hour for payments
+        bool fOldEnough = !fFilterAge || GetAdjustedTime() - mn.sigTime >= nFrenchnode_Min_Age;
+
+        bool fPass[RANK_FILTERS] = {fOldEnough, fOldEnough && fEnabled, fEnabled, true};
+        for (int i = 0; i < RANK_FILTERS; i++) {
+            if (!fPass[i]) continue;
+            vRanked[i].push_back(mn.vin);
+            mapRank[i][mn.vin.prevout] = vRanked[i].size();
         }
     }
+}
 
-    return -1;
+int CFrenchnodeRanks::GetRank(const CTxIn& vin, RankFilter filter) const
+{
+    boost::unordered_map<COutPoint, int, OutPointHasher>::const_iterator it = mapRank[filter].find(vin.prevout);
+    if (it == mapRank[filter].end()) return -1;
+    return it->second;
 }
 
-std::vector<pair<int, CFrenchnode> > CFrenchnodeMan::GetFrenchnodeRanks(int64_t nBlockHeight, int minProtocol)
+bool CFrenchnodeRanks::GetVin(int nRank, RankFilter filter, CTxIn& vinRet) const
 {
-    std::vector<pair<int64_t, CFrenchnode> > vecFrenchnodeScores;
-    std::vector<pair<int, CFrenchnode> > vecFrenchnodeRanks;
+    if (nRank < 1 || nRank > (int)vRanked[filter].size()) return false;
+    vinRet = vRanked[filter][nRank - 1];
+    return true;
+}
 
+CFrenchnodeRanksRef CFrenchnodeMan::GetRanks(int64_t nBlockHeight, int minProtocol)
+{
     //make sure we know about this block
     uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecFrenchnodeRanks;
-
-    // scan for winner
-    BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
-        mn.Check();
+    if (!GetBlockHash(hash, nBlockHeight)) return CFrenchnodeRanksRef();
 
-        if (mn.protocolVersion < minProtocol) continue;
+    LOCK(cs);
 
-        if (!mn.IsEnabled()) {
-            vecFrenchnodeScores.push_back(make_pair(9999, mn));
-            continue;
-        }
+    std::pair<int64_t, int> key(nBlockHeight, minProtocol);
+    std::map<std::pair<int64_t, int>, CFrenchnodeRanksRef>::iterator it = mapRanks.find(key);
+    if (it != mapRanks.end()) {
+        // states and ages move on with time, not only with the list
+        if (it->second->hashBlock == hash && GetTime() - it->second->nTimeCreated < FRENCHNODES_RANKS_SECONDS)
+            return it->second;
+        mapRanks.erase(it);
+    }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    // mostly the last few blocks and the ones a hundred before are asked for, keep the highest
+    while (mapRanks.size() >= FRENCHNODES_RANKS_CACHE_SIZE)
+        mapRanks.erase(mapRanks.begin());
 
-        vecFrenchnodeScores.push_back(make_pair(n2, mn));
-    }
+    CFrenchnodeRanksRef ranks(new CFrenchnodeRanks(nBlockHeight, hash, minProtocol, vFrenchnodes));
+    mapRanks.insert(std::make_pair(key, ranks));
+    LogPrint("masternode", "CFrenchnodeMan::GetRanks -- height %d, protocol %d, %u of %u Frenchnodes enabled\n",
+        nBlockHeight, minProtocol, ranks->GetRanked(CFrenchnodeRanks::RANK_ENABLED).size(), ranks->GetRanked(CFrenchnodeRanks::RANK_SCORED).size());
+    return ranks;
+}
 
-    sort(vecFrenchnodeScores.rbegin(), vecFrenchnodeScores.rend(), CompareScoreMN());
+void CFrenchnodeMan::ListChanged()
+{
+    LOCK(cs);
+    mapRanks.clear();
+    nListVersion++;
+}
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CFrenchnode) & s, vecFrenchnodeScores) {
-        rank++;
-        vecFrenchnodeRanks.push_back(make_pair(rank, s.second));
+CFrenchnodeListSnapshot::CFrenchnodeListSnapshot(int64_t nListVersionIn, const std::vector<CFrenchnodeBroadcast>& vBroadcasts)
+    : nListVersion(nListVersionIn), nTimeCreated(GetTime())
+{
+    vInv.reserve(vBroadcasts.size());
+    BOOST_FOREACH (const CFrenchnodeBroadcast& mnb, vBroadcasts)
+        vInv.push_back(CInv(MSG_FRENCHNODE_ANNOUNCE, mnb.GetHash()));
+
+    for (size_t i = 0; i < vBroadcasts.size(); i += FRENCHNODES_LIST_BATCH_SIZE) {
+        size_t nEnd = std::min(i + FRENCHNODES_LIST_BATCH_SIZE, vBroadcasts.size());
+        std::vector<CFrenchnodeBroadcast> vBatch(vBroadcasts.begin() + i, vBroadcasts.begin() + nEnd);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vBatch;
+        vBatches.push_back(MakeFramedMessage("mnblist", ss));
     }
-
-    return vecFrenchnodeRanks;
 }
 
-CFrenchnode* CFrenchnodeMan::GetFrenchnodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+CFrenchnodeListSnapshotRef CFrenchnodeMan::GetListSnapshot()
 {
-    std::vector<pair<int64_t, CTxIn> > vecFrenchnodeScores;
+    LOCK(cs);
 
-    // scan for winner
+    // nodes also expire and their pings move on without the list changing
+    if (listSnapshot && listSnapshot->nListVersion == nListVersion && GetTime() - listSnapshot->nTimeCreated < FRENCHNODES_LIST_SNAPSHOT_SECONDS)
+        return listSnapshot;
+
+    std::vector<CFrenchnodeBroadcast> vBroadcasts;
     BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
-        if (mn.protocolVersion < minProtocol) continue;
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
+        if (mn.addr.IsRFC1918()) continue; //local network
+        if (!mn.IsEnabled()) continue;
+
+        CFrenchnodeBroadcast mnb = CFrenchnodeBroadcast(mn);
+        {
+            LOCK(cs_mapSeen);
+            if (mapSeenFrenchnodeBroadcast.insert(make_pair(mnb.GetHash(), mnb)).second)
+                recordChanges.Mark(MN_RECORD_SEEN_BROADCAST, mnb.GetHash());
         }
+        vBroadcasts.push_back(mnb);
+    }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    listSnapshot.reset(new CFrenchnodeListSnapshot(nListVersion, vBroadcasts));
+    LogPrint("masternode", "CFrenchnodeMan::GetListSnapshot -- version %d, %u Frenchnode entries in %u batches\n",
+        nListVersion, listSnapshot->vInv.size(), listSnapshot->vBatches.size());
+    return listSnapshot;
+}
 
-        vecFrenchnodeScores.push_back(make_pair(n2, mn.vin));
-    }
+int CFrenchnodeMan::GetFrenchnodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    CFrenchnodeRanksRef ranks = GetRanks(nBlockHeight, minProtocol);
+    if (!ranks) return -1;
+
+    return ranks->GetRank(vin, fOnlyActive ? CFrenchnodeRanks::RANK_ACTIVE : CFrenchnodeRanks::RANK_ALL);
+}
+
+std::vector<pair<int, CTxIn> > CFrenchnodeMan::GetFrenchnodeRanks(int64_t nBlockHeight, int minProtocol)
+{
+    std::vector<pair<int, CTxIn> > vecFrenchnodeRanks;
 
-    sort(vecFrenchnodeScores.rbegin(), vecFrenchnodeScores.rend(), CompareScoreTxIn());
+    CFrenchnodeRanksRef ranks = GetRanks(nBlockHeight, minProtocol);
+    if (!ranks) return vecFrenchnodeRanks;
 
+    const std::vector<CTxIn>& vEnabled = ranks->GetRanked(CFrenchnodeRanks::RANK_ENABLED);
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecFrenchnodeScores) {
-        rank++;
-        if (rank == nRank) {
-            return Find(s.second);
-        }
+    BOOST_FOREACH (const CTxIn& vin, vEnabled) {
+        vecFrenchnodeRanks.push_back(make_pair(++rank, vin));
+    }
+    BOOST_FOREACH (const CTxIn& vin, ranks->GetRanked(CFrenchnodeRanks::RANK_SCORED)) {
+        if (ranks->GetRank(vin, CFrenchnodeRanks::RANK_ENABLED) == -1)
+            vecFrenchnodeRanks.push_back(make_pair(++rank, vin));
     }
 
-    return NULL;
+    return vecFrenchnodeRanks;
+}
+
+CFrenchnode* CFrenchnodeMan::GetFrenchnodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    CFrenchnodeRanksRef ranks = GetRanks(nBlockHeight, minProtocol);
+    if (!ranks) return NULL;
+
+    CTxIn vin;
+    if (!ranks->GetVin(nRank, fOnlyActive ? CFrenchnodeRanks::RANK_ENABLED : CFrenchnodeRanks::RANK_SCORED, vin))
+        return NULL;
+    return Find(vin);
 }
 
 void CFrenchnodeMan::ProcessFrenchnodeConnections()
@@ -718,6 +856,50 @@ void CFrenchnodeMan::ProcessFrenchnodeConnections()
     }
 }
 
+void CFrenchnodeMan::ProcessBroadcast(CNode* pfrom, CFrenchnodeBroadcast& mnb)
+{
+    bool fSeen;
+    {
+        LOCK(cs_mapSeen);
+        fSeen = !mapSeenFrenchnodeBroadcast.insert(make_pair(mnb.GetHash(), mnb)).second;
+    }
+    if (!fSeen)
+        recordChanges.Mark(MN_RECORD_SEEN_BROADCAST, mnb.GetHash());
+    if (fSeen) {
+        masternodeSync.AddedFrenchnodeList(mnb.GetHash());
+        return;
+    }
+
+    int nDoS = 0;
+    if (!mnb.CheckAndUpdate(nDoS)) {
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+
+        //failed
+        return;
+    }
+
+    // make sure the vout that was signed is related to the transaction that spawned the Frenchnode
+    //  - this is expensive, so it's only done once per Frenchnode
+    if (!masternodeSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubKeyCollateralAddress)) {
+        LogPrint("masternode","mnb - Got mismatched pubkey and vin\n");
+        Misbehaving(pfrom->GetId(), 33);
+        return;
+    }
+
+    // make sure it's still unspent
+    if (mnb.CheckInputsAndAdd(nDoS)) {
+        // use this as a peer
+        addrman.Add(CAddress(mnb.addr), pfrom->addr, 2 * 60 * 60);
+        masternodeSync.AddedFrenchnodeList(mnb.GetHash());
+    } else {
+        LogPrint("masternode","mnb - Rejected Frenchnode entry %s\n", mnb.vin.prevout.hash.ToString());
+
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
 void CFrenchnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
     if (fLiteMode) return; //disable all Frenchnode related functionality
@@ -728,41 +910,25 @@ void CFrenchnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
     if (strCommand == "mnb") { //Frenchnode Broadcast
         CFrenchnodeBroadcast mnb;
         vRecv >> mnb;
+        ProcessBroadcast(pfrom, mnb);
+    }
 
-        if (mapSeenFrenchnodeBroadcast.count(mnb.GetHash())) { //seen
-            masternodeSync.AddedFrenchnodeList(mnb.GetHash());
+    else if (strCommand == "mnblist") { //Frenchnode Broadcasts, a batch of the list we asked for
+        if (!IsListRequested(pfrom->GetId(), GetTime())) {
+            LogPrint("masternode", "mnblist - peer %i was not asked for the list\n", pfrom->GetId());
             return;
         }
-        mapSeenFrenchnodeBroadcast.insert(make_pair(mnb.GetHash(), mnb));
 
-        int nDoS = 0;
-        if (!mnb.CheckAndUpdate(nDoS)) {
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
+        vector<CFrenchnodeBroadcast> vBroadcasts;
+        vRecv >> vBroadcasts;
 
-            //failed
+        if (vBroadcasts.size() > FRENCHNODES_LIST_BATCH_SIZE) {
+            Misbehaving(pfrom->GetId(), 20);
             return;
         }
 
-        // make sure the vout that was signed is related to the transaction that spawned the Frenchnode
-        //  - this is expensive, so it's only done once per Frenchnode
-        if (!masternodeSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubKeyCollateralAddress)) {
-            LogPrint("masternode","mnb - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 33);
-            return;
-        }
-
-        // make sure it's still unspent
-        if (mnb.CheckInputsAndAdd(nDoS)) {
-            // use this as a peer
-            addrman.Add(CAddress(mnb.addr), pfrom->addr, 2 * 60 * 60);
-            masternodeSync.AddedFrenchnodeList(mnb.GetHash());
-        } else {
-            LogPrint("masternode","mnb - Rejected Frenchnode entry %s\n", mnb.vin.prevout.hash.ToString());
-
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
+        BOOST_FOREACH (CFrenchnodeBroadcast& mnb, vBroadcasts)
+            ProcessBroadcast(pfrom, mnb);
     }
 
     else if (strCommand == "mnp") { //Frenchnode Ping
@@ -771,8 +937,11 @@ void CFrenchnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         LogPrint("masternode", "mnp - Frenchnode ping, vin: %s\n", mnp.vin.prevout.hash.ToString());
 
-        if (mapSeenFrenchnodePing.count(mnp.GetHash())) return; //seen
-        mapSeenFrenchnodePing.insert(make_pair(mnp.GetHash(), mnp));
+        {
+            LOCK(cs_mapSeen);
+            if (!mapSeenFrenchnodePing.insert(make_pair(mnp.GetHash(), mnp)).second) return; //seen
+        }
+        recordChanges.Mark(MN_RECORD_SEEN_PING, mnp.GetHash());
 
         int nDoS = 0;
         if (mnp.CheckAndUpdate(nDoS)) return;
@@ -805,43 +974,53 @@ void CFrenchnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 if (i != mAskedUsForFrenchnodeList.end()) {
                     int64_t t = (*i).second;
                     if (GetTime() < t) {
-                        Misbehaving(pfrom->GetId(), 34);
+                        QueueMisbehaving(pfrom->GetId(), 34);
                         LogPrint("masternode","dseg - peer already asked me for the list\n");
                         return;
                     }
                 }
                 int64_t askAgain = GetTime() + FRENCHNODES_DSEG_SECONDS;
                 mAskedUsForFrenchnodeList[pfrom->addr] = askAgain;
+                recordChanges.Mark(MN_RECORD_ASKED_US, (CNetAddr)pfrom->addr);
             }
         } //else, asking for a specific node which is ok
 
 
-        int nInvCount = 0;
+        if (vin == CTxIn()) {
+            CFrenchnodeListSnapshotRef snapshot = GetListSnapshot();
+            if (pfrom->nVersion >= FRENCHNODE_LIST_BATCH_VERSION) {
+                BOOST_FOREACH (const CFramedMessageRef& msg, snapshot->vBatches)
+                    pfrom->PushSharedMessage(msg);
+            } else {
+                BOOST_FOREACH (const CInv& inv, snapshot->vInv)
+                    pfrom->PushInventory(inv);
+            }
+
+            int nInvCount = snapshot->vInv.size();
+            pfrom->PushMessage("ssc", FRENCHNODE_SYNC_LIST, nInvCount);
+            LogPrint("masternode", "dseg - Sent %d Frenchnode entries to peer %i\n", nInvCount, pfrom->GetId());
+            return;
+        }
 
+        LOCK(cs);
         BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
             if (mn.addr.IsRFC1918()) continue; //local network
 
-            if (mn.IsEnabled()) {
+            if (mn.IsEnabled() && vin == mn.vin) {
                 LogPrint("masternode", "dseg - Sending Frenchnode entry - %s \n", mn.vin.prevout.hash.ToString());
-                if (vin == CTxIn() || vin == mn.vin) {
-                    CFrenchnodeBroadcast mnb = CFrenchnodeBroadcast(mn);
-                    uint256 hash = mnb.GetHash();
-                    pfrom->PushInventory(CInv(MSG_FRENCHNODE_ANNOUNCE, hash));
-                    nInvCount++;
-
-                    if (!mapSeenFrenchnodeBroadcast.count(hash)) mapSeenFrenchnodeBroadcast.insert(make_pair(hash, mnb));
-
-                    if (vin == mn.vin) {
-                        LogPrint("masternode", "dseg - Sent 1 Frenchnode entry to peer %i\n", pfrom->GetId());
-                        return;
-                    }
+                CFrenchnodeBroadcast mnb = CFrenchnodeBroadcast(mn);
+                uint256 hash = mnb.GetHash();
+                pfrom->PushInventory(CInv(MSG_FRENCHNODE_ANNOUNCE, hash));
+
+                {
+                    LOCK(cs_mapSeen);
+                    if (mapSeenFrenchnodeBroadcast.insert(make_pair(hash, mnb)).second)
+                        recordChanges.Mark(MN_RECORD_SEEN_BROADCAST, hash);
                 }
-            }
-        }
 
-        if (vin == CTxIn()) {
-            pfrom->PushMessage("ssc", FRENCHNODE_SYNC_LIST, nInvCount);
-            LogPrint("masternode", "dseg - Sent %d Frenchnode entries to peer %i\n", nInvCount, pfrom->GetId());
+                LogPrint("masternode", "dseg - Sent 1 Frenchnode entry to peer %i\n", pfrom->GetId());
+                return;
+            }
         }
     }
 }
@@ -854,7 +1033,9 @@ void CFrenchnodeMan::Remove(CTxIn vin)
     while (it != vFrenchnodes.end()) {
         if ((*it).vin == vin) {
             LogPrint("masternode", "CFrenchnodeMan: Removing Frenchnode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
+            recordChanges.Mark(MN_RECORD_LIST, (*it).vin.prevout);
             vFrenchnodes.erase(it);
+            ListChanged();
             break;
         }
         ++it;
@@ -864,8 +1045,13 @@ void CFrenchnodeMan::Remove(CTxIn vin)
 void CFrenchnodeMan::UpdateFrenchnodeList(CFrenchnodeBroadcast mnb)
 {
     LOCK(cs);
-    mapSeenFrenchnodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
-    mapSeenFrenchnodeBroadcast.insert(std::make_pair(mnb.GetHash(), mnb));
+    {
+        LOCK(cs_mapSeen);
+        if (mapSeenFrenchnodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing)).second)
+            recordChanges.Mark(MN_RECORD_SEEN_PING, mnb.lastPing.GetHash());
+        if (mapSeenFrenchnodeBroadcast.insert(std::make_pair(mnb.GetHash(), mnb)).second)
+            recordChanges.Mark(MN_RECORD_SEEN_BROADCAST, mnb.GetHash());
+    }
 
     LogPrint("masternode","CFrenchnodeMan::UpdateFrenchnodeList -- masternode=%s\n", mnb.vin.prevout.ToStringShort());
 
@@ -11,11 +11,20 @@
 #include "main.h"
 #include "masternode.h"
 #include "net.h"
+#include "recordlog.h"
 #include "sync.h"
 #include "util.h"
 
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 #define FRENCHNODES_DUMP_SECONDS (15 * 60)
 #define FRENCHNODES_DSEG_SECONDS (3 * 60 * 60)
+#define FRENCHNODES_RANKS_SECONDS 60
+#define FRENCHNODES_RANKS_CACHE_SIZE 64
+#define FRENCHNODES_LIST_SNAPSHOT_SECONDS 60
+#define FRENCHNODES_LIST_BATCH_SIZE 500
+#define FRENCHNODES_LIST_REPLY_SECONDS (5 * 60)
 
 using namespace std;
 
@@ -24,30 +33,72 @@ class CFrenchnodeMan;
 extern CFrenchnodeMan mnodeman;
 void DumpFrenchnodes();
 
-/** Access to the MN database (mncache.dat)
+/** Access to the MN database (mncache.log)
  */
-class CFrenchnodeDB
+class CFrenchnodeDB : public CRecordLog
 {
-private:
-    boost::filesystem::path pathMN;
-    std::string strMagicMessage;
+public:
+    CFrenchnodeDB() : CRecordLog("mncache.log", "FrenchnodeCache") {}
+    ReadResult Read(CFrenchnodeMan& mnodemanToLoad);
+};
 
+extern CFrenchnodeDB mndb;
+
+/**
+ * The Frenchnodes of at least one protocol version ordered by their score for a block,
+ * best first. It is built once and never changed, so it can be used without holding
+ * CFrenchnodeMan::cs.
+ */
+class CFrenchnodeRanks
+{
 public:
-    enum ReadResult {
-        Ok,
-        FileError,
-        HashReadError,
-        IncorrectHash,
-        IncorrectMagicMessage,
-        IncorrectMagicNumber,
-        IncorrectFormat
+    enum RankFilter {
+        RANK_ALL,     // old enough to be paid, in any state
+        RANK_ACTIVE,  // old enough to be paid and enabled
+        RANK_ENABLED, // enabled, whatever the age
+        RANK_SCORED,  // every Frenchnode of the protocol version
+        RANK_FILTERS
     };
 
-    CFrenchnodeDB();
-    bool Write(const CFrenchnodeMan& mnodemanToSave);
-    ReadResult Read(CFrenchnodeMan& mnodemanToLoad, bool fDryRun = false);
+    const int64_t nBlockHeight;
+    const uint256 hashBlock;
+    const int minProtocol;
+    const int64_t nTimeCreated;
+
+    CFrenchnodeRanks(int64_t nBlockHeightIn, const uint256& hashBlockIn, int minProtocolIn, std::vector<CFrenchnode>& vFrenchnodes);
+
+    /// Rank of vin, starting at 1, among the Frenchnodes passing filter; -1 if it does not pass
+    int GetRank(const CTxIn& vin, RankFilter filter) const;
+    /// Frenchnode with rank nRank among the ones passing filter
+    bool GetVin(int nRank, RankFilter filter, CTxIn& vinRet) const;
+    const std::vector<CTxIn>& GetRanked(RankFilter filter) const { return vRanked[filter]; }
+
+private:
+    std::vector<CTxIn> vRanked[RANK_FILTERS];
+    boost::unordered_map<COutPoint, int, OutPointHasher> mapRank[RANK_FILTERS];
 };
 
+typedef boost::shared_ptr<const CFrenchnodeRanks> CFrenchnodeRanksRef;
+
+/**
+ * What a peer asking for the whole list (dseg) is sent: the inventory of the enabled
+ * Frenchnodes' broadcasts, and the same broadcasts framed as "mnblist" messages for
+ * peers that take them in batches. It is built once per version of the list and
+ * shared by every peer that asks until the list changes.
+ */
+class CFrenchnodeListSnapshot
+{
+public:
+    const int64_t nListVersion;
+    const int64_t nTimeCreated;
+    std::vector<CInv> vInv;
+    std::vector<CFramedMessageRef> vBatches;
+
+    CFrenchnodeListSnapshot(int64_t nListVersionIn, const std::vector<CFrenchnodeBroadcast>& vBroadcasts);
+};
+
+typedef boost::shared_ptr<const CFrenchnodeListSnapshot> CFrenchnodeListSnapshotRef;
+
 class CFrenchnodeMan
 {
 private:
@@ -65,13 +116,40 @@ private:
     std::map<CNetAddr, int64_t> mWeAskedForFrenchnodeList;
     // which Frenchnodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForFrenchnodeListEntry;
+    // peers we asked for the whole list and when; only they may send "mnblist" batches
+    std::map<NodeId, int64_t> mapListRequested;
+    // rank tables by block height and minimum protocol version
+    std::map<std::pair<int64_t, int>, CFrenchnodeRanksRef> mapRanks;
+    // bumped whenever the list or a Frenchnode's state changes
+    int64_t nListVersion;
+    // the full list announcement for dseg, built at nListVersion
+    CFrenchnodeListSnapshotRef listSnapshot;
+
+    /// Check and add a Frenchnode broadcast received from a peer
+    void ProcessBroadcast(CNode* pfrom, CFrenchnodeBroadcast& mnb);
 
 public:
+    // guards the two seen maps below, which message handlers, getdata and the list
+    // snapshot use without holding cs; taken after cs and before masternodeSync.cs
+    mutable CCriticalSection cs_mapSeen;
+
     // Keep track of all broadcasts I've seen
     map<uint256, CFrenchnodeBroadcast> mapSeenFrenchnodeBroadcast;
     // Keep track of all pings I've seen
     map<uint256, CFrenchnodePing> mapSeenFrenchnodePing;
 
+    // tables of the manager in mncache.log
+    enum {
+        MN_RECORD_LIST,
+        MN_RECORD_ASKED_US,
+        MN_RECORD_WE_ASKED,
+        MN_RECORD_WE_ASKED_ENTRY,
+        MN_RECORD_SEEN_BROADCAST,
+        MN_RECORD_SEEN_PING
+    };
+    // entries changed since the last dump, marked wherever the tables above are changed
+    CRecordChanges recordChanges;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -90,6 +168,11 @@ public:
     CFrenchnodeMan();
     CFrenchnodeMan(CFrenchnodeMan& other);
 
+    /// Contents as CRecordLog records, and back
+    void GetRecords(CRecordMap& records) const;
+    void GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const;
+    bool LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue);
+
     /// Add an entry
     bool Add(CFrenchnode& mn);
 
@@ -109,7 +192,11 @@ public:
 
     void CountNetworks(int protocolVersion, int& ipv4, int& ipv6, int& onion);
 
-    void DsegUpdate(CNode* pnode);
+    bool DsegUpdate(CNode* pnode);
+    /// The peer sent the last of the list we asked it for
+    void ListReplied(NodeId nodeid);
+    /// Whether the peer may send "mnblist" batches: we asked it for the list and it hasn't finished or timed out
+    bool IsListRequested(NodeId nodeid, int64_t nNow);
 
     /// Find an entry
     CFrenchnode* Find(const CScript& payee);
@@ -131,7 +218,20 @@ public:
         return vFrenchnodes;
     }
 
-    std::vector<pair<int, CFrenchnode> > GetFrenchnodeRanks(int64_t nBlockHeight, int minProtocol = 0);
+    /// Mark the Frenchnodes whose collateral the block spent, then look up the others in the UTXO set
+    void ConnectedBlock(const CBlock& block, const CCoinsViewCache& view);
+    /// Re-check the Frenchnodes whose collateral the block spent
+    void DisconnectedBlock(const CBlock& block);
+
+    /// Rank table for a block, shared until the list changes or the block is disconnected
+    CFrenchnodeRanksRef GetRanks(int64_t nBlockHeight, int minProtocol = 0);
+    /// The list or a Frenchnode's state changed: drop the rank tables and the list snapshot
+    void ListChanged();
+    /// The full list announcement, shared until the list changes
+    CFrenchnodeListSnapshotRef GetListSnapshot();
+
+    /// Enabled Frenchnodes by rank, then the others
+    std::vector<pair<int, CTxIn> > GetFrenchnodeRanks(int64_t nBlockHeight, int minProtocol = 0);
     int GetFrenchnodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     CFrenchnode* GetFrenchnodeByRank(int nRank, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
 
@@ -0,0 +1,129 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "crypto/sha256.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+
+namespace
+{
+/** The prime 2^3072 - 1103717, computed once */
+class CMuHashPrime
+{
+public:
+    BIGNUM* bn;
+
+    CMuHashPrime()
+    {
+        bn = BN_new();
+        BN_one(bn);
+        BN_lshift(bn, bn, 3072);
+        BN_sub_word(bn, 1103717);
+    }
+
+    ~CMuHashPrime()
+    {
+        BN_free(bn);
+    }
+};
+
+const BIGNUM* GetPrime()
+{
+    static CMuHashPrime prime;
+    return prime.bn;
+}
+
+void SetOne(unsigned char* pch)
+{
+    memset(pch, 0, CMuHash3072::BYTE_SIZE);
+    pch[CMuHash3072::BYTE_SIZE - 1] = 1;
+}
+
+void ToBytes(const BIGNUM* bn, unsigned char* pch)
+{
+    int nBytes = BN_num_bytes(bn);
+    assert(nBytes >= 0 && (size_t)nBytes <= CMuHash3072::BYTE_SIZE);
+    memset(pch, 0, CMuHash3072::BYTE_SIZE - nBytes);
+    BN_bn2bin(bn, pch + CMuHash3072::BYTE_SIZE - nBytes);
+}
+
+/** pchAcc = pchAcc * pchFactor (mod prime), with an optional inversion of pchFactor */
+void MulMod(unsigned char* pchAcc, const unsigned char* pchFactor, bool fInvertFactor = false)
+{
+    BN_CTX* ctx = BN_CTX_new();
+    BIGNUM* acc = BN_bin2bn(pchAcc, CMuHash3072::BYTE_SIZE, NULL);
+    BIGNUM* factor = BN_bin2bn(pchFactor, CMuHash3072::BYTE_SIZE, NULL);
+    assert(ctx && acc && factor);
+    if (fInvertFactor) {
+        bool fInverted = BN_mod_inverse(factor, factor, GetPrime(), ctx) != NULL;
+        assert(fInverted);
+    }
+    BN_mod_mul(acc, acc, factor, GetPrime(), ctx);
+    ToBytes(acc, pchAcc);
+    BN_free(factor);
+    BN_free(acc);
+    BN_CTX_free(ctx);
+}
+
+/** Expand an element to a 3072-bit number by hashing it in counter mode */
+void HashElement(const unsigned char* pch, size_t len, unsigned char* pchOut)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(pch, len).Finalize(hash);
+    for (unsigned char i = 0; i < CMuHash3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++)
+        CSHA256().Write(hash, sizeof(hash)).Write(&i, 1).Finalize(pchOut + i * CSHA256::OUTPUT_SIZE);
+}
+} // anon namespace
+
+CMuHash3072::CMuHash3072()
+{
+    SetOne(vchNumerator);
+    SetOne(vchDenominator);
+}
+
+CMuHash3072& CMuHash3072::Insert(const unsigned char* pch, size_t len)
+{
+    unsigned char vchElement[BYTE_SIZE];
+    HashElement(pch, len, vchElement);
+    MulMod(vchNumerator, vchElement);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::Remove(const unsigned char* pch, size_t len)
+{
+    unsigned char vchElement[BYTE_SIZE];
+    HashElement(pch, len, vchElement);
+    MulMod(vchDenominator, vchElement);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::operator*=(const CMuHash3072& other)
+{
+    MulMod(vchNumerator, other.vchNumerator);
+    MulMod(vchDenominator, other.vchDenominator);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::operator/=(const CMuHash3072& other)
+{
+    MulMod(vchNumerator, other.vchDenominator);
+    MulMod(vchDenominator, other.vchNumerator);
+    return *this;
+}
+
+uint256 CMuHash3072::Finalize() const
+{
+    unsigned char vchResult[BYTE_SIZE];
+    memcpy(vchResult, vchNumerator, BYTE_SIZE);
+    MulMod(vchResult, vchDenominator, true);
+
+    uint256 hash;
+    CSHA256().Write(vchResult, BYTE_SIZE).Finalize(hash.begin());
+    return hash;
+}
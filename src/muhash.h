@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FRENCH_MUHASH_H
+#define FRENCH_MUHASH_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stddef.h>
+
+/**
+ * Order-independent hash of a multiset of byte strings (MuHash).
+ *
+ * Every element is hashed to a number modulo the prime 2^3072 - 1103717 and the
+ * multiset is represented by the product of its elements. Removal multiplies the
+ * denominator instead, so elements can be added and removed in any order and only
+ * Finalize() needs a modular inverse. Two hashes of the same multiset are equal no
+ * matter how they were built.
+ */
+class CMuHash3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+private:
+    //! Big-endian numerator and denominator, both reduced modulo the prime
+    unsigned char vchNumerator[BYTE_SIZE];
+    unsigned char vchDenominator[BYTE_SIZE];
+
+public:
+    //! The hash of the empty set
+    CMuHash3072();
+
+    //! Add an element
+    CMuHash3072& Insert(const unsigned char* pch, size_t len);
+    //! Remove an element (which does not need to have been inserted first)
+    CMuHash3072& Remove(const unsigned char* pch, size_t len);
+    //! Combine with another set; the result represents the union of both
+    CMuHash3072& operator*=(const CMuHash3072& other);
+    //! Subtract another set
+    CMuHash3072& operator/=(const CMuHash3072& other);
+
+    //! Digest of the represented multiset
+    uint256 Finalize() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(FLATDATA(vchNumerator));
+        READWRITE(FLATDATA(vchDenominator));
+    }
+};
+
+#endif // FRENCH_MUHASH_H
@@ -29,6 +29,12 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define USE_EPOLL
 #endif
 
 #ifdef USE_UPNP
@@ -38,6 +44,9 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#include <limits>
+#include <set>
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -93,7 +102,7 @@ bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CFramedMessageRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -112,11 +121,83 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+int nMessageHandlerThreads = DEFAULT_MSGHAND_THREADS;
+int nMaxConnecting = DEFAULT_MAX_CONNECTING;
+int64_t nMaxPeerUploadRate = DEFAULT_MAX_PEER_UPLOAD_RATE * 1000;
+
+#ifdef USE_EPOLL
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_EPOLL;
+static int hEpoll = -1;
+#else
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_SELECT;
+#endif
 
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+bool SetSocketEventsMode(const std::string& strMode)
+{
+    if (strMode == "select") {
+        nSocketEventsMode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef USE_EPOLL
+    if (strMode == "epoll") {
+        nSocketEventsMode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/** select() cannot watch descriptors >= FD_SETSIZE; the other backends have no such limit */
+static bool IsUsableSocket(SOCKET hSocket)
+{
+    return nSocketEventsMode != SOCKETEVENTS_SELECT || IsSelectableSocket(hSocket);
+}
+
+#ifdef USE_EPOLL
+/** Update a node's epoll registration. Requires cs_hSocket, which keeps the descriptor from being closed meanwhile. */
+static void UpdateEpollRegistration(CNode* pnode, int op, bool fSend)
+{
+    if (hEpoll == -1 || pnode->hSocket == INVALID_SOCKET)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (fSend ? EPOLLOUT : 0);
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, op, pnode->hSocket, &event) != 0)
+        LogPrintf("%s : epoll_ctl failed for peer=%d: %s\n", __func__, pnode->id, NetworkErrorString(errno));
+}
+#endif
+
+/** Start watching a newly connected node's socket */
+static void RegisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL) {
+        // The version message may already be queued
+        LOCK2(pnode->cs_vSend, pnode->cs_hSocket);
+        pnode->fSendInterest = !pnode->vSendMsg.empty();
+        UpdateEpollRegistration(pnode, EPOLL_CTL_ADD, pnode->fSendInterest);
+        pnode->fSocketRegistered = true;
+    }
+#endif
+}
+
+/** Ask for write readiness only while there is something queued. Requires cs_vSend. */
+static void UpdateSendInterest(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    bool fSend = !pnode->vSendMsg.empty();
+    if (pnode->fSocketRegistered && fSend != pnode->fSendInterest) {
+        LOCK(pnode->cs_hSocket);
+        UpdateEpollRegistration(pnode, EPOLL_CTL_MOD, fSend);
+        pnode->fSendInterest = fSend;
+    }
+#endif
+}
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -353,8 +434,16 @@ void AddressCurrentlyConnected(const CService& addr)
 
 uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
+uint64_t CNode::nMaxOutboundLimit = 0;
+uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
+uint64_t CNode::nMaxOutboundCycleStartTime = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CCriticalSection CNode::cs_mapProcessingTime;
+CCriticalSection CNode::cs_mapTrafficTotal;
+mapMsgCmdTraffic CNode::mapSendTrafficTotal;
+mapMsgCmdTraffic CNode::mapRecvTrafficTotal;
+std::map<std::string, CMessageTimeStats> CNode::mapProcessingTime;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -399,6 +488,32 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+/** Add a node for an outbound socket that has just connected, which it takes over */
+static CNode* AddConnectedNode(SOCKET hSocket, const CAddress& addrConnect, const char* pszDest)
+{
+    if (!IsUsableSocket(hSocket)) {
+        LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
+        CloseSocket(hSocket);
+        return NULL;
+    }
+
+    addrman.Attempt(addrConnect);
+
+    // Add node
+    CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
+    pnode->AddRef();
+    RegisterNodeSocket(pnode);
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+
+    pnode->nTimeConnected = GetTime();
+
+    return pnode;
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char* pszDest)
 {
     if (pszDest == NULL) {
@@ -425,26 +540,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest)
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
-            LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
-            CloseSocket(hSocket);
-            return NULL;
-        }
-
-        addrman.Attempt(addrConnect);
-
-        // Add node
-        CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
-        pnode->AddRef();
-
-        {
-            LOCK(cs_vNodes);
-            vNodes.push_back(pnode);
-        }
-
-        pnode->nTimeConnected = GetTime();
-
-        return pnode;
+        return AddConnectedNode(hSocket, addrConnect, pszDest);
     } else if (!proxyConnectionFailed) {
         // If connecting to the node failed, and failure is not caused by a problem connecting to
         // the proxy, mark this as an attempt.
@@ -457,9 +553,12 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest)
 void CNode::CloseSocketDisconnect()
 {
     fDisconnect = true;
-    if (hSocket != INVALID_SOCKET) {
-        LogPrint("net", "disconnecting peer=%d\n", id);
-        CloseSocket(hSocket);
+    {
+        LOCK(cs_hSocket);
+        if (hSocket != INVALID_SOCKET) {
+            LogPrint("net", "disconnecting peer=%d\n", id);
+            CloseSocket(hSocket);
+        }
     }
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
@@ -663,6 +762,13 @@ void CNode::copyStats(CNodeStats& stats)
     X(nSendBytes);
     X(nRecvBytes);
     X(fWhitelisted);
+    X(nProcessedMsgs);
+    stats.dProcessingTime = ((double)nProcessingMicros) / 1e6;
+    {
+        LOCK(cs_msgTraffic);
+        X(mapSendTrafficPerCmd);
+        X(mapRecvTrafficPerCmd);
+    }
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -715,6 +821,7 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            RecordMessageTraffic(msg.hdr.GetCommand(), CMessageHeader::HEADER_SIZE + msg.hdr.nMessageSize, false);
             messageHandlerCondition.notify_one();
         }
     }
@@ -772,23 +879,60 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CFramedMessageRef>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
+        size_t nAllowance = pnode->GetSendAllowance();
+        if (nAllowance == 0)
+            break; // over -maxpeeruploadrate; the socket handler retries later
+#ifdef WIN32
+        const CSerializeData& data = **it;
         assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        size_t nToSend = std::min(data.size() - pnode->nSendOffset, nAllowance);
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Hand the kernel as many queued messages as it will take in one call,
+        // straight from the (possibly shared) message buffers
+        struct iovec vIov[MAX_SEND_IOV];
+        int nIov = 0;
+        size_t nToSend = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CFramedMessageRef>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV && nToSend < nAllowance; ++itIov) {
+            const CSerializeData& data = **itIov;
+            assert(data.size() > nOffset);
+            size_t nLen = std::min(data.size() - nOffset, nAllowance - nToSend);
+            vIov[nIov].iov_base = (void*)&data[nOffset];
+            vIov[nIov].iov_len = nLen;
+            nIov++;
+            nToSend += nLen;
+            nOffset = 0;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vIov;
+        msg.msg_iovlen = nIov;
+        int nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
+            pnode->dSendTokens -= nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the messages that went out completely
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                size_t nSize = (*it)->size();
+                if (nSent < nSize - pnode->nSendOffset) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nSize - pnode->nSendOffset;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= nSize;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nToSend) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -810,74 +954,198 @@ void SocketSendData(CNode* pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    UpdateSendInterest(pnode);
 }
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+static void DisconnectNodes(unsigned int& nPrevNodeCount)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        size_t vNodesSize;
+    }
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!IsUsableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+        RegisterNodeSocket(pnode);
+
         {
             LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            vNodes.push_back(pnode);
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+/** Whether the receive buffer has room for more data. Requires cs_vRecvMsg. */
+static bool CanReceiveMore(CNode* pnode)
+{
+    return pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+           pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+}
+
+/**
+ * Read from a node's socket. With fDrain, keep reading until the socket has nothing
+ * left, as edge-triggered readiness requires. Returns false if data may have been
+ * left unread (receive buffer busy or full), in which case the caller must come back.
+ */
+static bool SocketRecvData(CNode* pnode, bool fDrain)
+{
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    if (!lockRecv)
+        return false;
+
+    do {
+        if (pnode->hSocket == INVALID_SOCKET)
+            return true;
+        if (fDrain && !CanReceiveMore(pnode))
+            return false;
+
+        // typical socket buffer is 8K-64K
+        char pchBuf[0x10000];
+        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+        if (nBytes > 0) {
+            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                pnode->CloseSocketDisconnect();
+            pnode->nLastRecv = GetTime();
+            pnode->nRecvBytes += nBytes;
+            pnode->RecordBytesRecv(nBytes);
+        } else if (nBytes == 0) {
+            // socket closed gracefully
+            if (!pnode->fDisconnect)
+                LogPrint("net", "socket closed\n");
+            pnode->CloseSocketDisconnect();
+        } else if (nBytes < 0) {
+            // error
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+                if (!pnode->fDisconnect)
+                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+                pnode->CloseSocketDisconnect();
+            }
+            return true;
         }
+    } while (fDrain);
+    return true;
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+static void ThreadSocketHandlerSelect()
+{
+    unsigned int nPrevNodeCount = 0;
+    while (true) {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes(nPrevNodeCount);
 
         //
         // Find which sockets have data to receive
@@ -928,14 +1196,16 @@ void ThreadSocketHandler()
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
                     if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
+                        // A peer over -maxpeeruploadrate waits for the next poll instead
+                        // of making select() return at once
+                        if (!pnode->IsSendThrottled())
+                            FD_SET(pnode->hSocket, &fdsetSend);
                         continue;
                     }
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && CanReceiveMore(pnode))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -961,49 +1231,8 @@ void ThreadSocketHandler()
         // Accept new connections
         //
         BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                AcceptConnection(hListenSocket);
         }
 
         //
@@ -1024,36 +1253,8 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+                SocketRecvData(pnode, false);
 
             //
             // Send
@@ -1069,22 +1270,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1094,6 +1280,131 @@ void ThreadSocketHandler()
     }
 }
 
+#ifdef USE_EPOLL
+/**
+ * Service one node after a readiness notification. Returns false if something could
+ * not be done now (a lock was busy, the receive buffer is full or the peer is over
+ * its upload rate); with edge-triggered notifications nothing will remind us, so
+ * the caller has to retry later.
+ */
+static bool ServiceNodeSocket(CNode* pnode, bool fRecv, bool fSend)
+{
+    bool fDone = true;
+    if (fRecv && !SocketRecvData(pnode, true))
+        fDone = false;
+    if (fSend) {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (!lockSend)
+            fDone = false;
+        else if (!pnode->vSendMsg.empty()) {
+            SocketSendData(pnode);
+            // Held back by -maxpeeruploadrate: no readiness event will tell us to go on
+            if (!pnode->vSendMsg.empty() && pnode->IsSendThrottled())
+                fDone = false;
+        }
+    }
+    return fDone;
+}
+
+/**
+ * Edge-triggered epoll loop. Work is proportional to the number of sockets that
+ * became ready, not to the number of peers: nodes are registered once when they
+ * connect, write interest is only set while vSendMsg is non-empty (see
+ * SocketSendData), and complete messages wake the message handler directly from
+ * ReceiveMsgBytes. The O(peers) inactivity check runs once a second.
+ */
+static void ThreadSocketHandlerEpoll()
+{
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = (void*)&hListenSocket;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+            LogPrintf("%s : epoll_ctl failed for listening socket: %s\n", __func__, NetworkErrorString(errno));
+    }
+
+    unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
+    // Nodes that may have unread data or unsent messages; each holds a reference
+    vector<CNode*> vNodesPending;
+    vector<struct epoll_event> vEvents(1024);
+
+    while (true) {
+        DisconnectNodes(nPrevNodeCount);
+
+        int nEvents = epoll_wait(hEpoll, &vEvents[0], vEvents.size(), 50);
+        boost::this_thread::interruption_point();
+        if (nEvents < 0) {
+            if (errno != EINTR)
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
+            nEvents = 0;
+        }
+
+        // Retry nodes we could not finish with last time
+        vector<CNode*> vNodesRetry;
+        vNodesRetry.swap(vNodesPending);
+        BOOST_FOREACH (CNode* pnode, vNodesRetry) {
+            if (ServiceNodeSocket(pnode, true, true)) {
+                LOCK(cs_vNodes);
+                pnode->fSocketPending = false;
+                pnode->Release();
+            } else {
+                vNodesPending.push_back(pnode);
+            }
+        }
+
+        // Nodes are only deleted by DisconnectNodes above, after their socket (and
+        // with it their epoll registration) was closed, so every node pointer
+        // returned by epoll_wait stays valid until the next iteration.
+        for (int i = 0; i < nEvents; i++) {
+            boost::this_thread::interruption_point();
+            const struct epoll_event& event = vEvents[i];
+
+            bool fListen = false;
+            BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+                if (event.data.ptr == (void*)&hListenSocket) {
+                    AcceptConnection(hListenSocket);
+                    fListen = true;
+                }
+            }
+            if (fListen)
+                continue;
+
+            CNode* pnode = (CNode*)event.data.ptr;
+            bool fRecv = (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+            bool fSend = (event.events & EPOLLOUT) != 0;
+            if (!ServiceNodeSocket(pnode, fRecv, fSend)) {
+                LOCK(cs_vNodes);
+                if (!pnode->fSocketPending) {
+                    pnode->fSocketPending = true;
+                    pnode->AddRef();
+                    vNodesPending.push_back(pnode);
+                }
+            }
+        }
+
+        if (GetTime() != nLastInactivityCheck) {
+            nLastInactivityCheck = GetTime();
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodes)
+                InactivityCheck(pnode);
+        }
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL) {
+        ThreadSocketHandlerEpoll();
+        return;
+    }
+#endif
+    ThreadSocketHandlerSelect();
+}
+
 
 #ifdef USE_UPNP
 void ThreadMapPort()
@@ -1286,6 +1597,19 @@ void static ProcessOneShot()
     }
 }
 
+/** An outbound connection being established by ThreadOpenConnections, with the slot it will fill */
+struct COutboundAttempt {
+    CAddress addr;
+    boost::shared_ptr<CSemaphoreGrant> grant;
+};
+
+/**
+ * Up to nMaxConnecting direct connections are started at a time and waited on together,
+ * so an unreachable candidate only holds up its own attempt for nConnectTimeout. Every
+ * attempt holds an outbound slot, so there are never more attempts and connections
+ * together than slots, and whichever attempts succeed first fill them. Addresses
+ * reached through a proxy still connect one at a time, as the handshake blocks.
+ */
 void ThreadOpenConnections()
 {
     // Connect to specific addresses
@@ -1305,14 +1629,31 @@ void ThreadOpenConnections()
 
     // Initiate network connections
     int64_t nStart = GetTime();
+    CConnectingSockets connecting;
+    map<CService, COutboundAttempt> mapAttempts;
     while (true) {
         ProcessOneShot();
 
-        MilliSleep(500);
-
-        CSemaphoreGrant grant(*semOutbound);
+        // Sleeps when nothing is being connected
+        vector<pair<CService, SOCKET> > vConnected;
+        vector<CService> vFailed;
+        connecting.Wait(500, vConnected, vFailed);
         boost::this_thread::interruption_point();
 
+        for (unsigned int i = 0; i < vConnected.size(); i++) {
+            COutboundAttempt& attempt = mapAttempts[vConnected[i].first];
+            CNode* pnode = AddConnectedNode(vConnected[i].second, attempt.addr, NULL);
+            if (pnode) {
+                attempt.grant->MoveTo(pnode->grantOutbound);
+                pnode->fNetworkNode = true;
+            }
+            mapAttempts.erase(vConnected[i].first);
+        }
+        for (unsigned int i = 0; i < vFailed.size(); i++) {
+            addrman.Attempt(mapAttempts[vFailed[i]].addr);
+            mapAttempts.erase(vFailed[i]);
+        }
+
         // Add seed nodes if DNS seeds are all down (an infrastructure attack?).
         if (addrman.size() == 0 && (GetTime() - nStart > 60)) {
             static bool done = false;
@@ -1323,11 +1664,6 @@ void ThreadOpenConnections()
             }
         }
 
-        //
-        // Choose an address to connect to based on most recently seen
-        //
-        CAddress addrConnect;
-
         // Only connect out to one peer per network group (/16 for IPv4).
         // Do this here so we don't have to critsect vNodes inside mapAddresses critsect.
         int nOutbound = 0;
@@ -1341,41 +1677,72 @@ void ThreadOpenConnections()
                 }
             }
         }
+        for (map<CService, COutboundAttempt>::const_iterator it = mapAttempts.begin(); it != mapAttempts.end(); ++it)
+            setConnected.insert(it->second.addr.GetGroup());
 
         int64_t nANow = GetAdjustedTime();
 
-        int nTries = 0;
-        while (true) {
-            CAddress addr = addrman.Select();
+        while ((int)connecting.size() < nMaxConnecting) {
+            boost::shared_ptr<CSemaphoreGrant> grant(new CSemaphoreGrant(*semOutbound, true));
+            if (!*grant)
+                break;
+
+            //
+            // Choose an address to connect to based on most recently seen
+            //
+            CAddress addrConnect;
+            int nTries = 0;
+            while (true) {
+                CAddress addr = addrman.Select();
+
+                // if we selected an invalid address, restart
+                if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
+                    break;
 
-            // if we selected an invalid address, restart
-            if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
+                // If we didn't find an appropriate destination after trying 100 addresses fetched from addrman,
+                // stop this loop, and let the outer loop run again (which sleeps, adds seed nodes, recalculates
+                // already-connected network ranges, ...) before trying new addrman addresses.
+                nTries++;
+                if (nTries > 100)
+                    break;
+
+                if (IsLimited(addr))
+                    continue;
+
+                // only consider very recently tried nodes after 30 failed attempts
+                if (nANow - addr.nLastTry < 600 && nTries < 30)
+                    continue;
+
+                // do not allow non-default ports, unless after 50 invalid addresses selected already
+                if (addr.GetPort() != Params().GetDefaultPort() && nTries < 50)
+                    continue;
+
+                addrConnect = addr;
                 break;
+            }
 
-            // If we didn't find an appropriate destination after trying 100 addresses fetched from addrman,
-            // stop this loop, and let the outer loop run again (which sleeps, adds seed nodes, recalculates
-            // already-connected network ranges, ...) before trying new addrman addresses.
-            nTries++;
-            if (nTries > 100)
+            if (!addrConnect.IsValid())
                 break;
+            setConnected.insert(addrConnect.GetGroup());
 
-            if (IsLimited(addr))
+            proxyType proxy;
+            if (GetProxy(addrConnect.GetNetwork(), proxy)) {
+                OpenNetworkConnection(addrConnect, grant.get());
                 continue;
+            }
 
-            // only consider very recently tried nodes after 30 failed attempts
-            if (nANow - addr.nLastTry < 600 && nTries < 30)
+            if (FindNode((CNetAddr)addrConnect) || CNode::IsBanned(addrConnect) || FindNode(addrConnect.ToStringIPPort()))
                 continue;
-
-            // do not allow non-default ports, unless after 50 invalid addresses selected already
-            if (addr.GetPort() != Params().GetDefaultPort() && nTries < 50)
+            LogPrint("net", "trying connection %s lastseen=%.1fhrs\n",
+                addrConnect.ToString(), (double)(GetAdjustedTime() - addrConnect.nTime) / 3600.0);
+            if (!connecting.Start(addrConnect, nConnectTimeout)) {
+                addrman.Attempt(addrConnect);
                 continue;
-
-            addrConnect = addr;
-            break;
+            }
+            COutboundAttempt& attempt = mapAttempts[addrConnect];
+            attempt.addr = addrConnect;
+            attempt.grant = grant;
         }
-
-        if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
     }
 }
 
@@ -1476,7 +1843,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant* grantOu
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nWorker)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1492,17 +1859,25 @@ void ThreadMessageHandler()
             }
         }
 
-        // Poll the connected nodes for messages
+        // Only one worker picks the trickle node, so adding workers does not speed up trickling
         CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
+        if (nWorker == 0 && !vNodesCopy.empty())
             pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
 
         bool fSleep = true;
 
-        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+        // Start at a different node in each worker, so they don't all queue up behind the same busy one
+        size_t nStart = vNodesCopy.empty() ? 0 : GetRand(vNodesCopy.size());
+        for (size_t i = 0; i < vNodesCopy.size(); i++) {
+            CNode* pnode = vNodesCopy[(nStart + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            // A node is handled by one worker at a time, which keeps its messages in order
+            TRY_LOCK(pnode->cs_msgProcessing, lockProcessing);
+            if (!lockProcessing)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1577,7 +1952,7 @@ bool BindListenPort(const CService& addrBind, string& strError, bool fWhiteliste
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket)) {
+    if (!IsUsableSocket(hListenSocket)) {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
         return false;
@@ -1722,6 +2097,16 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+#ifdef USE_EPOLL
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL && hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            LogPrintf("epoll_create1 failed (%s), falling back to select\n", NetworkErrorString(errno));
+            nSocketEventsMode = SOCKETEVENTS_SELECT;
+        }
+    }
+#endif
+
     Discover(threadGroup);
 
     //
@@ -1746,7 +2131,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        boost::function<void()> messageHandler = boost::bind(&ThreadMessageHandler, i);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", messageHandler));
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -1796,6 +2184,11 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef USE_EPOLL
+        if (hEpoll != -1)
+            close(hEpoll);
+        hEpoll = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1827,18 +2220,7 @@ void RelayTransaction(const CTransaction& tx)
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 {
     CInv inv(MSG_TX, tx.GetHash());
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime()) {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
-
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
+    AddRelayMessage(inv, MakeFramedMessage("tx", ss));
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes) {
         if (!pnode->fRelayTxes)
@@ -1854,7 +2236,9 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
 {
-    CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    CFramedMessageRef msg = MakeFramedMessage("ix", ss);
 
     //broadcast the new lock
     LOCK(cs_vNodes);
@@ -1862,7 +2246,7 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
         if (!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("ix", tx);
+        pnode->PushSharedMessage(msg);
     }
 }
 
@@ -1877,6 +2261,20 @@ void RelayInv(CInv& inv)
     }
 }
 
+void AddRelayMessage(const CInv& inv, const CFramedMessageRef& msg)
+{
+    LOCK(cs_mapRelay);
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime()) {
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    // Save original serialized message so newer versions are preserved
+    if (mapRelay.insert(std::make_pair(inv, msg)).second)
+        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+}
+
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -1887,6 +2285,73 @@ void CNode::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+
+    uint64_t now = GetTime();
+    if (nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME < now) {
+        // timeframe expired, reset cycle
+        nMaxOutboundCycleStartTime = now;
+        nMaxOutboundTotalBytesSentInCycle = 0;
+    }
+    nMaxOutboundTotalBytesSentInCycle += bytes;
+}
+
+void CNode::SetMaxOutboundTarget(uint64_t limit)
+{
+    LOCK(cs_totalBytesSent);
+    nMaxOutboundLimit = limit;
+}
+
+uint64_t CNode::GetMaxOutboundTarget()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundLimit;
+}
+
+bool CNode::OutboundTargetReached()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return false;
+    // A cycle that has run out but saw no traffic since is not reset yet
+    if (nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME < (uint64_t)GetTime())
+        return false;
+    return nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit;
+}
+
+uint64_t CNode::GetOutboundTargetBytesLeft()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+    if (nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME < (uint64_t)GetTime())
+        return nMaxOutboundLimit;
+    return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
+}
+
+uint64_t CNode::GetMaxOutboundTimeLeftInCycle()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+    uint64_t cycleEndTime = nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME;
+    uint64_t now = GetTime();
+    return (cycleEndTime < now) ? 0 : cycleEndTime - now;
+}
+
+size_t CNode::GetSendAllowance()
+{
+    if (nMaxPeerUploadRate <= 0 || fWhitelisted)
+        return std::numeric_limits<size_t>::max();
+    // Refill at the configured rate, allowing bursts of up to one second's worth
+    int64_t nNow = GetTimeMicros();
+    dSendTokens = std::min((double)nMaxPeerUploadRate, dSendTokens + (nNow - nSendTokensTime) * (double)nMaxPeerUploadRate / 1000000);
+    nSendTokensTime = nNow;
+    return dSendTokens >= 1 ? (size_t)dSendTokens : 0;
+}
+
+bool CNode::IsSendThrottled()
+{
+    return GetSendAllowance() == 0;
 }
 
 uint64_t CNode::GetTotalBytesRecv()
@@ -1901,6 +2366,84 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+const std::string& GetMessageStatsKey(const std::string& strCommand)
+{
+    // Commands come straight from the wire; made-up ones all share one entry so
+    // they can't grow the per-command maps without bound
+    static const char* const knownCommands[] = {
+        "version", "verack", "addr", "getaddr", "inv", "getdata", "notfound",
+        "getblocks", "getheaders", "headers", "block", "merkleblock", "tx", "mempool",
+        "ping", "pong", "alert", "reject", "filterload", "filteradd", "filterclear",
+        "sendcmpct", "cmpctblock", "getblocktxn", "blocktxn",
+        "spork", "getsporks", "ix", "txlvote",
+        "mnb", "mnblist", "mnp", "mnw", "mnget", "dseg", "ssc",
+        "mnvs", "mprop", "mvote", "fbs", "fbvote"};
+    static const std::set<std::string> setKnown(knownCommands, knownCommands + ARRAYLEN(knownCommands));
+    static const std::string strOther("*other*");
+
+    std::set<std::string>::const_iterator it = setKnown.find(strCommand);
+    return it != setKnown.end() ? *it : strOther;
+}
+
+int64_t CMessageTimeStats::GetBucketBound(int n)
+{
+    if (n >= BUCKETS - 1)
+        return -1;
+    int64_t nBound = 10;
+    for (int i = 0; i < n; i++)
+        nBound *= 10;
+    return nBound;
+}
+
+void CMessageTimeStats::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    int n = 0;
+    for (int64_t nBound = 10; n < BUCKETS - 1 && nMicros > nBound; nBound *= 10)
+        n++;
+    vBuckets[n]++;
+}
+
+void CNode::RecordProcessingTime(const std::string& strCommand, int64_t nMicros)
+{
+    nProcessedMsgs++;
+    nProcessingMicros += nMicros;
+
+    LOCK(cs_mapProcessingTime);
+    mapProcessingTime[GetMessageStatsKey(strCommand)].Add(nMicros);
+}
+
+void CNode::GetProcessingTimeStats(std::map<std::string, CMessageTimeStats>& mapStats)
+{
+    LOCK(cs_mapProcessingTime);
+    mapStats = mapProcessingTime;
+}
+
+void CNode::RecordMessageTraffic(const std::string& strCommand, uint64_t nBytes, bool fSent)
+{
+    const std::string& strKey = GetMessageStatsKey(strCommand);
+    {
+        LOCK(cs_msgTraffic);
+        CMessageTrafficStats& stats = (fSent ? mapSendTrafficPerCmd : mapRecvTrafficPerCmd)[strKey];
+        stats.nCount++;
+        stats.nBytes += nBytes;
+    }
+
+    LOCK(cs_mapTrafficTotal);
+    CMessageTrafficStats& stats = (fSent ? mapSendTrafficTotal : mapRecvTrafficTotal)[strKey];
+    stats.nCount++;
+    stats.nBytes += nBytes;
+}
+
+void CNode::GetMessageTrafficTotals(mapMsgCmdTraffic& mapSent, mapMsgCmdTraffic& mapRecv)
+{
+    LOCK(cs_mapTrafficTotal);
+    mapSent = mapSendTrafficTotal;
+    mapRecv = mapRecvTrafficTotal;
+}
+
 void CNode::Fuzz(int nChance)
 {
     if (!fSuccessfullyConnected) return; // Don't fuzz initial handshake
@@ -2032,7 +2575,9 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION),
+                                                                                            addrKnown(5000, 0.001),
+                                                                                            filterInventoryKnown(SendBufferSize() / 1000, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2041,6 +2586,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nLastRecv = 0;
     nSendBytes = 0;
     nRecvBytes = 0;
+    nProcessedMsgs = 0;
+    nProcessingMicros = 0;
     nTimeConnected = GetTime();
     addr = addrIn;
     addrName = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
@@ -2056,11 +2603,15 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fSocketRegistered = false;
+    fSendInterest = false;
+    dSendTokens = nMaxPeerUploadRate;
+    nSendTokensTime = GetTimeMicros();
+    fSocketPending = false;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2170,15 +2721,74 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    ssSend.GetAndClear(*pmsg);
+    QueueFramedMessage(pmsg);
+
+    LEAVE_CRITICAL_SECTION(cs_vSend);
+}
+
+/** Fill in the header of a message laid out as HEADER_SIZE bytes of room followed by the payload */
+static void WriteMessageHeader(const char* pszCommand, CSerializeData& vMsg)
+{
+    assert(vMsg.size() >= CMessageHeader::HEADER_SIZE);
+
+    unsigned int nSize = vMsg.size() - CMessageHeader::HEADER_SIZE;
+    CMessageHeader hdr(pszCommand, nSize);
+    uint256 hash = Hash(vMsg.begin() + CMessageHeader::HEADER_SIZE, vMsg.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << hdr;
+    assert(ssHeader.size() == CMessageHeader::HEADER_SIZE);
+    memcpy(&vMsg[0], &ssHeader[0], CMessageHeader::HEADER_SIZE);
+}
+
+static std::string GetFramedCommand(const CSerializeData& vMsg)
+{
+    const char* pchCommand = &vMsg[MESSAGE_START_SIZE];
+    return std::string(pchCommand, strnlen_int(pchCommand, CMessageHeader::COMMAND_SIZE));
+}
+
+CFramedMessageRef MakeFramedMessage(const char* pszCommand, const CDataStream& ssPayload)
+{
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    pmsg->reserve(CMessageHeader::HEADER_SIZE + ssPayload.size());
+    pmsg->resize(CMessageHeader::HEADER_SIZE);
+    pmsg->insert(pmsg->end(), ssPayload.begin(), ssPayload.end());
+    WriteMessageHeader(pszCommand, *pmsg);
+    return pmsg;
+}
+
+// requires LOCK(cs_vSend)
+void CNode::QueueFramedMessage(const CFramedMessageRef& msg)
+{
+    RecordMessageTraffic(GetFramedCommand(*msg), msg->size(), true);
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
+}
 
-    LEAVE_CRITICAL_SECTION(cs_vSend);
+void CNode::PushFramedMessage(const char* pszCommand, CSerializeData& vMsg)
+{
+    // Build the header outside cs_vSend; hashing a large payload takes a while
+    WriteMessageHeader(pszCommand, vMsg);
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    pmsg->swap(vMsg);
+
+    LOCK(cs_vSend);
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(pszCommand), pmsg->size() - CMessageHeader::HEADER_SIZE, id);
+    QueueFramedMessage(pmsg);
+}
+
+void CNode::PushSharedMessage(const CFramedMessageRef& msg)
+{
+    LOCK(cs_vSend);
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(GetFramedCommand(*msg)), msg->size() - CMessageHeader::HEADER_SIZE, id);
+    QueueFramedMessage(msg);
 }
 
 //
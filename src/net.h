@@ -12,7 +12,6 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -21,6 +20,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
 #include <deque>
 #include <stdint.h>
 
@@ -30,6 +30,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -62,10 +63,31 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** Default number of threads processing peer messages (-msghandthreads) */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+/** Upper bound for -msghandthreads */
+static const int MAX_MSGHAND_THREADS = 16;
+/** Default number of outbound connection attempts in flight at once (-maxconnecting) */
+static const int DEFAULT_MAX_CONNECTING = 8;
+/** Upper bound for -maxconnecting, the most outbound slots there are */
+static const int MAX_CONNECTING = 16;
+/** Most queued messages handed to the kernel in one sendmsg() call */
+static const int MAX_SEND_IOV = 64;
+/** Default for -maxuploadtarget, in MiB per day; 0 = no limit */
+static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
+/** Length of one -maxuploadtarget cycle, in seconds */
+static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
+/** Default for -maxpeeruploadrate, in KB per second; 0 = no limit */
+static const int64_t DEFAULT_MAX_PEER_UPLOAD_RATE = 0;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
+/** A whole message, header included, shared by every send queue it is pushed to */
+typedef boost::shared_ptr<const CSerializeData> CFramedMessageRef;
+//! Frame a serialized payload once, so it can be queued to any number of peers without copying
+CFramedMessageRef MakeFramedMessage(const char* pszCommand, const CDataStream& ssPayload);
+
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
 void AddressCurrentlyConnected(const CService& addr);
@@ -82,6 +104,14 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
+/** How ThreadSocketHandler waits for socket readiness (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+/** Select the socket events backend by name; false if it is unknown or unsupported on this platform */
+bool SetSocketEventsMode(const std::string& strMode);
+
 typedef int NodeId;
 
 // Signals for message handling
@@ -130,10 +160,15 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern SocketEventsMode nSocketEventsMode;
+extern int nMessageHandlerThreads;
+extern int nMaxConnecting;
+//! Per-peer send rate limit in bytes per second (-maxpeeruploadrate), 0 if unlimited
+extern int64_t nMaxPeerUploadRate;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CFramedMessageRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -152,6 +187,16 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Messages and bytes of one command in one direction */
+struct CMessageTrafficStats {
+    uint64_t nCount;
+    uint64_t nBytes;
+
+    CMessageTrafficStats() : nCount(0), nBytes(0) {}
+};
+
+typedef std::map<std::string, CMessageTrafficStats> mapMsgCmdTraffic;
+
 class CNodeStats
 {
 public:
@@ -171,8 +216,38 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    uint64_t nProcessedMsgs;
+    double dProcessingTime;
+    mapMsgCmdTraffic mapSendTrafficPerCmd;
+    mapMsgCmdTraffic mapRecvTrafficPerCmd;
 };
 
+/**
+ * Time spent handling received messages of one command, with a histogram: bucket i
+ * counts the messages that took at most 10^(i+1) microseconds (10us up to 1s), the
+ * last one all slower messages.
+ */
+struct CMessageTimeStats {
+    static const int BUCKETS = 7;
+
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[BUCKETS];
+
+    CMessageTimeStats() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        std::fill(vBuckets, vBuckets + BUCKETS, 0);
+    }
+
+    //! Upper bound of bucket n in microseconds, -1 for the last one
+    static int64_t GetBucketBound(int n);
+    void Add(int64_t nMicros);
+};
+
+//! The key traffic and timing of a command are accounted under: the command itself if it is one we know, "*other*" if not
+const std::string& GetMessageStatsKey(const std::string& strCommand);
+
 
 class CNetMessage
 {
@@ -288,13 +363,33 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CFramedMessageRef> vSendMsg;
     CCriticalSection cs_vSend;
+    // Socket event registration (epoll), guarded by cs_vSend
+    bool fSocketRegistered;
+    bool fSendInterest;
+    // Held while closing hSocket or changing its registration
+    CCriticalSection cs_hSocket;
+    // Whether the socket handler has to come back to this node, guarded by cs_vNodes
+    bool fSocketPending;
+    // Token bucket for -maxpeeruploadrate: bytes that may be sent now and when it was
+    // last refilled (in microseconds), guarded by cs_vSend
+    double dSendTokens;
+    int64_t nSendTokensTime;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
+    // Held by the message handler thread working on this node, so its messages are handled in order
+    CCriticalSection cs_msgProcessing;
+    // Messages handled and time spent on them, written under cs_msgProcessing
+    uint64_t nProcessedMsgs;
+    int64_t nProcessingMicros;
+    // Messages and bytes per command, in each direction
+    CCriticalSection cs_msgTraffic;
+    mapMsgCmdTraffic mapSendTrafficPerCmd;
+    mapMsgCmdTraffic mapRecvTrafficPerCmd;
     int nRecvVersion;
 
     int64_t nLastSend;
@@ -350,12 +445,12 @@ public:
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    mruset<CAddress> setAddrKnown;
+    CRollingBloomFilter addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
@@ -381,9 +476,26 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Outbound limit (-maxuploadtarget), guarded by cs_totalBytesSent
+    static uint64_t nMaxOutboundLimit;
+    static uint64_t nMaxOutboundTotalBytesSentInCycle;
+    static uint64_t nMaxOutboundCycleStartTime;
+
+    // Message handling time per command, summed over all nodes
+    static CCriticalSection cs_mapProcessingTime;
+    static std::map<std::string, CMessageTimeStats> mapProcessingTime;
+
+    // Messages and bytes per command, summed over all nodes
+    static CCriticalSection cs_mapTrafficTotal;
+    static mapMsgCmdTraffic mapSendTrafficTotal;
+    static mapMsgCmdTraffic mapRecvTrafficTotal;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
+    // requires LOCK(cs_vSend)
+    void QueueFramedMessage(const CFramedMessageRef& msg);
+
 public:
     NodeId GetId() const
     {
@@ -430,7 +542,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -438,7 +550,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr)) {
+        if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
             } else {
@@ -452,7 +564,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.GetKey());
         }
     }
 
@@ -460,7 +572,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.GetKey()))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -476,6 +588,16 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    /**
+     * Queue a message whose payload is already serialized, without copying it again.
+     * vMsg holds CMessageHeader::HEADER_SIZE bytes of room followed by the payload;
+     * the header is filled in here and vMsg is moved into the send queue (left empty).
+     */
+    void PushFramedMessage(const char* pszCommand, CSerializeData& vMsg);
+
+    //! Queue a message framed by MakeFramedMessage; other peers may be sending the same buffer
+    void PushSharedMessage(const CFramedMessageRef& msg);
+
     void PushVersion();
 
 
@@ -720,6 +842,29 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    //! Set the daily upload target in bytes, 0 to disable it
+    static void SetMaxOutboundTarget(uint64_t limit);
+    static uint64_t GetMaxOutboundTarget();
+    //! True once the bytes sent in the current cycle reached the upload target
+    static bool OutboundTargetReached();
+    //! Bytes left before the upload target is reached in this cycle (0 if there is no target)
+    static uint64_t GetOutboundTargetBytesLeft();
+    //! Seconds until the current upload target cycle ends (0 if there is no target)
+    static uint64_t GetMaxOutboundTimeLeftInCycle();
+
+    //! Whether -maxpeeruploadrate currently allows nothing to be sent to this peer. Requires cs_vSend.
+    bool IsSendThrottled();
+    //! Bytes that may be sent to this peer right now, refilling its token bucket. Requires cs_vSend.
+    size_t GetSendAllowance();
+
+    // requires LOCK(cs_msgProcessing)
+    void RecordProcessingTime(const std::string& strCommand, int64_t nMicros);
+    static void GetProcessingTimeStats(std::map<std::string, CMessageTimeStats>& mapStats);
+
+    //! Account one whole message, header included, sent to or received from this peer
+    void RecordMessageTraffic(const std::string& strCommand, uint64_t nBytes, bool fSent);
+    static void GetMessageTrafficTotals(mapMsgCmdTraffic& mapSent, mapMsgCmdTraffic& mapRecv);
 };
 
 class CExplicitNetCleanup
@@ -733,6 +878,23 @@ void RelayTransaction(const CTransaction& tx);
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll = false);
 void RelayInv(CInv& inv);
+//! Keep msg in mapRelay for 15 minutes, to answer getdata for inv without serializing anything
+void AddRelayMessage(const CInv& inv, const CFramedMessageRef& msg);
+
+/**
+ * Announce inv to our peers and keep obj framed as a pszCommand message in mapRelay, so
+ * getdata requests from any number of peers share one serialized buffer. Only for objects
+ * whose hash covers everything that gets serialized.
+ */
+template <typename T>
+void RelayMessage(const CInv& inv, const char* pszCommand, const T& obj)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << obj;
+    AddRelayMessage(inv, MakeFramedMessage(pszCommand, ss));
+    CInv invRelay(inv);
+    RelayInv(invRelay);
+}
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
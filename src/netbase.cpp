@@ -25,6 +25,7 @@
 #include <arpa/inet.h>
 #endif
 #include <fcntl.h>
+#include <poll.h>
 #endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
@@ -239,6 +240,29 @@ struct timeval MillisToTimeval(int64_t nTimeout)
     return timeout;
 }
 
+/**
+ * Uses poll() where it is available: select() cannot watch descriptors >= FD_SETSIZE,
+ * and with -socketevents=epoll there is no limit keeping ours below it.
+ */
+int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout)
+{
+#ifdef WIN32
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    int nRet = select(hSocket + 1, fWrite ? NULL : &fdset, fWrite ? &fdset : NULL, NULL, &timeout);
+#else
+    struct pollfd pollfd;
+    pollfd.fd = hSocket;
+    pollfd.events = fWrite ? POLLOUT : POLLIN;
+    pollfd.revents = 0;
+    int nRet = poll(&pollfd, 1, nTimeout);
+#endif
+    if (nRet == SOCKET_ERROR) return SOCKET_ERROR;
+    return nRet > 0 ? 1 : 0;
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes requested
  * or return False on error or timeout.
@@ -267,14 +291,7 @@ bool static InterruptibleRecv(char* data, size_t len, int timeout, SOCKET& hSock
         } else { // Other error or blocking
             int nErr = WSAGetLastError();
             if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
-                if (!IsSelectableSocket(hSocket)) {
-                    return false;
-                }
-                struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+                int nRet = WaitForSocket(hSocket, false, std::min(endTime - curTime, maxWait));
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -442,7 +459,7 @@ bool static Socks5(string strDest, int port, const ProxyCredentials *auth, SOCKE
     return true;
 }
 
-bool static ConnectSocketDirectly(const CService& addrConnect, SOCKET& hSocketRet, int nTimeout)
+bool ConnectSocketStart(const CService& addrConnect, SOCKET& hSocketRet)
 {
     hSocketRet = INVALID_SOCKET;
 
@@ -464,61 +481,153 @@ bool static ConnectSocketDirectly(const CService& addrConnect, SOCKET& hSocketRe
 #endif
 
     // Set to non-blocking
-    if (!SetSocketNonBlocking(hSocket, true))
-        return error("ConnectSocketDirectly: Setting socket to non-blocking failed, error %s\n", NetworkErrorString(WSAGetLastError()));
+    if (!SetSocketNonBlocking(hSocket, true)) {
+        LogPrintf("ConnectSocketStart: Setting socket to non-blocking failed, error %s\n", NetworkErrorString(WSAGetLastError()));
+        CloseSocket(hSocket);
+        return false;
+    }
 
     if (connect(hSocket, (struct sockaddr*)&sockaddr, len) == SOCKET_ERROR) {
         int nErr = WSAGetLastError();
         // WSAEINVAL is here because some legacy version of winsock uses it
-        if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
-            if (nRet == 0) {
-                LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
-                CloseSocket(hSocket);
-                return false;
-            }
-            if (nRet == SOCKET_ERROR) {
-                LogPrintf("select() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
-                CloseSocket(hSocket);
-                return false;
-            }
-            socklen_t nRetSize = sizeof(nRet);
+        if (nErr != WSAEINPROGRESS && nErr != WSAEWOULDBLOCK && nErr != WSAEINVAL
 #ifdef WIN32
-            if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
-#else
-            if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
+            && nErr != WSAEISCONN
 #endif
-            {
-                LogPrintf("getsockopt() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
-                CloseSocket(hSocket);
-                return false;
-            }
-            if (nRet != 0) {
-                LogPrintf("connect() to %s failed after select(): %s\n", addrConnect.ToString(), NetworkErrorString(nRet));
-                CloseSocket(hSocket);
-                return false;
-            }
+            ) {
+            LogPrintf("connect() to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(nErr));
+            CloseSocket(hSocket);
+            return false;
         }
+    }
+
+    hSocketRet = hSocket;
+    return true;
+}
+
+bool ConnectSocketFinish(const CService& addrConnect, SOCKET& hSocket)
+{
+    int nRet = 0;
+    socklen_t nRetSize = sizeof(nRet);
 #ifdef WIN32
-        else if (WSAGetLastError() != WSAEISCONN)
+    if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
 #else
-        else
+    if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
 #endif
-        {
-            LogPrintf("connect() to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
-            CloseSocket(hSocket);
-            return false;
-        }
+    {
+        LogPrintf("getsockopt() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
+        CloseSocket(hSocket);
+        return false;
     }
+    if (nRet != 0) {
+        LogPrintf("connect() to %s failed after waiting: %s\n", addrConnect.ToString(), NetworkErrorString(nRet));
+        CloseSocket(hSocket);
+        return false;
+    }
+    return true;
+}
+
+bool static ConnectSocketDirectly(const CService& addrConnect, SOCKET& hSocketRet, int nTimeout)
+{
+    SOCKET hSocket;
+    if (!ConnectSocketStart(addrConnect, hSocket))
+        return false;
+
+    int nRet = WaitForSocket(hSocket, true, nTimeout);
+    if (nRet == 0) {
+        LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
+        CloseSocket(hSocket);
+        return false;
+    }
+    if (nRet == SOCKET_ERROR) {
+        LogPrintf("Waiting for connection to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
+        CloseSocket(hSocket);
+        return false;
+    }
+    if (!ConnectSocketFinish(addrConnect, hSocket))
+        return false;
 
     hSocketRet = hSocket;
     return true;
 }
 
+CConnectingSockets::~CConnectingSockets()
+{
+    for (size_t i = 0; i < vAttempts.size(); i++)
+        CloseSocket(vAttempts[i].hSocket);
+}
+
+bool CConnectingSockets::Start(const CService& addr, int64_t nTimeout)
+{
+    CAttempt attempt;
+    attempt.addr = addr;
+    attempt.nDeadline = GetTimeMillis() + nTimeout;
+    if (!ConnectSocketStart(addr, attempt.hSocket))
+        return false;
+    vAttempts.push_back(attempt);
+    return true;
+}
+
+void CConnectingSockets::Wait(int64_t nTimeout, std::vector<std::pair<CService, SOCKET> >& vConnected, std::vector<CService>& vFailed)
+{
+    if (vAttempts.empty()) {
+        MilliSleep(nTimeout);
+        return;
+    }
+
+    // Don't wait past the earliest deadline
+    int64_t nNow = GetTimeMillis();
+    for (size_t i = 0; i < vAttempts.size(); i++)
+        nTimeout = std::min(nTimeout, std::max(vAttempts[i].nDeadline - nNow, (int64_t)0));
+
+    // Sockets that became writable finished connecting, one way or the other
+    std::vector<bool> vDone(vAttempts.size(), false);
+#ifdef WIN32
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    fd_set fdsetSend;
+    FD_ZERO(&fdsetSend);
+    SOCKET hSocketMax = 0;
+    for (size_t i = 0; i < vAttempts.size(); i++) {
+        FD_SET(vAttempts[i].hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, vAttempts[i].hSocket);
+    }
+    int nRet = select(hSocketMax + 1, NULL, &fdsetSend, NULL, &timeout);
+    for (size_t i = 0; nRet > 0 && i < vAttempts.size(); i++)
+        vDone[i] = FD_ISSET(vAttempts[i].hSocket, &fdsetSend);
+#else
+    std::vector<struct pollfd> vPollFds(vAttempts.size());
+    for (size_t i = 0; i < vAttempts.size(); i++) {
+        vPollFds[i].fd = vAttempts[i].hSocket;
+        vPollFds[i].events = POLLOUT;
+        vPollFds[i].revents = 0;
+    }
+    int nRet = poll(&vPollFds[0], vPollFds.size(), nTimeout);
+    for (size_t i = 0; nRet > 0 && i < vAttempts.size(); i++)
+        vDone[i] = vPollFds[i].revents != 0;
+#endif
+    if (nRet == SOCKET_ERROR)
+        LogPrintf("Waiting for outbound connections failed: %s\n", NetworkErrorString(WSAGetLastError()));
+
+    nNow = GetTimeMillis();
+    std::vector<CAttempt> vPending;
+    for (size_t i = 0; i < vAttempts.size(); i++) {
+        CAttempt& attempt = vAttempts[i];
+        if (vDone[i]) {
+            if (ConnectSocketFinish(attempt.addr, attempt.hSocket))
+                vConnected.push_back(std::make_pair(attempt.addr, attempt.hSocket));
+            else
+                vFailed.push_back(attempt.addr);
+        } else if (nNow >= attempt.nDeadline) {
+            LogPrint("net", "connection to %s timeout\n", attempt.addr.ToString());
+            CloseSocket(attempt.hSocket);
+            vFailed.push_back(attempt.addr);
+        } else {
+            vPending.push_back(attempt);
+        }
+    }
+    vAttempts.swap(vPending);
+}
+
 bool SetProxy(enum Network net, const proxyType &addrProxy)
 {
     assert(net >= 0 && net < NET_MAX);
@@ -222,5 +222,36 @@ bool SetSocketNonBlocking(SOCKET& hSocket, bool fNonBlocking);
  * Convert milliseconds to a struct timeval for e.g. select.
  */
 struct timeval MillisToTimeval(int64_t nTimeout);
+/** Wait for a socket to become readable (or writable); 1 if it did, 0 on timeout, SOCKET_ERROR on failure */
+int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout);
+/** Create a non-blocking socket and start connecting it to addrConnect, without waiting for the outcome */
+bool ConnectSocketStart(const CService& addrConnect, SOCKET& hSocketRet);
+/** Check whether a socket from ConnectSocketStart that became writable did connect; closes it if not */
+bool ConnectSocketFinish(const CService& addrConnect, SOCKET& hSocket);
+
+/**
+ * Direct outbound connections in progress, all waited on by one poll() (select() on
+ * Windows). An unreachable address only costs its own attempt its timeout, instead of
+ * holding up every connection tried after it.
+ */
+class CConnectingSockets
+{
+private:
+    struct CAttempt {
+        CService addr;
+        SOCKET hSocket;
+        int64_t nDeadline;
+    };
+    std::vector<CAttempt> vAttempts;
+
+public:
+    ~CConnectingSockets();
+
+    //! Start connecting to addr, giving up after nTimeout milliseconds; false if it failed outright
+    bool Start(const CService& addr, int64_t nTimeout);
+    //! Wait up to nTimeout milliseconds for attempts to finish. Connected sockets are handed over to the caller.
+    void Wait(int64_t nTimeout, std::vector<std::pair<CService, SOCKET> >& vConnected, std::vector<CService>& vFailed);
+    size_t size() const { return vAttempts.size(); }
+};
 
 #endif // FRENCH_NETBASE_H
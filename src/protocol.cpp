@@ -30,7 +30,8 @@ static const char* ppszTypeName[] =
         "mn budget finalized vote",
         "mn quorum",
         "mn announce",
-        "mn ping"};
+        "mn ping",
+        "compact block"};
 
 CMessageHeader::CMessageHeader()
 {
@@ -136,7 +137,7 @@ bool CInv::IsKnownType() const
 }
 
 bool CInv::IsMasterNodeType() const{
- 	return (type >= 6);
+ 	return (type >= MSG_SPORK && type <= MSG_FRENCHNODE_PING);
 }
 
 const char* CInv::GetCommand() const
@@ -151,3 +152,11 @@ std::string CInv::ToString() const
 {
     return strprintf("%s %s", GetCommand(), hash.ToString());
 }
+
+std::vector<unsigned char> CInv::GetKey() const
+{
+    std::vector<unsigned char> vKey(hash.begin(), hash.end());
+    for (unsigned int i = 0; i < sizeof(type); i++)
+        vKey.push_back((unsigned char)(type >> (8 * i)));
+    return vKey;
+}
@@ -145,6 +145,8 @@ public:
     bool IsMasterNodeType() const;
     const char* GetCommand() const;
     std::string ToString() const;
+    //! Type and hash as a byte string, for keying bloom filters
+    std::vector<unsigned char> GetKey() const;
 
     // TODO: make private (improves encapsulation)
 public:
@@ -169,7 +171,10 @@ enum {
     MSG_BUDGET_FINALIZED_VOTE,
     MSG_FRENCHNODE_QUORUM,
     MSG_FRENCHNODE_ANNOUNCE,
-    MSG_FRENCHNODE_PING
+    MSG_FRENCHNODE_PING,
+    // A compact block (BIP152 style) may only be requested in a getdata; blocks are
+    // still announced with MSG_BLOCK.
+    MSG_CMPCT_BLOCK
 };
 
 #endif // FRENCH_PROTOCOL_H
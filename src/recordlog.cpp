@@ -0,0 +1,317 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recordlog.h"
+
+#include "blockstore.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace
+{
+enum RecordOp {
+    RECORD_PUT = 1,
+    RECORD_ERASE = 2
+};
+
+//! Size and checksum in front of every record
+const size_t RECORD_PREFIX_SIZE = 8;
+
+uint32_t RecordChecksum(const char* pbegin, const char* pend)
+{
+    uint256 hash = Hash(pbegin, pend);
+    return ReadLE32(hash.begin());
+}
+
+/** Append a record to ss and return its size on disk */
+uint64_t AppendRecord(CDataStream& ss, unsigned char nOp, const CRecordKey& key, const CSerializeData& value)
+{
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    ssRecord << nOp << key;
+    ssRecord.write(value.data(), value.size());
+
+    const char* pbegin = &ssRecord.begin()[0];
+    uint32_t nSize = ssRecord.size();
+    ss << nSize << RecordChecksum(pbegin, pbegin + nSize);
+    ss.write(pbegin, nSize);
+    return RECORD_PREFIX_SIZE + nSize;
+}
+
+CDataStream LogHeader(const std::string& strMagicMessage)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << strMagicMessage;                   // cache file specific magic message
+    ss << FLATDATA(Params().MessageStart()); // network specific magic number
+    uint32_t nVersion = CRecordLog::CURRENT_VERSION;
+    ss << nVersion;
+    return ss;
+}
+
+bool WriteAndCommit(FILE* file, const CDataStream& ss)
+{
+    if (ss.empty())
+        return true;
+    if (fwrite(&ss.begin()[0], 1, ss.size(), file) != ss.size())
+        return false;
+    FileCommit(file);
+    return true;
+}
+} // anon namespace
+
+CRecordLog::CRecordLog(const std::string& strFilenameIn, const std::string& strMagicMessageIn) : strFilename(strFilenameIn),
+                                                                                                  strMagicMessage(strMagicMessageIn),
+                                                                                                  fOpen(false),
+                                                                                                  nFileSize(0),
+                                                                                                  nLiveSize(0)
+{
+}
+
+boost::filesystem::path CRecordLog::GetPath() const
+{
+    return GetDataDir() / strFilename;
+}
+
+CRecordLog::ReadResult CRecordLog::ReadHeader(const char* pbegin, size_t nSize, size_t& nHeaderSize) const
+{
+    CDataStream ss(pbegin, pbegin + std::min(nSize, (size_t)256), SER_DISK, CLIENT_VERSION);
+    size_t nAvailable = ss.size();
+    std::string strMagicMessageTmp;
+    unsigned char pchMsgTmp[4];
+    uint32_t nVersion;
+    try {
+        ss >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp) {
+            error("%s : Invalid magic message in %s", __func__, strFilename);
+            return IncorrectMagicMessage;
+        }
+        ss >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
+            error("%s : Invalid network magic number in %s", __func__, strFilename);
+            return IncorrectMagicNumber;
+        }
+        ss >> nVersion;
+    } catch (const std::exception& e) {
+        error("%s : Header of %s is damaged - %s", __func__, strFilename, e.what());
+        return IncorrectFormat;
+    }
+    if (nVersion != CURRENT_VERSION) {
+        error("%s : Unknown version %u of %s", __func__, nVersion, strFilename);
+        return IncorrectFormat;
+    }
+    nHeaderSize = nAvailable - ss.size();
+    return Ok;
+}
+
+CRecordLog::ReadResult CRecordLog::ReadRecords(CRecordMap& records)
+{
+    LOCK(cs);
+    int64_t nStart = GetTimeMillis();
+    fOpen = false;
+    mapWritten.clear();
+    nFileSize = nLiveSize = 0;
+
+    boost::filesystem::path path = GetPath();
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(path, ec)) {
+        error("%s : Failed to open file %s", __func__, path.string());
+        return FileError;
+    }
+
+    // Map the file; where that is not possible, read it into memory instead
+    boost::shared_ptr<const CMappedFile> pmapped(new CMappedFile(path));
+    std::vector<char> vchFile;
+    const char* pbegin = pmapped->begin();
+    size_t nSize = pmapped->size();
+    if (pmapped->IsNull()) {
+        FILE* file = fopen(path.string().c_str(), "rb");
+        if (!file) {
+            error("%s : Failed to open file %s", __func__, path.string());
+            return FileError;
+        }
+        char buf[65536];
+        size_t nRead;
+        while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+            vchFile.insert(vchFile.end(), buf, buf + nRead);
+        fclose(file);
+        pbegin = vchFile.empty() ? NULL : &vchFile[0];
+        nSize = vchFile.size();
+    }
+
+    size_t nPos = 0;
+    ReadResult result = ReadHeader(pbegin, nSize, nPos);
+    if (result != Ok)
+        return result;
+
+    // First find the latest version of every record, then copy out only those
+    std::map<CRecordKey, std::pair<const char*, const char*> > mapLive;
+    size_t nRecords = 0;
+    while (nPos + RECORD_PREFIX_SIZE <= nSize) {
+        const unsigned char* pprefix = (const unsigned char*)pbegin + nPos;
+        uint32_t nRecordSize = ReadLE32(pprefix);
+        if (nRecordSize > MAX_RECORD_SIZE || nPos + RECORD_PREFIX_SIZE + nRecordSize > nSize)
+            break;
+        const char* precord = pbegin + nPos + RECORD_PREFIX_SIZE;
+        if (RecordChecksum(precord, precord + nRecordSize) != ReadLE32(pprefix + 4))
+            break;
+
+        CDataStream ss(precord, precord + nRecordSize, SER_DISK, CLIENT_VERSION);
+        unsigned char nOp;
+        CRecordKey key;
+        try {
+            ss >> nOp >> key;
+        } catch (const std::exception&) {
+            break;
+        }
+        uint64_t nOnDisk = RECORD_PREFIX_SIZE + nRecordSize;
+        if (nOp == RECORD_PUT) {
+            mapLive[key] = std::make_pair(precord + nRecordSize - ss.size(), precord + nRecordSize);
+            uint64_t& nWritten = mapWritten[key];
+            nLiveSize += nOnDisk - nWritten;
+            nWritten = nOnDisk;
+        } else if (nOp == RECORD_ERASE) {
+            mapLive.erase(key);
+            std::map<CRecordKey, uint64_t>::iterator it = mapWritten.find(key);
+            if (it != mapWritten.end()) {
+                nLiveSize -= it->second;
+                mapWritten.erase(it);
+            }
+        } else {
+            break;
+        }
+        nPos += nOnDisk;
+        nRecords++;
+    }
+
+    for (std::map<CRecordKey, std::pair<const char*, const char*> >::const_iterator it = mapLive.begin(); it != mapLive.end(); ++it)
+        records[it->first] = CSerializeData(it->second.first, it->second.second);
+    pmapped.reset();
+
+    if (nPos < nSize) {
+        LogPrintf("%s : Damaged record at offset %u of %s, dropping the last %u bytes\n", __func__, nPos, strFilename, nSize - nPos);
+        boost::filesystem::resize_file(path, nPos, ec);
+        if (ec) {
+            error("%s : Failed to truncate %s - %s", __func__, path.string(), ec.message());
+            mapWritten.clear();
+            nLiveSize = 0;
+            return Ok; // what was read is fine; the next write replaces the file
+        }
+    }
+
+    fOpen = true;
+    nFileSize = nPos;
+    LogPrint("masternode", "Loaded %u of %u records from %s  %dms\n", records.size(), nRecords, strFilename, GetTimeMillis() - nStart);
+    return Ok;
+}
+
+bool CRecordLog::AppendRecords(const CRecordMap& records, const std::set<CRecordKey>& setErased, bool& fCompact)
+{
+    LOCK(cs);
+    fCompact = !fOpen;
+    if (fCompact)
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+    CDataStream ssAppend(SER_DISK, CLIENT_VERSION);
+    std::map<CRecordKey, uint64_t> mapUpdated;
+    int64_t nLiveChange = 0;
+    for (CRecordMap::const_iterator it = records.begin(); it != records.end(); ++it) {
+        uint64_t nSize = AppendRecord(ssAppend, RECORD_PUT, it->first, it->second);
+        std::map<CRecordKey, uint64_t>::const_iterator itWritten = mapWritten.find(it->first);
+        nLiveChange += (int64_t)nSize - (int64_t)(itWritten != mapWritten.end() ? itWritten->second : 0);
+        mapUpdated[it->first] = nSize;
+    }
+    int nErased = 0;
+    for (std::set<CRecordKey>::const_iterator it = setErased.begin(); it != setErased.end(); ++it) {
+        std::map<CRecordKey, uint64_t>::const_iterator itWritten = mapWritten.find(*it);
+        if (itWritten == mapWritten.end())
+            continue;
+        AppendRecord(ssAppend, RECORD_ERASE, *it, CSerializeData());
+        nLiveChange -= (int64_t)itWritten->second;
+        nErased++;
+    }
+
+    uint64_t nMinCompactSize = MIN_COMPACT_SIZE;
+    if (nFileSize + ssAppend.size() > std::max(2 * (nLiveSize + nLiveChange), nMinCompactSize)) {
+        fCompact = true;
+        return true;
+    }
+
+    FILE* file = fopen(GetPath().string().c_str(), "ab");
+    if (!file || !WriteAndCommit(file, ssAppend)) {
+        if (file)
+            fclose(file);
+        // Whether any of it made it to disk is unknown; start over with a new file next time
+        fOpen = false;
+        return error("%s : Failed to append to %s", __func__, GetPath().string());
+    }
+    fclose(file);
+
+    for (std::map<CRecordKey, uint64_t>::const_iterator it = mapUpdated.begin(); it != mapUpdated.end(); ++it)
+        mapWritten[it->first] = it->second;
+    for (std::set<CRecordKey>::const_iterator it = setErased.begin(); it != setErased.end(); ++it)
+        mapWritten.erase(*it);
+    nFileSize += ssAppend.size();
+    nLiveSize += nLiveChange;
+    LogPrint("masternode", "Written %u changed and %d erased records (%u bytes) to %s  %dms\n",
+        records.size(), nErased, ssAppend.size(), strFilename, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CRecordLog::WriteAll(const CRecordMap& records)
+{
+    LOCK(cs);
+    return Compact(records);
+}
+
+bool CRecordLog::Compact(const CRecordMap& records)
+{
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path path = GetPath();
+
+    // Don't overwrite a file that belongs to something else
+    if (!fOpen) {
+        boost::shared_ptr<const CMappedFile> pmapped(new CMappedFile(path));
+        size_t nHeaderSize;
+        if (!pmapped->IsNull() && pmapped->size() > 0) {
+            ReadResult result = ReadHeader(pmapped->begin(), pmapped->size(), nHeaderSize);
+            if (result == IncorrectMagicMessage || result == IncorrectMagicNumber)
+                return error("%s : %s is not ours, please fix it manually", __func__, path.string());
+        }
+    }
+
+    CDataStream ss = LogHeader(strMagicMessage);
+    std::map<CRecordKey, uint64_t> mapWrittenNew;
+    uint64_t nLiveSizeNew = 0;
+    for (CRecordMap::const_iterator it = records.begin(); it != records.end(); ++it) {
+        uint64_t nSize = AppendRecord(ss, RECORD_PUT, it->first, it->second);
+        mapWrittenNew[it->first] = nSize;
+        nLiveSizeNew += nSize;
+    }
+
+    fOpen = false;
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+    if (!WriteAndCommit(file, ss)) {
+        fclose(file);
+        return error("%s : Failed to write %s", __func__, pathTmp.string());
+    }
+    fclose(file);
+    if (!RenameOver(pathTmp, path))
+        return error("%s : Failed to rename %s to %s", __func__, pathTmp.string(), path.string());
+
+    fOpen = true;
+    nFileSize = ss.size();
+    mapWritten.swap(mapWrittenNew);
+    nLiveSize = nLiveSizeNew;
+    LogPrint("masternode", "Written %u records (%u bytes) to %s  %dms\n", records.size(), nFileSize, strFilename, GetTimeMillis() - nStart);
+    return true;
+}
@@ -0,0 +1,258 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FRENCH_RECORDLOG_H
+#define FRENCH_RECORDLOG_H
+
+#include "clientversion.h"
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+#include "tinyformat.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <ios>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Key of a record: the number of the table it belongs to, then its serialized key in that table */
+typedef std::vector<unsigned char> CRecordKey;
+/** Serialized contents of an object, one record per entry of its tables */
+typedef std::map<CRecordKey, CSerializeData> CRecordMap;
+
+/** Key of the record of one table entry */
+template <typename K>
+CRecordKey MakeRecordKey(unsigned char nTable, const K& key)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << nTable << key;
+    return CRecordKey(ssKey.begin(), ssKey.end());
+}
+
+/** Serialized value of a record */
+template <typename V>
+CSerializeData MakeRecordValue(const V& value)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << value;
+    return CSerializeData(ssValue.begin(), ssValue.end());
+}
+
+/** Add the record of one table entry */
+template <typename K, typename V>
+void AddRecord(CRecordMap& records, unsigned char nTable, const K& key, const V& value)
+{
+    records[MakeRecordKey(nTable, key)] = MakeRecordValue(value);
+}
+
+/** Add a record for every entry of a map */
+template <typename K, typename V>
+void AddRecords(CRecordMap& records, unsigned char nTable, const std::map<K, V>& mapIn)
+{
+    for (typename std::map<K, V>::const_iterator it = mapIn.begin(); it != mapIn.end(); ++it)
+        AddRecord(records, nTable, it->first, it->second);
+}
+
+/**
+ * Add the record of the entry of mapIn a changed key refers to, or the key to setErased
+ * if the entry is gone. ssKey holds the key after its table number.
+ */
+template <typename K, typename V>
+void AddChangedRecord(CRecordMap& records, std::set<CRecordKey>& setErased, const CRecordKey& key, CDataStream& ssKey, const std::map<K, V>& mapIn)
+{
+    K keyIn;
+    ssKey >> keyIn;
+    typename std::map<K, V>::const_iterator it = mapIn.find(keyIn);
+    if (it != mapIn.end())
+        records[key] = MakeRecordValue(it->second);
+    else
+        setErased.insert(key);
+}
+
+/** Put an entry read back by CRecordLog::Read into its map */
+template <typename K, typename V>
+void LoadMapRecord(CDataStream& ssKey, CDataStream& ssValue, std::map<K, V>& mapOut)
+{
+    K key;
+    ssKey >> key;
+    V value;
+    ssValue >> value;
+    mapOut.insert(std::make_pair(key, value));
+}
+
+/**
+ * Keys of the records of an object that changed since they were last written. The
+ * object marks an entry whenever it adds, changes or removes it, so a write only has to
+ * serialize the marked entries. Until the object has been written or read once, all of
+ * it counts as changed. The lock is taken last: entries can be marked under any other.
+ */
+class CRecordChanges
+{
+private:
+    mutable CCriticalSection cs;
+    std::set<CRecordKey> setChanged;
+    bool fAll;
+
+public:
+    CRecordChanges() : fAll(true) {}
+    CRecordChanges(const CRecordChanges&) : fAll(true) {}
+    CRecordChanges& operator=(const CRecordChanges&)
+    {
+        MarkAll();
+        return *this;
+    }
+
+    template <typename K>
+    void Mark(unsigned char nTable, const K& key)
+    {
+        CRecordKey recordKey = MakeRecordKey(nTable, key);
+        LOCK(cs);
+        if (!fAll)
+            setChanged.insert(recordKey);
+    }
+
+    /** Everything has to be written again */
+    void MarkAll()
+    {
+        LOCK(cs);
+        fAll = true;
+        setChanged.clear();
+    }
+
+    /** The object is as it was written or read */
+    void Clear()
+    {
+        LOCK(cs);
+        fAll = false;
+        setChanged.clear();
+    }
+
+    /** Hand over the marked keys and start over; false if everything has to be written */
+    bool Take(std::set<CRecordKey>& setOut)
+    {
+        LOCK(cs);
+        setOut.clear();
+        setOut.swap(setChanged);
+        bool fChanged = !fAll;
+        fAll = false;
+        return fChanged;
+    }
+};
+
+/**
+ * Cache file of an object made of tables, like the Frenchnode list, the payment votes or
+ * the budgets, kept as an append-only log of one record per table entry.
+ *
+ * After a header, each record is [size][checksum][operation, key, value]. Write appends
+ * the records the object marked in its CRecordChanges since the last Read or Write and
+ * erasures for the ones that went away, so periodic dumps cost about as much as what
+ * changed in between; the rest of the object is neither serialized nor hashed. Once most
+ * of the file is superseded records it is compacted into a new file that replaces it.
+ * Read maps the file and replays it, copying out only the latest value of each key. A
+ * torn or damaged record ends the log: the records before it are kept and the rest of
+ * the file is cut off, so the next append follows valid data.
+ *
+ * The object has a CRecordChanges recordChanges and provides GetRecords(CRecordMap&),
+ * GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records,
+ * std::set<CRecordKey>& setErased) and
+ * LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue), returning
+ * false for tables it does not know.
+ */
+class CRecordLog
+{
+public:
+    enum ReadResult {
+        Ok,
+        FileError,
+        IncorrectMagicMessage,
+        IncorrectMagicNumber,
+        IncorrectFormat
+    };
+
+private:
+    CCriticalSection cs;
+    const std::string strFilename;
+    const std::string strMagicMessage;
+
+    //! True when mapWritten describes the file, so writes can be appended to it
+    bool fOpen;
+    //! The live records in the file and their size on disk
+    std::map<CRecordKey, uint64_t> mapWritten;
+    uint64_t nFileSize;
+    uint64_t nLiveSize;
+
+    boost::filesystem::path GetPath() const;
+    ReadResult ReadHeader(const char* pbegin, size_t nSize, size_t& nHeaderSize) const;
+    ReadResult ReadRecords(CRecordMap& records);
+    bool AppendRecords(const CRecordMap& records, const std::set<CRecordKey>& setErased, bool& fCompact);
+    bool WriteAll(const CRecordMap& records);
+    bool Compact(const CRecordMap& records);
+
+public:
+    static const uint32_t CURRENT_VERSION = 1;
+    //! Records larger than this are taken for damage
+    static const uint32_t MAX_RECORD_SIZE = 32 * 1024 * 1024;
+    //! Files smaller than this are never compacted
+    static const uint64_t MIN_COMPACT_SIZE = 1024 * 1024;
+
+    CRecordLog(const std::string& strFilenameIn, const std::string& strMagicMessageIn);
+
+    const std::string& GetFilename() const { return strFilename; }
+    uint64_t GetFileSize() const { return nFileSize; }
+
+    template <typename T>
+    ReadResult Read(T& objToLoad)
+    {
+        CRecordMap records;
+        ReadResult result = ReadRecords(records);
+        if (result != Ok)
+            return result;
+
+        try {
+            for (CRecordMap::const_iterator it = records.begin(); it != records.end(); ++it) {
+                CDataStream ssKey(it->first, SER_DISK, CLIENT_VERSION);
+                unsigned char nTable;
+                ssKey >> nTable;
+                CDataStream ssValue(it->second.begin(), it->second.end(), SER_DISK, CLIENT_VERSION);
+                if (!objToLoad.LoadRecord(nTable, ssKey, ssValue))
+                    throw std::ios_base::failure(strprintf("unknown table %d", nTable));
+            }
+            objToLoad.recordChanges.Clear();
+        } catch (const std::exception& e) {
+            objToLoad.Clear();
+            error("%s : Deserialize or I/O error in %s - %s", __func__, strFilename, e.what());
+            LOCK(cs);
+            fOpen = false; // rewrite it all on the next write
+            return IncorrectFormat;
+        }
+        return Ok;
+    }
+
+    template <typename T>
+    bool Write(T& objToSave)
+    {
+        CRecordMap records;
+        std::set<CRecordKey> setChanged;
+        if (objToSave.recordChanges.Take(setChanged)) {
+            std::set<CRecordKey> setErased;
+            objToSave.GetChangedRecords(setChanged, records, setErased);
+            bool fCompact;
+            if (!AppendRecords(records, setErased, fCompact))
+                return false;
+            if (!fCompact)
+                return true;
+            records.clear();
+        }
+        objToSave.GetRecords(records);
+        return WriteAll(records);
+    }
+};
+
+#endif // FRENCH_RECORDLOG_H
@@ -104,7 +104,7 @@ static bool rest_block(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
+    boost::shared_ptr<const CBlock> pblock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -112,9 +112,10 @@ static bool rest_block(AcceptedConnection* conn,
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
-        if (!ReadBlockFromDisk(block, pblockindex))
+        if (!ReadBlockFromDisk(pblock, pblockindex))
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
+    const CBlock& block = *pblock;
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
     ssBlock << block;
@@ -215,6 +216,67 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static void AppendTrafficSamples(string& strOut, const char* pszName, const mapMsgCmdTraffic& mapTraffic, const char* pszDirection, bool fBytes)
+{
+    for (mapMsgCmdTraffic::const_iterator it = mapTraffic.begin(); it != mapTraffic.end(); ++it)
+        strOut += strprintf("%s{command=\"%s\",direction=\"%s\"} %u\n", pszName, it->first, pszDirection, fBytes ? it->second.nBytes : it->second.nCount);
+}
+
+/** One metric family: its HELP and TYPE lines followed by all of its samples, as the format requires */
+static void AppendTrafficMetric(string& strOut, const char* pszName, const char* pszHelp, const mapMsgCmdTraffic& mapSent, const mapMsgCmdTraffic& mapRecv, bool fBytes)
+{
+    strOut += strprintf("# HELP %s %s\n", pszName, pszHelp);
+    strOut += strprintf("# TYPE %s counter\n", pszName);
+    AppendTrafficSamples(strOut, pszName, mapSent, "sent", fBytes);
+    AppendTrafficSamples(strOut, pszName, mapRecv, "recv", fBytes);
+}
+
+/** Network counters in the Prometheus text exposition format */
+static bool rest_metrics(AcceptedConnection* conn,
+    string& strReq,
+    map<string, string>& mapHeaders,
+    bool fRun)
+{
+    string strOut;
+    int nPeers = 0;
+    {
+        LOCK(cs_vNodes);
+        nPeers = vNodes.size();
+    }
+    strOut += "# TYPE french_net_peers gauge\n";
+    strOut += strprintf("french_net_peers %d\n", nPeers);
+    strOut += "# TYPE french_net_bytes_sent_total counter\n";
+    strOut += strprintf("french_net_bytes_sent_total %u\n", CNode::GetTotalBytesSent());
+    strOut += "# TYPE french_net_bytes_recv_total counter\n";
+    strOut += strprintf("french_net_bytes_recv_total %u\n", CNode::GetTotalBytesRecv());
+
+    // Message names are ours or "*other*", so they need no escaping as label values
+    mapMsgCmdTraffic mapSent, mapRecv;
+    CNode::GetMessageTrafficTotals(mapSent, mapRecv);
+    AppendTrafficMetric(strOut, "french_net_messages_total", "Messages exchanged with peers by command", mapSent, mapRecv, false);
+    AppendTrafficMetric(strOut, "french_net_message_bytes_total", "Bytes exchanged with peers by command, message headers included", mapSent, mapRecv, true);
+
+    std::map<std::string, CMessageTimeStats> mapStats;
+    CNode::GetProcessingTimeStats(mapStats);
+    strOut += "# HELP french_net_processing_seconds Time spent handling received messages by command\n";
+    strOut += "# TYPE french_net_processing_seconds histogram\n";
+    for (std::map<std::string, CMessageTimeStats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        const CMessageTimeStats& stats = it->second;
+        uint64_t nCumulative = 0;
+        for (int i = 0; i < CMessageTimeStats::BUCKETS; i++) {
+            nCumulative += stats.vBuckets[i];
+            int64_t nBound = CMessageTimeStats::GetBucketBound(i);
+            string strBound = nBound < 0 ? "+Inf" : strprintf("%g", nBound / 1e6);
+            strOut += strprintf("french_net_processing_seconds_bucket{command=\"%s\",le=\"%s\"} %u\n", it->first, strBound, nCumulative);
+        }
+        strOut += strprintf("french_net_processing_seconds_sum{command=\"%s\"} %.6f\n", it->first, stats.nTotalMicros / 1e6);
+        strOut += strprintf("french_net_processing_seconds_count{command=\"%s\"} %u\n", it->first, stats.nCount);
+    }
+
+    conn->stream() << HTTPReply(HTTP_OK, strOut, fRun, false, "text/plain; version=0.0.4") << std::flush;
+    return true;
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
@@ -225,6 +287,7 @@ static const struct {
     {"/rest/tx/", rest_tx},
     {"/rest/block/notxdetails/", rest_block_notxdetails},
     {"/rest/block/", rest_block_extended},
+    {"/rest/metrics", rest_metrics},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
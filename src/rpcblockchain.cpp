@@ -6,6 +6,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockstore.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "main.h"
@@ -288,11 +289,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
+    boost::shared_ptr<const CBlock> pblock;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (!ReadBlockFromDisk(block, pblockindex))
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    if (!ReadBlockFromDisk(pblock, pblockindex))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -338,11 +343,8 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlock block(pblockindex->GetBlockHeader());
 
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -356,11 +358,14 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( verify )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The statistics are maintained as blocks are connected, so this call is cheap unless verify is set.\n"
+            "\nArguments:\n"
+            "1. verify      (boolean, optional, default=false) Recompute everything by scanning the whole database\n"
+            "               and compare with the maintained statistics. Note this may take some time.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -368,14 +373,33 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"muhash\": \"hash\",          (string) Order-independent hash of the unspent outputs\n"
+            "  \"hash_serialized\": \"hash\", (string) The serialized hash (only with verify)\n"
+            "  \"total_amount\": x.xxx,         (numeric) The total amount\n"
+            "  \"verified\": true|false         (boolean) Whether the scan matched the maintained statistics (only with verify)\n"
             "}\n"
             "\nExamples:\n" +
-            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleRpc("gettxoutsetinfo", ""));
+            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleCli("gettxoutsetinfo", "true") + HelpExampleRpc("gettxoutsetinfo", ""));
+
+    bool fVerify = params.size() > 0 && params[0].get_bool();
 
     UniValue ret(UniValue::VOBJ);
 
+    CCoinsRunningStats running;
+    bool fRunning = pcoinsTip->GetRunningStats(running);
+    if (!fVerify) {
+        if (!fRunning)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set statistics are not available, use verify to scan the database");
+        ret.push_back(Pair("height", (int64_t)chainActive.Height()));
+        ret.push_back(Pair("bestblock", running.hashBlock.GetHex()));
+        ret.push_back(Pair("transactions", (int64_t)running.nTransactions));
+        ret.push_back(Pair("txouts", (int64_t)running.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", (int64_t)running.nSerializedSize));
+        ret.push_back(Pair("muhash", running.muhash.Finalize().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(running.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
@@ -384,12 +408,59 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
+        ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        ret.push_back(Pair("verified", fRunning && running.hashBlock == stats.hashBlock &&
+                                           running.nTransactions == stats.nTransactions &&
+                                           running.nTransactionOutputs == stats.nTransactionOutputs &&
+                                           running.nSerializedSize == stats.nSerializedSize &&
+                                           running.nTotalAmount == stats.nTotalAmount &&
+                                           running.muhash.Finalize() == stats.hashMuHash));
     }
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set at the current tip, together with the block index\n"
+            "leading to it, to a snapshot file that a new node can load with -loadtxoutset.\n"
+            "Note this call may take some time; blocks keep being processed while the coins are written.\n"
+            "\nArguments:\n"
+            "1. \"path\"     (string, required) Path to the output file. Relative paths are prefixed by the data directory.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,           (numeric) The height of the snapshot block\n"
+            "  \"bestblock\": \"hex\",    (string) The hash of the snapshot block\n"
+            "  \"coins_written\": n,    (numeric) The number of transactions with unspent outputs written\n"
+            "  \"snapshot_hash\": \"hash\", (string) The hash committing to the file contents (for -loadtxoutsethash)\n"
+            "  \"path\": \"path\"         (string) The absolute path of the written file\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CTxOutSetSnapshotHeader header;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    if (!DumpTxOutSet(path, header, nCoins, hashSnapshot))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to write UTXO set snapshot");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", header.nHeight));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("coins_written", (int64_t)nCoins));
+    ret.push_back(Pair("snapshot_hash", hashSnapshot.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -503,7 +574,17 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
+            "  \"blockcache\": {           (json object) the cache of recently read blocks\n"
+            "     \"entries\": xxxx,       (numeric) number of cached blocks\n"
+            "     \"bytes\": xxxx,         (numeric) serialized size of the cached blocks\n"
+            "     \"maxbytes\": xxxx,      (numeric) size limit (-blockcache)\n"
+            "     \"hits\": xxxx,          (numeric) block reads served from the cache\n"
+            "     \"misses\": xxxx,        (numeric) block reads that went to disk\n"
+            "     \"hitrate\": x.xxx       (numeric) hits / (hits + misses)\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getblockchaininfo", "") + HelpExampleRpc("getblockchaininfo", ""));
@@ -516,6 +597,24 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned", fPruneMode));
+    if (fPruneMode) {
+        CBlockIndex* block = chainActive.Tip();
+        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+            block = block->pprev;
+        obj.push_back(Pair("pruneheight", block->nHeight));
+    }
+
+    UniValue cache(UniValue::VOBJ);
+    uint64_t nHits = blockCache.GetHits();
+    uint64_t nMisses = blockCache.GetMisses();
+    cache.push_back(Pair("entries", (uint64_t)blockCache.GetCount()));
+    cache.push_back(Pair("bytes", (uint64_t)blockCache.GetBytes()));
+    cache.push_back(Pair("maxbytes", (uint64_t)blockCache.GetMaxBytes()));
+    cache.push_back(Pair("hits", nHits));
+    cache.push_back(Pair("misses", nMisses));
+    cache.push_back(Pair("hitrate", nHits + nMisses > 0 ? (double)nHits / (nHits + nMisses) : 0.0));
+    obj.push_back(Pair("blockcache", cache));
     return obj;
 }
 
@@ -84,6 +84,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"sendrawtransaction", 2},
         {"gettxout", 1},
         {"gettxout", 2},
+        {"gettxoutsetinfo", 0},
         {"lockunspent", 0},
         {"lockunspent", 1},
         {"importprivkey", 2},
@@ -99,6 +100,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"setban", 2},
         {"setban", 3},
         {"spork", 1},
+        {"swifttxloadtest", 0},
+        {"swifttxloadtest", 1},
+        {"swifttxloadtest", 2},
         {"mnbudget", 3},
         {"mnbudget", 4},
         {"mnbudget", 6},
@@ -329,8 +329,11 @@ UniValue submitbudget(const UniValue& params, bool fHelp)
     // }
 
     budget.mapSeenFrenchnodeBudgetProposals.insert(make_pair(budgetProposalBroadcast.GetHash(), budgetProposalBroadcast));
+
+    budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_PROPOSAL, budgetProposalBroadcast.GetHash());
     budgetProposalBroadcast.Relay();
     if(budget.AddProposal(budgetProposalBroadcast)) {
+        budget.CheckOrphanVotes(budgetProposalBroadcast.GetHash());
         return budgetProposalBroadcast.GetHash().ToString();
     }
     throw runtime_error("Invalid proposal, see debug.log for details.");
@@ -431,6 +434,7 @@ UniValue mnbudgetvote(const UniValue& params, bool fHelp)
             if (budget.UpdateProposal(vote, NULL, strError)) {
                 success++;
                 budget.mapSeenFrenchnodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+                budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_PROPOSAL_VOTE, vote.GetHash());
                 vote.Relay();
                 statusObj.push_back(Pair("node", "local"));
                 statusObj.push_back(Pair("result", "success"));
@@ -497,6 +501,7 @@ UniValue mnbudgetvote(const UniValue& params, bool fHelp)
             std::string strError = "";
             if (budget.UpdateProposal(vote, NULL, strError)) {
                 budget.mapSeenFrenchnodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+                budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_PROPOSAL_VOTE, vote.GetHash());
                 vote.Relay();
                 success++;
                 statusObj.push_back(Pair("node", mne.getAlias()));
@@ -572,6 +577,7 @@ UniValue mnbudgetvote(const UniValue& params, bool fHelp)
             std::string strError = "";
             if(budget.UpdateProposal(vote, NULL, strError)) {
                 budget.mapSeenFrenchnodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+                budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_PROPOSAL_VOTE, vote.GetHash());
                 vote.Relay();
                 success++;
                 statusObj.push_back(Pair("node", mne.getAlias()));
@@ -845,6 +851,7 @@ UniValue mnbudgetrawvote(const UniValue& params, bool fHelp)
     std::string strError = "";
     if (budget.UpdateProposal(vote, NULL, strError)) {
         budget.mapSeenFrenchnodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+        budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_PROPOSAL_VOTE, vote.GetHash());
         vote.Relay();
         return "Voted successfully";
     } else {
@@ -923,6 +930,7 @@ UniValue mnfinalbudget(const UniValue& params, bool fHelp)
             std::string strError = "";
             if (budget.UpdateFinalizedBudget(vote, NULL, strError)) {
                 budget.mapSeenFinalizedBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+                budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_FINALIZED_VOTE, vote.GetHash());
                 vote.Relay();
                 success++;
                 statusObj.push_back(Pair("result", "success"));
@@ -968,6 +976,7 @@ UniValue mnfinalbudget(const UniValue& params, bool fHelp)
         std::string strError = "";
         if (budget.UpdateFinalizedBudget(vote, NULL, strError)) {
             budget.mapSeenFinalizedBudgetVotes.insert(make_pair(vote.GetHash(), vote));
+            budget.recordChanges.Mark(CBudgetManager::BUDGET_RECORD_SEEN_FINALIZED_VOTE, vote.GetHash());
             vote.Relay();
             return "success";
         } else {
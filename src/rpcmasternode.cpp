@@ -12,6 +12,7 @@
 #include "masternodeconfig.h"
 #include "masternodeman.h"
 #include "rpcserver.h"
+#include "swifttx.h"
 #include "utilmoneystr.h"
 
 #include <univalue.h>
@@ -233,14 +234,14 @@ UniValue listmasternodes(const UniValue& params, bool fHelp)
         if(!pindex) return 0;
         nHeight = pindex->nHeight;
     }
-    std::vector<pair<int, CFrenchnode> > vFrenchnodeRanks = mnodeman.GetFrenchnodeRanks(nHeight);
-    BOOST_FOREACH (PAIRTYPE(int, CFrenchnode) & s, vFrenchnodeRanks) {
+    std::vector<pair<int, CTxIn> > vFrenchnodeRanks = mnodeman.GetFrenchnodeRanks(nHeight);
+    BOOST_FOREACH (PAIRTYPE(int, CTxIn) & s, vFrenchnodeRanks) {
         UniValue obj(UniValue::VOBJ);
-        std::string strVin = s.second.vin.prevout.ToStringShort();
-        std::string strTxHash = s.second.vin.prevout.hash.ToString();
-        uint32_t oIdx = s.second.vin.prevout.n;
+        std::string strVin = s.second.prevout.ToStringShort();
+        std::string strTxHash = s.second.prevout.hash.ToString();
+        uint32_t oIdx = s.second.prevout.n;
 
-        CFrenchnode* mn = mnodeman.Find(s.second.vin);
+        CFrenchnode* mn = mnodeman.Find(s.second);
 
         if (mn != NULL) {
             if (strFilter != "" && strTxHash.find(strFilter) == string::npos &&
@@ -847,20 +848,122 @@ UniValue getmasternodescores (const UniValue& params, bool fHelp)
     }
     UniValue obj(UniValue::VOBJ);
 
-    std::vector<CFrenchnode> vFrenchnodes = mnodeman.GetFullFrenchnodeVector();
     for (int nHeight = chainActive.Tip()->nHeight - nLast; nHeight < chainActive.Tip()->nHeight + 20; nHeight++) {
-        uint256 nHigh = 0;
-        CFrenchnode* pBestFrenchnode = NULL;
-        BOOST_FOREACH (CFrenchnode& mn, vFrenchnodes) {
-            uint256 n = mn.CalculateScore(1, nHeight - 100);
-            if (n > nHigh) {
-                nHigh = n;
-                pBestFrenchnode = &mn;
-            }
-        }
-        if (pBestFrenchnode)
-            obj.push_back(Pair(strprintf("%d", nHeight), pBestFrenchnode->vin.prevout.hash.ToString().c_str()));
+        CFrenchnodeRanksRef ranks = mnodeman.GetRanks(nHeight - 100);
+        CTxIn vinBest;
+        if (ranks && ranks->GetVin(1, CFrenchnodeRanks::RANK_SCORED, vinBest))
+            obj.push_back(Pair(strprintf("%d", nHeight), vinBest.prevout.hash.ToString().c_str()));
+    }
+
+    return obj;
+}
+
+static UniValue SwiftTXLatencyToJSON(const CSwiftTXLatencyStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", stats.nCount));
+    obj.push_back(Pair("avgtime", stats.nCount ? ((double)stats.nTotalMicros) / stats.nCount / 1e6 : 0.0));
+    obj.push_back(Pair("maxtime", ((double)stats.nMaxMicros) / 1e6));
+    obj.push_back(Pair("p50", ((double)stats.GetPercentileBound(0.5)) / 1e6));
+    obj.push_back(Pair("p90", ((double)stats.GetPercentileBound(0.9)) / 1e6));
+    obj.push_back(Pair("p99", ((double)stats.GetPercentileBound(0.99)) / 1e6));
+    UniValue histogram(UniValue::VARR);
+    for (int i = 0; i < CSwiftTXLatencyStats::BUCKETS; i++)
+        histogram.push_back(stats.vBuckets[i]);
+    obj.push_back(Pair("histogram", histogram));
+    return obj;
+}
+
+static UniValue SwiftTXStatsToJSON()
+{
+    CSwiftTXLatencyStats statsVote, statsComplete, statsNotify;
+    swifttx.GetLatencyStats(statsVote, statsComplete, statsNotify);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("locks", (uint64_t)swifttx.GetLockCount()));
+    obj.push_back(Pair("completed", nCompleteTXLocks));
+    obj.push_back(Pair("vote", SwiftTXLatencyToJSON(statsVote)));
+    obj.push_back(Pair("complete", SwiftTXLatencyToJSON(statsComplete)));
+    obj.push_back(Pair("notify", SwiftTXLatencyToJSON(statsNotify)));
+    return obj;
+}
+
+UniValue getswifttxstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getswifttxstats\n"
+            "\nReturns the SwiftTX latencies seen by this node, from the receipt of a lock request.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"locks\": n,          (numeric) Transaction locks in memory\n"
+            "  \"completed\": n,      (numeric) Wallet transactions locked since startup\n"
+            "  \"vote\": {            (json object) Time to each vote that counts for the lock\n"
+            "    \"count\": n,        (numeric) Number of times measured\n"
+            "    \"avgtime\": n,      (numeric) Average time in seconds\n"
+            "    \"maxtime\": n,      (numeric) Longest time in seconds\n"
+            "    \"p50\": n,          (numeric) Time within which half of them were, in seconds, to the histogram's precision;\n"
+            "                        -1 if it is beyond the last bound\n"
+            "    \"p90\": n,          (numeric) Same for 90%\n"
+            "    \"p99\": n,          (numeric) Same for 99%\n"
+            "    \"histogram\": [n,...]  (json array) Counts within 1ms, 2ms, 5ms, 10ms, ... 20s, 50s and slower\n"
+            "  },\n"
+            "  \"complete\": {...},   (json object) Time to " + strprintf("%d", SWIFTTX_SIGNATURES_REQUIRED) + " votes, the same way\n"
+            "  \"notify\": {...}      (json object) Time to the notification of the wallet and ZMQ, the same way\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getswifttxstats", "") + HelpExampleRpc("getswifttxstats", ""));
+
+    return SwiftTXStatsToJSON();
+}
+
+UniValue swifttxloadtest(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "swifttxloadtest nodes requests ( rate )\n"
+            "\nAdd Frenchnodes with fresh keys to the list, then send lock requests for made-up transactions\n"
+            "through the SwiftTX lock and vote code with those of them in the top " + strprintf("%d", SWIFTTX_SIGNATURES_TOTAL) + " voting (-regtest only).\n"
+            "The latency stats are reset first, the Frenchnodes are removed at the end. Completed locks are\n"
+            "published over ZMQ like any other.\n"
+            "\nArguments:\n"
+            "1. nodes       (numeric, required) Number of Frenchnodes to add (1-1000)\n"
+            "2. requests    (numeric, required) Number of lock requests (1-100000)\n"
+            "3. rate        (numeric, optional, default=100) Lock requests per second\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"requests\": n,       (numeric) Lock requests sent\n"
+            "  \"completed\": n,      (numeric) Locks that got " + strprintf("%d", SWIFTTX_SIGNATURES_REQUIRED) + " votes\n"
+            "  \"time\": n,           (numeric) Seconds taken\n"
+            "  \"lockspersecond\": n, (numeric) Locks completed per second\n"
+            "  \"stats\": {...}       (json object) As returned by getswifttxstats\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("swifttxloadtest", "50 1000 200") + HelpExampleRpc("swifttxloadtest", "50, 1000, 200"));
+
+    if (!Params().MineBlocksOnDemand())
+        throw runtime_error("swifttxloadtest for regression testing (-regtest mode) only");
+
+    int nFrenchnodes = params[0].get_int();
+    int nRequests = params[1].get_int();
+    int nRate = params.size() > 2 ? params[2].get_int() : 100;
+    if (nFrenchnodes < 1 || nFrenchnodes > 1000 || nRequests < 1 || nRequests > 100000 || nRate < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of nodes, requests or rate");
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() < 1)
+            throw JSONRPCError(RPC_MISC_ERROR, "The load test needs a block to rank the Frenchnodes with");
     }
 
+    int64_t nStart = GetTimeMicros();
+    int nCompleted = SwiftTXLoadTest(nFrenchnodes, nRequests, nRate);
+    double dTime = (GetTimeMicros() - nStart) / 1e6;
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("requests", nRequests));
+    obj.push_back(Pair("completed", nCompleted));
+    obj.push_back(Pair("time", dTime));
+    obj.push_back(Pair("lockspersecond", dTime > 0 ? nCompleted / dTime : 0.0));
+    obj.push_back(Pair("stats", SwiftTXStatsToJSON()));
     return obj;
 }
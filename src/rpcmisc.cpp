@@ -144,7 +144,13 @@ UniValue mnsync(const UniValue& params, bool fHelp)
             "  \"countBudgetItemProp\": n,      (numeric) Number of MN budget messages (local)\n"
             "  \"countBudgetItemFin\": n,       (numeric) Number of MN budget finalization messages (local)\n"
             "  \"RequestedFrenchnodeAssets\": n, (numeric) Status code of last sync phase\n"
-            "  \"RequestedFrenchnodeAttempt\": n, (numeric) Status code of last sync attempt\n"
+            "  \"RequestedFrenchnodeAttempt\": n, (numeric) Number of peers asked for the current asset\n"
+            "  \"syncPeersReplied\": n,       (numeric) Number of those peers that reported their item count\n"
+            "  \"assetSyncTime\": n.nnn,      (numeric) Seconds spent on the current asset so far\n"
+            "  \"assetSyncTimes\": {          (json object) Seconds each finished asset took to sync\n"
+            "    \"sporks|list|winners|budget\": n.nnn\n"
+            "    ,...\n"
+            "  }\n"
             "}\n"
 
             "\nResult ('reset' mode):\n"
@@ -173,6 +179,17 @@ UniValue mnsync(const UniValue& params, bool fHelp)
         obj.push_back(Pair("RequestedFrenchnodeAssets", masternodeSync.RequestedFrenchnodeAssets));
         obj.push_back(Pair("RequestedFrenchnodeAttempt", masternodeSync.RequestedFrenchnodeAttempt));
 
+        {
+            LOCK(masternodeSync.cs);
+            obj.push_back(Pair("syncPeersReplied", (int)masternodeSync.setSyncReplied.size()));
+            if (!masternodeSync.IsSynced() && masternodeSync.RequestedFrenchnodeAssets != FRENCHNODE_SYNC_FAILED)
+                obj.push_back(Pair("assetSyncTime", (GetTimeMillis() - masternodeSync.nAssetSyncStartedMillis) / 1000.0));
+            UniValue times(UniValue::VOBJ);
+            for (std::map<int, int64_t>::const_iterator it = masternodeSync.mapAssetSyncMillis.begin(); it != masternodeSync.mapAssetSyncMillis.end(); ++it)
+                times.push_back(Pair(CFrenchnodeSync::GetAssetName(it->first), it->second / 1000.0));
+            obj.push_back(Pair("assetSyncTimes", times));
+        }
+
         return obj;
     }
 
@@ -16,6 +16,8 @@
 #include "util.h"
 #include "version.h"
 
+#include <set>
+
 #include <boost/foreach.hpp>
 
 #include <univalue.h>
@@ -70,6 +72,34 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+/** Messages and bytes per command, sent and received */
+static UniValue MessageTrafficToJSON(const mapMsgCmdTraffic& mapSent, const mapMsgCmdTraffic& mapRecv)
+{
+    std::set<std::string> setCommands;
+    for (mapMsgCmdTraffic::const_iterator it = mapSent.begin(); it != mapSent.end(); ++it)
+        setCommands.insert(it->first);
+    for (mapMsgCmdTraffic::const_iterator it = mapRecv.begin(); it != mapRecv.end(); ++it)
+        setCommands.insert(it->first);
+
+    UniValue ret(UniValue::VOBJ);
+    BOOST_FOREACH (const std::string& strCommand, setCommands) {
+        CMessageTrafficStats sent, recv;
+        mapMsgCmdTraffic::const_iterator it = mapSent.find(strCommand);
+        if (it != mapSent.end())
+            sent = it->second;
+        it = mapRecv.find(strCommand);
+        if (it != mapRecv.end())
+            recv = it->second;
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("msgssent", sent.nCount));
+        entry.push_back(Pair("bytessent", sent.nBytes));
+        entry.push_back(Pair("msgsrecv", recv.nCount));
+        entry.push_back(Pair("bytesrecv", recv.nBytes));
+        ret.push_back(Pair(strCommand, entry));
+    }
+    return ret;
+}
+
 UniValue getpeerinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -90,6 +120,16 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
+            "    \"msgsprocessed\": n,        (numeric) The number of messages handled from this peer\n"
+            "    \"processingtime\": n,       (numeric) The time in seconds spent handling them\n"
+            "    \"msgtraffic\": {            (json object) Messages exchanged with this peer, by command (\"*other*\" for unknown ones)\n"
+            "      \"command\": {\n"
+            "        \"msgssent\": n,          (numeric) Messages sent\n"
+            "        \"bytessent\": n,         (numeric) Bytes sent, message headers included\n"
+            "        \"msgsrecv\": n,          (numeric) Messages received\n"
+            "        \"bytesrecv\": n          (numeric) Bytes received, message headers included\n"
+            "      }, ...\n"
+            "    },\n"
             "    \"version\": v,              (numeric) The peer version, such as 7001\n"
             "    \"subver\": \"/French Core:x.x.x.x/\",  (string) The string version\n"
             "    \"inbound\": true|false,     (boolean) Inbound (true) or Outbound (false)\n"
@@ -129,6 +169,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
             obj.push_back(Pair("pingwait", stats.dPingWait));
+        obj.push_back(Pair("msgsprocessed", stats.nProcessedMsgs));
+        obj.push_back(Pair("processingtime", stats.dProcessingTime));
+        obj.push_back(Pair("msgtraffic", MessageTrafficToJSON(stats.mapSendTrafficPerCmd, stats.mapRecvTrafficPerCmd)));
         obj.push_back(Pair("version", stats.nVersion));
         // Use the sanitized form of subver here, to avoid tricksy remote peers from
         // corrupting or modifiying the JSON output by putting special characters in
@@ -335,6 +378,32 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
             "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"msghandthreads\": n,   (numeric) Number of threads processing peer messages\n"
+            "  \"uploadtarget\": {      (json object) The -maxuploadtarget state\n"
+            "    \"timeframe\": n,          (numeric) Length of the measuring timeframe in seconds\n"
+            "    \"target\": n,             (numeric) Target in bytes, 0 if there is none\n"
+            "    \"target_reached\": true|false,  (boolean) True if the target is reached\n"
+            "    \"serve_historical_blocks\": true|false,  (boolean) True if blocks older than a week are served\n"
+            "    \"bytes_left_in_cycle\": n,  (numeric) Bytes left in the current timeframe\n"
+            "    \"time_left_in_cycle\": n    (numeric) Seconds left in the current timeframe\n"
+            "  },\n"
+            "  \"maxpeeruploadrate\": n,  (numeric) Per-peer send limit in bytes per second, 0 if there is none\n"
+            "  \"messages\": {           (json object) Time spent handling received messages, by command\n"
+            "    \"command\": {\n"
+            "      \"count\": n,          (numeric) Number of messages handled\n"
+            "      \"totaltime\": n,      (numeric) Total time in seconds\n"
+            "      \"maxtime\": n,        (numeric) Longest time for a single message in seconds\n"
+            "      \"histogram\": [n,...]  (json array) Messages handled within 10us, 100us, 1ms, 10ms, 100ms, 1s and slower\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"msgtraffic\": {         (json object) Messages exchanged with all peers since startup, by command\n"
+            "    \"command\": {\n"
+            "      \"msgssent\": n,        (numeric) Messages sent\n"
+            "      \"bytessent\": n,       (numeric) Bytes sent, message headers included\n"
+            "      \"msgsrecv\": n,        (numeric) Messages received\n"
+            "      \"bytesrecv\": n        (numeric) Bytes received, message headers included\n"
+            "    }, ...\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getnettotals", "") + HelpExampleRpc("getnettotals", ""));
@@ -343,6 +412,37 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+    obj.push_back(Pair("msghandthreads", nMessageHandlerThreads));
+
+    UniValue outboundLimit(UniValue::VOBJ);
+    outboundLimit.push_back(Pair("timeframe", MAX_UPLOAD_TIMEFRAME));
+    outboundLimit.push_back(Pair("target", CNode::GetMaxOutboundTarget()));
+    outboundLimit.push_back(Pair("target_reached", CNode::OutboundTargetReached()));
+    outboundLimit.push_back(Pair("serve_historical_blocks", !CNode::OutboundTargetReached()));
+    outboundLimit.push_back(Pair("bytes_left_in_cycle", CNode::GetOutboundTargetBytesLeft()));
+    outboundLimit.push_back(Pair("time_left_in_cycle", CNode::GetMaxOutboundTimeLeftInCycle()));
+    obj.push_back(Pair("uploadtarget", outboundLimit));
+    obj.push_back(Pair("maxpeeruploadrate", nMaxPeerUploadRate));
+
+    std::map<std::string, CMessageTimeStats> mapStats;
+    CNode::GetProcessingTimeStats(mapStats);
+    UniValue messages(UniValue::VOBJ);
+    for (std::map<std::string, CMessageTimeStats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("count", it->second.nCount));
+        entry.push_back(Pair("totaltime", ((double)it->second.nTotalMicros) / 1e6));
+        entry.push_back(Pair("maxtime", ((double)it->second.nMaxMicros) / 1e6));
+        UniValue histogram(UniValue::VARR);
+        for (int i = 0; i < CMessageTimeStats::BUCKETS; i++)
+            histogram.push_back(it->second.vBuckets[i]);
+        entry.push_back(Pair("histogram", histogram));
+        messages.push_back(Pair(it->first, entry));
+    }
+    obj.push_back(Pair("messages", messages));
+
+    mapMsgCmdTraffic mapSent, mapRecv;
+    CNode::GetMessageTrafficTotals(mapSent, mapRecv);
+    obj.push_back(Pair("msgtraffic", MessageTrafficToJSON(mapSent, mapRecv)));
     return obj;
 }
 
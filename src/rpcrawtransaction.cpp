@@ -729,7 +729,8 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         if (fSwiftTX) {
-            mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            swifttx.RequestReceived(hashTx, GetTimeMicros());
+            swifttx.AddTxLockRequest(tx);
             CreateNewLock(tx);
             RelayTransactionLockReq(tx, true);
         }
@@ -275,6 +275,7 @@ static const CRPCCommand vRPCCommands[] =
         {"network", "clearbanned", &clearbanned, true, false, false},
 
         /* Block chain and UTXO */
+        {"blockchain", "dumptxoutset", &dumptxoutset, true, true, false},
         {"blockchain", "getblockchaininfo", &getblockchaininfo, true, false, false},
         {"blockchain", "getbestblockhash", &getbestblockhash, true, false, false},
         {"blockchain", "getblockcount", &getblockcount, true, false, false},
@@ -326,6 +327,7 @@ static const CRPCCommand vRPCCommands[] =
         {"hidden", "invalidateblock", &invalidateblock, true, true, false},
         {"hidden", "reconsiderblock", &reconsiderblock, true, true, false},
         {"hidden", "setmocktime", &setmocktime, true, false, false},
+        {"hidden", "swifttxloadtest", &swifttxloadtest, true, true, false},
 
         /* French features */
         {"french", "masternode", &masternode, true, true, false},
@@ -341,6 +343,7 @@ static const CRPCCommand vRPCCommands[] =
         {"french", "getmasternodestatus", &getmasternodestatus, true, true, false},
         {"french", "getmasternodewinners", &getmasternodewinners, true, true, false},
         {"french", "getmasternodescores", &getmasternodescores, true, true, false},
+        {"french", "getswifttxstats", &getswifttxstats, true, true, false},
         {"french", "mnbudget", &mnbudget, true, true, false},
         {"french", "preparebudget", &preparebudget, true, true, false},
         {"french", "submitbudget", &submitbudget, true, true, false},
@@ -61,6 +61,7 @@ class CSporkManager;
 
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
+extern CCriticalSection cs_mapSporks;
 extern CSporkManager sporkManager;
 
 void LoadSporksFromDB();
@@ -283,12 +283,71 @@ public:
 
     void GetAndClear(CSerializeData& data)
     {
-        data.insert(data.end(), begin(), end());
+        // Hand the whole buffer over rather than copying it, if nothing was read from it
+        if (data.empty() && nReadPos == 0)
+            data.swap(vch);
+        else
+            data.insert(data.end(), begin(), end());
         clear();
     }
 };
 
 
+/** Read-only stream over a buffer owned by someone else (e.g. a memory mapped file).
+ *
+ * Deserializes in place, without copying the data into a CDataStream first.
+ * The buffer must outlive the reader.
+ */
+class CMemoryReader
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    const char* pread;
+
+    int nType;
+    int nVersion;
+
+public:
+    CMemoryReader(const char* pbeginIn, size_t nSize, int nTypeIn, int nVersionIn)
+        : pbegin(pbeginIn), pend(pbeginIn + nSize), pread(pbeginIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    //
+    // Stream subset
+    //
+    bool eof() const { return pread == pend; }
+    size_t size() const { return pend - pread; }
+    size_t GetPos() const { return pread - pbegin; }
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    CMemoryReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read : end of data");
+        memcpy(pch, pread, nSize);
+        pread += nSize;
+        return (*this);
+    }
+
+    CMemoryReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore : end of data");
+        pread += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
@@ -20,12 +20,7 @@
 using namespace std;
 using namespace boost;
 
-std::map<uint256, CTransaction> mapTxLockReq;
-std::map<uint256, CTransaction> mapTxLockReqRejected;
-std::map<uint256, CConsensusVote> mapTxLockVote;
-std::map<uint256, CTransactionLock> mapTxLocks;
-std::map<COutPoint, uint256> mapLockedInputs;
-std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
+CSwiftTXManager swifttx;
 int nCompleteTXLocks;
 
 //txlock - Locks transaction
@@ -35,7 +30,7 @@ int nCompleteTXLocks;
 //         Send "txvote", CTransaction, Signature, Approve
 //step 3.) Top 1 masternode, waits for SWIFTTX_SIGNATURES_REQUIRED messages. Upon success, sends "txlock'
 
-void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     if (fLiteMode) return; //disable all masternode related functionality
     if (!IsSporkActive(SPORK_2_SWIFTTX)) return;
@@ -50,7 +45,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
         CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if (mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())) {
+        if (swifttx.HasTxLockRequest(tx.GetHash())) {
             return;
         }
 
@@ -58,6 +53,8 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             return;
         }
 
+        swifttx.RequestReceived(tx.GetHash(), nTimeReceived);
+
         BOOST_FOREACH (const CTxOut o, tx.vout) {
             // IX supports normal scripts and unspendable scripts (used in DS collateral and Budget collateral).
             // TODO: Look into other script types that are normal and can be included
@@ -78,11 +75,11 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             fAccepted = AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs);
         }
         if (fAccepted) {
-            RelayInv(inv);
+            RelayMessage(inv, "ix", tx);
 
             DoConsensusVote(tx, nBlockHeight);
 
-            mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            swifttx.AddTxLockRequest(tx);
 
             LogPrintf("ProcessMessageSwiftTX::ix - Transaction Lock Request: %s %s : accepted %s\n",
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
@@ -91,7 +88,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             return;
 
         } else {
-            mapTxLockReqRejected.insert(make_pair(tx.GetHash(), tx));
+            swifttx.AddRejectedTxLockRequest(tx);
 
             // can we get the conflicting transaction as proof?
 
@@ -99,24 +96,17 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
                 tx.GetHash().ToString().c_str());
 
-            BOOST_FOREACH (const CTxIn& in, tx.vin) {
-                if (!mapLockedInputs.count(in.prevout)) {
-                    mapLockedInputs.insert(make_pair(in.prevout, tx.GetHash()));
-                }
-            }
+            swifttx.LockInputs(tx);
 
             // resolve conflicts
-            std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(tx.GetHash());
-            if (i != mapTxLocks.end()) {
-                //we only care if we have a complete tx lock
-                if ((*i).second.CountSignatures() >= SWIFTTX_SIGNATURES_REQUIRED) {
-                    if (!CheckForConflictingLocks(tx)) {
-                        LogPrintf("ProcessMessageSwiftTX::ix - Found Existing Complete IX Lock\n");
-
-                        //reprocess the last 15 blocks
-                        ReprocessBlocks(15);
-                        mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
-                    }
+            //we only care if we have a complete tx lock
+            if (swifttx.GetSignatures(tx.GetHash()) >= SWIFTTX_SIGNATURES_REQUIRED) {
+                if (!swifttx.CheckForConflictingLocks(tx)) {
+                    LogPrintf("ProcessMessageSwiftTX::ix - Found Existing Complete IX Lock\n");
+
+                    //reprocess the last 15 blocks
+                    ReprocessBlocks(15);
+                    swifttx.AddTxLockRequest(tx);
                 }
             }
 
@@ -130,12 +120,10 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
         CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if (mapTxLockVote.count(ctx.GetHash())) {
+        if (!swifttx.AddTxLockVote(ctx)) {
             return;
         }
 
-        mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
-
         if (ProcessConsensusVote(pfrom, ctx)) {
             //Spam/Dos protection
             /*
@@ -143,22 +131,13 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
                 This tracks those messages and allows it at the same rate of the rest of the network, if
                 a peer violates it, it will simply be ignored
             */
-            if (!mapTxLockReq.count(ctx.txHash) && !mapTxLockReqRejected.count(ctx.txHash)) {
-                if (!mapUnknownVotes.count(ctx.vinFrenchnode.prevout.hash)) {
-                    mapUnknownVotes[ctx.vinFrenchnode.prevout.hash] = GetTime() + (60 * 10);
-                }
-
-                if (mapUnknownVotes[ctx.vinFrenchnode.prevout.hash] > GetTime() &&
-                    mapUnknownVotes[ctx.vinFrenchnode.prevout.hash] - GetAverageVoteTime() > 60 * 10) {
-                    LogPrintf("ProcessMessageSwiftTX::ix - masternode is spamming transaction votes: %s %s\n",
-                        ctx.vinFrenchnode.ToString().c_str(),
-                        ctx.txHash.ToString().c_str());
-                    return;
-                } else {
-                    mapUnknownVotes[ctx.vinFrenchnode.prevout.hash] = GetTime() + (60 * 10);
-                }
+            if (!swifttx.HasTxLockRequest(ctx.txHash) && !swifttx.CheckUnknownVoteRate(ctx.vinFrenchnode)) {
+                LogPrintf("ProcessMessageSwiftTX::ix - masternode is spamming transaction votes: %s %s\n",
+                    ctx.vinFrenchnode.ToString().c_str(),
+                    ctx.txHash.ToString().c_str());
+                return;
             }
-            RelayInv(inv);
+            RelayMessage(inv, "txlvote", ctx);
         }
 
         return;
@@ -179,11 +158,14 @@ bool IsIXTXValid(const CTransaction& txCollateral)
 
     BOOST_FOREACH (const CTxIn i, txCollateral.vin) {
         CTransaction tx2;
+        CTxOut txout;
         uint256 hash;
         if (GetTransaction(i.prevout.hash, tx2, hash, true)) {
             if (tx2.vout.size() > i.prevout.n) {
                 nValueIn += tx2.vout[i.prevout.n].nValue;
             }
+        } else if (GetUnspentOutput(i.prevout, txout, hash)) {
+            nValueIn += txout.nValue;
         } else {
             missingTx = true;
         }
@@ -231,20 +213,7 @@ int64_t CreateNewLock(CTransaction tx)
     */
     int nBlockHeight = (chainActive.Tip()->nHeight - nTxAge) + 4;
 
-    if (!mapTxLocks.count(tx.GetHash())) {
-        LogPrintf("CreateNewLock - New Transaction Lock %s !\n", tx.GetHash().ToString().c_str());
-
-        CTransactionLock newLock;
-        newLock.nBlockHeight = nBlockHeight;
-        newLock.nExpiration = GetTime() + (60 * 60); //locks expire after 60 minutes (24 confirmations)
-        newLock.nTimeout = GetTime() + (60 * 5);
-        newLock.txHash = tx.GetHash();
-        mapTxLocks.insert(make_pair(tx.GetHash(), newLock));
-    } else {
-        mapTxLocks[tx.GetHash()].nBlockHeight = nBlockHeight;
-        LogPrint("swifttx", "CreateNewLock - Transaction Lock Exists %s !\n", tx.GetHash().ToString().c_str());
-    }
-
+    swifttx.CreateLock(tx.GetHash(), nBlockHeight);
 
     return nBlockHeight;
 }
@@ -284,10 +253,10 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight)
         return;
     }
 
-    mapTxLockVote[ctx.GetHash()] = ctx;
+    swifttx.AddTxLockVote(ctx);
 
     CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
-    RelayInv(inv);
+    RelayMessage(inv, "txlvote", ctx);
 }
 
 //received a consensus vote
@@ -302,7 +271,7 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
     if (n == -1) {
         //can be caused by past versions trying to vote with an invalid protocol
         LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Unknown Frenchnode\n");
-        mnodeman.AskForMN(pnode, ctx.vinFrenchnode);
+        if (pnode) mnodeman.AskForMN(pnode, ctx.vinFrenchnode);
         return false;
     }
 
@@ -314,140 +283,135 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
     if (!ctx.SignatureValid()) {
         LogPrintf("SwiftTX::ProcessConsensusVote - Signature invalid\n");
         // don't ban, it could just be a non-synced masternode
-        mnodeman.AskForMN(pnode, ctx.vinFrenchnode);
+        if (pnode) mnodeman.AskForMN(pnode, ctx.vinFrenchnode);
         return false;
     }
 
-    if (!mapTxLocks.count(ctx.txHash)) {
-        LogPrintf("SwiftTX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
-
-        CTransactionLock newLock;
-        newLock.nBlockHeight = 0;
-        newLock.nExpiration = GetTime() + (60 * 60);
-        newLock.nTimeout = GetTime() + (60 * 5);
-        newLock.txHash = ctx.txHash;
-        mapTxLocks.insert(make_pair(ctx.txHash, newLock));
-    } else
-        LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
-
     //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
-    if (i != mapTxLocks.end()) {
-        (*i).second.AddSignature(ctx);
+    int nSignatures = swifttx.AddSignature(ctx);
 
 #ifdef ENABLE_WALLET
-        if (pwalletMain) {
-            //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
-            if (pwalletMain->mapRequestCount.count(ctx.txHash))
-                pwalletMain->mapRequestCount[ctx.txHash]++;
-        }
+    if (pwalletMain) {
+        //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
+        if (pwalletMain->mapRequestCount.count(ctx.txHash))
+            pwalletMain->mapRequestCount[ctx.txHash]++;
+    }
 #endif
 
-        LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", (*i).second.CountSignatures(), ctx.GetHash().ToString().c_str());
+    LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", nSignatures, ctx.GetHash().ToString().c_str());
 
-        if ((*i).second.CountSignatures() >= SWIFTTX_SIGNATURES_REQUIRED) {
-            LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
+    if (nSignatures >= SWIFTTX_SIGNATURES_REQUIRED) {
+        LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", ctx.txHash.ToString().c_str());
 
-            CTransaction& tx = mapTxLockReq[ctx.txHash];
-            if (!CheckForConflictingLocks(tx)) {
+        CTransaction tx;
+        bool fHaveRequest = swifttx.GetTxLockRequest(ctx.txHash, tx);
+        if (!swifttx.CheckForConflictingLocks(tx)) {
 #ifdef ENABLE_WALLET
-                if (pwalletMain) {
-                    if (pwalletMain->UpdatedTransaction((*i).second.txHash)) {
-                        nCompleteTXLocks++;
-                    }
-                }
-#endif
-
-                if (mapTxLockReq.count(ctx.txHash)) {
-                    BOOST_FOREACH (const CTxIn& in, tx.vin) {
-                        if (!mapLockedInputs.count(in.prevout)) {
-                            mapLockedInputs.insert(make_pair(in.prevout, ctx.txHash));
-                        }
-                    }
-                }
-
-                // resolve conflicts
-
-                //if this tx lock was rejected, we need to remove the conflicting blocks
-                if (mapTxLockReqRejected.count((*i).second.txHash)) {
-                    //reprocess the last 15 blocks
-                    ReprocessBlocks(15);
+            if (pwalletMain) {
+                if (pwalletMain->UpdatedTransaction(ctx.txHash)) {
+                    nCompleteTXLocks++;
                 }
             }
-        }
-        return true;
-    }
+#endif
 
+            if (fHaveRequest)
+                swifttx.LockInputs(tx);
 
-    return false;
-}
+            if (swifttx.LockNotified(ctx.txHash) && fHaveRequest)
+                GetMainSignals().NotifyTransactionLock(tx);
 
-bool CheckForConflictingLocks(CTransaction& tx)
-{
-    /*
-        It's possible (very unlikely though) to get 2 conflicting transaction locks approved by the network.
-        In that case, they will cancel each other out.
+            // resolve conflicts
 
-        Blocks could have been rejected during this time, which is OK. After they cancel out, the client will
-        rescan the blocks and find they're acceptable and then take the chain with the most work.
-    */
-    BOOST_FOREACH (const CTxIn& in, tx.vin) {
-        if (mapLockedInputs.count(in.prevout)) {
-            if (mapLockedInputs[in.prevout] != tx.GetHash()) {
-                LogPrintf("SwiftTX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", tx.GetHash().ToString().c_str(), mapLockedInputs[in.prevout].ToString().c_str());
-                if (mapTxLocks.count(tx.GetHash())) mapTxLocks[tx.GetHash()].nExpiration = GetTime();
-                if (mapTxLocks.count(mapLockedInputs[in.prevout])) mapTxLocks[mapLockedInputs[in.prevout]].nExpiration = GetTime();
-                return true;
+            //if this tx lock was rejected, we need to remove the conflicting blocks
+            if (swifttx.IsTxLockRequestRejected(ctx.txHash)) {
+                //reprocess the last 15 blocks
+                ReprocessBlocks(15);
             }
         }
     }
-
-    return false;
-}
-
-int64_t GetAverageVoteTime()
-{
-    std::map<uint256, int64_t>::iterator it = mapUnknownVotes.begin();
-    int64_t total = 0;
-    int64_t count = 0;
-
-    while (it != mapUnknownVotes.end()) {
-        total += it->second;
-        count++;
-        it++;
-    }
-
-    return total / count;
+    return true;
 }
 
 void CleanTransactionLocksList()
 {
     if (chainActive.Tip() == NULL) return;
 
-    std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
-
-    while (it != mapTxLocks.end()) {
-        if (GetTime() > it->second.nExpiration) { //keep them for an hour
-            LogPrintf("Removing old transaction lock %s\n", it->second.txHash.ToString().c_str());
-
-            if (mapTxLockReq.count(it->second.txHash)) {
-                CTransaction& tx = mapTxLockReq[it->second.txHash];
+    swifttx.RemoveExpired(GetTime());
+}
 
-                BOOST_FOREACH (const CTxIn& in, tx.vin)
-                    mapLockedInputs.erase(in.prevout);
+int SwiftTXLoadTest(int nFrenchnodes, int nRequests, int nRate)
+{
+    int nBlockHeight;
+    {
+        LOCK(cs_main);
+        nBlockHeight = chainActive.Height();
+    }
+    if (nBlockHeight < 1) return 0;
+
+    // Frenchnodes old enough to be ranked for payments, which SwiftTX votes are ranked like
+    std::map<COutPoint, CKey> mapKeys;
+    for (int i = 0; i < nFrenchnodes; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        CFrenchnode mn;
+        mn.vin = CTxIn(COutPoint(GetRandHash(), 0));
+        mn.pubKeyCollateralAddress = key.GetPubKey();
+        mn.pubKeyFrenchnode = key.GetPubKey();
+        mn.sigTime = GetAdjustedTime() - GetSporkValue(SPORK_16_MN_WINNER_MINIMUM_AGE) - 60;
+        mn.lastPing.sigTime = GetAdjustedTime();
+        mn.lastPing.vin = mn.vin;
+        if (mnodeman.Add(mn)) mapKeys.insert(make_pair(mn.vin.prevout, key));
+    }
 
-                mapTxLockReq.erase(it->second.txHash);
-                mapTxLockReqRejected.erase(it->second.txHash);
+    swifttx.ResetLatencyStats();
+    std::vector<uint256> vRequests;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nRequests; i++) {
+        // pace with no lock held, so blocks and messages carry on in between
+        int64_t nWait = (nStart + (int64_t)i * 1000000 / nRate - GetTimeMicros()) / 1000;
+        if (nWait > 0) MilliSleep(nWait);
+        boost::this_thread::interruption_point();
+
+        // the "ix" and "txlvote" handlers run under cs_main, and so does each injection
+        LOCK(cs_main);
+        CMutableTransaction txNew;
+        txNew.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        txNew.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+        CTransaction tx(txNew);
+        uint256 txHash = tx.GetHash();
+        vRequests.push_back(txHash);
+
+        // what the "ix" handler does with an accepted request, then the votes of the top Frenchnodes
+        swifttx.RequestReceived(txHash, GetTimeMicros());
+        swifttx.CreateLock(txHash, nBlockHeight);
+        swifttx.AddTxLockRequest(tx);
+
+        CFrenchnodeRanksRef ranks = mnodeman.GetRanks(nBlockHeight, MIN_SWIFTTX_PROTO_VERSION);
+        for (int nRank = 1; ranks && nRank <= SWIFTTX_SIGNATURES_TOTAL; nRank++) {
+            CTxIn vin;
+            if (!ranks->GetVin(nRank, CFrenchnodeRanks::RANK_ACTIVE, vin)) break;
+            std::map<COutPoint, CKey>::const_iterator it = mapKeys.find(vin.prevout);
+            if (it == mapKeys.end()) continue;
+
+            CConsensusVote ctx;
+            ctx.vinFrenchnode = vin;
+            ctx.txHash = txHash;
+            ctx.nBlockHeight = nBlockHeight;
+            if (!ctx.Sign(it->second, it->second.GetPubKey())) continue;
+            if (swifttx.AddTxLockVote(ctx)) ProcessConsensusVote(NULL, ctx);
+        }
+    }
 
-                BOOST_FOREACH (CConsensusVote& v, it->second.vecConsensusVotes)
-                    mapTxLockVote.erase(v.GetHash());
-            }
+    for (std::map<COutPoint, CKey>::const_iterator it = mapKeys.begin(); it != mapKeys.end(); ++it)
+        mnodeman.Remove(CTxIn(it->first));
 
-            mapTxLocks.erase(it++);
-        } else {
-            it++;
-        }
+    int nCompleted = 0;
+    BOOST_FOREACH (const uint256& txHash, vRequests) {
+        if (swifttx.GetSignatures(txHash) >= SWIFTTX_SIGNATURES_REQUIRED) nCompleted++;
     }
+    LogPrintf("SwiftTXLoadTest - %d Frenchnodes, %d of %d locks completed in %dms\n",
+        mapKeys.size(), nCompleted, nRequests, (GetTimeMicros() - nStart) / 1000);
+    return nCompleted;
 }
 
 uint256 CConsensusVote::GetHash() const
@@ -483,8 +447,6 @@ bool CConsensusVote::Sign()
 
     CKey key2;
     CPubKey pubkey2;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
-    //LogPrintf("signing strMessage %s \n", strMessage.c_str());
     //LogPrintf("signing privkey %s \n", strMasterNodePrivKey.c_str());
 
     if (!masternodeSigner.SetKey(strMasterNodePrivKey, errorMessage, key2, pubkey2)) {
@@ -492,12 +454,21 @@ bool CConsensusVote::Sign()
         return false;
     }
 
-    if (!masternodeSigner.SignMessage(strMessage, errorMessage, vchMasterNodeSignature, key2)) {
+    return Sign(key2, pubkey2);
+}
+
+bool CConsensusVote::Sign(const CKey& key, const CPubKey& pubKey)
+{
+    std::string errorMessage;
+    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
+    //LogPrintf("signing strMessage %s \n", strMessage.c_str());
+
+    if (!masternodeSigner.SignMessage(strMessage, errorMessage, vchMasterNodeSignature, key)) {
         LogPrintf("CConsensusVote::Sign() - Sign message failed");
         return false;
     }
 
-    if (!masternodeSigner.VerifyMessage(pubkey2, vchMasterNodeSignature, strMessage, errorMessage)) {
+    if (!masternodeSigner.VerifyMessage(pubKey, vchMasterNodeSignature, strMessage, errorMessage)) {
         LogPrintf("CConsensusVote::Sign() - Verify message failed");
         return false;
     }
@@ -530,12 +501,26 @@ bool CTransactionLock::SignaturesValid()
     return true;
 }
 
-void CTransactionLock::AddSignature(CConsensusVote& cv)
+void CTransactionLock::AddSignature(const CConsensusVote& cv)
 {
     vecConsensusVotes.push_back(cv);
+    if (cv.nBlockHeight == nBlockHeight) nSignatures++;
+}
+
+void CTransactionLock::SetBlockHeight(int nBlockHeightIn)
+{
+    if (nBlockHeightIn == nBlockHeight) return;
+
+    nBlockHeight = nBlockHeightIn;
+    nSignatures = 0;
+    BOOST_FOREACH (const CConsensusVote& v, vecConsensusVotes) {
+        if (v.nBlockHeight == nBlockHeight) {
+            nSignatures++;
+        }
+    }
 }
 
-int CTransactionLock::CountSignatures()
+int CTransactionLock::CountSignatures() const
 {
     /*
         Only count signatures where the BlockHeight matches the transaction's blockheight.
@@ -544,11 +529,335 @@ int CTransactionLock::CountSignatures()
 
     if (nBlockHeight == 0) return -1;
 
-    int n = 0;
-    BOOST_FOREACH (CConsensusVote v, vecConsensusVotes) {
-        if (v.nBlockHeight == nBlockHeight) {
-            n++;
+    return nSignatures;
+}
+
+CSwiftTXManager::LockMap::iterator CSwiftTXManager::NewLock(const uint256& txHash)
+{
+    AssertLockHeld(cs);
+
+    CTransactionLock newLock;
+    newLock.nBlockHeight = 0;
+    newLock.nTimeout = GetTime() + (60 * 5);
+    newLock.txHash = txHash;
+    LockMap::iterator it = mapTxLocks.insert(make_pair(txHash, newLock)).first;
+    SetExpiration(it->second, GetTime() + (60 * 60)); //locks expire after 60 minutes (24 confirmations)
+    return it;
+}
+
+void CSwiftTXManager::SetExpiration(CTransactionLock& lock, int64_t nExpiration)
+{
+    AssertLockHeld(cs);
+
+    lock.nExpiration = nExpiration;
+    queueExpiration.push(std::make_pair(nExpiration, lock.txHash));
+}
+
+bool CSwiftTXManager::HasTxLockRequest(const uint256& txHash) const
+{
+    LOCK(cs);
+    return mapTxLockReq.count(txHash) || mapTxLockReqRejected.count(txHash);
+}
+
+bool CSwiftTXManager::IsTxLockRequestRejected(const uint256& txHash) const
+{
+    LOCK(cs);
+    return mapTxLockReqRejected.count(txHash);
+}
+
+bool CSwiftTXManager::GetTxLockRequest(const uint256& txHash, CTransaction& txRet) const
+{
+    LOCK(cs);
+    TxMap::const_iterator it = mapTxLockReq.find(txHash);
+    if (it == mapTxLockReq.end()) return false;
+    txRet = it->second;
+    return true;
+}
+
+void CSwiftTXManager::AddTxLockRequest(const CTransaction& tx)
+{
+    LOCK(cs);
+    mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+}
+
+void CSwiftTXManager::AddRejectedTxLockRequest(const CTransaction& tx)
+{
+    LOCK(cs);
+    mapTxLockReqRejected.insert(make_pair(tx.GetHash(), tx));
+}
+
+void CSwiftTXManager::RequestReceived(const uint256& txHash, int64_t nTimeMicros)
+{
+    LOCK(cs);
+    if (!mapRequestTime.insert(make_pair(txHash, nTimeMicros)).second) return;
+
+    // goes with the lock if there is one by then, on its own otherwise
+    queueExpiration.push(std::make_pair(GetTime() + (60 * 60), txHash));
+}
+
+bool CSwiftTXManager::HasTxLockVote(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapTxLockVote.count(hash);
+}
+
+bool CSwiftTXManager::GetTxLockVote(const uint256& hash, CConsensusVote& voteRet) const
+{
+    LOCK(cs);
+    boost::unordered_map<uint256, CConsensusVote, BlockHasher>::const_iterator it = mapTxLockVote.find(hash);
+    if (it == mapTxLockVote.end()) return false;
+    voteRet = it->second;
+    return true;
+}
+
+bool CSwiftTXManager::AddTxLockVote(const CConsensusVote& vote)
+{
+    LOCK(cs);
+    return mapTxLockVote.insert(make_pair(vote.GetHash(), vote)).second;
+}
+
+void CSwiftTXManager::CreateLock(const uint256& txHash, int nBlockHeight)
+{
+    LOCK(cs);
+
+    LockMap::iterator it = mapTxLocks.find(txHash);
+    if (it == mapTxLocks.end()) {
+        LogPrintf("CreateNewLock - New Transaction Lock %s !\n", txHash.ToString().c_str());
+        it = NewLock(txHash);
+    } else {
+        LogPrint("swifttx", "CreateNewLock - Transaction Lock Exists %s !\n", txHash.ToString().c_str());
+    }
+    it->second.SetBlockHeight(nBlockHeight);
+}
+
+int CSwiftTXManager::AddSignature(const CConsensusVote& vote)
+{
+    LOCK(cs);
+
+    LockMap::iterator it = mapTxLocks.find(vote.txHash);
+    if (it == mapTxLocks.end()) {
+        LogPrintf("SwiftTX::ProcessConsensusVote - New Transaction Lock %s !\n", vote.txHash.ToString().c_str());
+        it = NewLock(vote.txHash);
+    } else {
+        LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Exists %s !\n", vote.txHash.ToString().c_str());
+    }
+    CTransactionLock& lock = it->second;
+    lock.AddSignature(vote);
+    int nSignatures = lock.CountSignatures();
+
+    // votes that count are timed from the receipt of the request, if it came first
+    if (vote.nBlockHeight == lock.nBlockHeight) {
+        int64_t nNow = GetTimeMicros();
+        boost::unordered_map<uint256, int64_t, BlockHasher>::const_iterator itTime = mapRequestTime.find(vote.txHash);
+        bool fTimed = itTime != mapRequestTime.end() && nNow >= itTime->second;
+        if (fTimed) statsVote.Add(nNow - itTime->second);
+        if (nSignatures >= SWIFTTX_SIGNATURES_REQUIRED && lock.nTimeComplete == 0) {
+            lock.nTimeComplete = nNow;
+            if (fTimed) statsComplete.Add(nNow - itTime->second);
+        }
+    }
+    return nSignatures;
+}
+
+int CSwiftTXManager::GetSignatures(const uint256& txHash) const
+{
+    LOCK(cs);
+    LockMap::const_iterator it = mapTxLocks.find(txHash);
+    if (it == mapTxLocks.end()) return -1;
+    return it->second.CountSignatures();
+}
+
+bool CSwiftTXManager::IsLockTimedOut(const uint256& txHash) const
+{
+    LOCK(cs);
+    LockMap::const_iterator it = mapTxLocks.find(txHash);
+    if (it == mapTxLocks.end()) return false;
+    return GetTime() > it->second.nTimeout;
+}
+
+bool CSwiftTXManager::LockNotified(const uint256& txHash)
+{
+    LOCK(cs);
+    LockMap::iterator it = mapTxLocks.find(txHash);
+    if (it == mapTxLocks.end() || it->second.nTimeNotified != 0) return false;
+
+    int64_t nNow = GetTimeMicros();
+    it->second.nTimeNotified = nNow;
+    boost::unordered_map<uint256, int64_t, BlockHasher>::const_iterator itTime = mapRequestTime.find(txHash);
+    if (itTime != mapRequestTime.end() && nNow >= itTime->second)
+        statsNotify.Add(nNow - itTime->second);
+    return true;
+}
+
+void CSwiftTXManager::GetLockLatency(const uint256& txHash, int64_t& nCompleteRet, int64_t& nNotifyRet) const
+{
+    LOCK(cs);
+    nCompleteRet = -1;
+    nNotifyRet = -1;
+    LockMap::const_iterator it = mapTxLocks.find(txHash);
+    boost::unordered_map<uint256, int64_t, BlockHasher>::const_iterator itTime = mapRequestTime.find(txHash);
+    if (it == mapTxLocks.end() || itTime == mapRequestTime.end()) return;
+
+    if (it->second.nTimeComplete >= itTime->second) nCompleteRet = it->second.nTimeComplete - itTime->second;
+    if (it->second.nTimeNotified >= itTime->second) nNotifyRet = it->second.nTimeNotified - itTime->second;
+}
+
+void CSwiftTXManager::GetLatencyStats(CSwiftTXLatencyStats& voteRet, CSwiftTXLatencyStats& completeRet, CSwiftTXLatencyStats& notifyRet) const
+{
+    LOCK(cs);
+    voteRet = statsVote;
+    completeRet = statsComplete;
+    notifyRet = statsNotify;
+}
+
+void CSwiftTXManager::ResetLatencyStats()
+{
+    LOCK(cs);
+    statsVote = CSwiftTXLatencyStats();
+    statsComplete = CSwiftTXLatencyStats();
+    statsNotify = CSwiftTXLatencyStats();
+}
+
+void CSwiftTXManager::LockInputs(const CTransaction& tx)
+{
+    LOCK(cs);
+    uint256 txHash = tx.GetHash();
+    BOOST_FOREACH (const CTxIn& in, tx.vin)
+        mapLockedInputs.insert(make_pair(in.prevout, txHash));
+}
+
+bool CSwiftTXManager::GetConflictingLock(const CTransaction& tx, uint256& txHashLockRet) const
+{
+    LOCK(cs);
+    if (mapLockedInputs.empty()) return false;
+
+    uint256 txHash = tx.GetHash();
+    BOOST_FOREACH (const CTxIn& in, tx.vin) {
+        boost::unordered_map<COutPoint, uint256, OutPointHasher>::const_iterator it = mapLockedInputs.find(in.prevout);
+        if (it != mapLockedInputs.end() && it->second != txHash) {
+            txHashLockRet = it->second;
+            return true;
         }
     }
-    return n;
+    return false;
+}
+
+bool CSwiftTXManager::CheckForConflictingLocks(const CTransaction& tx)
+{
+    /*
+        It's possible (very unlikely though) to get 2 conflicting transaction locks approved by the network.
+        In that case, they will cancel each other out.
+
+        Blocks could have been rejected during this time, which is OK. After they cancel out, the client will
+        rescan the blocks and find they're acceptable and then take the chain with the most work.
+    */
+    LOCK(cs);
+
+    uint256 txHashLock;
+    if (!GetConflictingLock(tx, txHashLock)) return false;
+
+    LogPrintf("SwiftTX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", tx.GetHash().ToString().c_str(), txHashLock.ToString().c_str());
+    LockMap::iterator it = mapTxLocks.find(tx.GetHash());
+    if (it != mapTxLocks.end()) SetExpiration(it->second, GetTime());
+    it = mapTxLocks.find(txHashLock);
+    if (it != mapTxLocks.end()) SetExpiration(it->second, GetTime());
+    return true;
+}
+
+bool CSwiftTXManager::CheckUnknownVoteRate(const CTxIn& vinFrenchnode)
+{
+    /*
+        Frenchnodes will sometimes propagate votes before the transaction is known to the client.
+        This tracks those messages and allows it at the same rate of the rest of the network, if
+        a peer violates it, it will simply be ignored
+    */
+    LOCK(cs);
+
+    int64_t nNext = GetTime() + (60 * 10);
+    boost::unordered_map<uint256, int64_t, BlockHasher>::iterator it = mapUnknownVotes.find(vinFrenchnode.prevout.hash);
+    if (it == mapUnknownVotes.end()) {
+        it = mapUnknownVotes.insert(make_pair(vinFrenchnode.prevout.hash, nNext)).first;
+        nUnknownVotesTotal += nNext;
+    }
+
+    // compared with the average over all Frenchnodes, kept as a running total
+    int64_t nAverage = nUnknownVotesTotal / (int64_t)mapUnknownVotes.size();
+    if (it->second > GetTime() && it->second - nAverage > 60 * 10)
+        return false;
+
+    nUnknownVotesTotal += nNext - it->second;
+    it->second = nNext;
+    return true;
+}
+
+void CSwiftTXManager::RemoveExpired(int64_t nTime)
+{
+    LOCK(cs);
+
+    while (!queueExpiration.empty() && queueExpiration.top().first < nTime) { //keep them for an hour
+        ExpirationEntry entry = queueExpiration.top();
+        queueExpiration.pop();
+
+        LockMap::iterator it = mapTxLocks.find(entry.second);
+        if (it == mapTxLocks.end()) mapRequestTime.erase(entry.second);
+        if (it == mapTxLocks.end() || it->second.nExpiration != entry.first) continue;
+
+        LogPrintf("Removing old transaction lock %s\n", entry.second.ToString().c_str());
+
+        TxMap::iterator itReq = mapTxLockReq.find(entry.second);
+        if (itReq != mapTxLockReq.end()) {
+            BOOST_FOREACH (const CTxIn& in, itReq->second.vin)
+                mapLockedInputs.erase(in.prevout);
+
+            mapTxLockReq.erase(itReq);
+            mapTxLockReqRejected.erase(entry.second);
+
+            BOOST_FOREACH (const CConsensusVote& v, it->second.vecConsensusVotes)
+                mapTxLockVote.erase(v.GetHash());
+        }
+
+        mapRequestTime.erase(entry.second);
+        mapTxLocks.erase(it);
+    }
+}
+
+size_t CSwiftTXManager::GetLockCount() const
+{
+    LOCK(cs);
+    return mapTxLocks.size();
+}
+
+int64_t CSwiftTXLatencyStats::GetBucketBound(int n)
+{
+    if (n >= BUCKETS - 1)
+        return -1;
+    static const int64_t nSteps[3] = {1, 2, 5};
+    int64_t nBound = 1000 * nSteps[n % 3];
+    for (int i = 0; i < n / 3; i++)
+        nBound *= 10;
+    return nBound;
+}
+
+void CSwiftTXLatencyStats::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    int n = 0;
+    while (n < BUCKETS - 1 && nMicros > GetBucketBound(n))
+        n++;
+    vBuckets[n]++;
+}
+
+int64_t CSwiftTXLatencyStats::GetPercentileBound(double dFraction) const
+{
+    if (nCount == 0) return 0;
+
+    uint64_t nSum = 0;
+    for (int n = 0; n < BUCKETS - 1; n++) {
+        nSum += vBuckets[n];
+        if (nSum >= dFraction * nCount)
+            return GetBucketBound(n);
+    }
+    return -1;
 }
@@ -14,6 +14,14 @@
 #include "sync.h"
 #include "util.h"
 
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
 /*
     At 15 signatures, 1/2 of the masternode network can be owned by
     one party without comprimising the security of SwiftTX
@@ -30,16 +38,13 @@ using namespace std;
 using namespace boost;
 
 class CConsensusVote;
+class CSwiftTXManager;
 class CTransaction;
 class CTransactionLock;
 
 static const int MIN_SWIFTTX_PROTO_VERSION = 70103;
 
-extern map<uint256, CTransaction> mapTxLockReq;
-extern map<uint256, CTransaction> mapTxLockReqRejected;
-extern map<uint256, CConsensusVote> mapTxLockVote;
-extern map<uint256, CTransactionLock> mapTxLocks;
-extern std::map<COutPoint, uint256> mapLockedInputs;
+extern CSwiftTXManager swifttx;
 extern int nCompleteTXLocks;
 
 
@@ -47,10 +52,7 @@ int64_t CreateNewLock(CTransaction tx);
 
 bool IsIXTXValid(const CTransaction& txCollateral);
 
-// if two conflicting locks are approved by the network, they will cancel out
-bool CheckForConflictingLocks(CTransaction& tx);
-
-void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived);
 
 //check if we need to vote on this transaction
 void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight);
@@ -61,7 +63,14 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx);
 // keep transaction locks in memory for an hour
 void CleanTransactionLocksList();
 
-int64_t GetAverageVoteTime();
+/**
+ * Regtest load generator: add nFrenchnodes Frenchnodes with fresh keys to the list, then
+ * send nRequests lock requests for made-up transactions at nRate per second through the
+ * lock and vote code, each voted for by those of them in the top SWIFTTX_SIGNATURES_TOTAL
+ * at its block height. The latency stats are reset first; the Frenchnodes are removed at
+ * the end. Returns the number of requests whose lock was completed.
+ */
+int SwiftTXLoadTest(int nFrenchnodes, int nRequests, int nRate);
 
 class CConsensusVote
 {
@@ -75,6 +84,7 @@ public:
 
     bool SignatureValid();
     bool Sign();
+    bool Sign(const CKey& key, const CPubKey& pubKey);
 
     ADD_SERIALIZE_METHODS;
 
@@ -90,16 +100,26 @@ public:
 
 class CTransactionLock
 {
+private:
+    // votes for nBlockHeight, counted as they are added
+    int nSignatures;
+
 public:
     int nBlockHeight;
     uint256 txHash;
     std::vector<CConsensusVote> vecConsensusVotes;
     int nExpiration;
     int nTimeout;
+    // when the lock got SWIFTTX_SIGNATURES_REQUIRED votes and when that was notified, in microseconds
+    int64_t nTimeComplete;
+    int64_t nTimeNotified;
+
+    CTransactionLock() : nSignatures(0), nBlockHeight(0), nExpiration(0), nTimeout(0), nTimeComplete(0), nTimeNotified(0) {}
 
     bool SignaturesValid();
-    int CountSignatures();
-    void AddSignature(CConsensusVote& cv);
+    int CountSignatures() const;
+    void AddSignature(const CConsensusVote& cv);
+    void SetBlockHeight(int nBlockHeightIn);
 
     uint256 GetHash()
     {
@@ -107,5 +127,116 @@ public:
     }
 };
 
+/**
+ * Latencies of one SwiftTX stage, from the receipt of the lock request, with a histogram:
+ * bucket i counts the ones within GetBucketBound(i) microseconds (1ms, 2ms, 5ms, 10ms and
+ * so on up to 50s), the last one all slower ones.
+ */
+struct CSwiftTXLatencyStats {
+    static const int BUCKETS = 16;
+
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[BUCKETS];
+
+    CSwiftTXLatencyStats() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        std::fill(vBuckets, vBuckets + BUCKETS, 0);
+    }
+
+    //! Upper bound of bucket n in microseconds, -1 for the last one
+    static int64_t GetBucketBound(int n);
+    void Add(int64_t nMicros);
+    //! Bound of the bucket that takes the share dFraction of the latencies, -1 for the last one, 0 if there are none
+    int64_t GetPercentileBound(double dFraction) const;
+};
+
+/**
+ * SwiftTX lock requests, votes and transaction locks, with the inputs the complete locks
+ * hold. Everything is indexed by txid, vote hash or outpoint, the locks are expired from
+ * a queue ordered by expiration time and each lock keeps its own vote count, so nothing
+ * walks a whole map. It has its own lock and never calls out while holding it, so the
+ * wallet, RPC and message handlers can all use it.
+ */
+class CSwiftTXManager
+{
+private:
+    typedef boost::unordered_map<uint256, CTransaction, BlockHasher> TxMap;
+    typedef boost::unordered_map<uint256, CTransactionLock, BlockHasher> LockMap;
+    typedef std::pair<int64_t, uint256> ExpirationEntry;
+
+    mutable CCriticalSection cs;
+
+    TxMap mapTxLockReq;
+    TxMap mapTxLockReqRejected;
+    boost::unordered_map<uint256, CConsensusVote, BlockHasher> mapTxLockVote;
+    LockMap mapTxLocks;
+    boost::unordered_map<COutPoint, uint256, OutPointHasher> mapLockedInputs;
+
+    // votes for unknown transactions, by Frenchnode collateral: time they may vote again
+    boost::unordered_map<uint256, int64_t, BlockHasher> mapUnknownVotes;
+    int64_t nUnknownVotesTotal;
+
+    // when lock requests were received, in microseconds; kept until their lock expires
+    boost::unordered_map<uint256, int64_t, BlockHasher> mapRequestTime;
+    CSwiftTXLatencyStats statsVote;
+    CSwiftTXLatencyStats statsComplete;
+    CSwiftTXLatencyStats statsNotify;
+
+    // expiration time and txid of every lock, soonest first; an entry whose lock has
+    // since been given another expiration time is stale and skipped
+    std::priority_queue<ExpirationEntry, std::vector<ExpirationEntry>, std::greater<ExpirationEntry> > queueExpiration;
+
+    LockMap::iterator NewLock(const uint256& txHash);
+    void SetExpiration(CTransactionLock& lock, int64_t nExpiration);
+
+public:
+    CSwiftTXManager() : nUnknownVotesTotal(0) {}
+
+    /// Lock requests, accepted or rejected
+    bool HasTxLockRequest(const uint256& txHash) const;
+    bool IsTxLockRequestRejected(const uint256& txHash) const;
+    bool GetTxLockRequest(const uint256& txHash, CTransaction& txRet) const;
+    void AddTxLockRequest(const CTransaction& tx);
+    void AddRejectedTxLockRequest(const CTransaction& tx);
+
+    /// Note when the lock request of a transaction was first seen, for the latency stats
+    void RequestReceived(const uint256& txHash, int64_t nTimeMicros);
+
+    /// Votes by vote hash; AddTxLockVote returns false for a vote already seen
+    bool HasTxLockVote(const uint256& hash) const;
+    bool GetTxLockVote(const uint256& hash, CConsensusVote& voteRet) const;
+    bool AddTxLockVote(const CConsensusVote& vote);
+
+    /// Start a lock for a block height, or move an existing lock to it
+    void CreateLock(const uint256& txHash, int nBlockHeight);
+    /// Add a checked vote to its lock, starting the lock if needed; returns the votes that count
+    int AddSignature(const CConsensusVote& vote);
+    /// Votes that count for a lock, -1 for an unknown lock or one without a block height yet
+    int GetSignatures(const uint256& txHash) const;
+    bool IsLockTimedOut(const uint256& txHash) const;
+    /// Note that the completion of a lock was passed on; false if it was already
+    bool LockNotified(const uint256& txHash);
+    /// Microseconds from the receipt of the request to completion and notification, -1 where unknown
+    void GetLockLatency(const uint256& txHash, int64_t& nCompleteRet, int64_t& nNotifyRet) const;
+    /// Latencies of the votes, of the locks reaching SWIFTTX_SIGNATURES_REQUIRED and of their notification
+    void GetLatencyStats(CSwiftTXLatencyStats& voteRet, CSwiftTXLatencyStats& completeRet, CSwiftTXLatencyStats& notifyRet) const;
+    void ResetLatencyStats();
+
+    /// Lock the inputs of a transaction to it, where no other transaction holds them already
+    void LockInputs(const CTransaction& tx);
+    /// Find a transaction other than tx holding a lock on one of its inputs
+    bool GetConflictingLock(const CTransaction& tx, uint256& txHashLockRet) const;
+    /// If two conflicting locks are approved by the network they cancel out: both expire now
+    bool CheckForConflictingLocks(const CTransaction& tx);
+
+    /// DoS protection for votes on unknown transactions: false if the Frenchnode sends them too fast
+    bool CheckUnknownVoteRate(const CTxIn& vinFrenchnode);
+
+    /// Drop the locks that expired before nTime, with their request, votes and inputs
+    void RemoveExpired(int64_t nTime);
+    size_t GetLockCount() const;
+};
 
 #endif
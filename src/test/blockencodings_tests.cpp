@@ -0,0 +1,242 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "tinyformat.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+CTransaction MakeTransaction(unsigned int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), n);
+    tx.vin[0].scriptSig << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = 1000 * (n + 1) + i;
+        tx.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, n) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+/** A proof-of-stake block: coinbase, coinstake and nTx mempool transactions */
+CBlock MakeBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.nTime = 1530000000;
+    block.nBits = 0x1e0fffff;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig << 1000 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].SetEmpty();
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction coinstake;
+    coinstake.vin.resize(1);
+    coinstake.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].nValue = 50000;
+    block.vtx.push_back(coinstake);
+
+    for (unsigned int i = 0; i < nTx; i++)
+        block.vtx.push_back(MakeTransaction(i));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.vchBlockSig = std::vector<unsigned char>(71, 0x30);
+    return block;
+}
+
+template <typename T>
+size_t SerializedSize(const T& obj)
+{
+    return ::GetSerializeSize(obj, SER_NETWORK, PROTOCOL_VERSION);
+}
+
+/**
+ * Send block from one node to another with a mempool of its own: the cmpctblock,
+ * then a getblocktxn/blocktxn round trip for whatever the receiver is missing.
+ * Every message goes through serialization, as it would on the wire.
+ */
+struct CRelayResult {
+    bool fSuccess;
+    size_t nBytes;
+    int nRoundTrips;
+};
+
+CRelayResult RelayCompact(const CBlock& block, CTxMemPool& pool, const std::vector<CTransaction>& vExtraTxn)
+{
+    CRelayResult result = {false, 0, 1};
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CBlockHeaderAndShortTxIDs(block);
+    result.nBytes += stream.size();
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    stream >> cmpctblock;
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    if (partialBlock.InitData(cmpctblock, vExtraTxn) != READ_STATUS_OK)
+        return result;
+
+    BlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+        if (!partialBlock.IsTxAvailable(i))
+            req.indexes.push_back(i);
+    }
+
+    BlockTransactions resp;
+    if (!req.indexes.empty()) {
+        result.nRoundTrips++;
+        stream << req;
+        result.nBytes += stream.size();
+        BlockTransactionsRequest reqReceived;
+        stream >> reqReceived;
+        BOOST_CHECK(reqReceived.indexes == req.indexes);
+
+        BlockTransactions respSent(reqReceived);
+        for (size_t i = 0; i < reqReceived.indexes.size(); i++)
+            respSent.txn[i] = block.vtx[reqReceived.indexes[i]];
+        stream << respSent;
+        result.nBytes += stream.size();
+        stream >> resp;
+    }
+
+    CBlock rebuilt;
+    if (partialBlock.FillBlock(rebuilt, resp.txn) != READ_STATUS_OK)
+        return result;
+    result.fSuccess = rebuilt.GetHash() == block.GetHash() && rebuilt.hashMerkleRoot == block.hashMerkleRoot &&
+                      rebuilt.vchBlockSig == block.vchBlockSig && rebuilt.vtx.size() == block.vtx.size();
+    return result;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+BOOST_AUTO_TEST_CASE(cmpctblock_relay)
+{
+    const unsigned int nTx = 200;
+    CBlock block = MakeBlock(nTx);
+    BOOST_CHECK(block.IsProofOfStake());
+    size_t nFullBytes = SerializedSize(block);
+
+    // Three peers: one that has seen every transaction, one that missed two of
+    // them (one of which it holds as an orphan), and a freshly started one.
+    CTxMemPool poolFull(CFeeRate(0)), poolPartial(CFeeRate(0)), poolEmpty(CFeeRate(0));
+    std::vector<CTransaction> vOrphans;
+    for (unsigned int i = 2; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        poolFull.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+        if (i == 10)
+            vOrphans.push_back(tx);
+        else if (i != 100)
+            poolPartial.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+    }
+
+    CRelayResult full = RelayCompact(block, poolFull, std::vector<CTransaction>());
+    BOOST_CHECK(full.fSuccess);
+    BOOST_CHECK_EQUAL(full.nRoundTrips, 1);
+
+    CRelayResult partial = RelayCompact(block, poolPartial, vOrphans);
+    BOOST_CHECK(partial.fSuccess);
+    BOOST_CHECK_EQUAL(partial.nRoundTrips, 2);
+
+    CRelayResult empty = RelayCompact(block, poolEmpty, std::vector<CTransaction>());
+    BOOST_CHECK(empty.fSuccess);
+    BOOST_CHECK_EQUAL(empty.nRoundTrips, 2);
+
+    // The header, signature, coinbase, coinstake and 6 bytes per transaction
+    BOOST_CHECK(full.nBytes < nFullBytes / 10);
+    BOOST_CHECK(partial.nBytes < full.nBytes + 2 * SerializedSize(block.vtx[100]));
+    // Without a mempool it costs a round trip plus the short IDs over the full block
+    BOOST_CHECK(empty.nBytes > nFullBytes);
+    BOOST_CHECK(empty.nBytes < nFullBytes + 8 * block.vtx.size() + 200);
+
+    BOOST_TEST_MESSAGE(strprintf("full block: %u bytes, 1 round trip (inv/getdata/block)", nFullBytes));
+    BOOST_TEST_MESSAGE(strprintf("compact, full mempool: %u bytes, %d round trip(s)", full.nBytes, full.nRoundTrips));
+    BOOST_TEST_MESSAGE(strprintf("compact, 2 missing: %u bytes, %d round trip(s)", partial.nBytes, partial.nRoundTrips));
+    BOOST_TEST_MESSAGE(strprintf("compact, empty mempool: %u bytes, %d round trip(s)", empty.nBytes, empty.nRoundTrips));
+}
+
+BOOST_AUTO_TEST_CASE(cmpctblock_collision_and_invalid)
+{
+    CBlock block = MakeBlock(10);
+    CTxMemPool pool(CFeeRate(0));
+
+    // Two short IDs the same: can't tell the transactions apart, ask for the whole block
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CBlockHeaderAndShortTxIDs(block);
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    stream >> cmpctblock;
+    CBlock blockDup = block;
+    blockDup.vtx[3] = blockDup.vtx[2];
+    blockDup.hashMerkleRoot = blockDup.BuildMerkleTree();
+    stream << CBlockHeaderAndShortTxIDs(blockDup);
+    CBlockHeaderAndShortTxIDs cmpctblockDup;
+    stream >> cmpctblockDup;
+    PartiallyDownloadedBlock partialDup(&pool);
+    BOOST_CHECK(partialDup.InitData(cmpctblockDup, std::vector<CTransaction>()) == READ_STATUS_FAILED);
+
+    // Too few or too many transactions in the blocktxn is the peer's fault
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(cmpctblock, std::vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+    // The header can be checked as a proof-of-stake block before anything is requested
+    CBlock blockHeader = partialBlock.GetHeaderBlock();
+    BOOST_CHECK(blockHeader.GetHash() == block.GetHash());
+    BOOST_CHECK(blockHeader.IsProofOfStake());
+    BOOST_CHECK_EQUAL(blockHeader.vtx.size(), 2U);
+    BOOST_CHECK(blockHeader.vchBlockSig == block.vchBlockSig);
+
+    std::vector<CTransaction> vtxMissing(block.vtx.begin() + 2, block.vtx.end());
+    CBlock rebuilt;
+    BOOST_CHECK(partialBlock.FillBlock(rebuilt, std::vector<CTransaction>(vtxMissing.begin(), vtxMissing.end() - 1)) == READ_STATUS_INVALID);
+    std::vector<CTransaction> vtxTooMany(vtxMissing);
+    vtxTooMany.push_back(vtxMissing[0]);
+    BOOST_CHECK(partialBlock.FillBlock(rebuilt, vtxTooMany) == READ_STATUS_INVALID);
+
+    // The wrong transactions don't hash to the merkle root
+    std::vector<CTransaction> vtxWrong(vtxMissing);
+    vtxWrong[0] = MakeTransaction(99);
+    BOOST_CHECK(partialBlock.FillBlock(rebuilt, vtxWrong) == READ_STATUS_FAILED);
+    BOOST_CHECK(partialBlock.FillBlock(rebuilt, vtxMissing) == READ_STATUS_OK);
+    BOOST_CHECK(rebuilt.hashMerkleRoot == block.hashMerkleRoot);
+}
+
+BOOST_AUTO_TEST_CASE(getblocktxn_serialization)
+{
+    BlockTransactionsRequest req;
+    req.blockhash = GetRandHash();
+    req.indexes.push_back(0);
+    req.indexes.push_back(1);
+    req.indexes.push_back(3);
+    req.indexes.push_back(4);
+    req.indexes.push_back(1000);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req;
+    // Differentially encoded: 0, 0, 1, 0, 995 -> one byte each, three for the last
+    BOOST_CHECK_EQUAL(stream.size(), 32U + 1 + 4 + 3);
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+    BOOST_CHECK(req2.blockhash == req.blockhash);
+    BOOST_CHECK(req2.indexes == req.indexes);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "util.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+CBlockCache::BlockPtr MakeBlock(unsigned int nNonce)
+{
+    CBlock* pblock = new CBlock();
+    pblock->nNonce = nNonce;
+    return CBlockCache::BlockPtr(pblock);
+}
+
+uint256 Hash(unsigned int n)
+{
+    return uint256(n);
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(blockstore_tests)
+
+BOOST_AUTO_TEST_CASE(blockcache_lru_eviction)
+{
+    CBlockCache cache(300);
+    cache.Insert(Hash(1), MakeBlock(1), 100);
+    cache.Insert(Hash(2), MakeBlock(2), 100);
+    cache.Insert(Hash(3), MakeBlock(3), 100);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 3U);
+    BOOST_CHECK_EQUAL(cache.GetBytes(), 300U);
+
+    // Touch 1, so 2 is now the least recently used
+    BOOST_CHECK(cache.Get(Hash(1))->nNonce == 1);
+    cache.Insert(Hash(4), MakeBlock(4), 100);
+    BOOST_CHECK(cache.Get(Hash(2)) == NULL);
+    BOOST_CHECK(cache.Get(Hash(1)) != NULL);
+    BOOST_CHECK(cache.Get(Hash(3)) != NULL);
+    BOOST_CHECK(cache.Get(Hash(4)) != NULL);
+    BOOST_CHECK_EQUAL(cache.GetBytes(), 300U);
+
+    // A large block pushes out as many as needed
+    cache.Insert(Hash(5), MakeBlock(5), 250);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 1U);
+    BOOST_CHECK_EQUAL(cache.GetBytes(), 250U);
+
+    // One that can never fit is not cached at all
+    cache.Insert(Hash(6), MakeBlock(6), 301);
+    BOOST_CHECK(cache.Get(Hash(6)) == NULL);
+    BOOST_CHECK(cache.Get(Hash(5)) != NULL);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_resize_and_stats)
+{
+    CBlockCache cache(1000);
+    for (unsigned int i = 0; i < 10; i++)
+        cache.Insert(Hash(i), MakeBlock(i), 100);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 10U);
+
+    // Inserting a block that is already there does not count it twice
+    cache.Insert(Hash(0), MakeBlock(0), 100);
+    BOOST_CHECK_EQUAL(cache.GetBytes(), 1000U);
+
+    cache.SetMaxSize(350);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 3U);
+    BOOST_CHECK_EQUAL(cache.GetMaxBytes(), 350U);
+
+    // The most recently inserted ones survive (0 was refreshed by the re-insert)
+    BOOST_CHECK(cache.Get(Hash(0)) != NULL);
+    BOOST_CHECK(cache.Get(Hash(9)) != NULL);
+    BOOST_CHECK(cache.Get(Hash(1)) == NULL);
+    BOOST_CHECK_EQUAL(cache.GetHits(), 2U);
+    BOOST_CHECK_EQUAL(cache.GetMisses(), 1U);
+
+    cache.Erase(Hash(9));
+    BOOST_CHECK(cache.Get(Hash(9)) == NULL);
+    BOOST_CHECK_EQUAL(cache.GetBytes(), 200U);
+
+    // Readers keep their copy after it has been evicted
+    CBlockCache::BlockPtr pblock = cache.Get(Hash(0));
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetBytes(), 0U);
+    BOOST_CHECK(pblock->nNonce == 0);
+}
+
+BOOST_AUTO_TEST_CASE(memoryreader_roundtrip)
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.nTime = 1234567;
+    block.nNonce = 42;
+    CMutableTransaction tx;
+    tx.nLockTime = 7;
+    block.vtx.resize(1);
+    block.vtx.push_back(tx);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block << (unsigned int)0xdeadbeef;
+    std::vector<char> vch(ss.begin(), ss.end());
+
+    CMemoryReader reader(&vch[0], vch.size(), SER_DISK, CLIENT_VERSION);
+    CBlock block2;
+    unsigned int nTrailer;
+    reader >> block2 >> nTrailer;
+    BOOST_CHECK(reader.eof());
+    BOOST_CHECK_EQUAL(block2.nTime, block.nTime);
+    BOOST_CHECK_EQUAL(block2.nNonce, block.nNonce);
+    BOOST_CHECK_EQUAL(block2.vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(block2.vtx[1].nLockTime, 7U);
+    BOOST_CHECK_EQUAL(nTrailer, 0xdeadbeef);
+
+    // Reading past the end throws instead of running off the buffer
+    CMemoryReader truncated(&vch[0], vch.size() - 5, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(truncated >> block2 >> nTrailer, std::ios_base::failure);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(mappedfile_bounded_size)
+{
+    boost::filesystem::path path = GetTempPath() / boost::filesystem::unique_path();
+    std::vector<char> vch(3 * 4096 + 100);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = (char)i;
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(&vch[0], 1, vch.size(), file), vch.size());
+    fclose(file);
+
+    // Only the recorded size is mapped; the file may be longer (pre-allocated)
+    CBlockFileMapper mapper;
+    boost::shared_ptr<const CMappedFile> pfile = mapper.Get(0, path, 4096 + 10);
+    BOOST_REQUIRE(pfile);
+    BOOST_CHECK_EQUAL(pfile->size(), 4096U + 10);
+    BOOST_CHECK(mapper.Get(0, path, vch.size()) == pfile);
+
+    // Truncating down to the mapped size leaves every mapped byte readable
+    boost::filesystem::resize_file(path, 4096 + 10);
+    BOOST_CHECK(memcmp(pfile->begin(), &vch[0], pfile->size()) == 0);
+
+    // A released file is mapped again with the size it has now
+    mapper.Release(0);
+    boost::shared_ptr<const CMappedFile> pfile2 = mapper.Get(0, path, vch.size());
+    BOOST_REQUIRE(pfile2);
+    BOOST_CHECK(pfile2 != pfile);
+    BOOST_CHECK_EQUAL(pfile2->size(), 4096U + 10);
+
+    pfile.reset();
+    pfile2.reset();
+    mapper.Clear();
+    boost::filesystem::remove(path);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
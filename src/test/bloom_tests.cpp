@@ -8,6 +8,9 @@
 #include "clientversion.h"
 #include "key.h"
 #include "merkleblock.h"
+#include "mruset.h"
+#include "protocol.h"
+#include "random.h"
 #include "serialize.h"
 #include "streams.h"
 #include "uint256.h"
@@ -459,4 +462,120 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
     BOOST_CHECK(!filter.contains(COutPoint(uint256("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
 }
 
+
+static std::vector<unsigned char> RandomData()
+{
+    uint256 r = GetRandHash();
+    return std::vector<unsigned char>(r.begin(), r.end());
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    // last-100-entry, 1% false positive:
+    CRollingBloomFilter rb1(100, 0.01);
+
+    // Overfill:
+    static const int DATASIZE = 399;
+    std::vector<unsigned char> data[DATASIZE];
+    for (int i = 0; i < DATASIZE; i++) {
+        data[i] = RandomData();
+        rb1.insert(data[i]);
+    }
+    // Last 100 guaranteed to be remembered:
+    for (int i = 299; i < DATASIZE; i++) {
+        BOOST_CHECK(rb1.contains(data[i]));
+    }
+
+    // false positive rate is 1%, so we should get about 100 hits if
+    // testing 10,000 random keys. We get worst-case false positive
+    // behavior when the filter is as full as possible, which is
+    // when we've inserted one minus an integer multiple of nElement*2.
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (rb1.contains(RandomData()))
+            ++nHits;
+    }
+    // Run test_french with --log_level=message to see BOOST_TEST_MESSAGEs:
+    BOOST_TEST_MESSAGE("RollingBloomFilter got " << nHits << " false positives (~100 expected)");
+
+    // Insanely unlikely to get a fp count outside this range:
+    BOOST_CHECK(nHits > 25);
+    BOOST_CHECK(nHits < 175);
+
+    BOOST_CHECK(rb1.contains(data[DATASIZE - 1]));
+    rb1.reset();
+    BOOST_CHECK(!rb1.contains(data[DATASIZE - 1]));
+
+    // Now roll through data, make sure last 100 entries
+    // are always remembered:
+    for (int i = 0; i < DATASIZE; i++) {
+        if (i >= 100)
+            BOOST_CHECK(rb1.contains(data[i - 100]));
+        rb1.insert(data[i]);
+        BOOST_CHECK(rb1.contains(data[i]));
+    }
+
+    // Insert 999 more random entries:
+    for (int i = 0; i < 999; i++) {
+        std::vector<unsigned char> d = RandomData();
+        rb1.insert(d);
+        BOOST_CHECK(rb1.contains(d));
+    }
+    // Sanity check to make sure the filter isn't just filling up:
+    nHits = 0;
+    for (int i = 0; i < DATASIZE; i++) {
+        if (rb1.contains(data[i]))
+            ++nHits;
+    }
+    // Expect about 5 false positives, more than 100 means
+    // something is definitely broken.
+    BOOST_TEST_MESSAGE("RollingBloomFilter got " << nHits << " false positives (~5 expected)");
+    BOOST_CHECK(nHits < 100);
+
+    // last-1000-entry, 0.01% false positive:
+    CRollingBloomFilter rb2(1000, 0.001);
+    for (int i = 0; i < DATASIZE; i++) {
+        rb2.insert(data[i]);
+    }
+    // ... room for all of them:
+    for (int i = 0; i < DATASIZE; i++) {
+        BOOST_CHECK(rb2.contains(data[i]));
+    }
+}
+
+/** Rough heap size of an mruset: a red-black tree node and a deque slot per entry */
+template <typename T>
+static size_t EstimateMrusetUsage(size_t nElements)
+{
+    size_t nNode = (4 * sizeof(void*) + sizeof(T) + sizeof(void*) + 15) & ~(size_t)15; // malloc header and rounding
+    return nElements * (nNode + sizeof(T));
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom_known_inventory)
+{
+    // Same type, different hash and same hash, different type are different items:
+    // a SwiftTX lock request shares its hash with the transaction it locks
+    CRollingBloomFilter filter(5000, 0.000001);
+    uint256 hash = GetRandHash();
+    filter.insert(CInv(MSG_TX, hash).GetKey());
+    BOOST_CHECK(filter.contains(CInv(MSG_TX, hash).GetKey()));
+    BOOST_CHECK(!filter.contains(CInv(MSG_TXLOCK_REQUEST, hash).GetKey()));
+    BOOST_CHECK(!filter.contains(CInv(MSG_TX, GetRandHash()).GetKey()));
+
+    // The footprint of the per-peer filters is fixed, whatever goes through them.
+    // Compare with the mrusets they replace, filled to the same capacity.
+    CRollingBloomFilter filterInventory(5000, 0.000001), filterAddr(5000, 0.001);
+    size_t nInventoryBytes = filterInventory.GetMemoryUsage();
+    for (int i = 0; i < 20000; i++)
+        filterInventory.insert(CInv(MSG_TX, GetRandHash()).GetKey());
+    BOOST_CHECK_EQUAL(filterInventory.GetMemoryUsage(), nInventoryBytes);
+
+    size_t nInventorySetBytes = EstimateMrusetUsage<CInv>(5000);
+    size_t nAddrSetBytes = EstimateMrusetUsage<CAddress>(5000);
+    BOOST_TEST_MESSAGE("known inventory, 5000 entries: mruset ~" << nInventorySetBytes << " bytes, rolling bloom filter " << nInventoryBytes << " bytes");
+    BOOST_TEST_MESSAGE("known addresses, 5000 entries: mruset ~" << nAddrSetBytes << " bytes, rolling bloom filter " << filterAddr.GetMemoryUsage() << " bytes");
+    BOOST_CHECK(nInventoryBytes < nInventorySetBytes / 5);
+    BOOST_CHECK(filterAddr.GetMemoryUsage() < nAddrSetBytes / 10);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/script.h"
 #include "uint256.h"
 
 #include <vector>
@@ -175,4 +176,71 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Randomly spend and create outputs, keeping CCoinsRunningStats up to date
+// incrementally, and compare with statistics rebuilt from scratch.
+BOOST_AUTO_TEST_CASE(coins_running_stats_test)
+{
+    std::map<uint256, CCoins> result;
+    CCoinsRunningStats running;
+
+    std::vector<uint256> txids;
+    txids.resize(50);
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        txids[i] = GetRandHash();
+    }
+
+    for (unsigned int i = 0; i < 1000; i++) {
+        uint256 txid = txids[insecure_rand() % txids.size()];
+        CCoins& coins = result[txid];
+        CCoins before = coins;
+        if (coins.IsPruned()) {
+            coins.nHeight = insecure_rand() % 1000;
+            coins.fCoinBase = insecure_rand() % 2;
+            coins.fCoinStake = !coins.fCoinBase && insecure_rand() % 2;
+            coins.vout.resize(1 + insecure_rand() % 4);
+            for (unsigned int n = 0; n < coins.vout.size(); n++) {
+                coins.vout[n].nValue = insecure_rand();
+                coins.vout[n].scriptPubKey = CScript() << OP_TRUE;
+            }
+        } else {
+            coins.Spend(insecure_rand() % coins.vout.size());
+        }
+        running.UpdateCoins(txid, before, coins);
+    }
+
+    CCoinsRunningStats rebuilt;
+    CAmount nTotalAmount = 0;
+    for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
+        rebuilt.AddCoins(it->first, it->second);
+        for (unsigned int n = 0; n < it->second.vout.size(); n++) {
+            if (!it->second.vout[n].IsNull())
+                nTotalAmount += it->second.vout[n].nValue;
+        }
+    }
+    BOOST_CHECK_EQUAL(running.nTransactions, rebuilt.nTransactions);
+    BOOST_CHECK_EQUAL(running.nTransactionOutputs, rebuilt.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(running.nSerializedSize, rebuilt.nSerializedSize);
+    BOOST_CHECK_EQUAL(running.nTotalAmount, nTotalAmount);
+    BOOST_CHECK_EQUAL(rebuilt.nTotalAmount, nTotalAmount);
+    BOOST_CHECK(running.muhash.Finalize() == rebuilt.muhash.Finalize());
+
+    // The statistics travel down a stack of caches on Flush, and are only
+    // returned while they describe the view's best block.
+    CCoinsViewTest base;
+    CCoinsViewCache bottom(&base);
+    BOOST_CHECK(!bottom.GetRunningStats(rebuilt));
+    {
+        CCoinsViewCache top(&bottom);
+        uint256 hashBlock = GetRandHash();
+        running.hashBlock = hashBlock;
+        top.SetBestBlock(hashBlock);
+        top.SetRunningStats(running);
+        BOOST_CHECK(top.Flush());
+    }
+    BOOST_CHECK(bottom.GetRunningStats(rebuilt));
+    BOOST_CHECK(rebuilt.muhash.Finalize() == running.muhash.Finalize());
+    bottom.SetBestBlock(GetRandHash());
+    BOOST_CHECK(!bottom.GetRunningStats(rebuilt));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "checkpoints.h"
+#include "chainparams.h"
 #include "main.h"
 
 #include <boost/test/unit_test.hpp>
@@ -26,4 +28,82 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 50000000000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(assumevalid_skips_script_checks)
+{
+    LOCK(cs_main);
+    Checkpoints::fEnabled = false;
+    CBlockIndex* pindexBestHeaderOld = pindexBestHeader;
+
+    // A chain long enough to bury its middle block by two weeks, and a fork off it
+    int nBuried = ASSUMEVALID_MIN_BURIED_TIME / Params().TargetSpacing();
+    std::vector<uint256> vHashes(nBuried + 200);
+    std::vector<CBlockIndex> vBlocks(vHashes.size());
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        vHashes[i] = i + 1;
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].nHeight = i;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].BuildSkip();
+    }
+    uint256 hashFork = vHashes.size() + 1;
+    CBlockIndex fork;
+    fork.phashBlock = &hashFork;
+    fork.nHeight = 50;
+    fork.pprev = &vBlocks[49];
+    fork.BuildSkip();
+
+    // A spend whose signature does not verify
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction txPrev;
+    txPrev.vout.resize(1);
+    txPrev.vout[0].nValue = COIN;
+    txPrev.vout[0].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    view.ModifyCoins(txPrev.GetHash())->FromTx(txPrev, 0);
+    view.SetBestBlock(chainActive.Tip()->GetBlockHash());
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+
+    CValidationState state;
+    hashAssumeValid = 0;
+    BOOST_CHECK(!AssumeScriptsValid(&vBlocks[10]));
+    BOOST_CHECK(!CheckInputs(tx, state, view, !AssumeScriptsValid(&vBlocks[10]), SCRIPT_VERIFY_P2SH, false));
+
+    // Not downloaded yet, as during getblocks sync: anchored by height
+    hashAssumeValid = vHashes[100];
+    nAssumeValidHeight = 100;
+    BOOST_CHECK(AssumeScriptsValid(&vBlocks[10]));
+    BOOST_CHECK(CheckInputs(tx, state, view, !AssumeScriptsValid(&vBlocks[10]), SCRIPT_VERIFY_P2SH, false));
+    BOOST_CHECK(!AssumeScriptsValid(&vBlocks[100]));
+    BOOST_CHECK(!CheckInputs(tx, state, view, !AssumeScriptsValid(&vBlocks[150]), SCRIPT_VERIFY_P2SH, false));
+
+    // Known and at its anchor height: only its ancestors
+    mapBlockIndex.insert(std::make_pair(vHashes[100], &vBlocks[100]));
+    BOOST_CHECK(AssumeScriptsValid(&vBlocks[10]));
+    BOOST_CHECK(AssumeScriptsValid(&vBlocks[100]));
+    BOOST_CHECK(!AssumeScriptsValid(&fork));
+    BOOST_CHECK(!AssumeScriptsValid(&vBlocks[101]));
+
+    // Known without an anchor: only once two weeks of blocks are built on top of it
+    nAssumeValidHeight = 0;
+    pindexBestHeader = &vBlocks[100 + nBuried - 1];
+    BOOST_CHECK(!AssumeScriptsValid(&vBlocks[10]));
+    pindexBestHeader = &vBlocks[100 + nBuried];
+    BOOST_CHECK(AssumeScriptsValid(&vBlocks[10]));
+    BOOST_CHECK(CheckInputs(tx, state, view, !AssumeScriptsValid(&vBlocks[10]), SCRIPT_VERIFY_P2SH, false));
+    BOOST_CHECK(!AssumeScriptsValid(&fork));
+    BOOST_CHECK(!CheckInputs(tx, state, view, !AssumeScriptsValid(&fork), SCRIPT_VERIFY_P2SH, false));
+
+    mapBlockIndex.erase(vHashes[100]);
+    pindexBestHeader = pindexBestHeaderOld;
+    hashAssumeValid = 0;
+    Checkpoints::fEnabled = true;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,558 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "main.h"
+#include "masternode-budget.h"
+#include "masternode-payments.h"
+#include "masternode-sync.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "timedata.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+/** Holds cs_main on another thread for as long as it exists */
+class CMainLockHolder
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fLocked;
+    bool fRelease;
+    boost::thread thread;
+
+    void Run()
+    {
+        LOCK(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fLocked = true;
+        cond.notify_all();
+        while (!fRelease)
+            cond.wait(lock);
+    }
+
+public:
+    CMainLockHolder() : fLocked(false), fRelease(false)
+    {
+        thread = boost::thread(boost::bind(&CMainLockHolder::Run, this));
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fLocked)
+            cond.wait(lock);
+    }
+
+    ~CMainLockHolder()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fRelease = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+};
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(masternode_tests)
+
+BOOST_AUTO_TEST_CASE(rank_table)
+{
+    std::vector<CFrenchnode> vFrenchnodes(50);
+    for (unsigned int i = 0; i < vFrenchnodes.size(); i++) {
+        CFrenchnode& mn = vFrenchnodes[i];
+        mn.vin = CTxIn(COutPoint(GetRandHash(), i));
+        mn.unitTest = true;
+        mn.lastPing.sigTime = GetAdjustedTime();
+        if (i % 5 == 0) mn.lastPing.sigTime -= FRENCHNODE_EXPIRATION_SECONDS + 60;
+        if (i % 7 == 0) mn.protocolVersion = PROTOCOL_VERSION - 1;
+    }
+
+    uint256 hashBlock = GetRandHash();
+    CFrenchnodeRanks ranks(100, hashBlock, PROTOCOL_VERSION, vFrenchnodes);
+
+    // Every node of the protocol version is scored, best first
+    const std::vector<CTxIn>& vScored = ranks.GetRanked(CFrenchnodeRanks::RANK_SCORED);
+    BOOST_CHECK_EQUAL(vScored.size(), 50U - 8);
+    for (unsigned int i = 1; i < vScored.size(); i++) {
+        CFrenchnode mnPrev, mn;
+        mnPrev.vin = vScored[i - 1];
+        mn.vin = vScored[i];
+        BOOST_CHECK(mnPrev.CalculateScore(hashBlock).GetCompact(false) >= mn.CalculateScore(hashBlock).GetCompact(false));
+    }
+
+    // Rank and position agree both ways, and only enabled nodes are ranked as active
+    const std::vector<CTxIn>& vActive = ranks.GetRanked(CFrenchnodeRanks::RANK_ACTIVE);
+    BOOST_CHECK_EQUAL(vActive.size(), 50U - 8 - 8);
+    for (unsigned int i = 0; i < vActive.size(); i++) {
+        CTxIn vin;
+        BOOST_CHECK(ranks.GetVin(i + 1, CFrenchnodeRanks::RANK_ACTIVE, vin));
+        BOOST_CHECK(vin == vActive[i]);
+        BOOST_CHECK_EQUAL(ranks.GetRank(vin, CFrenchnodeRanks::RANK_ACTIVE), (int)i + 1);
+    }
+    CTxIn vin;
+    BOOST_CHECK(!ranks.GetVin(0, CFrenchnodeRanks::RANK_ACTIVE, vin));
+    BOOST_CHECK(!ranks.GetVin(vActive.size() + 1, CFrenchnodeRanks::RANK_ACTIVE, vin));
+
+    BOOST_CHECK_EQUAL(ranks.GetRank(vFrenchnodes[5].vin, CFrenchnodeRanks::RANK_ACTIVE), -1);
+    BOOST_CHECK(ranks.GetRank(vFrenchnodes[5].vin, CFrenchnodeRanks::RANK_SCORED) > 0);
+    BOOST_CHECK_EQUAL(ranks.GetRank(vFrenchnodes[7].vin, CFrenchnodeRanks::RANK_SCORED), -1);
+}
+
+BOOST_AUTO_TEST_CASE(rank_table_cache)
+{
+    CFrenchnodeMan mnodemanTest;
+    for (unsigned int i = 0; i < 20; i++) {
+        CFrenchnode mn;
+        mn.vin = CTxIn(COutPoint(GetRandHash(), i));
+        mn.unitTest = true;
+        mn.lastPing.sigTime = GetAdjustedTime();
+        BOOST_CHECK(mnodemanTest.Add(mn));
+    }
+
+    // Heights far above the test chain, so their hashes only come from the cache
+    const int nHeight = 1000000;
+    uint256 hash = GetRandHash(), hashNext = GetRandHash();
+    {
+        LOCK(cs_mapCacheBlockHashes);
+        mapCacheBlockHashes[nHeight] = hash;
+        mapCacheBlockHashes[nHeight + 1] = hashNext;
+    }
+
+    CFrenchnodeRanksRef ranks = mnodemanTest.GetRanks(nHeight);
+    BOOST_REQUIRE(ranks);
+    BOOST_CHECK(ranks->hashBlock == hash);
+    BOOST_CHECK_EQUAL(ranks->GetRanked(CFrenchnodeRanks::RANK_SCORED).size(), 20U);
+
+    // The same table is handed out again, without waiting for cs_main
+    {
+        CMainLockHolder holder;
+        BOOST_CHECK(mnodemanTest.GetRanks(nHeight) == ranks);
+    }
+
+    // A new height gets its own table
+    CFrenchnodeRanksRef ranksNext = mnodemanTest.GetRanks(nHeight + 1);
+    BOOST_REQUIRE(ranksNext);
+    BOOST_CHECK(ranksNext != ranks);
+    BOOST_CHECK(ranksNext->hashBlock == hashNext);
+    BOOST_CHECK(mnodemanTest.GetRanks(nHeight) == ranks);
+
+    // A list change drops every table
+    mnodemanTest.ListChanged();
+    CFrenchnodeRanksRef ranksRebuilt = mnodemanTest.GetRanks(nHeight);
+    BOOST_REQUIRE(ranksRebuilt);
+    BOOST_CHECK(ranksRebuilt != ranks);
+    BOOST_CHECK(ranksRebuilt->GetRanked(CFrenchnodeRanks::RANK_SCORED) == ranks->GetRanked(CFrenchnodeRanks::RANK_SCORED));
+    BOOST_CHECK(mnodemanTest.GetRanks(nHeight + 1) != ranksNext);
+
+    {
+        LOCK(cs_mapCacheBlockHashes);
+        mapCacheBlockHashes.erase(nHeight);
+        mapCacheBlockHashes.erase(nHeight + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(collateral_spent_by_block)
+{
+    CFrenchnodeMan mnodemanTest;
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    std::vector<CTxIn> vCollateral;
+    for (unsigned int i = 0; i < 10; i++) {
+        CFrenchnode mn;
+        mn.vin = CTxIn(COutPoint(GetRandHash(), i));
+        mn.lastPing.sigTime = GetAdjustedTime();
+        BOOST_CHECK(mnodemanTest.Add(mn));
+        vCollateral.push_back(mn.vin);
+
+        CCoinsModifier coins = view.ModifyCoins(mn.vin.prevout.hash);
+        coins->vout.resize(i + 1);
+        coins->vout[i].nValue = FRENCHNODE_COLLATERAL * COIN;
+    }
+
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    block.vtx.push_back(coinbase);
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    tx.vin.push_back(vCollateral[3]);
+    tx.vin.push_back(vCollateral[8]);
+    tx.vout.resize(1);
+    block.vtx.push_back(tx);
+
+    mnodemanTest.ConnectedBlock(block, view);
+    for (unsigned int i = 0; i < vCollateral.size(); i++) {
+        bool fSpent = i == 3 || i == 8;
+        BOOST_CHECK_EQUAL(mnodemanTest.Find(vCollateral[i])->activeState == CFrenchnode::FRENCHNODE_VIN_SPENT, fSpent);
+    }
+    BOOST_CHECK_EQUAL(mnodemanTest.CountEnabled(), 8);
+
+    mnodemanTest.DisconnectedBlock(block);
+    BOOST_CHECK_EQUAL(mnodemanTest.CountEnabled(), 10);
+}
+
+BOOST_AUTO_TEST_CASE(list_snapshot)
+{
+    CFrenchnodeMan mnodemanTest;
+    for (unsigned int i = 0; i < FRENCHNODES_LIST_BATCH_SIZE + 100; i++) {
+        CFrenchnode mn;
+        mn.vin = CTxIn(COutPoint(GetRandHash(), i));
+        mn.sigTime = GetAdjustedTime() - i;
+        mn.lastPing.sigTime = GetAdjustedTime();
+        if (i == 7) mn.addr = CService("192.168.1.7", 9999);
+        BOOST_CHECK(mnodemanTest.Add(mn));
+    }
+
+    // Every enabled, public Frenchnode is in both the inventory and the batches
+    CFrenchnodeListSnapshotRef snapshot = mnodemanTest.GetListSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->vInv.size(), FRENCHNODES_LIST_BATCH_SIZE + 99U);
+    BOOST_CHECK_EQUAL(snapshot->vBatches.size(), 2U);
+    std::vector<CFrenchnodeBroadcast> vBroadcasts;
+    BOOST_FOREACH (const CFramedMessageRef& msg, snapshot->vBatches) {
+        CDataStream ss(msg->begin() + CMessageHeader::HEADER_SIZE, msg->end(), SER_NETWORK, PROTOCOL_VERSION);
+        std::vector<CFrenchnodeBroadcast> vBatch;
+        ss >> vBatch;
+        vBroadcasts.insert(vBroadcasts.end(), vBatch.begin(), vBatch.end());
+    }
+    BOOST_CHECK_EQUAL(vBroadcasts.size(), snapshot->vInv.size());
+    for (unsigned int i = 0; i < vBroadcasts.size(); i++) {
+        BOOST_CHECK(vBroadcasts[i].GetHash() == snapshot->vInv[i].hash);
+        BOOST_CHECK(mnodemanTest.mapSeenFrenchnodeBroadcast.count(snapshot->vInv[i].hash));
+    }
+
+    // Shared until the list changes
+    BOOST_CHECK(mnodemanTest.GetListSnapshot() == snapshot);
+    CFrenchnode mn;
+    mn.vin = CTxIn(COutPoint(GetRandHash(), 0));
+    mn.lastPing.sigTime = GetAdjustedTime();
+    BOOST_CHECK(mnodemanTest.Add(mn));
+    CFrenchnodeListSnapshotRef snapshotNew = mnodemanTest.GetListSnapshot();
+    BOOST_CHECK(snapshotNew != snapshot);
+    BOOST_CHECK(snapshotNew->nListVersion > snapshot->nListVersion);
+    BOOST_CHECK_EQUAL(snapshotNew->vInv.size(), snapshot->vInv.size() + 1);
+}
+
+BOOST_AUTO_TEST_CASE(list_reply_window)
+{
+    CFrenchnodeMan mnodemanTest;
+    CAddress addr(CService("1.2.3.4", Params().GetDefaultPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    int64_t nNow = GetTime();
+
+    // Batches nobody asked for are dropped
+    BOOST_CHECK(!mnodemanTest.IsListRequested(node.GetId(), nNow));
+
+    // Once we asked, batches are taken for the reply window only
+    BOOST_CHECK(mnodemanTest.DsegUpdate(&node));
+    BOOST_CHECK(mnodemanTest.IsListRequested(node.GetId(), nNow));
+    BOOST_CHECK(mnodemanTest.IsListRequested(node.GetId(), nNow + FRENCHNODES_LIST_REPLY_SECONDS - 1));
+    BOOST_CHECK(!mnodemanTest.IsListRequested(node.GetId(), nNow + FRENCHNODES_LIST_REPLY_SECONDS + 60));
+
+    // The window closes as soon as the peer reports the end of the list
+    mnodemanTest.ListReplied(node.GetId());
+    BOOST_CHECK(!mnodemanTest.IsListRequested(node.GetId(), nNow));
+}
+
+BOOST_AUTO_TEST_CASE(budget_vote_tally)
+{
+    CBudgetProposal proposal("test", "https://example.com", 0, 100, CScript(), 10 * COIN, 0);
+    uint256 nProposalHash = proposal.GetHash();
+    std::vector<CTxIn> vVoters;
+    std::string strError;
+    for (int i = 0; i < 6; i++) {
+        vVoters.push_back(CTxIn(COutPoint(GetRandHash(), i)));
+        CBudgetVote vote(vVoters[i], nProposalHash, i < 3 ? VOTE_YES : (i < 5 ? VOTE_NO : VOTE_ABSTAIN));
+        vote.nTime = GetTime() - BUDGET_VOTE_UPDATE_MIN - 60;
+        BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    }
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 3);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 1);
+
+    // A changed vote moves from one count to the other
+    CBudgetVote vote(vVoters[0], nProposalHash, VOTE_NO);
+    vote.nTime = GetTime();
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 3);
+
+    // Votes of Frenchnodes that went away stop counting
+    for (int i = 0; i < 3; i++) {
+        CFrenchnode mn;
+        mn.vin = vVoters[i];
+        mn.lastPing.sigTime = GetAdjustedTime();
+        BOOST_CHECK(mnodeman.Add(mn));
+    }
+    proposal.CleanAndRemove(false);
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 1);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 0);
+    for (int i = 0; i < 3; i++)
+        mnodeman.Remove(vVoters[i]);
+
+    // Loaded proposals are counted again
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << proposal;
+    CBudgetProposal proposalLoaded;
+    ss >> proposalLoaded;
+    BOOST_CHECK_EQUAL(proposalLoaded.GetYeas(), 2);
+    BOOST_CHECK_EQUAL(proposalLoaded.GetNays(), 3);
+    BOOST_CHECK_EQUAL(proposalLoaded.GetAbstains(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(payment_window)
+{
+    CFrenchnodePayments payments;
+    std::vector<CScript> vPayees;
+    for (int i = 0; i < 3; i++)
+        vPayees.push_back(CScript() << OP_DUP << i);
+
+    // 3 votes for payee 0 and 1 for payee 1 at each height
+    std::vector<uint256> vHashes;
+    for (int nHeight = 1; nHeight <= 2000; nHeight++) {
+        for (int i = 0; i < 4; i++) {
+            CFrenchnodePaymentWinner winner(CTxIn(COutPoint(GetRandHash(), i)));
+            winner.nBlockHeight = nHeight;
+            winner.AddPayee(vPayees[i == 3 ? 1 : 0]);
+            BOOST_CHECK(payments.AddVote(winner));
+            BOOST_CHECK(!payments.AddVote(winner));
+            if (nHeight == 1990) vHashes.push_back(winner.GetHash());
+        }
+        payments.CleanPaymentList(nHeight, MNPAYMENTS_MIN_HISTORY);
+    }
+
+    // Only the window is kept
+    CScript payee;
+    BOOST_CHECK(payments.GetBlockPayee(2000, payee));
+    BOOST_CHECK(payee == vPayees[0]);
+    BOOST_CHECK(payments.GetBlockPayee(1000, payee));
+    BOOST_CHECK(!payments.GetBlockPayee(999, payee));
+    BOOST_CHECK(payments.HasPayeeWithVotes(1500, vPayees[1], 1));
+    BOOST_CHECK(!payments.HasPayeeWithVotes(1500, vPayees[1], 2));
+    BOOST_CHECK_EQUAL(payments.GetOldestBlock(), 1000);
+    BOOST_CHECK_EQUAL(payments.GetNewestBlock(), 2000);
+
+    // Votes are found by hash
+    CFrenchnodePaymentWinner winner;
+    BOOST_CHECK(payments.GetVote(vHashes[3], winner));
+    BOOST_CHECK(winner.nBlockHeight == 1990 && winner.payee == vPayees[1]);
+
+    // Too old for the window, or for a slot already holding a newer height
+    CFrenchnodePaymentWinner winnerOld(CTxIn(COutPoint(GetRandHash(), 0)));
+    winnerOld.nBlockHeight = 999;
+    BOOST_CHECK(!payments.AddVote(winnerOld));
+
+    // Scheduled in the next 8 blocks, other than the one asked about
+    BOOST_CHECK(payments.IsScheduled(vPayees[0], 1990, 0));
+    BOOST_CHECK(!payments.IsScheduled(vPayees[1], 1990, 0));
+    BOOST_CHECK(!payments.IsScheduled(vPayees[0], 2001, 0));
+
+    // A larger window keeps what is there
+    payments.CleanPaymentList(2000, 1500);
+    BOOST_CHECK(payments.GetBlockPayee(1000, payee));
+    BOOST_CHECK(payments.GetVote(vHashes[0], winner));
+    payments.CleanPaymentList(2600, 1500);
+    BOOST_CHECK(!payments.GetBlockPayee(1099, payee));
+    BOOST_CHECK(payments.GetBlockPayee(1100, payee));
+
+    // One vote per Frenchnode and height
+    COutPoint outpoint(GetRandHash(), 0);
+    BOOST_CHECK(payments.CanVote(outpoint, 2001));
+    BOOST_CHECK(!payments.CanVote(outpoint, 2001));
+    BOOST_CHECK(payments.CanVote(outpoint, 2002));
+}
+
+BOOST_AUTO_TEST_CASE(sync_completion)
+{
+    CFrenchnodeSync sync;
+    sync.GetNextAsset();
+    sync.GetNextAsset();
+    BOOST_CHECK_EQUAL(sync.RequestedFrenchnodeAssets, FRENCHNODE_SYNC_LIST);
+
+    int64_t nNow = GetTime();
+    for (NodeId nodeid = 1; nodeid <= FRENCHNODE_SYNC_PEERS; nodeid++)
+        sync.SyncRequested(nodeid, nNow);
+    BOOST_CHECK_EQUAL(sync.CountSyncPending(nNow), FRENCHNODE_SYNC_PEERS);
+    BOOST_CHECK(!sync.IsAssetComplete(nNow, false));
+
+    // Counts from peers that weren't asked, or for another asset, don't count as replies
+    sync.SyncReplied(1, FRENCHNODE_SYNC_LIST, 5, nNow);
+    sync.SyncReplied(7, FRENCHNODE_SYNC_LIST, 50, nNow);
+    sync.SyncReplied(2, FRENCHNODE_SYNC_MNW, 50, nNow);
+    BOOST_CHECK_EQUAL(sync.CountSyncPending(nNow), FRENCHNODE_SYNC_PEERS - 1);
+    BOOST_CHECK(!sync.IsAssetComplete(nNow, false));
+
+    // A single reply will do once the other peers timed out and nobody is left to ask
+    BOOST_CHECK_EQUAL(sync.CountSyncPending(nNow + FRENCHNODE_SYNC_PEER_TIMEOUT), 0);
+    BOOST_CHECK(!sync.IsAssetComplete(nNow + FRENCHNODE_SYNC_PEER_TIMEOUT, true));
+    BOOST_CHECK(sync.IsAssetComplete(nNow + FRENCHNODE_SYNC_PEER_TIMEOUT, false));
+
+    // With two replies it is complete once as many distinct items as the largest count came in
+    sync.SyncReplied(2, FRENCHNODE_SYNC_LIST, 6, nNow);
+    uint256 hash = GetRandHash();
+    sync.AddedFrenchnodeList(hash);
+    sync.AddedFrenchnodeList(hash);
+    for (int i = 0; i < 4; i++)
+        sync.AddedFrenchnodeList(GetRandHash());
+    BOOST_CHECK_EQUAL(sync.CountSeen(), 5);
+    BOOST_CHECK(!sync.IsAssetComplete(nNow, true));
+    sync.AddedFrenchnodeList(GetRandHash());
+    BOOST_CHECK(sync.IsAssetComplete(nNow, true));
+
+    // Moving on times the asset and starts over with the requests
+    sync.GetNextAsset();
+    sync.GetNextAsset();
+    BOOST_CHECK_EQUAL(sync.RequestedFrenchnodeAssets, FRENCHNODE_SYNC_BUDGET);
+    BOOST_CHECK_EQUAL(sync.mapAssetSyncMillis.size(), 3U);
+    BOOST_CHECK_EQUAL(sync.CountSyncPending(nNow), 0);
+
+    // A peer is done with budgets after the finalized budget count; without new items it's over after a quiet spell
+    sync.SyncRequested(1, nNow);
+    sync.SyncRequested(2, nNow);
+    sync.SyncReplied(1, FRENCHNODE_SYNC_BUDGET_PROP, 2, nNow);
+    sync.SyncReplied(2, FRENCHNODE_SYNC_BUDGET_PROP, 0, nNow);
+    BOOST_CHECK_EQUAL(sync.CountSyncPending(nNow), 2);
+    sync.SyncReplied(1, FRENCHNODE_SYNC_BUDGET_FIN, 1, nNow);
+    sync.SyncReplied(2, FRENCHNODE_SYNC_BUDGET_FIN, 0, nNow);
+    BOOST_CHECK(!sync.IsAssetComplete(nNow, true));
+    BOOST_CHECK(sync.IsAssetComplete(nNow + FRENCHNODE_SYNC_QUIET, true));
+
+    sync.GetNextAsset();
+    BOOST_CHECK(sync.IsSynced());
+    BOOST_CHECK_EQUAL(sync.mapAssetSyncMillis.size(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(budget_orphan_vote_limits)
+{
+    CBudgetManager budgetTest;
+    uint256 nHash = GetRandHash();
+    int64_t nNow = GetAdjustedTime();
+
+    // One orphan vote per Frenchnode and item, the newest
+    CTxIn vin(COutPoint(GetRandHash(), 0));
+    CBudgetVote vote(vin, nHash, VOTE_YES);
+    vote.nTime = nNow - 60;
+    BOOST_CHECK(budgetTest.AddOrphanVote(vote, 1));
+    CBudgetVote voteOlder(vin, nHash, VOTE_NO);
+    voteOlder.nTime = nNow - 120;
+    BOOST_CHECK(!budgetTest.AddOrphanVote(voteOlder, 1));
+    CBudgetVote voteNewer(vin, nHash, VOTE_NO);
+    voteNewer.nTime = nNow;
+    BOOST_CHECK(budgetTest.AddOrphanVote(voteNewer, 1));
+    BOOST_CHECK_EQUAL(budgetTest.mapOrphanFrenchnodeBudgetVotes[nHash].size(), 1U);
+    BOOST_CHECK(budgetTest.mapOrphanFrenchnodeBudgetVotes[nHash].count(voteNewer.GetHash()));
+
+    // Votes that would expire right away are not kept
+    CBudgetVote voteStale(CTxIn(COutPoint(GetRandHash(), 0)), nHash, VOTE_YES);
+    voteStale.nTime = nNow - BUDGET_ORPHAN_VOTE_SECONDS - 60;
+    BOOST_CHECK(!budgetTest.AddOrphanVote(voteStale, 1));
+
+    // At most MAX_ORPHAN_VOTES_PER_HASH for one item
+    unsigned int nAdded = 0;
+    for (unsigned int i = 1; i < MAX_ORPHAN_VOTES_PER_HASH; i++) {
+        CBudgetVote voteOther(CTxIn(COutPoint(GetRandHash(), i)), nHash, VOTE_YES);
+        if (budgetTest.AddOrphanVote(voteOther, 2))
+            nAdded++;
+    }
+    BOOST_CHECK_EQUAL(nAdded, MAX_ORPHAN_VOTES_PER_HASH - 1);
+    CBudgetVote voteOver(CTxIn(COutPoint(GetRandHash(), 0)), nHash, VOTE_YES);
+    BOOST_CHECK(!budgetTest.AddOrphanVote(voteOver, 3));
+    BOOST_CHECK_EQUAL(budgetTest.mapOrphanFrenchnodeBudgetVotes[nHash].size(), MAX_ORPHAN_VOTES_PER_HASH);
+
+    // At most MAX_ORPHAN_VOTES_PER_PEER from one peer, proposal and finalized budget votes together
+    int nAddedFromPeer = 0;
+    for (int i = 0; i < MAX_ORPHAN_VOTES_PER_PEER; i++) {
+        CBudgetVote voteOther(CTxIn(COutPoint(GetRandHash(), 0)), GetRandHash(), VOTE_YES);
+        if (budgetTest.AddOrphanVote(voteOther, 4))
+            nAddedFromPeer++;
+    }
+    BOOST_CHECK_EQUAL(nAddedFromPeer, MAX_ORPHAN_VOTES_PER_PEER);
+    CFinalizedBudgetVote voteFinalized(CTxIn(COutPoint(GetRandHash(), 0)), GetRandHash());
+    BOOST_CHECK(!budgetTest.AddOrphanVote(voteFinalized, 4));
+    BOOST_CHECK(budgetTest.AddOrphanVote(voteFinalized, 5));
+
+    // Expired votes are dropped, which also frees the peer's allowance
+    std::map<uint256, std::map<uint256, CBudgetVote> >::iterator it = budgetTest.mapOrphanFrenchnodeBudgetVotes.begin();
+    for (; it != budgetTest.mapOrphanFrenchnodeBudgetVotes.end(); ++it) {
+        std::map<uint256, CBudgetVote>::iterator itVote = (*it).second.begin();
+        for (; itVote != (*it).second.end(); ++itVote)
+            (*itVote).second.nTime = nNow - BUDGET_ORPHAN_VOTE_SECONDS - 60;
+    }
+    budgetTest.RemoveExpiredOrphanVotes();
+    BOOST_CHECK(budgetTest.mapOrphanFrenchnodeBudgetVotes.empty());
+    BOOST_CHECK_EQUAL(budgetTest.mapOrphanFinalizedBudgetVotes.size(), 1U);
+    CBudgetVote voteAgain(CTxIn(COutPoint(GetRandHash(), 0)), GetRandHash(), VOTE_YES);
+    BOOST_CHECK(budgetTest.AddOrphanVote(voteAgain, 4));
+}
+
+BOOST_AUTO_TEST_CASE(budget_matured_orphan_votes)
+{
+    CBudgetManager budgetTest;
+    std::vector<CTxBudgetPayment> vecPayments;
+    CFinalizedBudgetBroadcast finalizedBudget("test", GetBudgetPaymentCycleBlocks(), vecPayments, GetRandHash());
+    uint256 nHash = finalizedBudget.GetHash();
+
+    // Votes for a finalized budget still waiting on its collateral are orphans
+    CFinalizedBudgetVote vote(CTxIn(COutPoint(GetRandHash(), 0)), nHash);
+    BOOST_CHECK(budgetTest.AddOrphanVote(vote, 1));
+    BOOST_CHECK_EQUAL(budgetTest.mapOrphanFinalizedBudgetVotes[nHash].size(), 1U);
+
+    // Once the collateral matures they are counted
+    budgetTest.AddMaturedFinalizedBudget(finalizedBudget);
+    BOOST_CHECK(budgetTest.mapFinalizedBudgets.count(nHash));
+    BOOST_CHECK_EQUAL(budgetTest.mapFinalizedBudgets[nHash].GetVoteCount(), 1);
+    BOOST_CHECK(!budgetTest.mapOrphanFinalizedBudgetVotes.count(nHash));
+}
+
+BOOST_AUTO_TEST_CASE(budget_maintenance_steps)
+{
+    CBudgetManager budgetTest;
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_IDLE);
+
+    BOOST_CHECK(budgetTest.StartMaintenance(14));
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_SYNC);
+    // A run is not restarted before it is done
+    BOOST_CHECK(!budgetTest.StartMaintenance(28));
+
+    // A step never waits for cs_main: while another thread holds it, the tick is skipped
+    {
+        CMainLockHolder holder;
+        budgetTest.MaintenanceStep();
+        budgetTest.MaintenanceStep();
+        BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_SYNC);
+    }
+
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_CHECK);
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_CLEAN_PROPOSALS);
+
+    // Proposals are cleaned BUDGET_CLEAN_BATCH_SIZE per step
+    {
+        LOCK(budgetTest.cs);
+        for (int i = 0; i < 2 * BUDGET_CLEAN_BATCH_SIZE + 1; i++)
+            budgetTest.mapProposals.insert(std::make_pair(GetRandHash(), CBudgetProposal()));
+    }
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_CLEAN_PROPOSALS);
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_CLEAN_PROPOSALS);
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_CLEAN_BUDGETS);
+
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_IMMATURE);
+    budgetTest.MaintenanceStep();
+    BOOST_CHECK_EQUAL(budgetTest.GetMaintenanceStage(), CBudgetManager::MAINTENANCE_IDLE);
+    BOOST_CHECK(budgetTest.StartMaintenance(28));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "streams.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+CMuHash3072 FromElements(const unsigned char* pch, int n)
+{
+    CMuHash3072 muhash;
+    for (int i = 0; i < n; i++)
+        muhash.Insert(pch + i, 1);
+    return muhash;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(muhash_tests)
+
+BOOST_AUTO_TEST_CASE(muhash_order_independent)
+{
+    const unsigned char data[] = {1, 2, 3, 4, 5};
+    const unsigned char reversed[] = {5, 4, 3, 2, 1};
+    BOOST_CHECK(FromElements(data, 5).Finalize() == FromElements(reversed, 5).Finalize());
+    BOOST_CHECK(FromElements(data, 5).Finalize() != FromElements(data, 4).Finalize());
+    BOOST_CHECK(FromElements(data, 1).Finalize() != CMuHash3072().Finalize());
+
+    // A multiset, not a set: duplicates count
+    const unsigned char dup[] = {1, 1};
+    BOOST_CHECK(FromElements(dup, 2).Finalize() != FromElements(dup, 1).Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_insert_remove)
+{
+    const unsigned char data[] = {1, 2, 3, 4, 5};
+
+    // Removing in any order, before or after insertion, returns to the empty set
+    CMuHash3072 muhash;
+    muhash.Remove(data + 2, 1);
+    for (int i = 0; i < 5; i++)
+        muhash.Insert(data + i, 1);
+    muhash.Remove(data + 4, 1).Remove(data, 1).Remove(data + 3, 1).Remove(data + 1, 1);
+    BOOST_CHECK(muhash.Finalize() == CMuHash3072().Finalize());
+
+    muhash.Insert(data, 2);
+    CMuHash3072 single;
+    single.Insert(data, 2);
+    BOOST_CHECK(muhash.Finalize() == single.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_combine)
+{
+    const unsigned char data[] = {1, 2, 3, 4, 5, 6};
+    CMuHash3072 first = FromElements(data, 3);
+    CMuHash3072 second = FromElements(data + 3, 3);
+
+    CMuHash3072 all = first;
+    all *= second;
+    BOOST_CHECK(all.Finalize() == FromElements(data, 6).Finalize());
+
+    all /= first;
+    BOOST_CHECK(all.Finalize() == second.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_serialize)
+{
+    const unsigned char data[] = {7, 8, 9};
+    CMuHash3072 muhash = FromElements(data, 3);
+    muhash.Remove(data + 1, 1);
+
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << muhash;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * CMuHash3072::BYTE_SIZE);
+    CMuHash3072 restored;
+    ss >> restored;
+    BOOST_CHECK(restored.Finalize() == muhash.Finalize());
+    BOOST_CHECK(restored.Finalize() == FromElements(data, 3).Remove(data + 1, 1).Finalize());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,283 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "primitives/block.h"
+#include "serialize.h"
+#include "streams.h"
+#include "tinyformat.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(framed_message_matches_pushmessage)
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.nTime = 1234567;
+    block.nNonce = 42;
+    CMutableTransaction tx;
+    tx.nLockTime = 7;
+    block.vtx.push_back(tx);
+
+    // Nodes without a socket keep everything queued in vSendMsg
+    CNode nodeSerialized(INVALID_SOCKET, CAddress(), "", true);
+    nodeSerialized.PushMessage("block", block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CSerializeData vMsg(CMessageHeader::HEADER_SIZE);
+    vMsg.insert(vMsg.end(), ss.begin(), ss.end());
+    CNode nodeFramed(INVALID_SOCKET, CAddress(), "", true);
+    nodeFramed.PushFramedMessage("block", vMsg);
+    BOOST_CHECK(vMsg.empty());
+
+    BOOST_CHECK_EQUAL(nodeSerialized.vSendMsg.size(), 1U);
+    BOOST_CHECK_EQUAL(nodeFramed.vSendMsg.size(), 1U);
+    BOOST_CHECK(*nodeSerialized.vSendMsg.back() == *nodeFramed.vSendMsg.back());
+    BOOST_CHECK_EQUAL(nodeSerialized.nSendSize, nodeFramed.nSendSize);
+}
+
+BOOST_AUTO_TEST_CASE(shared_message_fanout)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(2);
+    tx.nLockTime = 7;
+
+    CNode nodeSerialized(INVALID_SOCKET, CAddress(), "", true);
+    nodeSerialized.PushMessage("tx", CTransaction(tx));
+
+    // Framed once, then queued to many peers without another copy
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CTransaction(tx);
+    CFramedMessageRef msg = MakeFramedMessage("tx", ss);
+    std::vector<CNode*> vPeers;
+    for (int i = 0; i < 50; i++) {
+        vPeers.push_back(new CNode(INVALID_SOCKET, CAddress(), "", true));
+        vPeers.back()->PushSharedMessage(msg);
+    }
+    BOOST_CHECK_EQUAL(msg.use_count(), 51);
+    BOOST_CHECK(*msg == *nodeSerialized.vSendMsg.back());
+    BOOST_FOREACH (CNode* pnode, vPeers) {
+        BOOST_CHECK(pnode->vSendMsg.back() == msg);
+        BOOST_CHECK_EQUAL(pnode->nSendSize, msg->size());
+        delete pnode;
+    }
+    BOOST_CHECK(msg.unique());
+
+    // getdata for relayed inventory is answered with the same buffer
+    CInv inv(MSG_TX, CTransaction(tx).GetHash());
+    AddRelayMessage(inv, msg);
+    {
+        LOCK(cs_mapRelay);
+        BOOST_CHECK(mapRelay[inv] == msg);
+        mapRelay.erase(inv);
+    }
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(scatter_gather_send)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    // A small send buffer, so the queue goes out in many partial writes
+    int nSendBuffer = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nSendBuffer, sizeof(nSendBuffer));
+
+    // Queue messages of all sizes while there is no socket to write them to
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    for (int i = 0; i < 500; i++)
+        node.PushMessage("inv", std::vector<unsigned char>((i * 37) % 1500, (unsigned char)i));
+
+    std::vector<char> vExpected;
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK_EQUAL(node.vSendMsg.size(), 500U);
+        BOOST_FOREACH (const CFramedMessageRef& msg, node.vSendMsg)
+            vExpected.insert(vExpected.end(), msg->begin(), msg->end());
+        BOOST_CHECK_EQUAL(node.nSendSize, vExpected.size());
+        node.hSocket = fds[0];
+    }
+
+    std::vector<char> vReceived;
+    char buf[8192];
+    for (int i = 0; i < 100000 && vReceived.size() < vExpected.size(); i++) {
+        {
+            LOCK(node.cs_vSend);
+            SocketSendData(&node);
+        }
+        ssize_t nBytes = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+        if (nBytes > 0)
+            vReceived.insert(vReceived.end(), buf, buf + nBytes);
+    }
+    BOOST_CHECK(vReceived == vExpected);
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK(node.vSendMsg.empty());
+        BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+        BOOST_CHECK_EQUAL(node.nSendOffset, 0U);
+        node.hSocket = INVALID_SOCKET;
+    }
+    BOOST_CHECK_EQUAL(node.nSendBytes, vExpected.size());
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(processing_time_stats)
+{
+    std::map<std::string, CMessageTimeStats> mapBefore;
+    CNode::GetProcessingTimeStats(mapBefore);
+
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    node.RecordProcessingTime("mnb", 300);
+    node.RecordProcessingTime("mnb", 100);
+    node.RecordProcessingTime("inv", 50);
+
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.nProcessedMsgs, 3U);
+    BOOST_CHECK_EQUAL(stats.dProcessingTime, 450 / 1e6);
+
+    // The per-command totals are shared by all nodes
+    std::map<std::string, CMessageTimeStats> mapAfter;
+    CNode::GetProcessingTimeStats(mapAfter);
+    BOOST_CHECK_EQUAL(mapAfter["mnb"].nCount - mapBefore["mnb"].nCount, 2U);
+    BOOST_CHECK_EQUAL(mapAfter["mnb"].nTotalMicros - mapBefore["mnb"].nTotalMicros, 400);
+    BOOST_CHECK(mapAfter["mnb"].nMaxMicros >= 300);
+    BOOST_CHECK_EQUAL(mapAfter["inv"].nCount - mapBefore["inv"].nCount, 1U);
+
+    // Made-up commands end up in one bucket once the map is full
+    for (int i = 0; i < 300; i++)
+        node.RecordProcessingTime(strprintf("junk%d", i), 1);
+    CNode::GetProcessingTimeStats(mapAfter);
+    BOOST_CHECK(mapAfter.size() <= 257U);
+    BOOST_CHECK(mapAfter.count("*other*"));
+}
+
+BOOST_AUTO_TEST_CASE(message_traffic_stats)
+{
+    mapMsgCmdTraffic mapSentBefore, mapRecvBefore;
+    CNode::GetMessageTrafficTotals(mapSentBefore, mapRecvBefore);
+
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    node.PushMessage("mnp", std::vector<unsigned char>(100));
+    node.PushMessage("mnp", std::vector<unsigned char>(10));
+
+    // Two whole messages arriving in one read, one of them with a made-up command
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader("mnw", 5);
+    ss.write("abcde", 5);
+    ss << CMessageHeader("bogus", 0);
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(node.ReceiveMsgBytes(&ss[0], ss.size()));
+    }
+
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.mapSendTrafficPerCmd["mnp"].nCount, 2U);
+    BOOST_CHECK_EQUAL(stats.mapSendTrafficPerCmd["mnp"].nBytes, 2 * CMessageHeader::HEADER_SIZE + 101 + 11U);
+    BOOST_CHECK_EQUAL(stats.mapRecvTrafficPerCmd["mnw"].nCount, 1U);
+    BOOST_CHECK_EQUAL(stats.mapRecvTrafficPerCmd["mnw"].nBytes, CMessageHeader::HEADER_SIZE + 5U);
+    BOOST_CHECK_EQUAL(stats.mapRecvTrafficPerCmd["*other*"].nCount, 1U);
+    BOOST_CHECK(!stats.mapRecvTrafficPerCmd.count("bogus"));
+
+    mapMsgCmdTraffic mapSent, mapRecv;
+    CNode::GetMessageTrafficTotals(mapSent, mapRecv);
+    BOOST_CHECK_EQUAL(mapSent["mnp"].nCount - mapSentBefore["mnp"].nCount, 2U);
+    BOOST_CHECK_EQUAL(mapRecv["mnw"].nBytes - mapRecvBefore["mnw"].nBytes, CMessageHeader::HEADER_SIZE + 5U);
+}
+
+BOOST_AUTO_TEST_CASE(processing_time_histogram)
+{
+    CMessageTimeStats stats;
+    stats.Add(5);
+    stats.Add(10);
+    stats.Add(11);
+    stats.Add(50000);
+    stats.Add(5000000);
+    BOOST_CHECK_EQUAL(stats.nCount, 5U);
+    BOOST_CHECK_EQUAL(stats.nMaxMicros, 5000000);
+    BOOST_CHECK_EQUAL(stats.vBuckets[0], 2U); // <= 10us
+    BOOST_CHECK_EQUAL(stats.vBuckets[1], 1U); // <= 100us
+    BOOST_CHECK_EQUAL(stats.vBuckets[4], 1U); // <= 100ms
+    BOOST_CHECK_EQUAL(stats.vBuckets[CMessageTimeStats::BUCKETS - 1], 1U);
+    BOOST_CHECK_EQUAL(CMessageTimeStats::GetBucketBound(0), 10);
+    BOOST_CHECK_EQUAL(CMessageTimeStats::GetBucketBound(5), 1000000);
+    BOOST_CHECK_EQUAL(CMessageTimeStats::GetBucketBound(CMessageTimeStats::BUCKETS - 1), -1);
+}
+
+BOOST_AUTO_TEST_CASE(upload_target_cycle)
+{
+    // Ahead of any cycle other tests may have started with the real clock
+    const int64_t nStart = GetTime() + 2 * MAX_UPLOAD_TIMEFRAME;
+    SetMockTime(nStart);
+    CNode::SetMaxOutboundTarget(10000);
+    BOOST_CHECK_EQUAL(CNode::GetMaxOutboundTarget(), 10000U);
+
+    // The first bytes start a new cycle
+    CNode::RecordBytesSent(6000);
+    BOOST_CHECK(!CNode::OutboundTargetReached());
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), 4000U);
+    BOOST_CHECK_EQUAL(CNode::GetMaxOutboundTimeLeftInCycle(), MAX_UPLOAD_TIMEFRAME);
+
+    SetMockTime(nStart + 3600);
+    CNode::RecordBytesSent(5000);
+    BOOST_CHECK(CNode::OutboundTargetReached());
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), 0U);
+    BOOST_CHECK_EQUAL(CNode::GetMaxOutboundTimeLeftInCycle(), MAX_UPLOAD_TIMEFRAME - 3600);
+
+    // A day later the budget is back, even before anything else is sent
+    SetMockTime(nStart + MAX_UPLOAD_TIMEFRAME + 1);
+    BOOST_CHECK(!CNode::OutboundTargetReached());
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), 10000U);
+    CNode::RecordBytesSent(100);
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), 9900U);
+
+    // No target, no limit
+    CNode::SetMaxOutboundTarget(0);
+    CNode::RecordBytesSent(1000000);
+    BOOST_CHECK(!CNode::OutboundTargetReached());
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(peer_upload_rate_token_bucket)
+{
+    int64_t nRateSaved = nMaxPeerUploadRate;
+    nMaxPeerUploadRate = 1000;
+
+    // A new peer may send one second's worth straight away, then has to wait
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK_EQUAL(node.GetSendAllowance(), 1000U);
+        node.dSendTokens -= 1000;
+        BOOST_CHECK(node.IsSendThrottled());
+
+        // Refills at the configured rate, but never beyond one second's worth
+        node.nSendTokensTime -= 500000;
+        size_t nAllowance = node.GetSendAllowance();
+        BOOST_CHECK(nAllowance >= 500 && nAllowance < 600);
+        node.nSendTokensTime -= 60 * 1000000;
+        BOOST_CHECK_EQUAL(node.GetSendAllowance(), 1000U);
+    }
+
+    // Whitelisted peers are never held back
+    CNode nodeWhitelisted(INVALID_SOCKET, CAddress(), "", true);
+    nodeWhitelisted.fWhitelisted = true;
+    {
+        LOCK(nodeWhitelisted.cs_vSend);
+        nodeWhitelisted.dSendTokens = 0;
+        BOOST_CHECK(!nodeWhitelisted.IsSendThrottled());
+    }
+
+    nMaxPeerUploadRate = nRateSaved;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
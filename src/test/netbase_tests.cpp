@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "netbase.h"
+#include "utiltime.h"
 
 #include <string>
 
@@ -146,4 +147,65 @@ BOOST_AUTO_TEST_CASE(subnet_test)
     BOOST_CHECK(!CSubNet("fuzzy").IsValid());
 }
 
+/** A socket listening on an unused loopback port */
+static SOCKET ListenLoopback(CService& addrRet)
+{
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr.sin_port = 0;
+    SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hListen != INVALID_SOCKET);
+    BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) != SOCKET_ERROR);
+    BOOST_REQUIRE(listen(hListen, 5) != SOCKET_ERROR);
+    socklen_t len = sizeof(sockaddr);
+    BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&sockaddr, &len) != SOCKET_ERROR);
+    addrRet = CService(sockaddr);
+    return hListen;
+}
+
+BOOST_AUTO_TEST_CASE(connecting_sockets_loopback)
+{
+    // Several listeners, and a port nobody listens on any more
+    std::vector<SOCKET> vListen;
+    std::vector<CService> vAddr(6);
+    for (int i = 0; i < 6; i++)
+        vListen.push_back(ListenLoopback(vAddr[i]));
+    CService addrRefused = vAddr.back();
+    CloseSocket(vListen.back());
+    vListen.pop_back();
+    vAddr.pop_back();
+
+    // All attempts are in flight together, and are finished by the same waits
+    CConnectingSockets connecting;
+    for (unsigned int i = 0; i < vAddr.size(); i++)
+        BOOST_CHECK(connecting.Start(vAddr[i], 5000));
+    bool fRefusedStarted = connecting.Start(addrRefused, 5000);
+    BOOST_CHECK(connecting.size() >= vAddr.size());
+
+    std::vector<std::pair<CService, SOCKET> > vConnected;
+    std::vector<CService> vFailed;
+    int64_t nStart = GetTimeMillis();
+    while (connecting.size() > 0 && GetTimeMillis() - nStart < 5000)
+        connecting.Wait(100, vConnected, vFailed);
+    BOOST_CHECK_EQUAL(connecting.size(), 0U);
+
+    BOOST_CHECK_EQUAL(vConnected.size(), vAddr.size());
+    for (unsigned int i = 0; i < vConnected.size(); i++) {
+        BOOST_CHECK(std::find(vAddr.begin(), vAddr.end(), vConnected[i].first) != vAddr.end());
+        BOOST_CHECK(vConnected[i].second != INVALID_SOCKET);
+        CloseSocket(vConnected[i].second);
+    }
+    if (fRefusedStarted) {
+        BOOST_CHECK_EQUAL(vFailed.size(), 1U);
+        BOOST_CHECK(vFailed.size() == 1 && vFailed[0] == addrRefused);
+    } else {
+        BOOST_CHECK(vFailed.empty());
+    }
+
+    for (unsigned int i = 0; i < vListen.size(); i++)
+        CloseSocket(vListen[i]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
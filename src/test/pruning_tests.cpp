@@ -0,0 +1,145 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+
+#include "masternode-budget.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "txdb.h"
+#include "uint256.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+extern CBlockIndex* AddToBlockIndex(const CBlock& block);
+extern UniValue CallRPC(std::string args);
+
+namespace
+{
+/** Throw away the in-memory block index and load it back from the block tree database */
+void ReloadBlockIndex()
+{
+    LOCK(cs_main);
+    UnloadBlockIndex();
+    fHavePruned = false;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(LoadBlockIndex(strError), strError);
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(pruning_tests)
+
+BOOST_AUTO_TEST_CASE(prune_one_block_file)
+{
+    LOCK(cs_main);
+    FlushStateToDisk();
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pindexGenesis->nStatus & BLOCK_HAVE_DATA);
+    uint64_t nUsageBefore = CalculateCurrentUsage();
+
+    PruneOneBlockFile(pindexGenesis->nFile);
+    fHavePruned = true;
+
+    // The index entries stay, only the data flags and file positions go
+    BOOST_CHECK(!(pindexGenesis->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)));
+    BOOST_CHECK_EQUAL(pindexGenesis->nDataPos, 0U);
+    BOOST_CHECK(pindexGenesis->nTx > 0);
+    BOOST_CHECK(pindexGenesis->IsValid(BLOCK_VALID_TRANSACTIONS));
+    BOOST_CHECK(chainActive.Genesis() == pindexGenesis);
+    BOOST_CHECK(CalculateCurrentUsage() < nUsageBefore);
+
+    // The index is still consistent with the data gone (the test setup enables -checkblockindex)
+    CheckBlockIndex();
+
+    // A pruned block is no longer served
+    try {
+        CallRPC("getblock " + pindexGenesis->GetBlockHash().GetHex());
+        BOOST_ERROR("getblock returned a pruned block");
+    } catch (const std::runtime_error& e) {
+        BOOST_CHECK(std::string(e.what()).find("pruned") != std::string::npos);
+    }
+
+    // Nothing was flushed, so the block index on disk still has the data
+    ReloadBlockIndex();
+    BOOST_CHECK(chainActive.Genesis()->nStatus & BLOCK_HAVE_DATA);
+}
+
+BOOST_AUTO_TEST_CASE(no_reorg_into_pruned_blocks)
+{
+    LOCK(cs_main);
+    FlushStateToDisk();
+    CBlockIndex* pindexTip = chainActive.Tip();
+    uint256 hashTip = pindexTip->GetBlockHash();
+
+    // A fork with more work than the active chain that was invalidated and has since been
+    // pruned: fully validated in the index, but none of its blocks are on disk any more
+    std::vector<CBlockIndex*> vFork;
+    CBlockIndex* pindexPrev = pindexTip->pprev ? pindexTip->pprev : pindexTip;
+    for (int i = 0; i < 3; i++) {
+        CBlock block;
+        block.nVersion = pindexPrev->nVersion;
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.hashMerkleRoot = GetRandHash();
+        block.nTime = pindexPrev->nTime + 1;
+        block.nBits = pindexPrev->nBits;
+        CBlockIndex* pindex = AddToBlockIndex(block);
+        pindex->nTx = 1;
+        pindex->nChainTx = pindexPrev->nChainTx + 1;
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        pindex->nStatus |= (i == 0 ? BLOCK_FAILED_VALID : BLOCK_FAILED_CHILD);
+        vFork.push_back(pindex);
+        pindexPrev = pindex;
+    }
+    BOOST_CHECK(vFork.back()->nChainWork > pindexTip->nChainWork);
+    fHavePruned = true;
+
+    // Reconsidering it makes it a candidate, but the node can't switch to it without the data
+    CValidationState state;
+    BOOST_CHECK(ReconsiderBlock(state, vFork[0]));
+    BOOST_CHECK(!(vFork.back()->nStatus & BLOCK_FAILED_MASK));
+    BOOST_CHECK(ActivateBestChain(state));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(chainActive.Tip() == pindexTip);
+    BOOST_CHECK(!chainActive.Contains(vFork[0]));
+    CheckBlockIndex();
+
+    // The fork only ever lived in memory
+    ReloadBlockIndex();
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+    BOOST_CHECK(!mapBlockIndex.count(vFork.back()->GetBlockHash()));
+}
+
+BOOST_AUTO_TEST_CASE(budget_collateral_kept)
+{
+    uint256 nProposalHash = GetRandHash();
+    CMutableTransaction txCollateral;
+    txCollateral.vout.resize(1);
+    txCollateral.vout[0].scriptPubKey << OP_RETURN << ToByteVector(nProposalHash);
+    txCollateral.vout[0].nValue = PROPOSAL_FEE_TX;
+    BOOST_CHECK(IsBudgetCollateralCandidate(txCollateral));
+
+    // Other data carriers are not kept
+    CMutableTransaction txData = txCollateral;
+    txData.vout[0].nValue = 0;
+    BOOST_CHECK(!IsBudgetCollateralCandidate(txData));
+
+    // Recorded collateral is found without its block file
+    std::vector<CTransaction> vCollaterals(1, txCollateral);
+    uint256 hashBlock = GetRandHash();
+    BOOST_CHECK(pblocktree->WriteBudgetCollaterals(vCollaterals, hashBlock));
+    CTransaction txRead;
+    uint256 hashBlockRead;
+    BOOST_CHECK(pblocktree->ReadBudgetCollateral(txCollateral.GetHash(), txRead, hashBlockRead));
+    BOOST_CHECK(txRead.GetHash() == txCollateral.GetHash());
+    BOOST_CHECK(hashBlockRead == hashBlock);
+    BOOST_CHECK(!pblocktree->ReadBudgetCollateral(GetRandHash(), txRead, hashBlockRead));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
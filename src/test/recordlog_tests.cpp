@@ -0,0 +1,190 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recordlog.h"
+
+#include "random.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Two tables, like the caches kept in a CRecordLog */
+struct CTestTables {
+    std::map<int, std::string> mapNames;
+    std::map<uint256, int64_t> mapTimes;
+    CRecordChanges recordChanges;
+
+    void SetName(int n, const std::string& strName)
+    {
+        mapNames[n] = strName;
+        recordChanges.Mark(0, n);
+    }
+
+    void EraseName(int n)
+    {
+        mapNames.erase(n);
+        recordChanges.Mark(0, n);
+    }
+
+    void SetTime(const uint256& hash, int64_t nTime)
+    {
+        mapTimes[hash] = nTime;
+        recordChanges.Mark(1, hash);
+    }
+
+    void GetRecords(CRecordMap& records) const
+    {
+        AddRecords(records, 0, mapNames);
+        AddRecords(records, 1, mapTimes);
+    }
+
+    void GetChangedRecords(const std::set<CRecordKey>& setChanged, CRecordMap& records, std::set<CRecordKey>& setErased) const
+    {
+        BOOST_FOREACH (const CRecordKey& key, setChanged) {
+            CDataStream ssKey(key, SER_DISK, CLIENT_VERSION);
+            unsigned char nTable;
+            ssKey >> nTable;
+            if (nTable == 0)
+                AddChangedRecord(records, setErased, key, ssKey, mapNames);
+            else
+                AddChangedRecord(records, setErased, key, ssKey, mapTimes);
+        }
+    }
+
+    bool LoadRecord(unsigned char nTable, CDataStream& ssKey, CDataStream& ssValue)
+    {
+        if (nTable == 0)
+            LoadMapRecord(ssKey, ssValue, mapNames);
+        else if (nTable == 1)
+            LoadMapRecord(ssKey, ssValue, mapTimes);
+        else
+            return false;
+        return true;
+    }
+
+    void Clear()
+    {
+        mapNames.clear();
+        mapTimes.clear();
+        recordChanges.MarkAll();
+    }
+
+    bool operator==(const CTestTables& other) const { return mapNames == other.mapNames && mapTimes == other.mapTimes; }
+};
+
+uint64_t FileSize(const std::string& strFilename)
+{
+    return boost::filesystem::file_size(GetDataDir() / strFilename);
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(recordlog_tests)
+
+BOOST_AUTO_TEST_CASE(recordlog_append_and_replay)
+{
+    CTestTables tables;
+    for (int i = 0; i < 1000; i++) {
+        tables.mapNames[i] = strprintf("entry %d ", i) + std::string(500, 'x');
+        tables.mapTimes[GetRandHash()] = i;
+    }
+
+    CRecordLog log("recordlog_test.log", "RecordLogTest");
+    CTestTables tablesRead;
+    BOOST_CHECK(log.Read(tablesRead) == CRecordLog::FileError);
+    BOOST_CHECK(log.Write(tables));
+    uint64_t nFullSize = FileSize("recordlog_test.log");
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nFullSize);
+
+    // Nothing changed, nothing written
+    BOOST_CHECK(log.Write(tables));
+    BOOST_CHECK_EQUAL(FileSize("recordlog_test.log"), nFullSize);
+
+    // Only the changes are appended
+    tables.SetName(5, "changed");
+    tables.EraseName(6);
+    tables.SetTime(GetRandHash(), 1234);
+    BOOST_CHECK(log.Write(tables));
+    uint64_t nDeltaSize = FileSize("recordlog_test.log") - nFullSize;
+    BOOST_CHECK(nDeltaSize > 0);
+    BOOST_CHECK(nDeltaSize < 200);
+
+    // Entries that were not marked are not even looked at
+    std::string strUnmarked = tables.mapNames[9];
+    tables.mapNames[9] = "not marked";
+    BOOST_CHECK(log.Write(tables));
+    BOOST_CHECK_EQUAL(FileSize("recordlog_test.log") - nFullSize, nDeltaSize);
+    tables.SetName(9, strUnmarked);
+
+    // A new reader replays to the latest state and can append after it
+    CRecordLog log2("recordlog_test.log", "RecordLogTest");
+    BOOST_CHECK(log2.Read(tablesRead) == CRecordLog::Ok);
+    BOOST_CHECK(tablesRead == tables);
+    tables.SetName(7, "changed again");
+    BOOST_CHECK(log2.Write(tables));
+    tablesRead.Clear();
+    BOOST_CHECK(log.Read(tablesRead) == CRecordLog::Ok);
+    BOOST_CHECK(tablesRead == tables);
+
+    // Once most of the file is superseded it is compacted
+    for (int n = 0; n < 4; n++) {
+        for (std::map<int, std::string>::iterator it = tables.mapNames.begin(); it != tables.mapNames.end(); ++it)
+            tables.SetName(it->first, it->second + "y");
+        BOOST_CHECK(log.Write(tables));
+    }
+    BOOST_CHECK(log.GetFileSize() < 2 * nFullSize);
+    BOOST_CHECK_EQUAL(FileSize("recordlog_test.log"), log.GetFileSize());
+    tablesRead.Clear();
+    BOOST_CHECK(log2.Read(tablesRead) == CRecordLog::Ok);
+    BOOST_CHECK(tablesRead == tables);
+
+    // Other caches' files are not read, nor overwritten
+    CRecordLog logOther("recordlog_test.log", "SomethingElse");
+    tablesRead.Clear();
+    BOOST_CHECK(logOther.Read(tablesRead) == CRecordLog::IncorrectMagicMessage);
+    BOOST_CHECK(!logOther.Write(tables));
+
+    boost::filesystem::remove(GetDataDir() / "recordlog_test.log");
+}
+
+BOOST_AUTO_TEST_CASE(recordlog_torn_write)
+{
+    CTestTables tables;
+    for (int i = 0; i < 10; i++)
+        tables.mapNames[i] = strprintf("entry %d", i);
+
+    CRecordLog log("recordlog_torn.log", "RecordLogTest");
+    BOOST_CHECK(log.Write(tables));
+    CTestTables tablesBefore = tables;
+    tables.SetName(3, "changed");
+    tables.SetName(11, "lost in a crash");
+    BOOST_CHECK(log.Write(tables));
+
+    // Cut the file in the middle of the last record
+    boost::filesystem::path path = GetDataDir() / "recordlog_torn.log";
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 3);
+
+    // The damaged record and whatever follows are dropped; the ones before are kept
+    CRecordLog log2("recordlog_torn.log", "RecordLogTest");
+    CTestTables tablesRead;
+    BOOST_CHECK(log2.Read(tablesRead) == CRecordLog::Ok);
+    BOOST_CHECK_EQUAL(tablesRead.mapNames.size(), 10U);
+    BOOST_CHECK_EQUAL(tablesRead.mapNames[3], "changed");
+    BOOST_CHECK(!tablesRead.mapNames.count(11));
+
+    // Appending continues right after the last good record
+    tables.SetName(3, tablesBefore.mapNames[3]);
+    tables.EraseName(11);
+    BOOST_CHECK(log2.Write(tables));
+    tablesRead.Clear();
+    BOOST_CHECK(log.Read(tablesRead) == CRecordLog::Ok);
+    BOOST_CHECK(tablesRead == tablesBefore);
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -159,6 +159,14 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     CSerializeData d;
     ss.GetAndClear(d);
     BOOST_CHECK_EQUAL(ss.size(), 0);
+    BOOST_CHECK_EQUAL(d.size(), 4U);
+    BOOST_CHECK_EQUAL(d[3], (char)0xff);
+
+    // Appends when there is something in the way
+    ss << (unsigned char)7;
+    ss.GetAndClear(d);
+    BOOST_CHECK_EQUAL(d.size(), 5U);
+    BOOST_CHECK_EQUAL(d[4], 7);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "swifttx.h"
+
+#include "random.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+CTransaction MakeTransaction(const COutPoint& prevout)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(prevout));
+    tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    tx.vout.resize(1);
+    tx.vout[0].nValue = GetRand(1000000);
+    return tx;
+}
+
+CConsensusVote MakeVote(const uint256& txHash, int nBlockHeight)
+{
+    CConsensusVote vote;
+    vote.vinFrenchnode = CTxIn(COutPoint(GetRandHash(), 0));
+    vote.txHash = txHash;
+    vote.nBlockHeight = nBlockHeight;
+    return vote;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(swifttx_tests)
+
+BOOST_AUTO_TEST_CASE(lock_vote_count)
+{
+    CSwiftTXManager manager;
+    uint256 txHash = GetRandHash();
+    BOOST_CHECK_EQUAL(manager.GetSignatures(txHash), -1);
+
+    // Votes can come before the lock request; they don't count until the height is known
+    BOOST_CHECK_EQUAL(manager.AddSignature(MakeVote(txHash, 100)), -1);
+    BOOST_CHECK_EQUAL(manager.AddSignature(MakeVote(txHash, 100)), -1);
+    BOOST_CHECK_EQUAL(manager.AddSignature(MakeVote(txHash, 99)), -1);
+    manager.CreateLock(txHash, 100);
+    BOOST_CHECK_EQUAL(manager.GetSignatures(txHash), 2);
+    BOOST_CHECK_EQUAL(manager.AddSignature(MakeVote(txHash, 100)), 3);
+    BOOST_CHECK_EQUAL(manager.AddSignature(MakeVote(txHash, 98)), 3);
+
+    // Moving the lock to another height counts the votes for that one
+    manager.CreateLock(txHash, 99);
+    BOOST_CHECK_EQUAL(manager.GetSignatures(txHash), 1);
+    BOOST_CHECK_EQUAL(manager.GetLockCount(), 1U);
+
+    CConsensusVote vote = MakeVote(txHash, 99);
+    BOOST_CHECK(manager.AddTxLockVote(vote));
+    BOOST_CHECK(!manager.AddTxLockVote(vote));
+    BOOST_CHECK(manager.HasTxLockVote(vote.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(lock_conflicts_and_expiry)
+{
+    CSwiftTXManager manager;
+    COutPoint prevoutShared(GetRandHash(), 1);
+    CTransaction tx1 = MakeTransaction(prevoutShared);
+    CTransaction tx2 = MakeTransaction(prevoutShared);
+    CTransaction tx3 = MakeTransaction(COutPoint(GetRandHash(), 2));
+
+    manager.AddTxLockRequest(tx1);
+    manager.AddRejectedTxLockRequest(tx2);
+    manager.AddTxLockRequest(tx3);
+    BOOST_CHECK(manager.HasTxLockRequest(tx2.GetHash()));
+    BOOST_CHECK(manager.IsTxLockRequestRejected(tx2.GetHash()));
+    manager.CreateLock(tx1.GetHash(), 10);
+    manager.CreateLock(tx2.GetHash(), 10);
+    manager.CreateLock(tx3.GetHash(), 10);
+
+    // The first transaction to lock an input keeps it
+    uint256 hashLock;
+    manager.LockInputs(tx1);
+    manager.LockInputs(tx3);
+    BOOST_CHECK(!manager.GetConflictingLock(tx1, hashLock));
+    BOOST_CHECK(manager.GetConflictingLock(tx2, hashLock));
+    BOOST_CHECK(hashLock == tx1.GetHash());
+
+    // Nothing has expired within the hour
+    int64_t nNow = GetTime();
+    manager.RemoveExpired(nNow + 30 * 60);
+    BOOST_CHECK_EQUAL(manager.GetLockCount(), 3U);
+
+    // Two complete conflicting locks cancel out: both go on the next clean-up, with tx1's inputs
+    BOOST_CHECK(manager.CheckForConflictingLocks(tx2));
+    manager.RemoveExpired(GetTime() + 1);
+    BOOST_CHECK_EQUAL(manager.GetLockCount(), 1U);
+    BOOST_CHECK_EQUAL(manager.GetSignatures(tx1.GetHash()), -1);
+    BOOST_CHECK_EQUAL(manager.GetSignatures(tx3.GetHash()), 0);
+    BOOST_CHECK(!manager.GetConflictingLock(tx2, hashLock));
+    BOOST_CHECK(!manager.HasTxLockRequest(tx1.GetHash()));
+
+    manager.RemoveExpired(nNow + 60 * 60 + 1);
+    BOOST_CHECK_EQUAL(manager.GetLockCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(latency_stats)
+{
+    BOOST_CHECK_EQUAL(CSwiftTXLatencyStats::GetBucketBound(0), 1000);
+    BOOST_CHECK_EQUAL(CSwiftTXLatencyStats::GetBucketBound(4), 20000);
+    BOOST_CHECK_EQUAL(CSwiftTXLatencyStats::GetBucketBound(CSwiftTXLatencyStats::BUCKETS - 2), 50000000);
+    BOOST_CHECK_EQUAL(CSwiftTXLatencyStats::GetBucketBound(CSwiftTXLatencyStats::BUCKETS - 1), -1);
+
+    CSwiftTXLatencyStats stats;
+    BOOST_CHECK_EQUAL(stats.GetPercentileBound(0.5), 0);
+    for (int i = 0; i < 98; i++)
+        stats.Add(1500);
+    stats.Add(300000);
+    stats.Add(100000000);
+    BOOST_CHECK_EQUAL(stats.nCount, 100U);
+    BOOST_CHECK_EQUAL(stats.nMaxMicros, 100000000);
+    BOOST_CHECK_EQUAL(stats.vBuckets[1], 98U);
+    BOOST_CHECK_EQUAL(stats.vBuckets[CSwiftTXLatencyStats::BUCKETS - 1], 1U);
+    BOOST_CHECK_EQUAL(stats.GetPercentileBound(0.5), 2000);
+    BOOST_CHECK_EQUAL(stats.GetPercentileBound(0.99), 500000);
+    BOOST_CHECK_EQUAL(stats.GetPercentileBound(1.0), -1);
+}
+
+BOOST_AUTO_TEST_CASE(lock_latency)
+{
+    CSwiftTXManager manager;
+    uint256 txHash = GetRandHash();
+    manager.RequestReceived(txHash, GetTimeMicros() - 1000);
+    manager.CreateLock(txHash, 100);
+
+    // Every vote that counts is timed, the lock once it is complete
+    for (int i = 0; i < SWIFTTX_SIGNATURES_REQUIRED + 2; i++)
+        manager.AddSignature(MakeVote(txHash, 100));
+    manager.AddSignature(MakeVote(txHash, 99));
+    BOOST_CHECK(manager.LockNotified(txHash));
+    BOOST_CHECK(!manager.LockNotified(txHash));
+
+    CSwiftTXLatencyStats statsVote, statsComplete, statsNotify;
+    manager.GetLatencyStats(statsVote, statsComplete, statsNotify);
+    BOOST_CHECK_EQUAL(statsVote.nCount, (uint64_t)SWIFTTX_SIGNATURES_REQUIRED + 2);
+    BOOST_CHECK_EQUAL(statsComplete.nCount, 1U);
+    BOOST_CHECK_EQUAL(statsNotify.nCount, 1U);
+    int64_t nComplete, nNotify;
+    manager.GetLockLatency(txHash, nComplete, nNotify);
+    BOOST_CHECK(nComplete >= 1000);
+    BOOST_CHECK(nNotify >= nComplete);
+
+    // Locks whose request was never seen are not timed, and receipt times go when they expire
+    uint256 txHashOther = GetRandHash();
+    manager.RequestReceived(txHashOther, GetTimeMicros());
+    manager.RemoveExpired(GetTime() + 60 * 60 + 1);
+    manager.CreateLock(txHashOther, 100);
+    for (int i = 0; i < SWIFTTX_SIGNATURES_REQUIRED; i++)
+        manager.AddSignature(MakeVote(txHashOther, 100));
+    manager.GetLockLatency(txHashOther, nComplete, nNotify);
+    BOOST_CHECK_EQUAL(nComplete, -1);
+
+    manager.ResetLatencyStats();
+    manager.GetLatencyStats(statsVote, statsComplete, statsNotify);
+    BOOST_CHECK_EQUAL(statsVote.nCount, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
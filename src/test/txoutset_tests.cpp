@@ -0,0 +1,215 @@
+// Copyright (c) 2018 The French developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+
+#include "coins.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Add nCount random transactions to the global chainstate and flush them to the database */
+std::vector<uint256> AddRandomCoins(int nCount)
+{
+    LOCK(cs_main);
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < nCount; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.resize(1 + i % 3);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            tx.vout[j].nValue = (i + 1) * COIN + j;
+            tx.vout[j].scriptPubKey = CScript() << OP_TRUE;
+        }
+        CTransaction txFinal(tx);
+        pcoinsTip->ModifyCoins(txFinal.GetHash())->FromTx(txFinal, 1);
+        vTxid.push_back(txFinal.GetHash());
+    }
+    FlushStateToDisk();
+    return vTxid;
+}
+
+void SpendCoins(const std::vector<uint256>& vTxid)
+{
+    LOCK(cs_main);
+    for (unsigned int i = 0; i < vTxid.size(); i++)
+        pcoinsTip->ModifyCoins(vTxid[i])->Clear();
+    FlushStateToDisk();
+}
+
+/** Load a snapshot the way a fresh data directory would, with its own block tree and index */
+bool LoadIntoEmpty(const boost::filesystem::path& path, CCoinsViewDB& coinsview, CBlockTreeDB& blocktree, const uint256& hashExpected, std::string& strError)
+{
+    LOCK(cs_main);
+    CBlockTreeDB* pblocktreeSaved = pblocktree;
+    BlockMap mapBlockIndexSaved;
+    mapBlockIndexSaved.swap(mapBlockIndex);
+    int nSnapshotHeightSaved = nTxOutSetSnapshotHeight;
+    pblocktree = &blocktree;
+    bool fLoaded = LoadTxOutSet(path, &coinsview, hashExpected, strError);
+    pblocktree = pblocktreeSaved;
+    mapBlockIndex.swap(mapBlockIndexSaved);
+    nTxOutSetSnapshotHeight = nSnapshotHeightSaved;
+    return fLoaded;
+}
+
+std::vector<char> ReadFile(const boost::filesystem::path& path)
+{
+    std::ifstream file(path.string().c_str(), std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const boost::filesystem::path& path, const std::vector<char>& vch)
+{
+    std::ofstream file(path.string().c_str(), std::ios::binary | std::ios::trunc);
+    file.write(&vch[0], vch.size());
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_SUITE(txoutset_tests)
+
+BOOST_AUTO_TEST_CASE(txoutset_dump_load_roundtrip)
+{
+    std::vector<uint256> vTxid = AddRandomCoins(50);
+    boost::filesystem::path path = GetDataDir() / "txoutset_roundtrip.dat";
+
+    CTxOutSetSnapshotHeader header;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    BOOST_CHECK(DumpTxOutSet(path, header, nCoins, hashSnapshot));
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".incomplete"));
+    BOOST_CHECK(header.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(header.nHeight, chainActive.Height());
+
+    CCoinsViewDB coinsLoaded(1 << 20, true);
+    CBlockTreeDB blocktreeLoaded(1 << 20, true);
+    std::string strError;
+    BOOST_CHECK_MESSAGE(LoadIntoEmpty(path, coinsLoaded, blocktreeLoaded, hashSnapshot, strError), strError);
+    BOOST_CHECK(coinsLoaded.GetBestBlock() == header.hashBlock);
+
+    // The loaded set hashes the same as the one it was dumped from
+    CCoinsStats statsDumped, statsLoaded;
+    BOOST_CHECK(pcoinsTip->GetStats(statsDumped));
+    BOOST_CHECK(coinsLoaded.GetStats(statsLoaded));
+    BOOST_CHECK(statsLoaded.hashSerialized == statsDumped.hashSerialized);
+    BOOST_CHECK_EQUAL(statsDumped.nTransactions, nCoins);
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactions, statsDumped.nTransactions);
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactionOutputs, statsDumped.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsLoaded.nTotalAmount, statsDumped.nTotalAmount);
+    for (unsigned int i = 0; i < vTxid.size(); i++) {
+        CCoins coinsDumped, coins;
+        BOOST_CHECK(pcoinsTip->GetCoins(vTxid[i], coinsDumped));
+        BOOST_CHECK(coinsLoaded.GetCoins(vTxid[i], coins));
+        BOOST_CHECK(coins == coinsDumped);
+    }
+
+    CCoins coins0;
+
+    // The block index up to the snapshot block is there, without block data
+    CDiskBlockIndex diskindex;
+    BOOST_CHECK(blocktreeLoaded.Read(std::make_pair('b', header.hashBlock), diskindex));
+    BOOST_CHECK(diskindex.GetBlockHash() == header.hashBlock);
+    BOOST_CHECK_EQUAL(diskindex.nStatus & BLOCK_HAVE_MASK, 0U);
+
+    // A cursor walks the same coins, pinned to the block they were flushed at
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(coinsLoaded.Cursor());
+    BOOST_CHECK(pcursor->GetBestBlock() == header.hashBlock);
+    uint64_t nWalked = 0;
+    for (; pcursor->Valid(); pcursor->Next())
+        nWalked++;
+    BOOST_CHECK_EQUAL(nWalked, nCoins);
+    pcursor.reset();
+
+    // The snapshot height is kept, so stake checks know which blocks the coins can't vouch for
+    int nSnapshotHeight = -1;
+    BOOST_CHECK(blocktreeLoaded.ReadInt("txoutsetheight", nSnapshotHeight));
+    BOOST_CHECK_EQUAL(nSnapshotHeight, header.nHeight);
+
+    // What a failed load leaves behind is wiped from both databases
+    BOOST_CHECK(blocktreeLoaded.WipeBlockIndex());
+    BOOST_CHECK(coinsLoaded.Wipe());
+    BOOST_CHECK(!blocktreeLoaded.Read(std::make_pair('b', header.hashBlock), diskindex));
+    BOOST_CHECK(coinsLoaded.GetBestBlock() == 0);
+    BOOST_CHECK(!coinsLoaded.GetCoins(vTxid[0], coins0));
+    pcursor.reset(coinsLoaded.Cursor());
+    BOOST_CHECK(!pcursor->Valid());
+
+    boost::filesystem::remove(path);
+    SpendCoins(vTxid);
+}
+
+BOOST_AUTO_TEST_CASE(txoutset_load_rejects_bad_snapshot)
+{
+    std::vector<uint256> vTxid = AddRandomCoins(10);
+    boost::filesystem::path path = GetDataDir() / "txoutset_bad.dat";
+
+    CTxOutSetSnapshotHeader header;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    BOOST_CHECK(DumpTxOutSet(path, header, nCoins, hashSnapshot));
+    std::vector<char> vchGood = ReadFile(path);
+    BOOST_REQUIRE(vchGood.size() > 200);
+
+    std::string strError;
+    {
+        // Intact file, but not the snapshot the operator asked for
+        CCoinsViewDB coinsLoaded(1 << 20, true);
+        CBlockTreeDB blocktreeLoaded(1 << 20, true);
+        BOOST_CHECK(!LoadIntoEmpty(path, coinsLoaded, blocktreeLoaded, GetRandHash(), strError));
+        BOOST_CHECK(coinsLoaded.GetBestBlock() == 0);
+        BOOST_CHECK(!blocktreeLoaded.Exists(std::make_pair('b', header.hashBlock)));
+    }
+    {
+        // No expected hash at all
+        CCoinsViewDB coinsLoaded(1 << 20, true);
+        CBlockTreeDB blocktreeLoaded(1 << 20, true);
+        BOOST_CHECK(!LoadIntoEmpty(path, coinsLoaded, blocktreeLoaded, 0, strError));
+        BOOST_CHECK(coinsLoaded.GetBestBlock() == 0);
+    }
+    {
+        // A flipped bit in the last coins record, before the terminator and trailer
+        std::vector<char> vch = vchGood;
+        vch[vch.size() - 32 - 8 - 32 - 4] ^= 0x01;
+        WriteFile(path, vch);
+        CCoinsViewDB coinsLoaded(1 << 20, true);
+        CBlockTreeDB blocktreeLoaded(1 << 20, true);
+        BOOST_CHECK(!LoadIntoEmpty(path, coinsLoaded, blocktreeLoaded, hashSnapshot, strError));
+        BOOST_CHECK(coinsLoaded.GetBestBlock() == 0);
+        BOOST_CHECK(!blocktreeLoaded.Exists(std::make_pair('b', header.hashBlock)));
+    }
+    {
+        // Truncated file
+        std::vector<char> vch(vchGood.begin(), vchGood.end() - 20);
+        WriteFile(path, vch);
+        CCoinsViewDB coinsLoaded(1 << 20, true);
+        CBlockTreeDB blocktreeLoaded(1 << 20, true);
+        BOOST_CHECK(!LoadIntoEmpty(path, coinsLoaded, blocktreeLoaded, hashSnapshot, strError));
+        BOOST_CHECK(coinsLoaded.GetBestBlock() == 0);
+    }
+    {
+        // The untouched file still loads
+        WriteFile(path, vchGood);
+        CCoinsViewDB coinsLoaded(1 << 20, true);
+        CBlockTreeDB blocktreeLoaded(1 << 20, true);
+        BOOST_CHECK_MESSAGE(LoadIntoEmpty(path, coinsLoaded, blocktreeLoaded, hashSnapshot, strError), strError);
+        BOOST_CHECK(coinsLoaded.GetBestBlock() == header.hashBlock);
+    }
+
+    boost::filesystem::remove(path);
+    SpendCoins(vTxid);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
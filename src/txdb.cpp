@@ -29,7 +29,44 @@ void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+/** Erase every record keyed (chType, hash), a batch of nBatchSize at a time */
+bool static EraseHashRecords(CLevelDBWrapper& db, char chType, size_t nBatchSize)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(chType, uint256(0));
+    pcursor->Seek(ssKeySet.str());
+
+    bool fDone = false;
+    while (!fDone) {
+        CLevelDBBatch batch;
+        size_t nCount = 0;
+        while (nCount < nBatchSize) {
+            std::pair<char, uint256> key(0, 0);
+            if (pcursor->Valid()) {
+                try {
+                    leveldb::Slice slKey = pcursor->key();
+                    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                    ssKey >> key;
+                } catch (const std::exception& e) {
+                    key.first = 0;
+                }
+            }
+            if (key.first != chType) {
+                fDone = true;
+                break;
+            }
+            batch.Erase(key);
+            nCount++;
+            pcursor->Next();
+        }
+        if (!db.WriteBatch(batch))
+            return false;
+    }
+    return true;
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe), fStatsPending(false)
 {
 }
 
@@ -67,11 +104,38 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
+    if (fStatsPending) {
+        // Committed atomically with the best block, so the two never disagree on disk
+        batch.Write('S', pendingStats);
+        fStatsPending = false;
+    }
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Wipe()
+{
+    if (!EraseHashRecords(db, 'c', 10000))
+        return false;
+    CLevelDBBatch batch;
+    batch.Erase('B');
+    batch.Erase('S');
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::WriteCoinsBatch(const std::vector<std::pair<uint256, CCoins> >& vCoins, const uint256& hashBlock)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<uint256, CCoins> >::const_iterator it = vCoins.begin(); it != vCoins.end(); it++)
+        BatchWriteCoins(batch, it->first, it->second);
+    if (hashBlock != uint256(0))
+        BatchWriteHashBestChain(batch, hashBlock);
+
+    LogPrint("coindb", "Committing %u bulk-loaded transactions to coin database...\n", (unsigned int)vCoins.size());
+    return db.WriteBatch(batch);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
@@ -81,6 +145,14 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
+bool CBlockTreeDB::WriteBlockIndexBatch(const std::vector<CDiskBlockIndex>& vIndex)
+{
+    CLevelDBBatch batch;
+    for (std::vector<CDiskBlockIndex>::const_iterator it = vIndex.begin(); it != vIndex.end(); it++)
+        batch.Write(make_pair('b', it->GetBlockHash()), *it);
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo& info)
 {
     return Write(make_pair('f', nFile), info);
@@ -127,6 +199,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    CCoinsRunningStats running;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -157,6 +230,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
                 }
                 stats.nSerializedSize += 32 + slValue.size();
                 ss << VARINT(0);
+                running.AddCoins(txhash, coins);
             }
             pcursor->Next();
         } catch (std::exception& e) {
@@ -165,10 +239,116 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     }
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
+    stats.hashMuHash = running.muhash.Finalize();
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+bool CCoinsViewDB::GetRunningStats(CCoinsRunningStats& stats) const
+{
+    if (fStatsPending)
+        stats = pendingStats;
+    else if (!db.Read('S', stats))
+        return false;
+    return stats.hashBlock == GetBestBlock();
+}
+
+void CCoinsViewDB::SetRunningStats(const CCoinsRunningStats& stats)
+{
+    pendingStats = stats;
+    fStatsPending = true;
+}
+
+bool CCoinsViewDB::ForEachCoins(boost::function<bool(const uint256&, const CCoins&)> func) const
+{
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(Cursor());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        uint256 txhash;
+        CCoins coins;
+        if (!pcursor->GetKey(txhash) || !pcursor->GetValue(coins))
+            return error("%s : unable to read coins record", __func__);
+        if (!func(txhash, coins))
+            return false;
+        pcursor->Next();
+    }
+    return true;
+}
+
+CCoinsViewCursor* CCoinsViewDB::Cursor() const
+{
+    leveldb::Iterator* pcursor = const_cast<CLevelDBWrapper*>(&db)->NewIterator();
+
+    // The iterator reads from an implicit snapshot taken now, so take the best block
+    // through it as well: the coins it walks are then exactly the state at that block
+    uint256 hashBlock = 0;
+    CDataStream ssKeyBest(SER_DISK, CLIENT_VERSION);
+    ssKeyBest << 'B';
+    pcursor->Seek(ssKeyBest.str());
+    if (pcursor->Valid() && pcursor->key() == ssKeyBest.str()) {
+        try {
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> hashBlock;
+        } catch (const std::exception& e) {
+            hashBlock = 0;
+        }
+    }
+
+    CCoinsViewDBCursor* i = new CCoinsViewDBCursor(pcursor, hashBlock);
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('c', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    i->ReadKey();
+    return i;
+}
+
+void CCoinsViewDBCursor::ReadKey()
+{
+    // Cache the key of the current entry; an entry outside the coins range ends the walk
+    keyTmp.first = 0;
+    if (!pcursor->Valid())
+        return;
+    try {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        ssKey >> keyTmp;
+    } catch (const std::exception& e) {
+        keyTmp.first = 0;
+    }
+}
+
+bool CCoinsViewDBCursor::GetKey(uint256& key) const
+{
+    if (keyTmp.first != 'c')
+        return false;
+    key = keyTmp.second;
+    return true;
+}
+
+bool CCoinsViewDBCursor::GetValue(CCoins& coins) const
+{
+    try {
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> coins;
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCoinsViewDBCursor::Valid() const
+{
+    return keyTmp.first == 'c';
+}
+
+void CCoinsViewDBCursor::Next()
+{
+    pcursor->Next();
+    ReadKey();
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256& txid, CDiskTxPos& pos)
 {
     return Read(make_pair('t', txid), pos);
@@ -182,6 +362,29 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WipeBlockIndex()
+{
+    return EraseHashRecords(*this, 'b', 10000);
+}
+
+bool CBlockTreeDB::ReadBudgetCollateral(const uint256& txid, CTransaction& tx, uint256& hashBlock)
+{
+    std::pair<CTransaction, uint256> record;
+    if (!Read(make_pair('C', txid), record))
+        return false;
+    tx = record.first;
+    hashBlock = record.second;
+    return true;
+}
+
+bool CBlockTreeDB::WriteBudgetCollaterals(const std::vector<CTransaction>& vtx, const uint256& hashBlock)
+{
+    CLevelDBBatch batch;
+    for (std::vector<CTransaction>::const_iterator it = vtx.begin(); it != vtx.end(); it++)
+        batch.Write(make_pair('C', it->GetHash()), make_pair(*it, hashBlock));
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
 {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
@@ -15,6 +15,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/scoped_ptr.hpp>
+
 class CCoins;
 class uint256;
 
@@ -31,6 +33,10 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CLevelDBWrapper db;
 
+    //! Running statistics waiting for the next BatchWrite
+    CCoinsRunningStats pendingStats;
+    bool fStatsPending;
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -39,6 +45,37 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+    bool ForEachCoins(boost::function<bool(const uint256&, const CCoins&)> func) const;
+    CCoinsViewCursor* Cursor() const;
+    bool GetRunningStats(CCoinsRunningStats& stats) const;
+    void SetRunningStats(const CCoinsRunningStats& stats);
+
+    //! Erase all coins, the best block and the running statistics
+    bool Wipe();
+    //! Bulk-write coins records; the best block is only updated when hashBlock is non-zero
+    bool WriteCoinsBatch(const std::vector<std::pair<uint256, CCoins> >& vCoins, const uint256& hashBlock);
+};
+
+/** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
+class CCoinsViewDBCursor : public CCoinsViewCursor
+{
+public:
+    ~CCoinsViewDBCursor() {}
+
+    bool GetKey(uint256& key) const;
+    bool GetValue(CCoins& coins) const;
+
+    bool Valid() const;
+    void Next();
+
+private:
+    CCoinsViewDBCursor(leveldb::Iterator* pcursorIn, const uint256& hashBlockIn) : CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    std::pair<char, uint256> keyTmp;
+
+    void ReadKey();
+
+    friend class CCoinsViewDB;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -53,6 +90,9 @@ private:
 
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool WriteBlockIndexBatch(const std::vector<CDiskBlockIndex>& vIndex);
+    //! Erase all block index entries
+    bool WipeBlockIndex();
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
@@ -61,6 +101,8 @@ public:
     bool ReadReindexing(bool& fReindex);
     bool ReadTxIndex(const uint256& txid, CDiskTxPos& pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >& list);
+    bool ReadBudgetCollateral(const uint256& txid, CTransaction& tx, uint256& hashBlock);
+    bool WriteBudgetCollaterals(const std::vector<CTransaction>& vtx, const uint256& hashBlock);
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
@@ -11,7 +11,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70912;
+static const int PROTOCOL_VERSION = 70914;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -36,5 +36,11 @@ static const int MEMPOOL_GD_VERSION = 60002;
 //! "filter*" commands are disabled without NODE_BLOOM after and including this version
 static const int NO_BLOOM_VERSION = 70005;
 
+//! "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" commands start with this version
+static const int SHORT_IDS_BLOCKS_VERSION = 70913;
+
+//! the whole Frenchnode list is answered with "mnblist" batches instead of inventory starting with this version
+static const int FRENCHNODE_LIST_BATCH_VERSION = 70914;
+
 
 #endif // FRENCH_VERSION_H
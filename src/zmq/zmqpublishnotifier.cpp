@@ -5,6 +5,7 @@
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "swifttx.h"
 #include "util.h"
 #include "crypto/common.h"
 
@@ -16,6 +17,7 @@ static const char *MSG_HASHTXLOCK = "hashtxlock";
 static const char *MSG_RAWBLOCK   = "rawblock";
 static const char *MSG_RAWTX      = "rawtx";
 static const char *MSG_RAWTXLOCK = "rawtxlock";
+static const char *MSG_TXLOCKTIME = "txlocktime";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -173,6 +175,21 @@ bool CZMQPublishHashTransactionLockNotifier::NotifyTransactionLock(const CTransa
     return SendMessage(MSG_HASHTXLOCK, data, 32);
 }
 
+bool CZMQPublishTransactionLockTimeNotifier::NotifyTransactionLock(const CTransaction &transaction)
+{
+    uint256 hash = transaction.GetHash();
+    int64_t nComplete, nNotify;
+    swifttx.GetLockLatency(hash, nComplete, nNotify);
+    LogPrint("zmq", "zmq: Publish txlocktime %s %d %d\n", hash.GetHex(), nComplete, nNotify);
+    /* transaction hash, then microseconds from the lock request to completion and to notification (LE, -1 if unknown) */
+    unsigned char data[48];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = hash.begin()[i];
+    WriteLE64(&data[32], nComplete);
+    WriteLE64(&data[40], nNotify);
+    return SendMessage(MSG_TXLOCKTIME, data, 48);
+}
+
 bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
@@ -181,15 +198,15 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     {
         LOCK(cs_main);
-        CBlock block;
+        boost::shared_ptr<const CBlock> pblock;
 // XX42        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        if(!ReadBlockFromDisk(block, pindex))
+        if(!ReadBlockFromDisk(pblock, pindex))
         {
             zmqError("Can't read block from disk");
             return false;
         }
 
-        ss << block;
+        ss << *pblock;
     }
 
     return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());